@@ -193,6 +193,11 @@ local function init()
 				class = "ABM",
 				label = spec.label,
 			}
+			spec.bulk_action = instrument {
+				func = spec.bulk_action,
+				class = "ABM",
+				label = spec.label,
+			}
 			orig_register_abm(spec)
 		end
 	end
@@ -0,0 +1,170 @@
+-- The bulk ABMs record their calls here while a test waits for them
+local bulk_calls
+local action_called
+
+for _, name in ipairs({"abm_bulk", "abm_changed", "abm_both"}) do
+	core.register_node("unittests:" .. name, {
+		description = "Unittests ABM Test Node",
+		tiles = {"default_dirt.png"},
+		groups = {dig_immediate = 3},
+	})
+end
+
+core.register_abm({
+	label = "unittests:bulk",
+	nodenames = {"unittests:abm_bulk", "unittests:abm_changed"},
+	interval = 1,
+	chance = 1,
+	bulk_action = function(pos_list, node_list)
+		if bulk_calls then
+			table.insert(bulk_calls, {label = "bulk", pos_list = pos_list, node_list = node_list})
+		end
+	end,
+})
+
+-- Runs for every node before the bulk actions are called
+core.register_abm({
+	label = "unittests:change",
+	nodenames = {"unittests:abm_changed"},
+	interval = 1,
+	chance = 1,
+	action = function(pos)
+		core.swap_node(pos, {name = "basenodes:dirt"})
+	end,
+})
+
+core.register_abm({
+	label = "unittests:both",
+	nodenames = {"unittests:abm_both"},
+	interval = 1,
+	chance = 1,
+	action = function()
+		action_called = true
+	end,
+	bulk_action = function(pos_list, node_list)
+		if bulk_calls then
+			table.insert(bulk_calls, {label = "both", pos_list = pos_list, node_list = node_list})
+		end
+	end,
+})
+
+-- Places the nodes, waits for an ABM step that calls the bulk ABM with
+-- the given label and returns the result of check(calls) to cb
+local function run_abms(cb, nodes, label, check)
+	for _, it in ipairs(nodes) do
+		core.set_node(it.pos, {name = it.name})
+	end
+	bulk_calls = {}
+	action_called = false
+
+	local function finish(err)
+		bulk_calls = nil
+		for _, it in ipairs(nodes) do
+			core.remove_node(it.pos)
+		end
+		cb(err)
+	end
+
+	local deadline = core.get_us_time() + 10 * 1000000
+	local function wait()
+		-- Checked after every server step, so the calls are all from one ABM step
+		for _, call in ipairs(bulk_calls) do
+			if call.label == label then
+				return finish(check(bulk_calls))
+			end
+		end
+		if core.get_us_time() > deadline then
+			return finish("bulk_action was not called")
+		end
+		bulk_calls = {}
+		core.after(0, wait)
+	end
+	core.after(0, wait)
+end
+
+local function find_call(calls, label)
+	local found
+	for _, call in ipairs(calls) do
+		if call.label == label then
+			if found then
+				return nil, "bulk_action called more than once"
+			end
+			found = call
+		end
+	end
+	if #found.pos_list ~= #found.node_list then
+		return nil, "pos_list and node_list differ in length"
+	end
+	return found
+end
+
+local function find_pos(call, pos)
+	for i, p in ipairs(call.pos_list) do
+		if vector.equals(p, pos) then
+			return i
+		end
+	end
+end
+
+local function test_abm_bulk_action(cb, _, pos)
+	local p1, p2 = pos, pos:offset(1, 0, 0)
+	run_abms(cb, {
+		{pos = p1, name = "unittests:abm_bulk"},
+		{pos = p2, name = "unittests:abm_bulk"},
+	}, "bulk", function(calls)
+		local call, err = find_call(calls, "bulk")
+		if not call then
+			return err
+		end
+		for i, p in ipairs(call.pos_list) do
+			if call.node_list[i].name ~= core.get_node(p).name then
+				return "node_list does not match pos_list at " .. core.pos_to_string(p)
+			end
+		end
+		if not find_pos(call, p1) or not find_pos(call, p2) then
+			return "pos_list misses a node"
+		end
+	end)
+end
+unittests.register("test_abm_bulk_action", test_abm_bulk_action, {map=true, async=true})
+
+local function test_abm_bulk_action_changed(cb, _, pos)
+	local p1, p2 = pos, pos:offset(1, 0, 0)
+	run_abms(cb, {
+		{pos = p1, name = "unittests:abm_changed"},
+		{pos = p2, name = "unittests:abm_bulk"},
+	}, "bulk", function(calls)
+		local call, err = find_call(calls, "bulk")
+		if not call then
+			return err
+		end
+		if core.get_node(p1).name ~= "basenodes:dirt" then
+			return "action was not called"
+		end
+		if find_pos(call, p1) then
+			return "pos_list contains a node changed by an earlier ABM"
+		end
+		if not find_pos(call, p2) then
+			return "pos_list misses a node"
+		end
+	end)
+end
+unittests.register("test_abm_bulk_action_changed", test_abm_bulk_action_changed, {map=true, async=true})
+
+local function test_abm_bulk_action_replaces_action(cb, _, pos)
+	run_abms(cb, {
+		{pos = pos, name = "unittests:abm_both"},
+	}, "both", function(calls)
+		local call, err = find_call(calls, "both")
+		if not call then
+			return err
+		end
+		if action_called then
+			return "action called in addition to bulk_action"
+		end
+		if not find_pos(call, pos) then
+			return "pos_list misses a node"
+		end
+	end)
+end
+unittests.register("test_abm_bulk_action_replaces_action", test_abm_bulk_action_replaces_action, {map=true, async=true})
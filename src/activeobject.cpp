@@ -0,0 +1,160 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "activeobject.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include <cmath>
+
+// Steps per unit of quantized positions, velocities and accelerations
+#define AO_POS_SCALE 16.0f
+
+static bool fits_s16(const v3f &v)
+{
+	const f32 limit = S16_MAX / AO_POS_SCALE;
+	return std::fabs(v.X) <= limit && std::fabs(v.Y) <= limit &&
+		std::fabs(v.Z) <= limit;
+}
+
+static void write_quantized(std::ostream &os, const v3f &v)
+{
+	writeS16(os, std::lround(v.X * AO_POS_SCALE));
+	writeS16(os, std::lround(v.Y * AO_POS_SCALE));
+	writeS16(os, std::lround(v.Z * AO_POS_SCALE));
+}
+
+static v3f read_quantized(std::istream &is)
+{
+	v3f v;
+	v.X = readS16(is) / AO_POS_SCALE;
+	v.Y = readS16(is) / AO_POS_SCALE;
+	v.Z = readS16(is) / AO_POS_SCALE;
+	return v;
+}
+
+static void write_angle(std::ostream &os, f32 degrees)
+{
+	writeU16(os, (u16)std::lround(wrapDegrees_0_360(degrees) * 65536.0f / 360.0f));
+}
+
+static f32 read_angle(std::istream &is)
+{
+	return readU16(is) * 360.0f / 65536.0f;
+}
+
+bool AOPositionUpdate::fitsKeyframe(const v3f &position,
+		const AOPositionKeyframe &keyframe)
+{
+	return keyframe.valid && fits_s16(position - keyframe.position);
+}
+
+void AOPositionUpdate::serializeCompact(std::ostream &os,
+		const AOPositionKeyframe &keyframe, bool is_keyframe) const
+{
+	u8 flags = 0;
+	if (is_keyframe)
+		flags |= AO_POS_KEYFRAME;
+	if (velocity != v3f())
+		flags |= AO_POS_VELOCITY;
+	if (acceleration != v3f())
+		flags |= AO_POS_ACCELERATION;
+	if (rotation.X != 0.0f || rotation.Z != 0.0f)
+		flags |= AO_POS_PITCH_ROLL;
+	if (do_interpolate)
+		flags |= AO_POS_INTERPOLATE;
+	if (is_movement_end)
+		flags |= AO_POS_MOVEMENT_END;
+	const bool full_precision = !fits_s16(velocity) || !fits_s16(acceleration);
+	if (full_precision)
+		flags |= AO_POS_FULL_PRECISION;
+
+	writeU8(os, flags);
+	writeU8(os, keyframe.id);
+	if (is_keyframe)
+		writeV3F32(os, keyframe.position);
+	else
+		write_quantized(os, position - keyframe.position);
+
+	if (full_precision) {
+		if (flags & AO_POS_VELOCITY)
+			writeV3F32(os, velocity);
+		if (flags & AO_POS_ACCELERATION)
+			writeV3F32(os, acceleration);
+	} else {
+		if (flags & AO_POS_VELOCITY)
+			write_quantized(os, velocity);
+		if (flags & AO_POS_ACCELERATION)
+			write_quantized(os, acceleration);
+	}
+
+	write_angle(os, rotation.Y);
+	if (flags & AO_POS_PITCH_ROLL) {
+		write_angle(os, rotation.X);
+		write_angle(os, rotation.Z);
+	}
+	writeU16(os, (u16)rangelim(std::lround(update_interval * 1000.0f), 0, U16_MAX));
+}
+
+bool AOPositionUpdate::deSerializeCompact(std::istream &is,
+		AOPositionKeyframe &keyframe)
+{
+	const u8 flags = readU8(is);
+	const u8 id = readU8(is);
+	if (flags & AO_POS_KEYFRAME) {
+		keyframe.valid = true;
+		keyframe.id = id;
+		keyframe.position = readV3F32(is);
+		if (flags & AO_POS_KEYFRAME_ONLY)
+			return false;
+		position = keyframe.position;
+	} else {
+		v3f offset = read_quantized(is);
+		// Sent before the keyframe we have, or after one still underway
+		if (!keyframe.valid || id != keyframe.id)
+			return false;
+		position = keyframe.position + offset;
+	}
+
+	const bool full_precision = flags & AO_POS_FULL_PRECISION;
+	velocity = acceleration = v3f();
+	if (flags & AO_POS_VELOCITY)
+		velocity = full_precision ? readV3F32(is) : read_quantized(is);
+	if (flags & AO_POS_ACCELERATION)
+		acceleration = full_precision ? readV3F32(is) : read_quantized(is);
+
+	rotation = v3f();
+	rotation.Y = read_angle(is);
+	if (flags & AO_POS_PITCH_ROLL) {
+		rotation.X = read_angle(is);
+		rotation.Z = read_angle(is);
+	}
+	do_interpolate = flags & AO_POS_INTERPOLATE;
+	is_movement_end = flags & AO_POS_MOVEMENT_END;
+	update_interval = readU16(is) / 1000.0f;
+	return true;
+}
+
+void AOPositionUpdate::serializeKeyframeOnly(std::ostream &os,
+		const AOPositionKeyframe &keyframe)
+{
+	writeU8(os, AO_POS_KEYFRAME | AO_POS_KEYFRAME_ONLY);
+	writeU8(os, keyframe.id);
+	writeV3F32(os, keyframe.position);
+}
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "irr_aabb3d.h"
 #include "irr_v3d.h"
+#include <iostream>
 #include <string>
 
 
@@ -53,6 +54,9 @@ struct ActiveObjectMessage
 	u16 id;
 	bool reliable;
 	std::string datastring;
+	// Range of client protocol versions the message is for
+	u16 min_protocol_version = 0;
+	u16 max_protocol_version = U16_MAX;
 };
 
 enum ActiveObjectCommand {
@@ -69,7 +73,74 @@ enum ActiveObjectCommand {
 	AO_CMD_OBSOLETE1,
 	// ^ UPDATE_NAMETAG_ATTRIBUTES deprecated since 0.4.14, removed in 5.3.0
 	AO_CMD_SPAWN_INFANT,
-	AO_CMD_SET_ANIMATION_SPEED
+	AO_CMD_SET_ANIMATION_SPEED,
+	AO_CMD_UPDATE_POSITION_COMPACT
+};
+
+/*
+	Position known to both the server and a client, which the position
+	in AO_CMD_UPDATE_POSITION_COMPACT is relative to.
+*/
+struct AOPositionKeyframe
+{
+	bool valid = false;
+	u8 id = 0;
+	v3f position;
+};
+
+/*
+	Contents of AO_CMD_UPDATE_POSITION, and of its compact form sent to
+	clients since protocol version 44:
+
+	u8 flags (AO_POS_*)
+	u8 keyframe id
+	if AO_POS_KEYFRAME: v3f32 position, the new keyframe
+	else: v3s16 position relative to the keyframe, 1/16 units
+	unless AO_POS_KEYFRAME_ONLY:
+		if AO_POS_VELOCITY: velocity
+		if AO_POS_ACCELERATION: acceleration
+			(v3s16 in 1/16 units, v3f32 with AO_POS_FULL_PRECISION)
+		u16 yaw, if AO_POS_PITCH_ROLL: u16 pitch, u16 roll (1/65536 turns)
+		u16 update interval in milliseconds
+
+	Omitted fields are zero. Keyframes are sent reliably, updates relative
+	to a keyframe the client doesn't have (yet) are dropped.
+*/
+enum AOPositionFlags : u8 {
+	AO_POS_KEYFRAME = 0x01,
+	// Only sets the keyframe, like in the object's initialization data
+	AO_POS_KEYFRAME_ONLY = 0x02,
+	AO_POS_VELOCITY = 0x04,
+	AO_POS_ACCELERATION = 0x08,
+	AO_POS_PITCH_ROLL = 0x10,
+	AO_POS_INTERPOLATE = 0x20,
+	AO_POS_MOVEMENT_END = 0x40,
+	AO_POS_FULL_PRECISION = 0x80,
+};
+
+struct AOPositionUpdate
+{
+	v3f position;
+	v3f velocity;
+	v3f acceleration;
+	v3f rotation;
+	bool do_interpolate = false;
+	bool is_movement_end = false;
+	f32 update_interval = 0.0f;
+
+	// Whether position can be sent relative to the keyframe
+	static bool fitsKeyframe(const v3f &position, const AOPositionKeyframe &keyframe);
+
+	// Writes the compact form without the command byte. Sends position as
+	// a new keyframe if is_keyframe is set, else relative to keyframe.
+	void serializeCompact(std::ostream &os, const AOPositionKeyframe &keyframe,
+			bool is_keyframe) const;
+	// Reads the compact form, updating keyframe. Returns false if there is
+	// no update to apply.
+	bool deSerializeCompact(std::istream &is, AOPositionKeyframe &keyframe);
+
+	static void serializeKeyframeOnly(std::ostream &os,
+			const AOPositionKeyframe &keyframe);
 };
 
 /*
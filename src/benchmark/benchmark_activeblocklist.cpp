@@ -0,0 +1,107 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "serverenvironment.h"
+#include "util/numeric.h"
+
+namespace {
+
+constexpr s16 ACTIVE_BLOCK_RANGE = 4;
+constexpr size_t PLAYER_COUNT = 100;
+
+std::vector<ActiveBlockList::PlayerView> makePlayers()
+{
+	std::vector<ActiveBlockList::PlayerView> players(PLAYER_COUNT);
+	for (size_t i = 0; i < players.size(); i++) {
+		players[i].id = i + 1;
+		players[i].blockpos = v3s16(myrand_range(-100, 100),
+			myrand_range(-5, 5), myrand_range(-100, 100));
+	}
+	return players;
+}
+
+// The update used before the lists were kept incrementally, for comparison
+void rebuildAll(const std::vector<ActiveBlockList::PlayerView> &players,
+		std::set<v3s16> &list, std::vector<v3s16> &blocks_removed,
+		std::vector<v3s16> &blocks_added)
+{
+	const s16 r = ACTIVE_BLOCK_RANGE;
+	std::set<v3s16> newlist;
+	for (const auto &player : players) {
+		v3s16 p0 = player.blockpos;
+		v3s16 p;
+		for (p.X = p0.X - r; p.X <= p0.X + r; p.X++)
+		for (p.Y = p0.Y - r; p.Y <= p0.Y + r; p.Y++)
+		for (p.Z = p0.Z - r; p.Z <= p0.Z + r; p.Z++) {
+			if (p.getDistanceFrom(p0) <= r)
+				newlist.insert(p);
+		}
+	}
+	for (v3s16 p : list) {
+		if (newlist.find(p) == newlist.end())
+			blocks_removed.push_back(p);
+	}
+	for (v3s16 p : newlist) {
+		if (list.find(p) == list.end())
+			blocks_added.push_back(p);
+	}
+	list = std::move(newlist);
+}
+
+}
+
+// moving: whether every player walks into the next block on each update
+void benchUpdate(Catch::Benchmark::Chronometer &meter, bool moving, bool incremental)
+{
+	auto players = makePlayers();
+	ActiveBlockList list;
+	std::set<v3s16> old_list;
+	std::vector<v3s16> blocks_removed, blocks_added;
+
+	auto update = [&] () {
+		blocks_removed.clear();
+		blocks_added.clear();
+		if (moving) {
+			for (auto &player : players) {
+				if (++player.blockpos.X > 1000)
+					player.blockpos.X = -1000;
+			}
+		}
+		if (incremental)
+			list.update(players, ACTIVE_BLOCK_RANGE, blocks_removed, blocks_added);
+		else
+			rebuildAll(players, old_list, blocks_removed, blocks_added);
+		return blocks_removed.size() + blocks_added.size();
+	};
+
+	update();
+	meter.measure(update);
+}
+
+#define BENCH_UPDATE(_name, _moving) \
+	BENCHMARK_ADVANCED("update_" _name)(Catch::Benchmark::Chronometer meter) \
+	{ benchUpdate(meter, _moving, true); }; \
+	BENCHMARK_ADVANCED("update_rebuild_" _name)(Catch::Benchmark::Chronometer meter) \
+	{ benchUpdate(meter, _moving, false); };
+
+TEST_CASE("ActiveBlockList") {
+	BENCH_UPDATE("idle_100_players", false)
+	BENCH_UPDATE("moving_100_players", true)
+}
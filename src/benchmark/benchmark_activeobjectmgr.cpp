@@ -0,0 +1,132 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "server/activeobjectmgr.h"
+#include "util/numeric.h"
+
+namespace {
+
+class TestObject : public ServerActiveObject {
+public:
+	TestObject(v3f pos) : ServerActiveObject(nullptr, pos)
+	{}
+
+	ActiveObjectType getType() const { return ACTIVEOBJECT_TYPE_TEST; }
+	bool getCollisionBox(aabb3f *toset) const { return false; }
+	bool getSelectionBox(aabb3f *toset) const { return false; }
+	bool collideWithObjects() const { return false; }
+};
+
+constexpr float POS_RANGE = 2001;
+
+inline v3f randpos()
+{
+	return v3f(myrand_range(-POS_RANGE, POS_RANGE),
+		myrand_range(-20, 60),
+		myrand_range(-POS_RANGE, POS_RANGE));
+}
+
+void fill(server::ActiveObjectMgr &mgr, std::vector<ServerActiveObject *> &all,
+		size_t n)
+{
+	mgr.clear([] (ServerActiveObject *obj, u16) {
+		delete obj;
+		return true;
+	});
+	all.clear();
+	for (size_t i = 0; i < n; i++) {
+		auto *obj = new TestObject(randpos());
+		if (mgr.registerObject(obj))
+			all.push_back(obj);
+	}
+}
+
+// The query used before the spatial index existed, for comparison
+void scanAllInsideRadius(const std::vector<ServerActiveObject *> &all,
+		const v3f &pos, float radius, std::vector<ServerActiveObject *> &result)
+{
+	float r2 = radius * radius;
+	for (auto *obj : all) {
+		if (obj->getBasePosition().getDistanceFromSQ(pos) <= r2)
+			result.push_back(obj);
+	}
+}
+
+}
+
+template <size_t N>
+void benchGetObjectsInsideRadius(Catch::Benchmark::Chronometer &meter, bool indexed)
+{
+	server::ActiveObjectMgr mgr;
+	std::vector<ServerActiveObject *> all;
+	fill(mgr, all, N);
+
+	std::vector<ServerActiveObject *> result;
+	result.reserve(N);
+	meter.measure([&] {
+		result.clear();
+		if (indexed)
+			mgr.getObjectsInsideRadius(randpos(), 30, result, nullptr);
+		else
+			scanAllInsideRadius(all, randpos(), 30, result);
+		return result.size();
+	});
+
+	fill(mgr, all, 0);
+}
+
+template <size_t N>
+void benchGetObjectsInArea(Catch::Benchmark::Chronometer &meter)
+{
+	server::ActiveObjectMgr mgr;
+	std::vector<ServerActiveObject *> all;
+	fill(mgr, all, N);
+
+	std::vector<ServerActiveObject *> result;
+	result.reserve(N);
+	meter.measure([&] {
+		result.clear();
+		v3f pos = randpos();
+		mgr.getObjectsInArea(aabb3f(pos, pos + v3f(50)), result, nullptr);
+		return result.size();
+	});
+
+	fill(mgr, all, 0);
+}
+
+#define BENCH_INSIDE_RADIUS(_count) \
+	BENCHMARK_ADVANCED("inside_radius_" #_count)(Catch::Benchmark::Chronometer meter) \
+	{ benchGetObjectsInsideRadius<_count>(meter, true); }; \
+	BENCHMARK_ADVANCED("inside_radius_scan_" #_count)(Catch::Benchmark::Chronometer meter) \
+	{ benchGetObjectsInsideRadius<_count>(meter, false); };
+
+#define BENCH_IN_AREA(_count) \
+	BENCHMARK_ADVANCED("in_area_" #_count)(Catch::Benchmark::Chronometer meter) \
+	{ benchGetObjectsInArea<_count>(meter); };
+
+TEST_CASE("ActiveObjectMgr") {
+	BENCH_INSIDE_RADIUS(1000)
+	BENCH_INSIDE_RADIUS(10000)
+	BENCH_INSIDE_RADIUS(65000)
+
+	BENCH_IN_AREA(1000)
+	BENCH_IN_AREA(10000)
+	BENCH_IN_AREA(65000)
+}
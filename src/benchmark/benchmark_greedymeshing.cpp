@@ -0,0 +1,174 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "benchmark_setup.h"
+#include "client/meshgen/greedy.h"
+#include "mapgen/mapgen_v7.h"
+#include "noise.h"
+#include "util/numeric.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+constexpr s16 BLOCK_SIZE = 16;
+// Columns of blocks along X and Z
+constexpr s16 AREA_BLOCKS = 4;
+constexpr s32 SEED = 42;
+
+enum {
+	TILE_GRASS,
+	TILE_DIRT,
+};
+
+/*
+	Surface heights of the mapgen v7 base terrain (without mountains, rivers
+	and caves) for the area plus a border of one node.
+*/
+class Terrain
+{
+public:
+	Terrain()
+	{
+		MapgenV7Params params;
+		m_size = AREA_BLOCKS * BLOCK_SIZE + 2;
+		m_heights.resize(m_size * m_size);
+		for (s16 z = 0; z < m_size; z++)
+		for (s16 x = 0; x < m_size; x++)
+			m_heights[z * m_size + x] = baseTerrainLevel(params, x - 1, z - 1);
+	}
+
+	bool isSolid(v3s16 p) const
+	{
+		return p.Y <= m_heights[(p.Z + 1) * m_size + p.X + 1];
+	}
+
+	s16 minHeight() const { return *std::min_element(m_heights.begin(), m_heights.end()); }
+	s16 maxHeight() const { return *std::max_element(m_heights.begin(), m_heights.end()); }
+
+private:
+	// Same as MapgenV7::baseTerrainLevelAtPoint
+	static s16 baseTerrainLevel(MapgenV7Params &params, s16 x, s16 z)
+	{
+		float hselect = NoisePerlin2D(&params.np_height_select, x, z, SEED);
+		hselect = rangelim(hselect, 0.0f, 1.0f);
+
+		float persist = NoisePerlin2D(&params.np_terrain_persist, x, z, SEED);
+
+		params.np_terrain_base.persist = persist;
+		float height_base = NoisePerlin2D(&params.np_terrain_base, x, z, SEED);
+
+		params.np_terrain_alt.persist = persist;
+		float height_alt = NoisePerlin2D(&params.np_terrain_alt, x, z, SEED);
+
+		if (height_alt > height_base)
+			return std::floor(height_alt);
+		return std::floor((height_base * hselect) + (height_alt * (1.0f - hselect)));
+	}
+
+	s16 m_size;
+	std::vector<s16> m_heights;
+};
+
+struct Face
+{
+	v3s16 p;
+	u8 face;
+	u16 tile;
+	video::SColor color;
+};
+
+/*
+	The faces of every block that intersects the terrain surface, as
+	MapblockMeshGenerator would hand them to the merger: solid nodes facing
+	air, grass on top and dirt elsewhere, shaded by face direction.
+*/
+std::vector<std::vector<Face>> makeBlocks()
+{
+	static const v3s16 dirs[6] = {
+		v3s16(0, 1, 0), v3s16(0, -1, 0),
+		v3s16(1, 0, 0), v3s16(-1, 0, 0),
+		v3s16(0, 0, 1), v3s16(0, 0, -1),
+	};
+	static const u8 shading[6] = {255, 178, 204, 204, 229, 229};
+
+	Terrain terrain;
+	const s16 min_y = std::floor(terrain.minHeight() / (float)BLOCK_SIZE);
+	const s16 max_y = std::floor(terrain.maxHeight() / (float)BLOCK_SIZE);
+
+	std::vector<std::vector<Face>> blocks;
+	for (s16 bz = 0; bz < AREA_BLOCKS; bz++)
+	for (s16 bx = 0; bx < AREA_BLOCKS; bx++)
+	for (s16 by = min_y; by <= max_y; by++) {
+		const v3s16 offset(bx * BLOCK_SIZE, by * BLOCK_SIZE, bz * BLOCK_SIZE);
+		std::vector<Face> faces;
+		v3s16 p;
+		for (p.Z = 0; p.Z < BLOCK_SIZE; p.Z++)
+		for (p.Y = 0; p.Y < BLOCK_SIZE; p.Y++)
+		for (p.X = 0; p.X < BLOCK_SIZE; p.X++) {
+			if (!terrain.isSolid(p + offset))
+				continue;
+			for (u8 face = 0; face < 6; face++) {
+				if (terrain.isSolid(p + offset + dirs[face]))
+					continue;
+				u16 tile = face == 0 ? TILE_GRASS : TILE_DIRT;
+				u8 light = shading[face];
+				faces.push_back({p, face, tile, video::SColor(255, light, light, light)});
+			}
+		}
+		if (!faces.empty())
+			blocks.push_back(std::move(faces));
+	}
+	return blocks;
+}
+
+}
+
+TEST_CASE("GreedyFaceMerger") {
+	const auto blocks = makeBlocks();
+
+	GreedyFaceMerger merger;
+	std::vector<GreedyFaceMerger::Quad> quads;
+
+	auto mergeAll = [&] () {
+		size_t count = 0;
+		for (const auto &faces : blocks) {
+			for (const auto &f : faces)
+				merger.add(f.p, f.face, f.tile, f.color);
+			quads.clear();
+			merger.merge(BLOCK_SIZE, quads);
+			count += quads.size();
+		}
+		return count;
+	};
+
+	size_t face_count = 0;
+	for (const auto &faces : blocks)
+		face_count += faces.size();
+	const size_t quad_count = mergeAll();
+
+	INFO("triangles: " << face_count * 2 << " unmerged, " << quad_count * 2 << " merged");
+	CHECK(quad_count < face_count);
+
+	BENCHMARK_ADVANCED("merge_v7_terrain")(Catch::Benchmark::Chronometer meter) {
+		meter.measure(mergeAll);
+	};
+}
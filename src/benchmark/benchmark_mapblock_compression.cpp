@@ -0,0 +1,196 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "benchmark_setup.h"
+#include "dummygamedef.h"
+#include "inventory.h"
+#include "mapblock.h"
+#include "nodemetadata.h"
+#include "nodedef.h"
+#include "light.h"
+#include "noise.h"
+#include "serialization.h"
+#include <cmath>
+#include <sstream>
+
+namespace {
+
+constexpr s16 WORLD_SIZE = 12; // in blocks, horizontally
+constexpr s16 WATER_LEVEL = -4;
+
+struct Content {
+	content_t stone, dirt, grass, water, ore, plant, chest;
+};
+
+content_t addNode(NodeDefManager *ndef, const std::string &name)
+{
+	ContentFeatures f;
+	f.name = name;
+	return ndef->set(f.name, f);
+}
+
+// Hash of the position, to place things in a way that does not repeat
+u32 hashPos(s16 x, s16 y, s16 z)
+{
+	return (u32)(x * 73856093) ^ (u32)(y * 19349663) ^ (u32)(z * 83492791);
+}
+
+void addChest(MapBlock *block, v3s16 p, IItemDefManager *idef, PseudoRandom &pr)
+{
+	NodeMetadata *meta = new NodeMetadata(idef);
+	meta->setString("formspec", "size[8,9]list[current_name;main;0,0.3;8,4;]"
+			"list[current_player;main;0,4.85;8,1;]"
+			"list[current_player;main;0,6.08;8,3;8]"
+			"listring[current_name;main]listring[current_player;main]");
+	meta->setString("infotext", "Chest");
+	InventoryList *list = meta->getInventory()->addList("main", 32);
+	for (u32 i = 0; i < list->getSize(); i++) {
+		int r = pr.range(0, 9);
+		if (r == 0)
+			list->changeItem(i, ItemStack("cobble", pr.range(1, 99), 0, idef));
+		else if (r == 1)
+			list->changeItem(i, ItemStack("torch", pr.range(1, 99), 0, idef));
+	}
+	block->m_node_metadata.set(p, meta);
+}
+
+// Fills a block with hilly terrain, much like the blocks of a real world
+void generateBlock(MapBlock *block, const Content &c, IItemDefManager *idef,
+		PseudoRandom &pr)
+{
+	const v3s16 base = block->getPosRelative();
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+		const s16 wx = base.X + x, wz = base.Z + z;
+		const s16 surface = std::round(6 * std::sin(wx / 13.0f) +
+				5 * std::cos(wz / 9.0f) + 2 * std::sin((wx + wz) / 5.0f));
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+			const s16 wy = base.Y + y;
+			MapNode n(CONTENT_AIR, LIGHT_SUN);
+			if (wy < surface - 3) {
+				// Ores come in clusters
+				bool ore = hashPos(wx >> 2, wy >> 2, wz >> 2) % 23 == 0;
+				n = MapNode(ore ? c.ore : c.stone, 0);
+			} else if (wy < surface) {
+				n = MapNode(c.dirt, 0);
+			} else if (wy == surface) {
+				n = MapNode(wy < WATER_LEVEL ? c.dirt : c.grass, 0);
+			} else if (wy <= WATER_LEVEL) {
+				n = MapNode(c.water, 0);
+			} else if (wy == surface + 1 && hashPos(wx, 0, wz) % 7 == 0) {
+				n = MapNode(c.plant, LIGHT_SUN - 1, hashPos(wx, 1, wz) % 4);
+			}
+			block->setNodeNoCheck(x, y, z, n);
+		}
+	}
+
+	// A chest in some of the blocks
+	if (pr.range(0, 3) == 0) {
+		v3s16 p(pr.range(0, MAP_BLOCKSIZE - 1), pr.range(0, MAP_BLOCKSIZE - 1),
+				pr.range(0, MAP_BLOCKSIZE - 1));
+		block->setNodeNoCheck(p, MapNode(c.chest, 0, pr.range(0, 3)));
+		addChest(block, p, idef, pr);
+	}
+}
+
+std::string compressBlock(const std::string &raw, const ZstdDictionary *dict)
+{
+	std::ostringstream os(std::ios_base::binary);
+	compress(raw, os, SER_FMT_VER_HIGHEST_WRITE, -1, dict);
+	return os.str();
+}
+
+}
+
+/*
+	Compares network compression of mapblocks with and without a dictionary.
+	The dictionary is trained on one half of the blocks and measured on the other,
+	just like the server trains it on some blocks of the world and then uses it
+	for all of them.
+*/
+TEST_CASE("benchmark_mapblock_compression")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+	Content c;
+	c.stone = addNode(ndef, "stone");
+	c.dirt = addNode(ndef, "dirt");
+	c.grass = addNode(ndef, "dirt_with_grass");
+	c.water = addNode(ndef, "water_source");
+	c.ore = addNode(ndef, "stone_with_coal");
+	c.plant = addNode(ndef, "grass_1");
+	c.chest = addNode(ndef, "chest");
+
+	PseudoRandom pr(42);
+	std::vector<std::string> training, blocks;
+	for (s16 z = 0; z < WORLD_SIZE; z++)
+	for (s16 x = 0; x < WORLD_SIZE; x++)
+	for (s16 y = -2; y <= 1; y++) {
+		MapBlock block(nullptr, v3s16(x, y, z), &gamedef);
+		generateBlock(&block, c, gamedef.idef(), pr);
+		std::ostringstream os(std::ios_base::binary);
+		block.serializeUncompressed(os, SER_FMT_VER_HIGHEST_WRITE, false);
+		((x + z) % 2 ? training : blocks).push_back(os.str());
+	}
+
+	// Compression level 0, as with the default map_compression_level_net
+	ZstdDictionary dict(ZstdDictionary::train(training, 32 * 1024), 0);
+
+	std::vector<std::string> plain, compact;
+	size_t plain_size = 0, compact_size = 0;
+	for (const std::string &raw : blocks) {
+		plain.push_back(compressBlock(raw, nullptr));
+		compact.push_back(compressBlock(raw, &dict));
+		plain_size += plain.back().size();
+		compact_size += compact.back().size();
+	}
+	WARN("Bytes per block: " << plain_size / blocks.size() << " without, "
+			<< compact_size / blocks.size() << " with dictionary");
+	CHECK(compact_size < plain_size);
+
+	// Every run handles one block
+	BENCHMARK_ADVANCED("compress_block")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] (int i) {
+			return compressBlock(blocks[i % blocks.size()], nullptr);
+		});
+	};
+	BENCHMARK_ADVANCED("compress_block_dictionary")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] (int i) {
+			return compressBlock(blocks[i % blocks.size()], &dict);
+		});
+	};
+
+	auto decompressBlock = [] (const std::string &data, const ZstdDictionary *dict) {
+		std::istringstream is(data, std::ios_base::binary);
+		std::ostringstream os(std::ios_base::binary);
+		decompress(is, os, SER_FMT_VER_HIGHEST_WRITE, dict);
+		return os.str();
+	};
+	BENCHMARK_ADVANCED("decompress_block")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] (int i) {
+			return decompressBlock(plain[i % plain.size()], nullptr);
+		});
+	};
+	BENCHMARK_ADVANCED("decompress_block_dictionary")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] (int i) {
+			return decompressBlock(compact[i % compact.size()], &dict);
+		});
+	};
+}
@@ -0,0 +1,69 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "benchmark_setup.h"
+#include "client/mapblock_mesh.h"
+#include "noise.h"
+#include <vector>
+
+// A block mesh with many day/night dependent vertices, shuffled like
+// the vertices of several mesh buffers
+constexpr u16 VERTEX_COUNT = 24000;
+
+static void benchDaynightUpdate(Catch::Benchmark::Chronometer &meter, bool batch)
+{
+	PcgRandom pr(1234);
+	VertexColorChannels data;
+	std::vector<video::SColor> colors;
+	std::vector<u16> indices;
+	std::vector<video::S3DVertex> vertices(VERTEX_COUNT);
+	for (u16 i = 0; i < VERTEX_COUNT; i++) {
+		video::SColor c(pr.range(0, 255), pr.range(0, 255),
+			pr.range(0, 255), pr.range(0, 255));
+		data.push_back(c);
+		colors.push_back(c);
+		indices.push_back((i * 7) % VERTEX_COUNT);
+	}
+
+	u32 daynight_ratio = 0;
+	auto update = [&] () {
+		video::SColorf day_light;
+		get_sunlight_color(&day_light, daynight_ratio);
+		daynight_ratio = (daynight_ratio + 37) % 1001;
+
+		if (batch) {
+			final_color_blend(vertices.data(), indices.data(), data, day_light);
+		} else {
+			// The update used before the batch overload, for comparison
+			for (u16 i = 0; i < VERTEX_COUNT; i++)
+				final_color_blend(&vertices[indices[i]].Color, colors[i], day_light);
+		}
+		return vertices[0].Color.color;
+	};
+
+	meter.measure(update);
+}
+
+TEST_CASE("MapBlockMesh") {
+	BENCHMARK_ADVANCED("daynight_update")(Catch::Benchmark::Chronometer meter)
+	{ benchDaynightUpdate(meter, true); };
+	BENCHMARK_ADVANCED("daynight_update_per_vertex")(Catch::Benchmark::Chronometer meter)
+	{ benchDaynightUpdate(meter, false); };
+}
@@ -0,0 +1,158 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "benchmark_setup.h"
+#include "client/mapdrawlist.h"
+#include "dummygamedef.h"
+#include "mapblock.h"
+#include <cmath>
+#include <map>
+#include <set>
+
+namespace {
+
+// viewing_range of 500 nodes
+constexpr s16 VIEW_RANGE = 32;
+const float VIEW_ANGLE = 100.0f * core::DEGTORAD;
+constexpr size_t UPDATE_COUNT = 200;
+
+/*
+	The blocks a ClientMap would find visible on each draw list update,
+	for a camera flying over flat terrain. It moves a quarter block and
+	turns by 2 degrees per update.
+*/
+std::vector<std::vector<v3s16>> makeUpdates(bool moving)
+{
+	std::vector<std::vector<v3s16>> updates(UPDATE_COUNT);
+	for (size_t i = 0; i < updates.size(); i++) {
+		const float t = moving ? i : 0;
+		const v3f camera(t * 0.25f, 0.0f, 0.0f);
+		const float yaw = t * 2.0f * core::DEGTORAD;
+		const v3f dir(std::cos(yaw), 0.0f, std::sin(yaw));
+		const v3s16 camera_block(std::floor(camera.X), 0, 0);
+
+		v3s16 p;
+		for (p.X = camera_block.X - VIEW_RANGE; p.X <= camera_block.X + VIEW_RANGE; p.X++)
+		for (p.Z = -VIEW_RANGE; p.Z <= VIEW_RANGE; p.Z++)
+		for (p.Y = -2; p.Y <= 1; p.Y++) {
+			v3f d = v3f(p.X + 0.5f, p.Y + 0.5f, p.Z + 0.5f) - camera;
+			float distance = d.getLength();
+			if (distance > VIEW_RANGE)
+				continue;
+			if (distance > 1.0f && d.dotProduct(dir) < distance * std::cos(VIEW_ANGLE / 2))
+				continue;
+			updates[i].push_back(p);
+		}
+	}
+	return updates;
+}
+
+v3s16 getCameraBlock(size_t update, bool moving)
+{
+	return v3s16(moving ? update / 4 : 0, 0, 0);
+}
+
+// Orders blocks by distance to the camera
+class MapBlockComparer
+{
+public:
+	MapBlockComparer(const v3s16 &camera_block) : m_camera_block(camera_block) {}
+
+	bool operator() (const v3s16 &left, const v3s16 &right) const
+	{
+		auto distance_left = left.getDistanceFromSQ(m_camera_block);
+		auto distance_right = right.getDistanceFromSQ(m_camera_block);
+		return distance_left > distance_right || (distance_left == distance_right && left > right);
+	}
+
+private:
+	v3s16 m_camera_block;
+};
+
+typedef std::map<v3s16, MapBlock *, MapBlockComparer> SortedBlocks;
+
+// The update used before the draw list was kept, for comparison
+void rebuild(SortedBlocks &drawlist, v3s16 camera_block,
+		const std::vector<v3s16> &visible, MapBlock *block)
+{
+	for (auto &i : drawlist)
+		i.second->refDrop();
+	drawlist = SortedBlocks(MapBlockComparer(camera_block));
+
+	std::set<v3s16> shortlist;
+	for (v3s16 p : visible)
+		shortlist.emplace(p);
+
+	for (v3s16 p : shortlist) {
+		block->refGrab();
+		drawlist.emplace(p, block);
+	}
+}
+
+}
+
+// moving: whether the camera moves and turns between updates
+void benchUpdate(Catch::Benchmark::Chronometer &meter, bool moving, bool incremental)
+{
+	const auto updates = makeUpdates(moving);
+
+	// All positions share one block, only the positions matter here
+	DummyGameDef gamedef;
+	MapBlock block(nullptr, v3s16(0, 0, 0), &gamedef);
+
+	MapDrawList list;
+	SortedBlocks old_list(MapBlockComparer(v3s16(0, 0, 0)));
+	size_t i = 0;
+
+	auto update = [&] () {
+		const auto &visible = updates[i % updates.size()];
+		const v3s16 camera_block = getCameraBlock(i % updates.size(), moving);
+		i++;
+
+		if (!incremental) {
+			rebuild(old_list, camera_block, visible, &block);
+			return old_list.size();
+		}
+
+		list.beginUpdate(camera_block);
+		for (v3s16 p : visible)
+			list.markVisible(p);
+		list.endUpdate([&] (v3s16) { return &block; });
+		return list.size();
+	};
+
+	update();
+	meter.measure(update);
+
+	list.clear();
+	for (auto &it : old_list)
+		it.second->refDrop();
+}
+
+#define BENCH_UPDATE(_name, _moving) \
+	BENCHMARK_ADVANCED("update_" _name)(Catch::Benchmark::Chronometer meter) \
+	{ benchUpdate(meter, _moving, true); }; \
+	BENCHMARK_ADVANCED("update_rebuild_" _name)(Catch::Benchmark::Chronometer meter) \
+	{ benchUpdate(meter, _moving, false); };
+
+TEST_CASE("MapDrawList") {
+	BENCH_UPDATE("still_camera", false)
+	BENCH_UPDATE("moving_camera", true)
+}
@@ -0,0 +1,77 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "benchmark_setup.h"
+#include "network/socket.h"
+
+namespace {
+
+constexpr int PACKET_COUNT = 256;
+constexpr int PACKET_SIZE = 512;
+constexpr u16 PORT = 30004;
+
+// Sends PACKET_COUNT datagrams to itself over loopback and reads them back
+void benchLoopback(Catch::Benchmark::Chronometer &meter, bool batched)
+{
+	UDPSocket socket(false);
+	const Address address(127, 0, 0, 1, PORT);
+	socket.Bind(address);
+	socket.setTimeoutMs(0);
+
+	std::string payload(PACKET_SIZE, 'x');
+	std::vector<UDPSocket::OutgoingDatagram> datagrams(PACKET_COUNT,
+		{ &address, payload.data(), PACKET_SIZE });
+
+	constexpr int batch = 32;
+	std::vector<char> buffer(PACKET_SIZE * batch);
+	Address senders[batch];
+	int sizes[batch];
+
+	meter.measure([&] {
+		int received = 0;
+		if (batched) {
+			// Send in small groups so the receive buffer cannot overflow
+			for (int i = 0; i < PACKET_COUNT; i += batch) {
+				socket.SendMany(&datagrams[i], batch);
+				int count;
+				while ((count = socket.ReceiveMany(senders, sizes, buffer.data(),
+						PACKET_SIZE, batch)) > 0)
+					received += count;
+			}
+		} else {
+			for (int i = 0; i < PACKET_COUNT; i += batch) {
+				for (int j = 0; j < batch; j++)
+					socket.Send(address, payload.data(), PACKET_SIZE);
+				while (socket.Receive(senders[0], buffer.data(), PACKET_SIZE) >= 0)
+					received++;
+			}
+		}
+		return received;
+	});
+}
+
+}
+
+TEST_CASE("UDPSocket") {
+	BENCHMARK_ADVANCED("loopback_256_packets")(Catch::Benchmark::Chronometer meter)
+	{ benchLoopback(meter, false); };
+	BENCHMARK_ADVANCED("loopback_256_packets_batched")(Catch::Benchmark::Chronometer meter)
+	{ benchLoopback(meter, true); };
+}
@@ -603,6 +603,7 @@ void Client::step(float dtime)
 						block->mesh = r.mesh;
 						if (r.urgent)
 							force_update_shadows = true;
+						m_env.getClientMap().onBlockMeshUpdated(r.p, block);
 					}
 				}
 			} else {
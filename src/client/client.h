@@ -67,6 +67,7 @@ class ParticleManager;
 class Camera;
 struct PlayerControl;
 class NetworkPacket;
+class ZstdDictionary;
 namespace con {
 class Connection;
 }
@@ -234,6 +235,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void handleCommand_MediaPush(NetworkPacket *pkt);
 	void handleCommand_MinimapModes(NetworkPacket *pkt);
 	void handleCommand_SetLighting(NetworkPacket *pkt);
+	void handleCommand_BlockDictionary(NetworkPacket *pkt);
+	void handleCommand_NodesChanged(NetworkPacket *pkt);
 
 	void ProcessData(NetworkPacket *pkt);
 
@@ -500,6 +503,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 
 	// Server serialization version
 	u8 m_server_ser_ver;
+	// Dictionary the server compresses mapblocks with, if any
+	std::unique_ptr<ZstdDictionary> m_block_dictionary;
 
 	// Used version of the protocol with server
 	// Values smaller than 25 only mean they are smaller than 25,
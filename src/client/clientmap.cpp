@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 #include "camera.h"               // CameraModes
 #include "util/basic_macros.h"
+#include "util/worker_pool.h"
 #include "client/renderingengine.h"
 
 #include <queue>
@@ -80,8 +81,7 @@ ClientMap::ClientMap(
 		rendering_engine->get_scene_manager(), id),
 	m_client(client),
 	m_rendering_engine(rendering_engine),
-	m_control(control),
-	m_drawlist(MapBlockComparer(v3s16(0,0,0)))
+	m_control(control)
 {
 
 	/*
@@ -109,6 +109,11 @@ ClientMap::ClientMap(
 	g_settings->registerChangedCallback("occlusion_culler", on_settings_changed, this);
 	m_enable_raytraced_culling = g_settings->getBool("enable_raytraced_culling");
 	g_settings->registerChangedCallback("enable_raytraced_culling", on_settings_changed, this);
+	m_enable_depth_buffer_culling = g_settings->getBool("enable_depth_buffer_culling");
+	g_settings->registerChangedCallback("enable_depth_buffer_culling", on_settings_changed, this);
+
+	m_drawlist_pool = std::make_unique<WorkerPool>("DrawList",
+			g_settings->getU16("num_drawlist_threads"));
 }
 
 void ClientMap::onSettingChanged(const std::string &name)
@@ -117,12 +122,15 @@ void ClientMap::onSettingChanged(const std::string &name)
 		m_loops_occlusion_culler = g_settings->get("occlusion_culler") == "loops";
 	if (name == "enable_raytraced_culling")
 		m_enable_raytraced_culling = g_settings->getBool("enable_raytraced_culling");
+	if (name == "enable_depth_buffer_culling")
+		m_enable_depth_buffer_culling = g_settings->getBool("enable_depth_buffer_culling");
 }
 
 ClientMap::~ClientMap()
 {
 	g_settings->deregisterChangedCallback("occlusion_culler", on_settings_changed, this);
 	g_settings->deregisterChangedCallback("enable_raytraced_culling", on_settings_changed, this);
+	g_settings->deregisterChangedCallback("enable_depth_buffer_culling", on_settings_changed, this);
 }
 
 void ClientMap::updateCamera(v3f pos, v3f dir, f32 fov, v3s16 offset, video::SColor light_color)
@@ -253,18 +261,33 @@ class MapBlockFlags
 	v3s16 volume;
 };
 
+/*
+	Box of the mesh chunk at mesh_pos, in world coordinates
+*/
+static aabb3f getMeshBox(v3s16 mesh_pos, u16 cell_size)
+{
+	v3f min_edge = intToFloat(mesh_pos * MAP_BLOCKSIZE, BS) - v3f(0.5f * BS);
+	return aabb3f(min_edge, min_edge + v3f(cell_size * MAP_BLOCKSIZE * BS));
+}
+
+/*
+	Box the meshes of a mesh chunk are drawn in, nodes can reach out of
+	their position by up to one node
+*/
+static aabb3f getDrawnBox(v3s16 mesh_pos, u16 cell_size)
+{
+	aabb3f box = getMeshBox(mesh_pos, cell_size);
+	box.MinEdge -= v3f(BS);
+	box.MaxEdge += v3f(BS);
+	return box;
+}
+
 void ClientMap::updateDrawList()
 {
 	ScopeProfiler sp(g_profiler, "CM::updateDrawList()", SPT_AVG);
 
 	m_needs_update_drawlist = false;
 
-	for (auto &i : m_drawlist) {
-		MapBlock *block = i.second;
-		block->refDrop();
-	}
-	m_drawlist.clear();
-
 	for (auto &block : m_keeplist) {
 		block->refDrop();
 	}
@@ -284,17 +307,24 @@ void ClientMap::updateDrawList()
 	MeshGrid mesh_grid = m_client->getMeshGrid();
 
 	// No occlusion culling when free_move is on and camera is inside ground
-	// No occlusion culling for chunk sizes of 4 and above
-	//   because the current occlusion culling test is highly inefficient at these sizes
-	bool occlusion_culling_enabled = mesh_grid.cell_size < 4;
+	bool occlusion_culling_enabled = true;
 	if (m_control.allow_noclip) {
 		MapNode n = getNode(cam_pos_nodes);
 		if (n.getContent() == CONTENT_IGNORE || m_nodedef->get(n).solidness == 2)
 			occlusion_culling_enabled = false;
 	}
+	// No raytraced occlusion culling for chunk sizes of 4 and above
+	//   because the test is highly inefficient at these sizes
+	const bool raytraced_culling_enabled = occlusion_culling_enabled &&
+			m_enable_raytraced_culling && mesh_grid.cell_size < 4;
+	const bool depth_buffer_culling_enabled = occlusion_culling_enabled &&
+			m_enable_depth_buffer_culling && !m_control.range_all;
 
 	const v3s16 camera_block = getContainerPos(cam_pos_nodes, MAP_BLOCKSIZE);
-	m_drawlist = std::map<v3s16, MapBlock*, MapBlockComparer>(MapBlockComparer(camera_block));
+	m_drawlist.beginUpdate(camera_block);
+
+	if (depth_buffer_culling_enabled)
+		updateOcclusionBuffer(mesh_grid.getMeshPos(camera_block), mesh_grid);
 
 	auto is_frustum_culled = m_client->getCamera()->getFrustumCuller();
 
@@ -303,9 +333,6 @@ void ClientMap::updateDrawList()
 	// if (occlusion_culling_enabled && m_control.show_wireframe)
 	// 	occlusion_culling_enabled = porting::getTimeS() & 1;
 
-	// Set of mesh holding blocks
-	std::set<v3s16> shortlist;
-
 	/*
 	 When range_all is enabled, enumerate all blocks visible in the
 	 frustum and display them.
@@ -316,8 +343,8 @@ void ClientMap::updateDrawList()
 		// Number of blocks with mesh in rendering range
 		u32 blocks_in_range_with_mesh = 0;
 
-		MapBlockVect sectorblocks;
-
+		std::vector<MapSector *> sectors;
+		sectors.reserve(m_sectors.size());
 		for (auto &sector_it : m_sectors) {
 			MapSector *sector = sector_it.second;
 			v2s16 sp = sector->getPos();
@@ -328,53 +355,92 @@ void ClientMap::updateDrawList()
 						sp.Y < p_blocks_min.Z || sp.Y > p_blocks_max.Z)
 					continue;
 			}
+			sectors.push_back(sector);
+		}
 
-			sectorblocks.clear();
-			sector->getBlocks(sectorblocks);
-
-			// Loop through blocks in sector
-			for (MapBlock *block : sectorblocks) {
-				MapBlockMesh *mesh = block->mesh;
+		// The blocks are classified on the worker threads, a slice of
+		// sectors per job. This only reads the map.
+		struct SectorSlice
+		{
+			// Blocks that passed the tests
+			std::vector<MapBlock *> blocks;
+			u32 in_range_with_mesh = 0;
+			u32 frustum_culled = 0;
+			u32 occlusion_culled = 0;
+		};
+		const size_t sectors_per_job = 32;
+		std::vector<SectorSlice> slices((sectors.size() + sectors_per_job - 1) / sectors_per_job);
+
+		m_drawlist_pool->run(slices.size(), [&] (size_t job) {
+			SectorSlice &slice = slices[job];
+			MapBlockVect sectorblocks;
+			const size_t end = std::min(sectors.size(), (job + 1) * sectors_per_job);
+			for (size_t i = job * sectors_per_job; i < end; i++) {
+				sectorblocks.clear();
+				sectors[i]->getBlocks(sectorblocks);
+
+				// Loop through blocks in sector
+				for (MapBlock *block : sectorblocks) {
+					MapBlockMesh *mesh = block->mesh;
+
+					// Calculate the coordinates for range and frustum culling
+					v3f mesh_sphere_center;
+					f32 mesh_sphere_radius;
+
+					v3s16 block_pos_nodes = block->getPos() * MAP_BLOCKSIZE;
+
+					if (mesh) {
+						mesh_sphere_center = intToFloat(block_pos_nodes, BS)
+								+ mesh->getBoundingSphereCenter();
+						mesh_sphere_radius = mesh->getBoundingRadius();
+					} else {
+						mesh_sphere_center = intToFloat(block_pos_nodes, BS)
+								+ v3f((MAP_BLOCKSIZE * 0.5f - 0.5f) * BS);
+						mesh_sphere_radius = 0.0f;
+					}
 
-				// Calculate the coordinates for range and frustum culling
-				v3f mesh_sphere_center;
-				f32 mesh_sphere_radius;
+					// First, perform a simple distance check.
+					if (!m_control.range_all &&
+						mesh_sphere_center.getDistanceFrom(m_camera_position) >
+							m_control.wanted_range * BS + mesh_sphere_radius)
+						continue; // Out of range, skip.
+
+					// Keep the block alive as long as it is in range.
+					block->resetUsageTimer();
+					slice.in_range_with_mesh++;
+
+					// Frustum culling
+					// Only do coarse culling here, to account for fast camera movement.
+					// This is needed because this function is not called every frame.
+					float frustum_cull_extra_radius = 300.0f;
+					if (is_frustum_culled(mesh_sphere_center,
+							mesh_sphere_radius + frustum_cull_extra_radius)) {
+						slice.frustum_culled++;
+						continue;
+					}
 
-				v3s16 block_pos_nodes = block->getPos() * MAP_BLOCKSIZE;
+					// Occlusion culling against the depth buffer
+					if (depth_buffer_culling_enabled &&
+							m_occlusion_buffer.isOccluded(getDrawnBox(block->getPos(), 1))) {
+						slice.occlusion_culled++;
+						continue;
+					}
 
-				if (mesh) {
-					mesh_sphere_center = intToFloat(block_pos_nodes, BS)
-							+ mesh->getBoundingSphereCenter();
-					mesh_sphere_radius = mesh->getBoundingRadius();
-				} else {
-					mesh_sphere_center = intToFloat(block_pos_nodes, BS)
-							+ v3f((MAP_BLOCKSIZE * 0.5f - 0.5f) * BS);
-					mesh_sphere_radius = 0.0f;
+					slice.blocks.push_back(block);
 				}
+			}
+		});
 
-				// First, perform a simple distance check.
-				if (!m_control.range_all &&
-					mesh_sphere_center.getDistanceFrom(m_camera_position) >
-						m_control.wanted_range * BS + mesh_sphere_radius)
-					continue; // Out of range, skip.
-
-				// Keep the block alive as long as it is in range.
-				block->resetUsageTimer();
-				blocks_in_range_with_mesh++;
-
-				// Frustum culling
-				// Only do coarse culling here, to account for fast camera movement.
-				// This is needed because this function is not called every frame.
-				float frustum_cull_extra_radius = 300.0f;
-				if (is_frustum_culled(mesh_sphere_center,
-						mesh_sphere_radius + frustum_cull_extra_radius)) {
-					blocks_frustum_culled++;
-					continue;
-				}
+		for (SectorSlice &slice : slices) {
+			blocks_in_range_with_mesh += slice.in_range_with_mesh;
+			blocks_frustum_culled += slice.frustum_culled;
+			blocks_occlusion_culled += slice.occlusion_culled;
 
+			for (MapBlock *block : slice.blocks) {
 				// Raytraced occlusion culling - send rays from the camera to the block's corners
-				if (!m_control.range_all && occlusion_culling_enabled && m_enable_raytraced_culling &&
-						mesh &&
+				// This stays on this thread, the rays look up nodes through the sector cache.
+				if (!m_control.range_all && raytraced_culling_enabled &&
+						block->mesh &&
 						isMeshOccluded(block, mesh_grid.cell_size, cam_pos_nodes)) {
 					blocks_occlusion_culled++;
 					continue;
@@ -383,15 +449,15 @@ void ClientMap::updateDrawList()
 				if (mesh_grid.cell_size > 1) {
 					// Block meshes are stored in the corner block of a chunk
 					// (where all coordinate are divisible by the chunk size)
-					// Add them to the de-dup set.
-					shortlist.emplace(mesh_grid.getMeshPos(block->getPos()));
+					// Mark those as visible, the draw list de-duplicates.
+					m_drawlist.markVisible(mesh_grid.getMeshPos(block->getPos()));
 					// All other blocks we can grab and add to the keeplist right away.
 					m_keeplist.push_back(block);
 					block->refGrab();
-				} else if (mesh) {
-					// without mesh chunking we can add the block to the drawlist
-					block->refGrab();
-					m_drawlist.emplace(block->getPos(), block);
+				} else {
+					// without mesh chunking the block holds its own mesh,
+					// if it has none yet it is drawn once it gets it
+					m_drawlist.markVisible(block->getPos());
 				}
 			}
 		}
@@ -478,8 +544,15 @@ void ClientMap::updateDrawList()
 			// Occluded near sides will further occlude the far sides
 			u8 visible_outer_sides = flags & 0x07;
 
+			// Occlusion culling against the depth buffer
+			if (depth_buffer_culling_enabled &&
+					m_occlusion_buffer.isOccluded(getDrawnBox(block_coord, mesh_grid.cell_size))) {
+				blocks_occlusion_culled++;
+				continue;
+			}
+
 			// Raytraced occlusion culling - send rays from the camera to the block's corners
-			if (occlusion_culling_enabled && m_enable_raytraced_culling &&
+			if (raytraced_culling_enabled &&
 					block && mesh &&
 					visible_outer_sides != 0x07 && isMeshOccluded(block, mesh_grid.cell_size, cam_pos_nodes)) {
 				blocks_occlusion_culled++;
@@ -489,17 +562,16 @@ void ClientMap::updateDrawList()
 			if (mesh_grid.cell_size > 1) {
 				// Block meshes are stored in the corner block of a chunk
 				// (where all coordinate are divisible by the chunk size)
-				// Add them to the de-dup set.
-				shortlist.emplace(block_coord.X, block_coord.Y, block_coord.Z);
+				m_drawlist.markVisible(block_coord);
 				// All other blocks we can grab and add to the keeplist right away.
 				if (block) {
 					m_keeplist.push_back(block);
 					block->refGrab();
 				}
-			} else if (mesh) {
-				// without mesh chunking we can add the block to the drawlist
-				block->refGrab();
-				m_drawlist.emplace(block_coord, block);
+			} else if (block) {
+				// without mesh chunking the block holds its own mesh,
+				// if it has none yet it is drawn once it gets it
+				m_drawlist.markVisible(block_coord);
 			}
 
 			// Decide which sides to traverse next or to block away
@@ -604,22 +676,72 @@ void ClientMap::updateDrawList()
 		g_profiler->avg("MapBlocks sides skipped [#]", sides_skipped);
 		g_profiler->avg("MapBlocks examined [#]", blocks_visited);
 	}
-	g_profiler->avg("MapBlocks shortlist [#]", shortlist.size());
 
-	assert(m_drawlist.empty() || shortlist.empty());
-	for (auto pos : shortlist) {
+	m_drawlist.endUpdate([this] (v3s16 pos) -> MapBlock * {
 		MapBlock *block = getBlockNoCreateNoEx(pos);
-		if (block) {
-			block->refGrab();
-			m_drawlist.emplace(pos, block);
-		}
-	}
+		return block && block->mesh ? block : nullptr;
+	});
+	g_profiler->avg("MapBlocks added to draw list [#]", m_drawlist.getAddedCount());
+	g_profiler->avg("MapBlocks removed from draw list [#]", m_drawlist.getRemovedCount());
 
 	g_profiler->avg("MapBlocks occlusion culled [#]", blocks_occlusion_culled);
 	g_profiler->avg("MapBlocks frustum culled [#]", blocks_frustum_culled);
 	g_profiler->avg("MapBlocks drawn [#]", m_drawlist.size());
 }
 
+void ClientMap::onBlockMeshUpdated(v3s16 mesh_pos, MapBlock *block)
+{
+	if (block->mesh)
+		m_drawlist.addIfVisible(mesh_pos, block);
+}
+
+void ClientMap::updateOcclusionBuffer(v3s16 camera_mesh, const MeshGrid &mesh_grid)
+{
+	ScopeProfiler sp(g_profiler, "CM::updateOcclusionBuffer()", SPT_AVG);
+
+	// Distance in mesh chunks up to which solid sides are rasterized
+	const s16 occluder_range = 4;
+
+	// The draw list is not updated every frame, leave room for turning
+	m_occlusion_buffer.begin(m_camera_position, m_camera_direction, m_camera_fov + 0.4f);
+
+	auto get_solid_sides = [this] (v3s16 mesh_pos) -> u8 {
+		MapBlock *block = getBlockNoCreateNoEx(mesh_pos);
+		return block ? block->solid_sides : 0;
+	};
+
+	const s16 cell_size = mesh_grid.cell_size;
+	const v3s16 range(occluder_range * cell_size);
+	const v3s16 p_min = camera_mesh - range;
+	const v3s16 p_max = camera_mesh + range;
+	v3s16 p;
+	for (p.Z = p_min.Z; p.Z <= p_max.Z; p.Z += cell_size)
+	for (p.Y = p_min.Y; p.Y <= p_max.Y; p.Y += cell_size)
+	for (p.X = p_min.X; p.X <= p_max.X; p.X += cell_size) {
+		const u8 solid_sides = get_solid_sides(p);
+		if (solid_sides == 0)
+			continue;
+
+		aabb3f box = getMeshBox(p, cell_size);
+		// solid sides are +Z-Z+Y-Y+X-X, see MapBlockMesh
+		for (u8 side = 0; side < 6; side++) {
+			if (!(solid_sides & (1 << side)) || !m_occlusion_buffer.isFrontSide(box, side))
+				continue;
+
+			// A neighbour in front that is solid all around hides this side
+			v3s16 neighbour = p;
+			neighbour[side / 2] += (side & 1) ? cell_size : -cell_size;
+			if (neighbour != camera_mesh && get_solid_sides(neighbour) == 0x3F)
+				continue;
+
+			m_occlusion_buffer.addBoxSide(box, side);
+		}
+	}
+
+	m_occlusion_buffer.end();
+	g_profiler->avg("MapBlock sides rasterized [#]", m_occlusion_buffer.getOccluderCount());
+}
+
 void ClientMap::touchMapBlocks()
 {
 	if (m_control.range_all || m_loops_occlusion_culler)
@@ -744,9 +866,9 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	auto is_frustum_culled = m_client->getCamera()->getFrustumCuller();
 
 	const MeshGrid mesh_grid = m_client->getMeshGrid();
-	for (auto &i : m_drawlist) {
-		v3s16 block_pos = i.first;
-		MapBlock *block = i.second;
+	for (const auto &i : m_drawlist) {
+		v3s16 block_pos = i.pos;
+		MapBlock *block = i.block;
 		MapBlockMesh *block_mesh = block->mesh;
 
 		// If the mesh of the block happened to get deleted, ignore it
@@ -1255,39 +1377,57 @@ void ClientMap::updateDrawListShadow(v3f shadow_light_pos, v3f shadow_light_dir,
 	// Number of blocks with mesh in rendering range
 	u32 blocks_in_range_with_mesh = 0;
 
+	std::vector<MapSector *> sectors;
+	sectors.reserve(m_sectors.size());
 	for (auto &sector_it : m_sectors) {
 		MapSector *sector = sector_it.second;
 		if (!sector)
 			continue;
 		blocks_loaded += sector->size();
+		sectors.push_back(sector);
+	}
+
+	// Find the blocks in range on the worker threads, a slice of sectors per job
+	const size_t sectors_per_job = 32;
+	std::vector<std::vector<MapBlock *>> slices((sectors.size() + sectors_per_job - 1) / sectors_per_job);
 
+	m_drawlist_pool->run(slices.size(), [&] (size_t job) {
 		MapBlockVect sectorblocks;
-		sector->getBlocks(sectorblocks);
+		const size_t end = std::min(sectors.size(), (job + 1) * sectors_per_job);
+		for (size_t i = job * sectors_per_job; i < end; i++) {
+			sectorblocks.clear();
+			sectors[i]->getBlocks(sectorblocks);
 
-		/*
-			Loop through blocks in sector
-		*/
-		for (MapBlock *block : sectorblocks) {
-			MapBlockMesh *mesh = block->mesh;
-			if (!mesh) {
-				// Ignore if mesh doesn't exist
-				continue;
-			}
+			/*
+				Loop through blocks in sector
+			*/
+			for (MapBlock *block : sectorblocks) {
+				MapBlockMesh *mesh = block->mesh;
+				if (!mesh) {
+					// Ignore if mesh doesn't exist
+					continue;
+				}
 
-			v3f block_pos = intToFloat(block->getPos() * MAP_BLOCKSIZE, BS) + mesh->getBoundingSphereCenter();
-			v3f projection = shadow_light_pos + shadow_light_dir * shadow_light_dir.dotProduct(block_pos - shadow_light_pos);
-			if (projection.getDistanceFrom(block_pos) > (radius + mesh->getBoundingRadius()))
-				continue;
+				v3f block_pos = intToFloat(block->getPos() * MAP_BLOCKSIZE, BS) + mesh->getBoundingSphereCenter();
+				v3f projection = shadow_light_pos + shadow_light_dir * shadow_light_dir.dotProduct(block_pos - shadow_light_pos);
+				if (projection.getDistanceFrom(block_pos) > (radius + mesh->getBoundingRadius()))
+					continue;
 
-			blocks_in_range_with_mesh++;
+				// This block is in range. Reset usage timer.
+				block->resetUsageTimer();
 
-			// This block is in range. Reset usage timer.
-			block->resetUsageTimer();
+				slices[job].push_back(block);
+			}
+		}
+	});
 
-			// Add to set
-			if (m_drawlist_shadow.emplace(block->getPos(), block).second) {
+	for (auto &slice : slices) {
+		blocks_in_range_with_mesh += slice.size();
+
+		// Add to set
+		for (MapBlock *block : slice) {
+			if (m_drawlist_shadow.emplace(block->getPos(), block).second)
 				block->refGrab();
-			}
 		}
 	}
 
@@ -1311,7 +1451,7 @@ void ClientMap::updateTransparentMeshBuffers()
 
 	// Update the order of transparent mesh buffers in each mesh
 	for (auto it = m_drawlist.begin(); it != m_drawlist.end(); it++) {
-		MapBlock* block = it->second;
+		MapBlock* block = it->block;
 		if (!block->mesh)
 			continue;
 
@@ -22,8 +22,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes_extrabloated.h"
 #include "map.h"
 #include "camera.h"
-#include <set>
+#include "mapdrawlist.h"
+#include "occlusionbuffer.h"
 #include <map>
+#include <memory>
+#include <set>
 
 struct MapDrawControl
 {
@@ -58,6 +61,7 @@ struct MeshBufListList
 
 class Client;
 class ITextureSource;
+class WorkerPool;
 class PartialMeshBuffer;
 
 /*
@@ -121,6 +125,9 @@ class ClientMap : public Map, public scene::ISceneNode
 	void updateDrawListShadow(v3f shadow_light_pos, v3f shadow_light_dir, float radius, float length);
 	// Returns true if draw list needs updating before drawing the next frame.
 	bool needsUpdateDrawList() { return m_needs_update_drawlist; }
+	// Draws a block that got a mesh right away, if it was found visible
+	// by the last draw list update
+	void onBlockMeshUpdated(v3s16 mesh_pos, MapBlock *block);
 	void renderMap(video::IVideoDriver* driver, s32 pass);
 
 	void renderMapShadows(video::IVideoDriver *driver,
@@ -144,29 +151,13 @@ class ClientMap : public Map, public scene::ISceneNode
 	void reportMetrics(u64 save_time_us, u32 saved_blocks, u32 all_blocks) override;
 private:
 	bool isMeshOccluded(MapBlock *mesh_block, u16 mesh_size, v3s16 cam_pos_nodes);
+	// Rasterizes the solid sides of the meshes around the camera
+	void updateOcclusionBuffer(v3s16 camera_mesh, const MeshGrid &mesh_grid);
 
 	// update the vertex order in transparent mesh buffers
 	void updateTransparentMeshBuffers();
 
 
-	// Orders blocks by distance to the camera
-	class MapBlockComparer
-	{
-	public:
-		MapBlockComparer(const v3s16 &camera_block) : m_camera_block(camera_block) {}
-
-		bool operator() (const v3s16 &left, const v3s16 &right) const
-		{
-			auto distance_left = left.getDistanceFromSQ(m_camera_block);
-			auto distance_right = right.getDistanceFromSQ(m_camera_block);
-			return distance_left > distance_right || (distance_left == distance_right && left > right);
-		}
-
-	private:
-		v3s16 m_camera_block;
-	};
-
-
 	// reference to a mesh buffer used when rendering the map.
 	struct DrawDescriptor {
 		v3s16 m_pos;
@@ -204,9 +195,12 @@ class ClientMap : public Map, public scene::ISceneNode
 	video::SColor m_camera_light_color = video::SColor(0xFFFFFFFF);
 	bool m_needs_update_transparent_meshes = true;
 
-	std::map<v3s16, MapBlock*, MapBlockComparer> m_drawlist;
+	MapDrawList m_drawlist;
+	OcclusionBuffer m_occlusion_buffer;
 	std::vector<MapBlock*> m_keeplist;
 	std::map<v3s16, MapBlock*> m_drawlist_shadow;
+	// Classifies the blocks of the loaded sectors for the draw lists
+	std::unique_ptr<WorkerPool> m_drawlist_pool;
 	bool m_needs_update_drawlist;
 
 	std::set<v2s16> m_last_drawn_sectors;
@@ -218,4 +212,5 @@ class ClientMap : public Map, public scene::ISceneNode
 
 	bool m_loops_occlusion_culler;
 	bool m_enable_raytraced_culling;
+	bool m_enable_depth_buffer_culling;
 };
@@ -1713,33 +1713,19 @@ void GenericCAO::processMessage(const std::string &data)
 	} else if (cmd == AO_CMD_UPDATE_POSITION) {
 		// Not sent by the server if this object is an attachment.
 		// We might however get here if the server notices the object being detached before the client.
-		m_position = readV3F32(is);
-		m_velocity = readV3F32(is);
-		m_acceleration = readV3F32(is);
-		m_rotation = readV3F32(is);
-
-		m_rotation = wrapDegrees_0_360_v3f(m_rotation);
-		bool do_interpolate = readU8(is);
-		bool is_end_position = readU8(is);
-		float update_interval = readF32(is);
-
-		// Place us a bit higher if we're physical, to not sink into
-		// the ground due to sucky collision detection...
-		if(m_prop.physical)
-			m_position += v3f(0,0.002,0);
-
-		if(getParent() != NULL) // Just in case
-			return;
-
-		if(do_interpolate)
-		{
-			if(!m_prop.physical)
-				pos_translator.update(m_position, is_end_position, update_interval);
-		} else {
-			pos_translator.init(m_position);
-		}
-		rot_translator.update(m_rotation, false, update_interval);
-		updateNodePos();
+		AOPositionUpdate update;
+		update.position = readV3F32(is);
+		update.velocity = readV3F32(is);
+		update.acceleration = readV3F32(is);
+		update.rotation = readV3F32(is);
+		update.do_interpolate = readU8(is);
+		update.is_movement_end = readU8(is);
+		update.update_interval = readF32(is);
+		applyPositionUpdate(update);
+	} else if (cmd == AO_CMD_UPDATE_POSITION_COMPACT) {
+		AOPositionUpdate update;
+		if (update.deSerializeCompact(is, m_position_keyframe))
+			applyPositionUpdate(update);
 	} else if (cmd == AO_CMD_SET_TEXTURE_MOD) {
 		std::string mod = deSerializeString16(is);
 
@@ -1920,6 +1906,33 @@ void GenericCAO::processMessage(const std::string &data)
 	}
 }
 
+void GenericCAO::applyPositionUpdate(const AOPositionUpdate &update)
+{
+	m_position = update.position;
+	m_velocity = update.velocity;
+	m_acceleration = update.acceleration;
+	m_rotation = wrapDegrees_0_360_v3f(update.rotation);
+
+	// Place us a bit higher if we're physical, to not sink into
+	// the ground due to sucky collision detection...
+	if(m_prop.physical)
+		m_position += v3f(0,0.002,0);
+
+	if(getParent() != NULL) // Just in case
+		return;
+
+	if(update.do_interpolate)
+	{
+		if(!m_prop.physical)
+			pos_translator.update(m_position, update.is_movement_end,
+					update.update_interval);
+	} else {
+		pos_translator.init(m_position);
+	}
+	rot_translator.update(m_rotation, false, update.update_interval);
+	updateNodePos();
+}
+
 /* \pre punchitem != NULL
  */
 bool GenericCAO::directReportPunch(v3f dir, const ItemStack *punchitem,
@@ -93,6 +93,8 @@ class GenericCAO : public ClientActiveObject
 	u16 m_hp = 1;
 	SmoothTranslator<v3f> pos_translator;
 	SmoothTranslatorWrappedv3f rot_translator;
+	// Compact position updates are relative to this
+	AOPositionKeyframe m_position_keyframe;
 	// Spritesheet/animation stuff
 	v2f m_tx_size = v2f(1,1);
 	v2s16 m_tx_basepos;
@@ -133,6 +135,7 @@ class GenericCAO : public ClientActiveObject
 	bool m_enable_shaders = false;
 
 	bool visualExpiryRequired(const ObjectProperties &newprops) const;
+	void applyPositionUpdate(const AOPositionUpdate &update);
 
 public:
 	GenericCAO(Client *client, ClientEnvironment *env);
@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include <cmath>
 #include "content_mapblock.h"
 #include "util/numeric.h"
@@ -405,6 +406,66 @@ void MapblockMeshGenerator::drawAutoLightedCuboid(aabb3f box, const f32 *txc,
 	}
 }
 
+// Whether the faces of a tile can be merged: the texture must repeat
+// seamlessly and the material must be opaque and not waving
+static bool isGreedyTile(const TileSpec &tile)
+{
+	for (const TileLayer &layer : tile.layers) {
+		if (layer.texture_id == 0)
+			continue;
+		if (!(layer.material_flags & MATERIAL_FLAG_TILEABLE_HORIZONTAL) ||
+				!(layer.material_flags & MATERIAL_FLAG_TILEABLE_VERTICAL))
+			return false;
+		// Transparent faces are depth sorted per triangle, and waving
+		// ones are displaced per vertex: only merge opaque ones
+		if (layer.material_type != TILE_MATERIAL_BASIC &&
+				layer.material_type != TILE_MATERIAL_OPAQUE)
+			return false;
+	}
+	return true;
+}
+
+u16 MapblockMeshGenerator::getGreedyTileIndex(const TileSpec &tile)
+{
+	for (size_t i = 0; i < greedy_tiles.size(); i++) {
+		const TileSpec &other = greedy_tiles[i];
+		if (other.world_aligned == tile.world_aligned &&
+				other.rotation == tile.rotation &&
+				other.emissive_light == tile.emissive_light &&
+				std::equal(std::begin(other.layers), std::end(other.layers),
+					std::begin(tile.layers)))
+			return i;
+	}
+	greedy_tiles.push_back(tile);
+	return greedy_tiles.size() - 1;
+}
+
+void MapblockMeshGenerator::drawGreedyFaces()
+{
+	if (greedy_faces.empty())
+		return;
+
+	std::vector<GreedyFaceMerger::Quad> quads;
+	greedy_faces.merge(data->side_length, quads);
+
+	// Texture coordinates follow the position, so a merged face is drawn
+	// just like the face of a node as large as the rectangle
+	for (const GreedyFaceMerger::Quad &quad : quads) {
+		TileSpec &quad_tile = greedy_tiles[quad.tile];
+		aabb3f box(intToFloat(quad.min, BS) - v3f(0.5 * BS),
+				intToFloat(quad.max, BS) + v3f(0.5 * BS));
+		f32 texture_coord_buf[24];
+		generateCuboidTextureCoords(box, texture_coord_buf);
+		auto vertices = setupCuboidVertices(box, texture_coord_buf, &quad_tile, 1);
+		video::S3DVertex *face_vertices = &vertices[4 * quad.face];
+		for (int j = 0; j < 4; j++)
+			face_vertices[j].Color = quad.color;
+		collector->append(quad_tile, face_vertices, 4, quad_indices, 6);
+	}
+
+	greedy_tiles.clear();
+}
+
 void MapblockMeshGenerator::drawSolidNode()
 {
 	u8 faces = 0; // k-th bit will be set if k-th face is to be drawn.
@@ -453,6 +514,17 @@ void MapblockMeshGenerator::drawSolidNode()
 	if (!faces)
 		return;
 	u8 mask = faces ^ 0b0011'1111; // k-th bit is set if k-th face is to be *omitted*, as expected by cuboid drawing functions.
+	// Faces of a single color can be left to the greedy merge pass
+	auto defer_face = [&] (int face, u16 face_light) {
+		video::SColor face_color = encode_light(face_light, f->light_source);
+		if (!f->light_source)
+			applyFacesShading(face_color, v3f(tile_dirs[face].X, tile_dirs[face].Y, tile_dirs[face].Z));
+		greedy_faces.add(p, face, getGreedyTileIndex(tiles[face]), face_color);
+		mask |= 1 << face;
+	};
+	auto can_defer_face = [&] (int face) {
+		return data->m_greedy_meshing && !(mask & (1 << face)) && isGreedyTile(tiles[face]);
+	};
 	origin = intToFloat(p, BS);
 	auto box = aabb3f(v3f(-0.5 * BS), v3f(0.5 * BS));
 	f32 texture_coord_buf[24];
@@ -466,6 +538,10 @@ void MapblockMeshGenerator::drawSolidNode()
 				v3s16 corner = light_dirs[light_indices[face][k]];
 				lights[face][k] = LightPair(getSmoothLightSolid(blockpos_nodes + p, tile_dirs[face], corner, data));
 			}
+			u16 face_light = lights[face][0];
+			if (can_defer_face(face) && lights[face][1] == face_light &&
+					lights[face][2] == face_light && lights[face][3] == face_light)
+				defer_face(face, face_light);
 		}
 
 		drawCuboid(box, tiles, 6, texture_coord_buf, mask, [&] (int face, video::S3DVertex vertices[4]) {
@@ -481,6 +557,11 @@ void MapblockMeshGenerator::drawSolidNode()
 			return QuadDiagonal::Diag02;
 		});
 	} else {
+		for (int face = 0; face < 6; ++face) {
+			if (can_defer_face(face))
+				defer_face(face, lights[face]);
+		}
+
 		drawCuboid(box, tiles, 6, texture_coord_buf, mask, [&] (int face, video::S3DVertex vertices[4]) {
 			video::SColor color = encode_light(lights[face], f->light_source);
 			if (!f->light_source)
@@ -1725,6 +1806,7 @@ void MapblockMeshGenerator::generate()
 		f = &nodedef->get(n);
 		drawNode();
 	}
+	drawGreedyFaces();
 }
 
 void MapblockMeshGenerator::renderSingle(content_t node, u8 param2)
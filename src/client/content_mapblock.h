@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "nodedef.h"
+#include "client/meshgen/greedy.h"
 #include <IMeshManipulator.h>
 
 struct MeshMakeData;
@@ -152,6 +153,14 @@ class MapblockMeshGenerator
 	void drawFirelikeQuad(float rotation, float opening_angle,
 		float offset_h, float offset_v = 0.0);
 
+// greedy meshing of solid nodes
+	// Tiles of the faces left to the merge pass, indexed by GreedyFaceMerger
+	std::vector<TileSpec> greedy_tiles;
+	GreedyFaceMerger greedy_faces;
+
+	u16 getGreedyTileIndex(const TileSpec &tile);
+	void drawGreedyFaces();
+
 // drawtypes
 	void drawSolidNode();
 	void drawLiquidNode();
@@ -298,31 +298,72 @@ void final_color_blend(video::SColor *result,
 		encode_light(light, 0), dayLight);
 }
 
-void final_color_blend(video::SColor *result,
-		const video::SColor &data, const video::SColorf &dayLight)
+// Emphase blue a bit in darker places: the blue levels added for each
+// range of 8 levels of brightness are 1, 4, 6, 6, 6, 5, 4, 3, 2, 1 and
+// then 0. Computed with plain selects rather than a table lookup or
+// std::min, so that the batch blend stays branch-free and vectorizes.
+static inline s32 emphase_blue_when_dark(s32 brightness)
 {
-	static const video::SColorf artificialColor(1.04f, 1.04f, 1.04f);
+	s32 range = brightness / 8;
+	s32 rising = 1 + 3 * range;
+	s32 falling = 10 - range;
+	rising = rising < 6 ? rising : 6;
+	falling = falling > 0 ? falling : 0;
+	return rising < falling ? rising : falling;
+}
 
-	video::SColorf c(data);
-	f32 n = 1 - c.a;
+// Blends a half-baked color given as floats in [0, 1], returns the RGB part
+static inline u32 blend_color(f32 r, f32 g, f32 b, f32 a,
+		const video::SColorf &dayLight)
+{
+	const f32 artificial = 1.04f;
+	f32 n = 1 - a;
 
-	f32 r = c.r * (c.a * dayLight.r + n * artificialColor.r) * 2.0f;
-	f32 g = c.g * (c.a * dayLight.g + n * artificialColor.g) * 2.0f;
-	f32 b = c.b * (c.a * dayLight.b + n * artificialColor.b) * 2.0f;
+	r = r * (a * dayLight.r + n * artificial) * 2.0f;
+	g = g * (a * dayLight.g + n * artificial) * 2.0f;
+	b = b * (a * dayLight.b + n * artificial) * 2.0f;
 
-	// Emphase blue a bit in darker places
-	// Each entry of this array represents a range of 8 blue levels
-	static const u8 emphase_blue_when_dark[32] = {
-		1, 4, 6, 6, 6, 5, 4, 3, 2, 1, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	};
+	b += emphase_blue_when_dark(core::clamp((s32) ((r + g + b) / 3 * 255),
+		0, 255)) / 255.0f;
+
+	return core::clamp((s32) (r * 255.0f), 0, 255) << 16 |
+		core::clamp((s32) (g * 255.0f), 0, 255) << 8 |
+		core::clamp((s32) (b * 255.0f), 0, 255);
+}
 
-	b += emphase_blue_when_dark[irr::core::clamp((s32) ((r + g + b) / 3 * 255),
-		0, 255) / 8] / 255.0f;
+void final_color_blend(video::SColor *result,
+		const video::SColor &data, const video::SColorf &dayLight)
+{
+	video::SColorf c(data);
+	u32 rgb = blend_color(c.r, c.g, c.b, c.a, dayLight);
+	result->color = (result->color & 0xFF000000) | rgb;
+}
 
-	result->setRed(core::clamp((s32) (r * 255.0f), 0, 255));
-	result->setGreen(core::clamp((s32) (g * 255.0f), 0, 255));
-	result->setBlue(core::clamp((s32) (b * 255.0f), 0, 255));
+void final_color_blend(video::S3DVertex *vertices, const u16 *indices,
+		const VertexColorChannels &data, const video::SColorf &dayLight)
+{
+	// Blend into a contiguous buffer, then scatter to the vertices: the
+	// first loop has no dependencies between iterations and vectorizes
+	const f32 inv = 1.0f / 255.0f;
+	const size_t count = data.size();
+	const u8 *red = data.red.data();
+	const u8 *green = data.green.data();
+	const u8 *blue = data.blue.data();
+	const u8 *sunlight = data.sunlight.data();
+
+	constexpr size_t CHUNK_SIZE = 256;
+	u32 rgb[CHUNK_SIZE];
+	for (size_t start = 0; start < count; start += CHUNK_SIZE) {
+		const size_t n = std::min(CHUNK_SIZE, count - start);
+		for (size_t i = 0; i < n; i++) {
+			rgb[i] = blend_color(red[start + i] * inv, green[start + i] * inv,
+				blue[start + i] * inv, sunlight[start + i] * inv, dayLight);
+		}
+		for (size_t i = 0; i < n; i++) {
+			video::SColor &c = vertices[indices[start + i]].Color;
+			c.color = (c.color & 0xFF000000) | rgb[i];
+		}
+	}
 }
 
 /*
@@ -743,22 +784,26 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 				video::SColorf sunlight;
 				get_sunlight_color(&sunlight, 0);
 
-				std::map<u32, video::SColor> colors;
+				DaynightDiff diff;
+				diff.layer = layer;
+				diff.buffer = i;
 				const u32 vertex_count = p.vertices.size();
 				for (u32 j = 0; j < vertex_count; j++) {
 					video::SColor *vc = &p.vertices[j].Color;
 					video::SColor copy = *vc;
-					if (vc->getAlpha() == 0) // No sunlight - no need to animate
+					if (vc->getAlpha() == 0) { // No sunlight - no need to animate
 						final_color_blend(vc, copy, sunlight); // Finalize color
-					else // Record color to animate
-						colors[j] = copy;
+					} else { // Record color to animate
+						diff.indices.push_back(j);
+						diff.colors.push_back(copy);
+					}
 
 					// The sunlight ratio has been stored,
 					// delete alpha (for the final rendering).
 					vc->setAlpha(255);
 				}
-				if (!colors.empty())
-					m_daynight_diffs[{layer, i}] = std::move(colors);
+				if (!diff.indices.empty())
+					m_daynight_diffs.push_back(std::move(diff));
 			}
 
 			// Create material
@@ -896,20 +941,16 @@ bool MapBlockMesh::animate(bool faraway, float time, int crack,
 
 	// Day-night transition
 	if (!m_enable_shaders && (daynight_ratio != m_last_daynight_ratio)) {
-		// Force reload mesh to VBO
-		if (m_enable_vbo)
-			for (scene::IMesh *m : m_mesh)
-				m->setDirty();
 		video::SColorf day_color;
 		get_sunlight_color(&day_color, daynight_ratio);
 
-		for (auto &daynight_diff : m_daynight_diffs) {
-			scene::IMeshBuffer *buf = m_mesh[daynight_diff.first.first]->
-				getMeshBuffer(daynight_diff.first.second);
-			video::S3DVertex *vertices = (video::S3DVertex *)buf->getVertices();
-			for (const auto &j : daynight_diff.second)
-				final_color_blend(&(vertices[j.first].Color), j.second,
-						day_color);
+		for (const DaynightDiff &diff : m_daynight_diffs) {
+			scene::IMeshBuffer *buf = m_mesh[diff.layer]->getMeshBuffer(diff.buffer);
+			final_color_blend((video::S3DVertex *)buf->getVertices(),
+					diff.indices.data(), diff.colors, day_color);
+			// Force reload of the vertices to VBO, the indices did not change
+			if (m_enable_vbo)
+				buf->setDirty(scene::EBT_VERTEX);
 		}
 		m_last_daynight_ratio = daynight_ratio;
 	}
@@ -43,6 +43,8 @@ struct MeshMakeData
 	v3s16 m_blockpos = v3s16(-1337,-1337,-1337);
 	v3s16 m_crack_pos_relative = v3s16(-1337,-1337,-1337);
 	bool m_smooth_lighting = false;
+	// Merge faces of solid nodes that look the same
+	bool m_greedy_meshing = false;
 	MeshGrid m_mesh_grid;
 	u16 side_length;
 
@@ -164,6 +166,29 @@ class PartialMeshBuffer
 	mutable std::vector<u16> m_vertex_indexes;
 };
 
+/*
+	Half-baked vertex colors (see final_color_blend), stored per channel so
+	that many of them can be blended at once.
+*/
+struct VertexColorChannels
+{
+	std::vector<u8> red;
+	std::vector<u8> green;
+	std::vector<u8> blue;
+	// The sunlight ratio stored in the alpha channel
+	std::vector<u8> sunlight;
+
+	void push_back(video::SColor c)
+	{
+		red.push_back(c.getRed());
+		green.push_back(c.getGreen());
+		blue.push_back(c.getBlue());
+		sunlight.push_back(c.getAlpha());
+	}
+
+	size_t size() const { return red.size(); }
+};
+
 /*
 	Holds a mesh for a mapblock.
 
@@ -270,10 +295,18 @@ class MapBlockMesh
 	// Animation info: day/night transitions
 	// Last daynight_ratio value passed to animate()
 	u32 m_last_daynight_ratio;
-	// For each mesh and mesh buffer, stores pre-baked colors
-	// of sunlit vertices
-	// Keys are pairs of (mesh index, buffer index in the mesh)
-	std::map<std::pair<u8, u32>, std::map<u32, video::SColor > > m_daynight_diffs;
+	// Pre-baked colors of the sunlit vertices of a mesh buffer
+	struct DaynightDiff
+	{
+		// mesh index and buffer index in the mesh
+		u8 layer;
+		u32 buffer;
+		// vertex indices and their colors, in the same order.
+		// Like the buffer's own indices these fit in 16 bits.
+		std::vector<u16> indices;
+		VertexColorChannels colors;
+	};
+	std::vector<DaynightDiff> m_daynight_diffs;
 
 	// list of all semitransparent triangles in the mapblock
 	std::vector<MeshTriangle> m_transparent_triangles;
@@ -329,6 +362,18 @@ void final_color_blend(video::SColor *result,
 void final_color_blend(video::SColor *result,
 		const video::SColor &data, const video::SColorf &dayLight);
 
+/*!
+ * Gives the final colors of many vertices at once, like the overload
+ * above. Keeps the alpha of the vertices.
+ *
+ * \param vertices the vertices to update
+ * \param indices indices of the vertices to update
+ * \param data the half-baked vertex colors, one per index
+ * \param dayLight color of the sunlight
+ */
+void final_color_blend(video::S3DVertex *vertices, const u16 *indices,
+		const VertexColorChannels &data, const video::SColorf &dayLight);
+
 // Retrieves the TileSpec of a face of a node
 // Adds MATERIAL_FLAG_CRACK if the node is cracked
 // TileSpec should be passed as reference due to the underlying TileFrame and its vector
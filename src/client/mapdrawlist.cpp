@@ -0,0 +1,193 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "mapdrawlist.h"
+#include <algorithm>
+#include "mapblock.h"
+
+/*
+	BlockBitset
+*/
+
+bool BlockBitset::get(v3s16 p) const
+{
+	auto it = m_columns.find(v2s16(p.X, p.Z));
+	if (it == m_columns.end())
+		return false;
+
+	const Column &column = it->second;
+	s32 i = p.Y - column.y_min;
+	if (i < 0 || i >= (s32)column.words.size() * 64)
+		return false;
+	return (column.words[i / 64] >> (i % 64)) & 1;
+}
+
+bool BlockBitset::set(v3s16 p)
+{
+	Column &column = m_columns[v2s16(p.X, p.Z)];
+
+	const s32 y_min = p.Y & ~63;
+	if (column.words.empty()) {
+		column.y_min = y_min;
+	} else if (y_min < column.y_min) {
+		column.words.insert(column.words.begin(), (column.y_min - y_min) / 64, 0);
+		column.y_min = y_min;
+	}
+
+	s32 i = p.Y - column.y_min;
+	if (i >= (s32)column.words.size() * 64)
+		column.words.resize(i / 64 + 1, 0);
+
+	u64 &word = column.words[i / 64];
+	const u64 bit = (u64)1 << (i % 64);
+	bool previous = word & bit;
+	if (!previous) {
+		word |= bit;
+		column.count++;
+	}
+	return previous;
+}
+
+void BlockBitset::reset(v3s16 p)
+{
+	auto it = m_columns.find(v2s16(p.X, p.Z));
+	if (it == m_columns.end())
+		return;
+
+	Column &column = it->second;
+	s32 i = p.Y - column.y_min;
+	if (i < 0 || i >= (s32)column.words.size() * 64)
+		return;
+	u64 &word = column.words[i / 64];
+	const u64 bit = (u64)1 << (i % 64);
+	if (!(word & bit))
+		return;
+	word &= ~bit;
+	if (--column.count == 0)
+		m_emptied.push_back(it->first);
+}
+
+void BlockBitset::shrink()
+{
+	for (v2s16 p : m_emptied) {
+		auto it = m_columns.find(p);
+		if (it != m_columns.end() && it->second.count == 0)
+			m_columns.erase(it);
+	}
+	m_emptied.clear();
+}
+
+/*
+	MapDrawList
+*/
+
+MapDrawList::Entry MapDrawList::makeEntry(v3s16 pos, MapBlock *block) const
+{
+	v3s32 d(pos.X - m_camera_block.X, pos.Y - m_camera_block.Y,
+			pos.Z - m_camera_block.Z);
+	return {pos, block, d.X * d.X + d.Y * d.Y + d.Z * d.Z};
+}
+
+void MapDrawList::beginUpdate(v3s16 camera_block)
+{
+	for (v3s16 p : m_visible_list)
+		m_visible.reset(p);
+	m_visible_list.clear();
+
+	if (camera_block == m_camera_block)
+		return;
+
+	m_camera_block = camera_block;
+	for (Entry &entry : m_entries)
+		entry = makeEntry(entry.pos, entry.block);
+	std::sort(m_entries.begin(), m_entries.end(), isDrawnBefore);
+}
+
+void MapDrawList::markVisible(v3s16 pos)
+{
+	if (!m_visible.set(pos))
+		m_visible_list.push_back(pos);
+}
+
+void MapDrawList::endUpdate(const BlockGetter &get_block)
+{
+	// Remove what is not visible anymore, keeping the order
+	size_t kept = 0;
+	for (size_t i = 0; i < m_entries.size(); i++) {
+		const Entry &entry = m_entries[i];
+		if (m_visible.get(entry.pos)) {
+			m_entries[kept++] = entry;
+			continue;
+		}
+		m_listed.reset(entry.pos);
+		entry.block->refDrop();
+	}
+	m_removed_count = m_entries.size() - kept;
+	m_entries.resize(kept);
+
+	// Sort what became visible and merge it in
+	m_added.clear();
+	for (v3s16 p : m_visible_list) {
+		if (m_listed.get(p))
+			continue;
+		MapBlock *block = get_block(p);
+		if (!block)
+			continue;
+		block->refGrab();
+		m_listed.set(p);
+		m_added.push_back(makeEntry(p, block));
+	}
+	m_added_count = m_added.size();
+
+	// Columns not visible anymore would otherwise be kept forever
+	m_visible.shrink();
+	m_listed.shrink();
+
+	if (m_added.empty())
+		return;
+
+	std::sort(m_added.begin(), m_added.end(), isDrawnBefore);
+	m_entries.insert(m_entries.end(), m_added.begin(), m_added.end());
+	std::inplace_merge(m_entries.begin(), m_entries.begin() + kept,
+			m_entries.end(), isDrawnBefore);
+}
+
+void MapDrawList::addIfVisible(v3s16 pos, MapBlock *block)
+{
+	if (!m_visible.get(pos) || m_listed.get(pos))
+		return;
+
+	block->refGrab();
+	m_listed.set(pos);
+	Entry entry = makeEntry(pos, block);
+	m_entries.insert(std::upper_bound(m_entries.begin(), m_entries.end(),
+			entry, isDrawnBefore), entry);
+}
+
+void MapDrawList::clear()
+{
+	for (const Entry &entry : m_entries)
+		entry.block->refDrop();
+	m_entries.clear();
+	m_listed.clear();
+
+	m_visible.clear();
+	m_visible_list.clear();
+}
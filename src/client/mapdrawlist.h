@@ -0,0 +1,131 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "irr_v2d.h"
+#include "irr_v3d.h"
+
+class MapBlock;
+
+/*
+	Set of block positions, stored as a bitset for each sector
+*/
+class BlockBitset
+{
+public:
+	bool get(v3s16 p) const;
+	// Returns the previous value
+	bool set(v3s16 p);
+	void reset(v3s16 p);
+	void clear() { m_columns.clear(); m_emptied.clear(); }
+	// Frees the columns that have no bit set anymore. Kept separate from
+	// reset so that a column cleared and set again is not reallocated.
+	void shrink();
+	size_t getColumnCount() const { return m_columns.size(); }
+
+private:
+	struct Column
+	{
+		// Y of the first bit, a multiple of 64
+		s32 y_min = 0;
+		// Number of bits set
+		u32 count = 0;
+		std::vector<u64> words;
+	};
+
+	std::unordered_map<v2s16, Column> m_columns;
+	// Columns whose count dropped to zero since the last shrink
+	std::vector<v2s16> m_emptied;
+};
+
+/*
+	Blocks drawn by the ClientMap, ordered from far to near the camera.
+
+	The list is kept across updates. An update marks the positions found
+	visible and only the difference to the previous one is applied: blocks
+	no longer visible are removed, the new ones are sorted among themselves
+	and merged in. Everything is sorted again only when the camera has
+	entered another block.
+
+	A reference to each block in the list is held.
+*/
+class MapDrawList
+{
+public:
+	struct Entry
+	{
+		v3s16 pos;
+		MapBlock *block;
+		// Squared distance to the camera block
+		s32 distance_sq;
+	};
+
+	// Returns the block to draw at a position, nullptr if there is none
+	typedef std::function<MapBlock *(v3s16)> BlockGetter;
+
+	void beginUpdate(v3s16 camera_block);
+	void markVisible(v3s16 pos);
+	void endUpdate(const BlockGetter &get_block);
+
+	// Adds a block that got its mesh after the last update, if its
+	// position was visible in that update
+	void addIfVisible(v3s16 pos, MapBlock *block);
+
+	// Drops all blocks
+	void clear();
+
+	std::vector<Entry>::const_iterator begin() const { return m_entries.begin(); }
+	std::vector<Entry>::const_iterator end() const { return m_entries.end(); }
+	size_t size() const { return m_entries.size(); }
+	bool empty() const { return m_entries.empty(); }
+
+	// Changes made by the last update
+	u32 getAddedCount() const { return m_added_count; }
+	u32 getRemovedCount() const { return m_removed_count; }
+
+private:
+	Entry makeEntry(v3s16 pos, MapBlock *block) const;
+
+	// Far to near, same distances ordered by position
+	static bool isDrawnBefore(const Entry &a, const Entry &b)
+	{
+		return a.distance_sq > b.distance_sq ||
+				(a.distance_sq == b.distance_sq && a.pos > b.pos);
+	}
+
+	v3s16 m_camera_block;
+	std::vector<Entry> m_entries;
+	// Positions in m_entries
+	BlockBitset m_listed;
+
+	// Positions marked visible by the current or last update
+	BlockBitset m_visible;
+	std::vector<v3s16> m_visible_list;
+
+	// Scratch space for new entries
+	std::vector<Entry> m_added;
+
+	u32 m_added_count = 0;
+	u32 m_removed_count = 0;
+};
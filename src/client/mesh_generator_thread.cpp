@@ -54,6 +54,7 @@ MeshUpdateQueue::MeshUpdateQueue(Client *client):
 {
 	m_cache_enable_shaders = g_settings->getBool("enable_shaders");
 	m_cache_smooth_lighting = g_settings->getBool("smooth_lighting");
+	m_cache_greedy_meshing = g_settings->getBool("greedy_meshing");
 	m_meshgen_block_cache_size = g_settings->getS32("meshgen_block_cache_size");
 }
 
@@ -206,6 +207,7 @@ void MeshUpdateQueue::fillDataFromMapBlocks(QueuedMeshUpdate *q)
 
 	data->setCrack(q->crack_level, q->crack_pos);
 	data->setSmoothLighting(m_cache_smooth_lighting);
+	data->m_greedy_meshing = m_cache_greedy_meshing;
 }
 
 /*
@@ -87,6 +87,7 @@ class MeshUpdateQueue
 	// TODO: Add callback to update these when g_settings changes
 	bool m_cache_enable_shaders;
 	bool m_cache_smooth_lighting;
+	bool m_cache_greedy_meshing;
 	int m_meshgen_block_cache_size;
 
 	void fillDataFromMapBlocks(QueuedMeshUpdate *q);
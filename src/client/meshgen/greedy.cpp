@@ -0,0 +1,109 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "greedy.h"
+#include <algorithm>
+
+// Axis of the normal of each face
+static const u8 face_axis[6] = {1, 1, 0, 0, 2, 2};
+
+void GreedyFaceMerger::merge(u16 side_length, std::vector<Quad> &result)
+{
+	// Group the faces by plane, in each plane sort them by row and column
+	std::sort(m_faces.begin(), m_faces.end(), [] (const Face &a, const Face &b) {
+		if (a.face != b.face)
+			return a.face < b.face;
+		const u8 axis = face_axis[a.face];
+		const u8 u = (axis + 1) % 3;
+		const u8 v = (axis + 2) % 3;
+		if (a.p[axis] != b.p[axis])
+			return a.p[axis] < b.p[axis];
+		if (a.p[v] != b.p[v])
+			return a.p[v] < b.p[v];
+		return a.p[u] < b.p[u];
+	});
+
+	m_grid.assign((size_t)side_length * side_length, -1);
+
+	size_t plane_begin = 0;
+	while (plane_begin < m_faces.size()) {
+		const Face &first = m_faces[plane_begin];
+		const u8 axis = face_axis[first.face];
+		const u8 u = (axis + 1) % 3;
+		const u8 v = (axis + 2) % 3;
+
+		size_t plane_end = plane_begin;
+		while (plane_end < m_faces.size() &&
+				m_faces[plane_end].face == first.face &&
+				m_faces[plane_end].p[axis] == first.p[axis]) {
+			const v3s16 &p = m_faces[plane_end].p;
+			m_grid[p[v] * side_length + p[u]] = plane_end;
+			plane_end++;
+		}
+
+		// Every face starts a rectangle unless an earlier one took it.
+		// The grid is empty again once the plane is done.
+		for (size_t i = plane_begin; i < plane_end; i++) {
+			const Face &face = m_faces[i];
+			const s16 u0 = face.p[u];
+			const s16 v0 = face.p[v];
+			if (m_grid[v0 * side_length + u0] < 0)
+				continue;
+
+			auto matches = [&] (s16 pu, s16 pv) {
+				s32 other = m_grid[pv * side_length + pu];
+				return other >= 0 && m_faces[other].tile == face.tile &&
+						m_faces[other].color == face.color;
+			};
+
+			// Grow along the row, then add rows as long as they match entirely
+			s16 width = 1;
+			while (u0 + width < side_length && matches(u0 + width, v0))
+				width++;
+			s16 height = 1;
+			while (v0 + height < side_length) {
+				bool row_matches = true;
+				for (s16 du = 0; du < width && row_matches; du++)
+					row_matches = matches(u0 + du, v0 + height);
+				if (!row_matches)
+					break;
+				height++;
+			}
+
+			for (s16 dv = 0; dv < height; dv++)
+			for (s16 du = 0; du < width; du++)
+				m_grid[(v0 + dv) * side_length + u0 + du] = -1;
+
+			Quad quad;
+			quad.min = face.p;
+			quad.max = face.p;
+			quad.max[u] += width - 1;
+			quad.max[v] += height - 1;
+			quad.face = face.face;
+			quad.tile = face.tile;
+			quad.color = face.color;
+			result.push_back(quad);
+		}
+
+		plane_begin = plane_end;
+	}
+
+	m_faces.clear();
+}
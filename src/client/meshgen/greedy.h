@@ -0,0 +1,75 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include <SColor.h>
+
+/*
+	Merges faces of full nodes that lie next to each other in the same plane
+	and look the same into rectangles ("greedy meshing").
+
+	Faces are identified by the node position in the mesh and the face
+	direction, in the order of the cuboid faces: +Y, -Y, +X, -X, +Z, -Z.
+	Two faces look the same if they have the same tile and a single, equal
+	color. It is up to the caller to only add faces whose texture repeats
+	seamlessly across nodes.
+*/
+class GreedyFaceMerger
+{
+public:
+	struct Quad
+	{
+		// Nodes at the corners of the rectangle
+		v3s16 min;
+		v3s16 max;
+		u8 face;
+		u16 tile;
+		video::SColor color;
+	};
+
+	void add(v3s16 p, u8 face, u16 tile, video::SColor color)
+	{
+		m_faces.push_back({p, face, tile, color});
+	}
+
+	// Merges all faces added so far into rectangles and forgets them.
+	// side_length: nodes per edge of the mesh, positions are in [0, side_length)
+	void merge(u16 side_length, std::vector<Quad> &result);
+
+	size_t size() const { return m_faces.size(); }
+	bool empty() const { return m_faces.empty(); }
+
+private:
+	struct Face
+	{
+		v3s16 p;
+		u8 face;
+		u16 tile;
+		video::SColor color;
+	};
+
+	std::vector<Face> m_faces;
+	// Face indices of a plane, -1 where there is none
+	std::vector<s32> m_grid;
+};
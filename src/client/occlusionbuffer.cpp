@@ -0,0 +1,257 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "occlusionbuffer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+static constexpr f32 EMPTY_DEPTH = std::numeric_limits<f32>::max();
+
+OcclusionBuffer::OcclusionBuffer(u16 size) :
+	m_size(size)
+{
+	assert(size > 0 && (size & (size - 1)) == 0);
+	for (u16 level_size = size; level_size > 0; level_size >>= 1)
+		m_levels.emplace_back((size_t)level_size * level_size, EMPTY_DEPTH);
+}
+
+void OcclusionBuffer::begin(v3f camera_pos, v3f camera_dir, f32 fov)
+{
+	m_camera_pos = camera_pos;
+	m_forward = camera_dir;
+	m_forward.normalize();
+
+	// The camera does not roll, any up vector perpendicular to the view will do
+	m_right = v3f(0.0f, 1.0f, 0.0f).crossProduct(m_forward);
+	if (m_right.getLengthSQ() < 1e-6f)
+		m_right = v3f(0.0f, 0.0f, 1.0f).crossProduct(m_forward);
+	m_right.normalize();
+	m_up = m_forward.crossProduct(m_right);
+
+	fov = std::min(fov, 3.0f);
+	m_scale = m_size * 0.5f / std::tan(fov * 0.5f);
+
+	std::fill(m_levels[0].begin(), m_levels[0].end(), EMPTY_DEPTH);
+	m_occluder_count = 0;
+}
+
+v3f OcclusionBuffer::project(v3f p) const
+{
+	v3f d = p - m_camera_pos;
+	return v3f(d.dotProduct(m_right), d.dotProduct(m_up), d.dotProduct(m_forward));
+}
+
+bool OcclusionBuffer::getSpan(const std::vector<v3f> &polygon, f32 y,
+		f32 &x_min, f32 &x_max)
+{
+	bool found = false;
+	x_min = EMPTY_DEPTH;
+	x_max = -EMPTY_DEPTH;
+	for (size_t i = 0; i < polygon.size(); i++) {
+		const v3f &a = polygon[i];
+		const v3f &b = polygon[(i + 1) % polygon.size()];
+		if ((a.Y > y && b.Y > y) || (a.Y < y && b.Y < y))
+			continue;
+		found = true;
+		if (a.Y == b.Y) {
+			x_min = std::min({x_min, a.X, b.X});
+			x_max = std::max({x_max, a.X, b.X});
+		} else {
+			f32 x = a.X + (y - a.Y) * (b.X - a.X) / (b.Y - a.Y);
+			x_min = std::min(x_min, x);
+			x_max = std::max(x_max, x);
+		}
+	}
+	return found;
+}
+
+void OcclusionBuffer::addOccluder(const v3f *vertices, u8 count)
+{
+	// Clip against the near plane in view space
+	m_clipped.clear();
+	for (u8 i = 0; i < count; i++) {
+		v3f a = project(vertices[i]);
+		v3f b = project(vertices[(i + 1) % count]);
+		if (a.Z >= NEAR_PLANE)
+			m_clipped.push_back(a);
+		if ((a.Z < NEAR_PLANE) != (b.Z < NEAR_PLANE))
+			m_clipped.push_back(a + (b - a) * ((NEAR_PLANE - a.Z) / (b.Z - a.Z)));
+	}
+	if (m_clipped.size() < 3)
+		return;
+
+	// The inverse depth is linear in screen space, get its gradient from
+	// the plane of the polygon: dot(normal, v) = distance
+	v3f normal(0.0f, 0.0f, 0.0f);
+	for (size_t i = 0; i < m_clipped.size(); i++)
+		normal += m_clipped[i].crossProduct(m_clipped[(i + 1) % m_clipped.size()]);
+	const f32 distance = normal.dotProduct(m_clipped[0]);
+	// Seen from the edge
+	if (std::fabs(distance) < 1e-6f)
+		return;
+
+	const f32 center = m_size * 0.5f;
+	const f32 inv_dx = normal.X / (m_scale * distance);
+	const f32 inv_dy = -normal.Y / (m_scale * distance);
+	const f32 inv_0 = normal.Z / distance - (inv_dx + inv_dy) * center;
+
+	// Perspective divide into pixels, the depth stays in view space
+	f32 depth = 0.0f;
+	f32 y_min = EMPTY_DEPTH;
+	f32 y_max = -EMPTY_DEPTH;
+	for (v3f &v : m_clipped) {
+		depth = std::max(depth, v.Z);
+		v.X = center + v.X * m_scale / v.Z;
+		v.Y = center - v.Y * m_scale / v.Z;
+		y_min = std::min(y_min, v.Y);
+		y_max = std::max(y_max, v.Y);
+	}
+
+	// Fill the pixels that are covered completely. The polygon is convex,
+	// so that is where the spans at the top and bottom of a row overlap.
+	s32 row_begin = std::max<f32>(std::ceil(y_min), 0);
+	s32 row_end = std::min<f32>(std::floor(y_max), m_size);
+	bool covered = false;
+	for (s32 y = row_begin; y < row_end; y++) {
+		f32 top_min, top_max, bottom_min, bottom_max;
+		if (!getSpan(m_clipped, y, top_min, top_max) ||
+				!getSpan(m_clipped, y + 1, bottom_min, bottom_max))
+			continue;
+		s32 x_begin = std::max<f32>(std::ceil(std::max(top_min, bottom_min)), 0);
+		s32 x_end = std::min<f32>(std::floor(std::min(top_max, bottom_max)), m_size);
+		// Farthest depth within each pixel, at the corner where the
+		// inverse depth is smallest
+		f32 row_inv = inv_0 + inv_dy * (inv_dy < 0.0f ? y + 1 : y) +
+				(inv_dx < 0.0f ? inv_dx : 0.0f);
+		for (s32 x = x_begin; x < x_end; x++) {
+			f32 inv = row_inv + inv_dx * x;
+			f32 &d = depthAt(0, x, y);
+			d = std::min({d, depth, inv > 0.0f ? 1.0f / inv : depth});
+			covered = true;
+		}
+	}
+	if (covered)
+		m_occluder_count++;
+}
+
+void OcclusionBuffer::addBoxSide(const aabb3f &box, u8 side)
+{
+	const u8 axis = side / 2;
+	const f32 plane = (side & 1) ? box.MaxEdge[axis] : box.MinEdge[axis];
+	const u8 u = (axis + 1) % 3;
+	const u8 v = (axis + 2) % 3;
+
+	v3f quad[4];
+	for (u8 i = 0; i < 4; i++) {
+		quad[i][axis] = plane;
+		quad[i][u] = (i == 1 || i == 2) ? box.MaxEdge[u] : box.MinEdge[u];
+		quad[i][v] = (i >= 2) ? box.MaxEdge[v] : box.MinEdge[v];
+	}
+	addOccluder(quad, 4);
+}
+
+void OcclusionBuffer::end()
+{
+	for (u8 level = 1; level < m_levels.size(); level++) {
+		s32 size = m_size >> level;
+		for (s32 y = 0; y < size; y++)
+		for (s32 x = 0; x < size; x++) {
+			depthAt(level, x, y) = std::max({
+				depthAt(level - 1, 2 * x, 2 * y),
+				depthAt(level - 1, 2 * x + 1, 2 * y),
+				depthAt(level - 1, 2 * x, 2 * y + 1),
+				depthAt(level - 1, 2 * x + 1, 2 * y + 1)});
+		}
+	}
+}
+
+bool OcclusionBuffer::isFrontSide(const aabb3f &box, u8 side) const
+{
+	const u8 axis = side / 2;
+	if (side & 1)
+		return m_camera_pos[axis] > box.MaxEdge[axis];
+	return m_camera_pos[axis] < box.MinEdge[axis];
+}
+
+bool OcclusionBuffer::isOccluded(const aabb3f &box) const
+{
+	if (m_occluder_count == 0)
+		return false;
+
+	// Screen rectangle and nearest depth of the box
+	f32 x_min = EMPTY_DEPTH, x_max = -EMPTY_DEPTH;
+	f32 y_min = EMPTY_DEPTH, y_max = -EMPTY_DEPTH;
+	f32 depth = EMPTY_DEPTH;
+	const f32 center = m_size * 0.5f;
+	for (u8 i = 0; i < 8; i++) {
+		v3f corner((i & 1) ? box.MaxEdge.X : box.MinEdge.X,
+				(i & 2) ? box.MaxEdge.Y : box.MinEdge.Y,
+				(i & 4) ? box.MaxEdge.Z : box.MinEdge.Z);
+		v3f v = project(corner);
+		if (v.Z < NEAR_PLANE)
+			return false;
+		f32 x = center + v.X * m_scale / v.Z;
+		f32 y = center - v.Y * m_scale / v.Z;
+		x_min = std::min(x_min, x);
+		x_max = std::max(x_max, x);
+		y_min = std::min(y_min, y);
+		y_max = std::max(y_max, y);
+		depth = std::min(depth, v.Z);
+	}
+
+	// Parts outside of the view are unknown
+	if (x_min < 0 || y_min < 0 || x_max > m_size || y_max > m_size)
+		return false;
+
+	s32 x0 = std::floor(x_min);
+	s32 y0 = std::floor(y_min);
+	s32 x1 = std::max<s32>(std::ceil(x_max), x0 + 1);
+	s32 y1 = std::max<s32>(std::ceil(y_max), y0 + 1);
+
+	// Start at the level where the rectangle spans at most 2x2 pixels
+	u8 level = 0;
+	while (level + 1 < (s32)m_levels.size() &&
+			(((x1 - 1) >> level) - (x0 >> level) > 1 ||
+			((y1 - 1) >> level) - (y0 >> level) > 1))
+		level++;
+
+	return isAreaOccluded(level, x0, y0, x1, y1, depth);
+}
+
+bool OcclusionBuffer::isAreaOccluded(u8 level, s32 x0, s32 y0, s32 x1, s32 y1,
+		f32 depth) const
+{
+	for (s32 y = y0 >> level; y <= (y1 - 1) >> level; y++)
+	for (s32 x = x0 >> level; x <= (x1 - 1) >> level; x++) {
+		if (depthAt(level, x, y) < depth)
+			continue;
+		if (level == 0)
+			return false;
+		// Some of it may be visible, look closer at the part in the rectangle
+		if (!isAreaOccluded(level - 1,
+				std::max(x0, x << level), std::max(y0, y << level),
+				std::min(x1, (x + 1) << level), std::min(y1, (y + 1) << level),
+				depth))
+			return false;
+	}
+	return true;
+}
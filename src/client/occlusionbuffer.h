@@ -0,0 +1,96 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <vector>
+#include "irr_v3d.h"
+#include "irr_aabb3d.h"
+#include "constants.h"
+
+/*
+	Low resolution depth buffer rasterized on the CPU, used for occlusion
+	culling of the map.
+
+	Occluders are convex polygons, in practice the solid sides of nearby
+	mesh chunks. After all occluders were added, a hierarchy of farthest
+	depths is built that allows testing boxes with a few lookups.
+
+	The test is conservative: occluders only cover pixels they cover
+	completely and with their farthest depth, a box is only reported as
+	occluded if it is entirely behind them.
+*/
+class OcclusionBuffer
+{
+public:
+	// size: width and height in pixels, a power of two
+	OcclusionBuffer(u16 size = 128);
+
+	// Clears the buffer and sets the view it is rasterized from.
+	// fov: full view angle in radians, both horizontal and vertical
+	void begin(v3f camera_pos, v3f camera_dir, f32 fov);
+	// Adds a convex planar polygon, in world coordinates
+	void addOccluder(const v3f *vertices, u8 count);
+	// Adds a side of a box, in the order of MapBlock::solid_sides:
+	// -X, +X, -Y, +Y, -Z, +Z
+	void addBoxSide(const aabb3f &box, u8 side);
+	// Builds the depth hierarchy, call after all occluders were added
+	void end();
+
+	// Whether the box is hidden behind the occluders.
+	// Boxes outside of the view or crossing the near plane are not.
+	bool isOccluded(const aabb3f &box) const;
+
+	// Whether the camera is on the outer side of a box side
+	bool isFrontSide(const aabb3f &box, u8 side) const;
+
+	u32 getOccluderCount() const { return m_occluder_count; }
+
+	// Minimum view depth of occluders and boxes
+	static constexpr f32 NEAR_PLANE = 0.1f * BS;
+
+private:
+	// x and y are in pixels, z is the view depth
+	v3f project(v3f p) const;
+	// Returns the range of x covered at the given y, or false if there is none
+	static bool getSpan(const std::vector<v3f> &polygon, f32 y, f32 &x_min, f32 &x_max);
+	bool isAreaOccluded(u8 level, s32 x0, s32 y0, s32 x1, s32 y1, f32 depth) const;
+
+	f32 &depthAt(u8 level, s32 x, s32 y)
+	{ return m_levels[level][y * (m_size >> level) + x]; }
+	f32 depthAt(u8 level, s32 x, s32 y) const
+	{ return m_levels[level][y * (m_size >> level) + x]; }
+
+	const u16 m_size;
+	// Level 0 is the full resolution, each further level halves it and
+	// keeps the farthest depth
+	std::vector<std::vector<f32>> m_levels;
+
+	v3f m_camera_pos;
+	v3f m_right;
+	v3f m_up;
+	v3f m_forward;
+	// pixels per unit of x / z
+	f32 m_scale = 1.0f;
+
+	u32 m_occluder_count = 0;
+	// avoid reallocating while rasterizing
+	std::vector<v3f> m_clipped;
+};
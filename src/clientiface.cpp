@@ -31,7 +31,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server/player_sao.h"
 #include "log.h"
 #include "util/srp.h"
-#include "face_position_cache.h"
 
 const char *ClientInterface::statenames[] = {
 	"Invalid",
@@ -53,6 +52,9 @@ std::string ClientInterface::state2Name(ClientState state)
 	return statenames[state];
 }
 
+// Blocks taken from the send queue per step at most
+static constexpr u32 MAX_BLOCK_CHECKS_PER_STEP = 1000;
+
 RemoteClient::RemoteClient() :
 	m_max_simul_sends(g_settings->getU16("max_simultaneous_block_sends_per_client")),
 	m_min_time_from_building(
@@ -60,7 +62,8 @@ RemoteClient::RemoteClient() :
 	m_max_send_distance(g_settings->getS16("max_block_send_distance")),
 	m_block_optimize_distance(g_settings->getS16("block_send_optimize_distance")),
 	m_max_gen_distance(g_settings->getS16("max_block_generate_distance")),
-	m_occ_cull(g_settings->getBool("server_side_occlusion_culling"))
+	m_occ_cull(g_settings->getBool("server_side_occlusion_culling")),
+	m_send_budget(1, m_max_simul_sends)
 {
 }
 
@@ -95,24 +98,11 @@ void RemoteClient::GetNextBlocks (
 		ServerEnvironment *env,
 		EmergeManager * emerge,
 		float dtime,
+		const BlockSendBudget::Stats &net_stats,
 		std::vector<PrioritySortedBlockTransfer> &dest)
 {
-	// Increment timers
-	m_nothing_to_send_pause_timer -= dtime;
-	m_map_send_completion_timer += dtime;
-
-	if (m_map_send_completion_timer > g_settings->getFloat("server_unload_unused_data_timeout") * 0.8f) {
-		infostream << "Server: Player " << m_name << ", peer_id=" << peer_id
-				<< ": full map send is taking too long ("
-				<< m_map_send_completion_timer
-				<< "s), restarting to avoid visible blocks being unloaded."
-				<< std::endl;
-		m_map_send_completion_timer = 0.0f;
-		m_nearest_unsent_d = 0;
-	}
-
-	if (m_nothing_to_send_pause_timer >= 0)
-		return;
+	m_send_budget.update(dtime, net_stats, m_send_limit_reached);
+	m_send_limit_reached = false;
 
 	RemotePlayer *player = env->getPlayer(peer_id);
 	// This can happen sometimes; clients and players are not in perfect sync.
@@ -123,9 +113,25 @@ void RemoteClient::GetNextBlocks (
 	if (!sao)
 		return;
 
+	/*
+		The blocks the client has are not visited again, keep the ones
+		in range from being unloaded.
+	*/
+	m_sent_usage_timer += dtime;
+	if (m_sent_usage_timer > g_settings->getFloat("server_unload_unused_data_timeout") * 0.5f) {
+		m_sent_usage_timer = 0.0f;
+		for (const v3s16 &p : m_blocks_sent) {
+			if (!m_send_queue.isInArea(p))
+				continue;
+			if (MapBlock *block = env->getMap().getBlockNoCreateNoEx(p))
+				block->resetUsageTimer();
+		}
+	}
+
 	// Won't send anything if already sending
 	if (m_blocks_sending.size() >= m_max_simul_sends) {
 		//infostream<<"Not sending any blocks, Queue full."<<std::endl;
+		m_send_limit_reached = true;
 		return;
 	}
 
@@ -152,7 +158,8 @@ void RemoteClient::GetNextBlocks (
 	if (sao->getCameraInverted())
 		camera_dir = -camera_dir;
 
-	u16 max_simul_sends_usually = m_max_simul_sends;
+	// The usual limit follows the measured capacity of the connection
+	u16 max_simul_sends_usually = m_send_budget.getLimit();
 
 	/*
 		Check the time from last addNode/removeNode.
@@ -170,15 +177,6 @@ void RemoteClient::GetNextBlocks (
 	*/
 	u32 num_blocks_selected = m_blocks_sending.size();
 
-	/*
-		next time d will be continued from the d from which the nearest
-		unsent block was found this time.
-
-		This is because not necessarily any of the blocks found this
-		time are actually sent.
-	*/
-	s32 new_nearest_unsent_d = -1;
-
 	// Get view range and camera fov (radians) from the client
 	s16 fog_distance = sao->getPlayer()->getSkyParams().fog_distance;
 	s16 wanted_range = sao->getWantedRange() + 1;
@@ -188,31 +186,6 @@ void RemoteClient::GetNextBlocks (
 	}
 	float camera_fov = sao->getFov();
 
-	/*
-		Get the starting value of the block finder radius.
-	*/
-	if (m_last_center != center) {
-		m_nearest_unsent_d = 0;
-		m_last_center = center;
-		m_map_send_completion_timer = 0.0f;
-	}
-	// reset the unsent distance if the view angle has changed more that 10% of the fov
-	// (this matches isBlockInSight which allows for an extra 10%)
-	if (camera_dir.dotProduct(m_last_camera_dir) < std::cos(camera_fov * 0.1f)) {
-		m_nearest_unsent_d = 0;
-		m_last_camera_dir = camera_dir;
-		m_map_send_completion_timer = 0.0f;
-	}
-	if (m_nearest_unsent_d > 0) {
-		// make sure any blocks modified since the last time we sent blocks are resent
-		for (const v3s16 &p : m_blocks_modified) {
-			m_nearest_unsent_d = std::min(m_nearest_unsent_d, center.getDistanceFrom(p));
-		}
-	}
-	m_blocks_modified.clear();
-
-	s16 d_start = m_nearest_unsent_d;
-
 	// Distrust client-sent FOV and get server-set player object property
 	// zoom FOV (degrees) as a check to avoid hacked clients using FOV to load
 	// distant world.
@@ -230,13 +203,6 @@ void RemoteClient::GetNextBlocks (
 	s16 d_max_gen = std::min(adjustDist(m_max_gen_distance, prop_zoom_fov),
 		wanted_range);
 
-	s16 d_max = full_d_max;
-
-	// Don't loop very much at a time
-	s16 max_d_increment_at_time = 2;
-	if (d_max > d_start + max_d_increment_at_time)
-		d_max = d_start + max_d_increment_at_time;
-
 	// cos(angle between velocity and camera) * |velocity|
 	// Limit to 0.0f in case player moves backwards.
 	f32 dot = rangelim(camera_dir.dotProduct(playerspeed), 0.0f, 300.0f);
@@ -245,190 +211,183 @@ void RemoteClient::GetNextBlocks (
 	// limit max fov effect to 50%, 60% at 20n/s fly speed
 	camera_fov = camera_fov / (1 + dot / 300.0f);
 
-	s32 nearest_emerged_d = -1;
-	s32 nearest_emergefull_d = -1;
-	s32 nearest_sent_d = -1;
-	//bool queue_is_full = false;
+	/*
+		Update the send queue for the view of the player
+	*/
+	const bool area_changed = center != m_send_queue.getCenter() ||
+			full_d_max != m_send_queue.getRadius();
 
-	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
+	// reprioritize if the view angle has changed more that 10% of the fov
+	// (this matches isBlockInSight which allows for an extra 10%)
+	const float angle_change = std::cos(camera_fov * 0.1f);
+	if (area_changed ||
+			camera_dir.dotProduct(m_last_camera_dir) < angle_change ||
+			playerspeeddir.dotProduct(m_last_speed_dir) < angle_change ||
+			std::fabs(camera_fov - m_last_camera_fov) > m_last_camera_fov * 0.05f ||
+			camera_pos.getDistanceFrom(m_last_camera_pos) > MAP_BLOCKSIZE * BS / 2) {
+		m_last_camera_pos = camera_pos;
+		m_last_camera_dir = camera_dir;
+		m_last_speed_dir = playerspeeddir;
+		m_last_camera_fov = camera_fov;
+
+		const v2u32 &screen = m_dynamic_info.render_target_size;
+		const float aspect_ratio = screen.Y > 0 ? (float)screen.X / screen.Y : 1.0f;
 
-	s16 d;
-	for (d = d_start; d <= d_max; d++) {
 		/*
-			Get the border/face dot coordinates of a "d-radiused"
-			box
+			Blocks out of sight are not sent, the others by distance,
+			weighted by how far outside of the screen they are.
+			FIXME This only works if the client uses a small enough
+			FOV setting. The default of 72 degrees is fine.
+			Also retrieve a smaller view cone in the direction of the player's
+			movement.
+			(0.1 is about 5 degrees)
 		*/
-		std::vector<v3s16> list = FacePositionCache::getFacePositions(d);
+		m_send_queue.setPriority([=] (v3s16 p) -> float {
+			f32 dist;
+			if (!(isBlockInSight(p, camera_pos, camera_dir, camera_fov,
+						d_blocks_in_sight, &dist) ||
+					(playerspeeddir != v3f() &&
+					isBlockInSight(p, camera_pos, playerspeeddir, 0.1f,
+						d_blocks_in_sight, &dist)))) {
+				return INFINITY;
+			}
+			v3f block_center = intToFloat(p * MAP_BLOCKSIZE + MAP_BLOCKSIZE / 2, BS);
+			return dist * getBlockViewWeight(block_center - camera_pos,
+					camera_dir, camera_fov, aspect_ratio);
+		});
+	}
 
-		std::vector<v3s16>::iterator li;
-		for (li = list.begin(); li != list.end(); ++li) {
-			v3s16 p = *li + center;
+	if (area_changed) {
+		// The player moved on, give the skipped blocks another chance
+		for (const v3s16 &p : m_blocks_skipped)
+			m_send_queue.add(p);
+		m_blocks_skipped.clear();
+		// Emerging ones too, in case they never show up
+		for (const v3s16 &p : m_blocks_emerging)
+			m_send_queue.add(p);
+		m_blocks_emerging.clear();
+
+		m_send_queue.setArea(center, full_d_max, [this] (v3s16 p) {
+			return m_blocks_sending.find(p) == m_blocks_sending.end() &&
+					m_blocks_sent.find(p) == m_blocks_sent.end() &&
+					!blockpos_over_max_limit(p);
+		});
+	}
 
-			/*
-				Send throttling
-				- Don't allow too many simultaneous transfers
-				- EXCEPT when the blocks are very close
+	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
 
-				Also, don't send blocks that are already flying.
-			*/
+	// Blocks selected stay queued until SentBlock(), the server might not
+	// send all of them
+	std::vector<v3s16> selected;
 
-			// Start with the usual maximum
-			u16 max_simul_dynamic = max_simul_sends_usually;
+	v3s16 p;
+	float priority;
+	for (u32 checks = 0; checks < MAX_BLOCK_CHECKS_PER_STEP &&
+			m_send_queue.pop(p, priority); checks++) {
+		const s16 d = center.getDistanceFrom(p);
 
-			// If block is very close, allow full maximum
-			if (d <= BLOCK_SEND_DISABLE_LIMITS_MAX_D)
-				max_simul_dynamic = m_max_simul_sends;
+		/*
+			Send throttling
+			- Don't allow too many simultaneous transfers
+			- EXCEPT when the blocks are very close
+		*/
+		u16 max_simul_dynamic = max_simul_sends_usually;
 
-			/*
-				Do not go over max mapgen limit
-			*/
-			if (blockpos_over_max_limit(p))
-				continue;
+		// If block is very close, allow full maximum
+		if (d <= BLOCK_SEND_DISABLE_LIMITS_MAX_D)
+			max_simul_dynamic = m_max_simul_sends;
 
-			// If this is true, inexistent block will be made from scratch
-			bool generate = d <= d_max_gen;
+		// Don't select too many blocks for sending
+		if (num_blocks_selected >= max_simul_dynamic) {
+			m_send_queue.add(p);
+			break;
+		}
 
-			/*
-				Don't generate or send if not in sight
-				FIXME This only works if the client uses a small enough
-				FOV setting. The default of 72 degrees is fine.
-				Also retrieve a smaller view cone in the direction of the player's
-				movement.
-				(0.1 is about 5 degrees)
-			*/
-			f32 dist;
-			if (!(isBlockInSight(p, camera_pos, camera_dir, camera_fov,
-						d_blocks_in_sight, &dist) ||
-					(playerspeed.getLength() > 1.0f * BS &&
-					isBlockInSight(p, camera_pos, playerspeeddir, 0.1f,
-						d_blocks_in_sight)))) {
-				continue;
-			}
+		// Don't send blocks that are currently being transferred
+		// or have already been sent
+		if (m_blocks_sending.find(p) != m_blocks_sending.end() ||
+				m_blocks_sent.find(p) != m_blocks_sent.end())
+			continue;
 
-			/*
-				Check if map has this block
-			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
-			if (block) {
-				// First: Reset usage timer, this block will be of use in the future.
-				block->resetUsageTimer();
-			}
+		/*
+			Do not go over max mapgen limit
+		*/
+		if (blockpos_over_max_limit(p))
+			continue;
 
-			// Don't select too many blocks for sending
-			if (num_blocks_selected >= max_simul_dynamic) {
-				//queue_is_full = true;
-				goto queue_full_break;
-			}
+		// If this is true, inexistent block will be made from scratch
+		bool generate = d <= d_max_gen;
 
-			// Don't send blocks that are currently being transferred
-			if (m_blocks_sending.find(p) != m_blocks_sending.end())
-				continue;
+		/*
+			Check if map has this block
+		*/
+		MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
 
-			/*
-				Don't send already sent blocks
-			*/
-			if (m_blocks_sent.find(p) != m_blocks_sent.end())
-				continue;
+		bool block_not_found = false;
+		if (block) {
+			// First: Reset usage timer, this block will be of use in the future.
+			block->resetUsageTimer();
 
-			bool block_not_found = false;
-			if (block) {
-				// Check whether the block exists (with data)
-				if (!block->isGenerated())
-					block_not_found = true;
-
-				/*
-					If block is not close, don't send it unless it is near
-					ground level.
-
-					Block is near ground level if night-time mesh
-					differs from day-time mesh.
-				*/
-				if (d >= d_opt) {
-					if (!block->getIsUnderground() && !block->getDayNightDiff())
-						continue;
-				}
+			// Check whether the block exists (with data)
+			if (!block->isGenerated())
+				block_not_found = true;
 
-				/*
-					Check occlusion cache first.
-				 */
-				if (m_blocks_occ.find(p) != m_blocks_occ.end())
-					continue;
+			/*
+				If block is not close, don't send it unless it is near
+				ground level.
 
-				if (m_occ_cull && !block_not_found &&
-						env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
-					m_blocks_occ.insert(p);
+				Block is near ground level if night-time mesh
+				differs from day-time mesh.
+			*/
+			if (d >= d_opt) {
+				if (!block->getIsUnderground() && !block->getDayNightDiff()) {
+					m_blocks_skipped.insert(p);
 					continue;
 				}
 			}
 
-			/*
-				If block has been marked to not exist on disk (dummy) or is
-				not generated and generating new ones is not wanted, skip block.
-			*/
-			if (!generate && block_not_found) {
-				// get next one.
+			if (m_occ_cull && !block_not_found &&
+					env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
+				m_blocks_skipped.insert(p);
 				continue;
 			}
+		}
 
-			/*
-				Add inexistent block to emerge queue.
-			*/
-			if (block == NULL || block_not_found) {
-				if (emerge->enqueueBlockEmerge(peer_id, p, generate)) {
-					if (nearest_emerged_d == -1)
-						nearest_emerged_d = d;
-				} else {
-					if (nearest_emergefull_d == -1)
-						nearest_emergefull_d = d;
-					goto queue_full_break;
-				}
+		/*
+			If block has been marked to not exist on disk (dummy) or is
+			not generated and generating new ones is not wanted, skip block.
+		*/
+		if (!generate && block_not_found) {
+			m_blocks_skipped.insert(p);
+			continue;
+		}
 
-				// get next one.
-				continue;
+		/*
+			Add inexistent block to emerge queue.
+		*/
+		if (block == NULL || block_not_found) {
+			if (!emerge->enqueueBlockEmerge(peer_id, p, generate)) {
+				// Emerge queue is full, try again next time
+				m_send_queue.add(p);
+				break;
 			}
+			m_blocks_emerging.insert(p);
+			continue;
+		}
 
-			if (nearest_sent_d == -1)
-				nearest_sent_d = d;
-
-			/*
-				Add block to send queue
-			*/
-			PrioritySortedBlockTransfer q((float)dist, p, peer_id);
-
-			dest.push_back(q);
+		/*
+			Add block to send queue
+		*/
+		dest.emplace_back(priority, p, peer_id);
+		selected.push_back(p);
 
-			num_blocks_selected += 1;
-		}
-	}
-queue_full_break:
-
-	// If nothing was found for sending and nothing was queued for
-	// emerging, continue next time browsing from here
-	if (nearest_emerged_d != -1) {
-		new_nearest_unsent_d = nearest_emerged_d;
-	} else if (nearest_emergefull_d != -1) {
-		new_nearest_unsent_d = nearest_emergefull_d;
-	} else {
-		if (d > full_d_max) {
-			new_nearest_unsent_d = 0;
-			m_nothing_to_send_pause_timer = 2.0f;
-			infostream << "Server: Player " << m_name << ", peer_id=" << peer_id
-				<< ": full map send completed after " << m_map_send_completion_timer
-				<< "s, restarting" << std::endl;
-			m_map_send_completion_timer = 0.0f;
-		} else {
-			if (nearest_sent_d != -1)
-				new_nearest_unsent_d = nearest_sent_d;
-			else
-				new_nearest_unsent_d = d;
-		}
+		num_blocks_selected += 1;
 	}
 
-	if (new_nearest_unsent_d != -1 && m_nearest_unsent_d != new_nearest_unsent_d) {
-		m_nearest_unsent_d = new_nearest_unsent_d;
-		// if the distance has changed, clear the occlusion cache
-		m_blocks_occ.clear();
-	}
+	for (const v3s16 &p : selected)
+		m_send_queue.add(p);
+
+	m_send_limit_reached = num_blocks_selected >= m_send_budget.getLimit();
 }
 
 void RemoteClient::GotBlock(v3s16 p)
@@ -445,6 +404,8 @@ void RemoteClient::GotBlock(v3s16 p)
 
 void RemoteClient::SentBlock(v3s16 p)
 {
+	m_send_queue.remove(p);
+
 	if (m_blocks_sending.find(p) == m_blocks_sending.end())
 		m_blocks_sending[p] = 0.0f;
 	else
@@ -454,25 +415,19 @@ void RemoteClient::SentBlock(v3s16 p)
 
 void RemoteClient::SetBlockNotSent(v3s16 p)
 {
-	m_nothing_to_send_pause_timer = 0;
-
-	// remove the block from sending and sent sets,
-	// and mark as modified if found
-	if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0)
-		m_blocks_modified.insert(p);
+	// remove the block from all sets and queue it for sending again,
+	// if it is in range
+	m_blocks_sending.erase(p);
+	m_blocks_sent.erase(p);
+	m_blocks_skipped.erase(p);
+	m_blocks_emerging.erase(p);
+	m_send_queue.add(p);
 }
 
 void RemoteClient::SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks)
 {
-	m_nothing_to_send_pause_timer = 0;
-
-	for (auto &block : blocks) {
-		v3s16 p = block.first;
-		// remove the block from sending and sent sets,
-		// and mark as modified if found
-		if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0)
-			m_blocks_modified.insert(p);
-	}
+	for (auto &block : blocks)
+		SetBlockNotSent(block.first);
 }
 
 void RemoteClient::notifyEvent(ClientStateEvent event)
@@ -802,6 +757,32 @@ void ClientInterface::setPlayerName(session_t peer_id, const std::string &name)
 		n->second->setName(name);
 }
 
+void ClientInterface::markObjectKnown(RemoteClient *client, u16 id)
+{
+	RecursiveMutexAutoLock clientslock(m_clients_mutex);
+	client->m_known_objects.insert(id);
+	m_object_subscribers[id].insert(client->peer_id);
+}
+
+void ClientInterface::markObjectUnknown(RemoteClient *client, u16 id)
+{
+	RecursiveMutexAutoLock clientslock(m_clients_mutex);
+	client->m_known_objects.erase(id);
+
+	auto n = m_object_subscribers.find(id);
+	if (n == m_object_subscribers.end())
+		return;
+	n->second.erase(client->peer_id);
+	if (n->second.empty())
+		m_object_subscribers.erase(n);
+}
+
+const std::unordered_set<session_t> *ClientInterface::lockedGetObjectSubscribers(u16 id) const
+{
+	auto n = m_object_subscribers.find(id);
+	return n != m_object_subscribers.end() ? &n->second : nullptr;
+}
+
 void ClientInterface::DeleteClient(session_t peer_id)
 {
 	RecursiveMutexAutoLock conlock(m_clients_mutex);
@@ -825,6 +806,13 @@ void ClientInterface::DeleteClient(session_t peer_id)
 
 		if(obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
+
+		auto subscribers = m_object_subscribers.find(id);
+		if (subscribers != m_object_subscribers.end()) {
+			subscribers->second.erase(peer_id);
+			if (subscribers->second.empty())
+				m_object_subscribers.erase(subscribers);
+		}
 	}
 
 	// Delete client
@@ -29,10 +29,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "threading/mutex_auto_lock.h"
 #include "clientdynamicinfo.h"
+#include "server/block_send_queue.h"
 
 #include <list>
 #include <vector>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
 #include <memory>
 #include <mutex>
@@ -256,12 +258,14 @@ class RemoteClient
 	~RemoteClient() = default;
 
 	/*
-		Finds block that should be sent next to the client.
+		Finds blocks that should be sent next to the client.
 		Environment should be locked when this is called.
-		dtime is used for resetting send radius at slow interval
+		net_stats of the connection to the client decide how many
+		blocks may be on the wire at once.
 	*/
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
-			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
+			float dtime, const BlockSendBudget::Stats &net_stats,
+			std::vector<PrioritySortedBlockTransfer> &dest);
 
 	void GotBlock(v3s16 p);
 
@@ -295,7 +299,8 @@ class RemoteClient
 		o<<"RemoteClient "<<peer_id<<": "
 				<<"m_blocks_sent.size()="<<m_blocks_sent.size()
 				<<", m_blocks_sending.size()="<<m_blocks_sending.size()
-				<<", m_nearest_unsent_d="<<m_nearest_unsent_d
+				<<", m_send_queue.size()="<<m_send_queue.size()
+				<<", send limit="<<m_send_budget.getLimit()
 				<<", m_excess_gotblocks="<<m_excess_gotblocks
 				<<std::endl;
 		m_excess_gotblocks = 0;
@@ -306,6 +311,8 @@ class RemoteClient
 
 	/*
 		List of active objects that the client knows of.
+		Modify through ClientInterface::markObjectKnown/markObjectUnknown
+		to keep the per-object subscriber index in sync.
 	*/
 	std::set<u16> m_known_objects;
 
@@ -382,17 +389,6 @@ class RemoteClient
 	*/
 	std::unordered_set<v3s16> m_blocks_sent;
 
-	/*
-		Cache of blocks that have been occlusion culled at the current distance.
-		As GetNextBlocks traverses the same distance multiple times, this saves
-		significant CPU time.
-	 */
-	std::unordered_set<v3s16> m_blocks_occ;
-
-	s16 m_nearest_unsent_d = 0;
-	v3s16 m_last_center;
-	v3f m_last_camera_dir;
-
 	const u16 m_max_simul_sends;
 	const float m_min_time_from_building;
 	const s16 m_max_send_distance;
@@ -400,6 +396,34 @@ class RemoteClient
 	const s16 m_max_gen_distance;
 	const bool m_occ_cull;
 
+	/*
+		Blocks within sending range that have not been sent yet,
+		prioritized by the view of the player.
+	*/
+	BlockSendQueue m_send_queue;
+	BlockSendBudget m_send_budget;
+	// Whether the budget limited sending in the last GetNextBlocks()
+	bool m_send_limit_reached = false;
+
+	/*
+		Blocks taken from the queue but skipped for now, because they are
+		occlusion culled or not worth sending at their distance.
+		They are queued again when the player moves to another block.
+	*/
+	std::unordered_set<v3s16> m_blocks_skipped;
+
+	/*
+		Blocks waiting to be loaded or generated. They are queued again
+		once that is done, see SetBlockNotSent().
+	*/
+	std::unordered_set<v3s16> m_blocks_emerging;
+
+	// View the queue was prioritized for
+	v3f m_last_camera_pos;
+	v3f m_last_camera_dir;
+	v3f m_last_speed_dir;
+	float m_last_camera_fov = 0.0f;
+
 	/*
 		Blocks that are currently on the line.
 		This is used for throttling the sending of blocks.
@@ -410,16 +434,6 @@ class RemoteClient
 	*/
 	std::unordered_map<v3s16, float> m_blocks_sending;
 
-	/*
-		Blocks that have been modified since blocks were
-		sent to the client last (getNextBlocks()).
-		This is used to reset the unsent distance, so that
-		modified blocks are resent to the client.
-
-		List of block positions.
-	*/
-	std::unordered_set<v3s16> m_blocks_modified;
-
 	/*
 		Count of excess GotBlocks().
 		There is an excess amount because the client sometimes
@@ -429,11 +443,8 @@ class RemoteClient
 	*/
 	u32 m_excess_gotblocks = 0;
 
-	// CPU usage optimization
-	float m_nothing_to_send_pause_timer = 0.0f;
-
-	// measure how long it takes the server to send the complete map
-	float m_map_send_completion_timer = 0.0f;
+	// Time since the sent blocks were last kept from being unloaded
+	float m_sent_usage_timer = 0.0f;
 
 	/*
 		name of player using this client
@@ -513,6 +524,13 @@ class ClientInterface {
 	void setClientVersion(session_t peer_id, u8 major, u8 minor, u8 patch,
 			const std::string &full);
 
+	/* add or remove an active object from the objects known by a client */
+	void markObjectKnown(RemoteClient *client, u16 id);
+	void markObjectUnknown(RemoteClient *client, u16 id);
+
+	/* get peers knowing an object, or nullptr (make sure you have list lock before!) */
+	const std::unordered_set<session_t> *lockedGetObjectSubscribers(u16 id) const;
+
 	/* event to update client state */
 	void event(session_t peer_id, ClientStateEvent event);
 
@@ -546,6 +564,9 @@ class ClientInterface {
 	RemoteClientMap m_clients;
 	std::vector<std::string> m_clients_names; //for announcing masterserver
 
+	// Inverse of RemoteClient::m_known_objects: object id -> peers knowing it
+	std::unordered_map<u16, std::unordered_set<session_t>> m_object_subscribers;
+
 	// Environment
 	ServerEnvironment *m_env;
 
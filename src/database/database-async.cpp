@@ -0,0 +1,453 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "database-async.h"
+#include <algorithm>
+#include "threading/thread.h"
+#include "log.h"
+#include "irrlicht_changes/printing.h"
+
+// Limits on the memory used for pending writes and read-ahead
+static constexpr size_t MAX_WRITE_BYTES = 64 * 1024 * 1024;
+static constexpr size_t MAX_PREFETCH_BLOCKS = 1024;
+// Blocks written in one transaction of the wrapped database
+static constexpr size_t WRITE_BATCH_SIZE = 256;
+// Blocks read ahead before looking at pending writes again
+static constexpr size_t READ_BATCH_SIZE = 64;
+// Pending writes are written after this time even without endSave()
+static constexpr auto WRITE_INTERVAL = std::chrono::seconds(2);
+
+class MapDatabaseAsync::IOThread : public Thread
+{
+public:
+	IOThread(MapDatabaseAsync *db) :
+		Thread("MapDatabase"), m_db(db)
+	{}
+
+protected:
+	void *run()
+	{
+		m_db->ioLoop();
+		return nullptr;
+	}
+
+private:
+	MapDatabaseAsync *m_db;
+};
+
+MapDatabaseAsync::MapDatabaseAsync(MapDatabase *db) :
+	m_db(db)
+{
+	m_thread = std::make_unique<IOThread>(this);
+	if (!m_thread->start()) {
+		errorstream << "MapDatabaseAsync: failed to start I/O thread" << std::endl;
+		m_thread.reset();
+	}
+}
+
+MapDatabaseAsync::~MapDatabaseAsync()
+{
+	if (m_thread) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_io_cv.notify_one();
+		// The thread writes everything left before exiting
+		m_thread->wait();
+	}
+}
+
+void MapDatabaseAsync::endSave()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_write_requested = true;
+	}
+	m_io_cv.notify_one();
+}
+
+bool MapDatabaseAsync::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	if (!m_thread) {
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		return m_db->saveBlock(pos, data);
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	waitForWriteSpace(lock);
+	queueWrite(pos, data);
+	return !m_write_failed;
+}
+
+bool MapDatabaseAsync::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	if (!m_thread) {
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		return m_db->saveBlocks(blocks);
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	waitForWriteSpace(lock);
+	for (const auto &it : blocks)
+		queueWrite(it.first, it.second);
+	return !m_write_failed;
+}
+
+void MapDatabaseAsync::loadBlock(const v3s16 &pos, std::string *block)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (loadPending(pos, block))
+			return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_db_mutex);
+	m_db->loadBlock(pos, block);
+}
+
+void MapDatabaseAsync::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// Blocks which have to be read from the wrapped database
+	std::vector<v3s16> to_read;
+	std::vector<size_t> to_read_index;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (!loadPending(positions[i], &(*blocks)[i])) {
+				to_read.push_back(positions[i]);
+				to_read_index.push_back(i);
+			}
+		}
+	}
+	if (to_read.empty())
+		return;
+
+	std::vector<std::string> read;
+	{
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		m_db->loadBlocks(to_read, &read);
+	}
+	for (size_t i = 0; i < to_read.size(); i++)
+		(*blocks)[to_read_index[i]] = std::move(read[i]);
+}
+
+bool MapDatabaseAsync::deleteBlock(const v3s16 &pos)
+{
+	// Writes queued before must not overwrite the deletion
+	flush();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Left over from a failed write
+		auto it = m_writes.find(pos);
+		if (it != m_writes.end()) {
+			m_write_bytes -= it->second.size();
+			m_writes.erase(it);
+		}
+		if (m_prefetch_queued.erase(pos) > 0) {
+			m_prefetch_queue.erase(std::find(m_prefetch_queue.begin(),
+					m_prefetch_queue.end(), pos));
+		}
+		invalidatePrefetched(pos);
+	}
+
+	bool success;
+	{
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		success = m_db->deleteBlock(pos);
+	}
+
+	// The IO thread may have read the block between the lines above
+	std::lock_guard<std::mutex> lock(m_mutex);
+	invalidatePrefetched(pos);
+	return success;
+}
+
+void MapDatabaseAsync::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	flush();
+
+	std::lock_guard<std::mutex> lock(m_db_mutex);
+	m_db->listAllLoadableBlocks(dst);
+}
+
+void MapDatabaseAsync::forEachLoadableBlock(const std::function<void(v3s16)> &callback)
+{
+	flush();
+
+	std::lock_guard<std::mutex> lock(m_db_mutex);
+	m_db->forEachLoadableBlock(callback);
+}
+
+void MapDatabaseAsync::prefetchBlock(const v3s16 &pos)
+{
+	if (!m_thread)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_prefetch_queue.size() >= MAX_PREFETCH_BLOCKS)
+			return;
+		if (m_writes.count(pos) || m_writing_index.count(pos) || m_prefetched.count(pos))
+			return;
+		if (!m_prefetch_queued.insert(pos).second)
+			return;
+		m_prefetch_queue.push_back(pos);
+	}
+	m_io_cv.notify_one();
+}
+
+void MapDatabaseAsync::flush()
+{
+	if (!m_thread)
+		return;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_write_requested = true;
+	m_flushing++;
+	m_io_cv.notify_one();
+	const u64 passes = m_write_passes;
+	m_written_cv.wait(lock, [&] {
+		return (m_writes.empty() && m_writing.empty()) ||
+			(m_write_failed && m_write_passes > passes);
+	});
+	m_flushing--;
+}
+
+void MapDatabaseAsync::waitForWriteSpace(std::unique_lock<std::mutex> &lock)
+{
+	// Do not let the pending writes grow without bounds if the database
+	// cannot keep up. If it fails instead, saving fails and the callers
+	// keep their blocks anyway.
+	if (m_write_bytes > MAX_WRITE_BYTES && !m_write_failed) {
+		m_write_requested = true;
+		m_io_cv.notify_one();
+		m_written_cv.wait(lock, [this] {
+			return m_write_bytes <= MAX_WRITE_BYTES || m_write_failed;
+		});
+	}
+}
+
+void MapDatabaseAsync::queueWrite(const v3s16 &pos, const std::string &data)
+{
+	std::string &entry = m_writes[pos];
+	m_write_bytes -= entry.size();
+	entry = data;
+	m_write_bytes += entry.size();
+	invalidatePrefetched(pos);
+}
+
+bool MapDatabaseAsync::loadPending(const v3s16 &pos, std::string *block)
+{
+	auto it = m_writes.find(pos);
+	if (it != m_writes.end()) {
+		*block = it->second;
+		return true;
+	}
+	auto it2 = m_writing_index.find(pos);
+	if (it2 != m_writing_index.end()) {
+		*block = *it2->second;
+		return true;
+	}
+	auto it3 = m_prefetched.find(pos);
+	if (it3 != m_prefetched.end()) {
+		*block = std::move(it3->second.data);
+		m_prefetched.erase(it3);
+		return true;
+	}
+	return false;
+}
+
+void MapDatabaseAsync::invalidatePrefetched(const v3s16 &pos)
+{
+	auto it = m_prefetched.find(pos);
+	if (it != m_prefetched.end())
+		m_prefetched.erase(it);
+	if (m_reading)
+		m_invalidated.insert(pos);
+}
+
+void MapDatabaseAsync::ioLoop()
+{
+	std::vector<v3s16> to_read;
+	auto last_write = std::chrono::steady_clock::now();
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_io_cv.wait_until(lock, last_write + WRITE_INTERVAL, [this] {
+				return m_stop || m_write_requested || !m_prefetch_queue.empty();
+			});
+
+			bool timed_out = std::chrono::steady_clock::now() >= last_write + WRITE_INTERVAL;
+			// After a failure, only try again once in a while or when flushing
+			bool write = !m_writes.empty() && (m_stop || timed_out ||
+				(m_write_requested && (!m_write_failed || m_flushing > 0)));
+			if (!write)
+				m_write_requested = false;
+
+			// Reads are waited for by the emerge threads, do them first
+			to_read.clear();
+			while (!m_prefetch_queue.empty() && to_read.size() < READ_BATCH_SIZE) {
+				v3s16 pos = m_prefetch_queue.front();
+				m_prefetch_queue.pop_front();
+				m_prefetch_queued.erase(pos);
+				to_read.push_back(pos);
+			}
+
+			if (to_read.empty() && !write) {
+				if (m_stop)
+					break;
+				if (timed_out)
+					last_write = std::chrono::steady_clock::now();
+				continue;
+			}
+			if (!to_read.empty())
+				m_reading = true;
+			if (write) {
+				// Split into transactions, so that a huge save does not
+				// hold the database for long
+				m_writing.reserve((m_writes.size() + WRITE_BATCH_SIZE - 1) / WRITE_BATCH_SIZE);
+				for (auto &it : m_writes) {
+					if (m_writing.empty() || m_writing.back().size() >= WRITE_BATCH_SIZE) {
+						m_writing.emplace_back();
+						m_writing.back().reserve(WRITE_BATCH_SIZE);
+					}
+					m_writing.back().emplace_back(it.first, std::move(it.second));
+				}
+				for (const auto &batch : m_writing) {
+					for (const auto &it : batch)
+						m_writing_index.emplace(it.first, &it.second);
+				}
+				m_writes.clear();
+				m_write_bytes = 0;
+				m_write_requested = false;
+			}
+		}
+
+		if (!to_read.empty())
+			readPrefetched(to_read);
+
+		if (!m_writing.empty()) {
+			writeBatch();
+			last_write = std::chrono::steady_clock::now();
+		}
+	}
+}
+
+void MapDatabaseAsync::readPrefetched(std::vector<v3s16> &positions)
+{
+	std::vector<std::string> blocks;
+	try {
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		m_db->loadBlocks(positions, &blocks);
+	} catch (std::exception &e) {
+		errorstream << "MapDatabaseAsync: failed to read blocks ahead: "
+				<< e.what() << std::endl;
+		positions.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < positions.size(); i++) {
+		const v3s16 &pos = positions[i];
+		// Saved or deleted meanwhile, the data read may be outdated
+		if (m_invalidated.count(pos) || m_writes.count(pos) || m_writing_index.count(pos))
+			continue;
+		u64 seq = m_prefetch_seq++;
+		if (!m_prefetched.emplace(pos, Prefetched{std::move(blocks[i]), seq}).second)
+			continue;
+		m_prefetched_order.emplace_back(pos, seq);
+	}
+	m_invalidated.clear();
+	m_reading = false;
+
+	// Drop the oldest blocks which were never loaded
+	while (m_prefetched_order.size() > MAX_PREFETCH_BLOCKS) {
+		auto it = m_prefetched.find(m_prefetched_order.front().first);
+		if (it != m_prefetched.end() && it->second.seq == m_prefetched_order.front().second)
+			m_prefetched.erase(it);
+		m_prefetched_order.pop_front();
+	}
+}
+
+void MapDatabaseAsync::writeBatch()
+{
+	std::vector<bool> failed(m_writing.size(), false);
+	for (size_t i = 0; i < m_writing.size(); i++) {
+		const auto &batch = m_writing[i];
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		try {
+			m_db->beginSave();
+			try {
+				failed[i] = !m_db->saveBlocks(batch);
+			} catch (std::exception &e) {
+				errorstream << "MapDatabaseAsync: failed to save blocks: "
+						<< e.what() << std::endl;
+				failed[i] = true;
+			}
+			// Also ends the transaction when saving threw
+			m_db->endSave();
+		} catch (std::exception &e) {
+			errorstream << "MapDatabaseAsync: failed to save blocks: "
+					<< e.what() << std::endl;
+			failed[i] = true;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_writing_index.clear();
+
+		// Keep the blocks not written, unless they were saved again meanwhile
+		size_t lost = 0;
+		m_write_failed = false;
+		for (size_t i = 0; i < m_writing.size(); i++) {
+			if (!failed[i])
+				continue;
+			m_write_failed = true;
+			if (m_stop) {
+				lost += m_writing[i].size();
+				continue;
+			}
+			for (auto &it : m_writing[i]) {
+				if (m_writes.count(it.first))
+					continue;
+				m_write_bytes += it.second.size();
+				m_writes.emplace(it.first, std::move(it.second));
+			}
+		}
+		if (m_write_failed && !m_stop) {
+			errorstream << "MapDatabaseAsync: failed to save blocks, "
+					"trying again later" << std::endl;
+		}
+		if (lost > 0) {
+			errorstream << "MapDatabaseAsync: " << lost
+					<< " blocks could not be saved" << std::endl;
+		}
+
+		m_writing.clear();
+		m_write_passes++;
+	}
+	m_written_cv.notify_all();
+}
@@ -0,0 +1,133 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "database.h"
+
+/*
+	Runs the block reads and writes of another MapDatabase on a thread.
+
+	Saved blocks are kept in memory and written by the thread in batches
+	(write-behind), and blocks can be read ahead with prefetchBlock().
+	Reads always see the data saved before. flush() waits until all of it
+	has reached the wrapped database.
+
+	Blocks the wrapped database fails to write are kept and written again
+	later. Until that succeeds, saving returns false, so that the caller
+	keeps its blocks marked as modified.
+*/
+class MapDatabaseAsync : public MapDatabase
+{
+public:
+	// Takes ownership of db
+	MapDatabaseAsync(MapDatabase *db);
+	~MapDatabaseAsync();
+
+	DISABLE_CLASS_COPY(MapDatabaseAsync)
+
+	void beginSave() override {}
+	// Starts writing the blocks saved so far
+	void endSave() override;
+
+	// Fails while the last write of the wrapped database failed, the
+	// block is queued nonetheless
+	bool saveBlock(const v3s16 &pos, const std::string &data) override;
+	void loadBlock(const v3s16 &pos, std::string *block) override;
+	bool deleteBlock(const v3s16 &pos) override;
+	void listAllLoadableBlocks(std::vector<v3s16> &dst) override;
+	// Holds the database for the whole iteration
+	void forEachLoadableBlock(const std::function<void(v3s16)> &callback) override;
+
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks) override;
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks) override;
+
+	// Queues the block to be read in the background, so that a following
+	// loadBlock() does not have to wait for the wrapped database
+	void prefetchBlock(const v3s16 &pos);
+
+	// Waits until all saved blocks have been written, or writing them failed
+	void flush();
+
+private:
+	class IOThread;
+
+	void ioLoop();
+	void readPrefetched(std::vector<v3s16> &positions);
+	void writeBatch();
+	// Require m_mutex held
+	void waitForWriteSpace(std::unique_lock<std::mutex> &lock);
+	void queueWrite(const v3s16 &pos, const std::string &data);
+	// Returns false if the block is neither pending nor read ahead
+	bool loadPending(const v3s16 &pos, std::string *block);
+	void invalidatePrefetched(const v3s16 &pos);
+
+	std::unique_ptr<MapDatabase> m_db;
+	// Serializes the access to m_db
+	std::mutex m_db_mutex;
+
+	std::mutex m_mutex;
+	// Wakes up the thread
+	std::condition_variable m_io_cv;
+	// Signalled when a batch has been written
+	std::condition_variable m_written_cv;
+
+	// Blocks waiting to be written
+	std::unordered_map<v3s16, std::string> m_writes;
+	size_t m_write_bytes = 0;
+	bool m_write_requested = false;
+	// Blocks being written by the thread, in transactions of the
+	// wrapped database. Only modified by the thread.
+	std::vector<std::vector<std::pair<v3s16, std::string>>> m_writing;
+	std::unordered_map<v3s16, const std::string *> m_writing_index;
+	// Whether the wrapped database failed to write the last batches,
+	// which are then back in m_writes
+	bool m_write_failed = false;
+	// Number of times m_writing was written
+	u64 m_write_passes = 0;
+	// Threads waiting in flush()
+	u32 m_flushing = 0;
+
+	std::deque<v3s16> m_prefetch_queue;
+	std::unordered_set<v3s16> m_prefetch_queued;
+	struct Prefetched
+	{
+		// Empty if the block is not in the database
+		std::string data;
+		u64 seq;
+	};
+	// Read ahead, removed once loaded
+	std::unordered_map<v3s16, Prefetched> m_prefetched;
+	// For dropping the oldest entries, may refer to entries already loaded
+	std::deque<std::pair<v3s16, u64>> m_prefetched_order;
+	u64 m_prefetch_seq = 0;
+	// Positions written to while the thread was reading ahead
+	bool m_reading = false;
+	std::unordered_set<v3s16> m_invalidated;
+
+	bool m_stop = false;
+	std::unique_ptr<IOThread> m_thread;
+};
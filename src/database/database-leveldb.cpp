@@ -33,6 +33,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -88,11 +89,52 @@ bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 	return true;
 }
 
+bool Database_LevelDB::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	leveldb::WriteBatch batch;
+	for (const auto &it : blocks)
+		batch.Put(i64tos(getBlockAsInteger(it.first)), it.second);
+
+	leveldb::Status status = m_database->Write(leveldb::WriteOptions(), &batch);
+	if (!status.ok()) {
+		warningstream << "saveBlocks: LevelDB error saving " << blocks.size()
+			<< " blocks: " << status.ToString() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// Read all of them from the same state of the database
+	leveldb::ReadOptions options;
+	options.snapshot = m_database->GetSnapshot();
+	for (size_t i = 0; i < positions.size(); i++) {
+		leveldb::Status status = m_database->Get(options,
+			i64tos(getBlockAsInteger(positions[i])), &(*blocks)[i]);
+		if (!status.ok())
+			(*blocks)[i].clear();
+	}
+	m_database->ReleaseSnapshot(options.snapshot);
+}
+
 void Database_LevelDB::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	forEachLoadableBlock([&] (v3s16 pos) {
+		dst.push_back(pos);
+	});
+}
+
+void Database_LevelDB::forEachLoadableBlock(const std::function<void(v3s16)> &callback)
 {
 	std::unique_ptr<leveldb::Iterator> it(m_database->NewIterator(leveldb::ReadOptions()));
 	for (it->SeekToFirst(); it->Valid(); it->Next()) {
-		dst.push_back(getIntegerAsBlock(stoi64(it->key().ToString())));
+		callback(getIntegerAsBlock(stoi64(it->key().ToString())));
 	}
 	ENSURE_STATUS_OK(it->status());  // Check for any errors found during the scan
 }
@@ -38,6 +38,11 @@ class Database_LevelDB : public MapDatabase
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+	void forEachLoadableBlock(const std::function<void(v3s16)> &callback);
+
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 
 	void beginSave() {}
 	void endSave() {}
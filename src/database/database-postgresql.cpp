@@ -35,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "remoteplayer.h"
 #include "server/player_sao.h"
 #include <cstdlib>
+#include <cstring>
 
 Database_PostgreSQL::Database_PostgreSQL(const std::string &connect_string,
 	const char *type) :
@@ -214,6 +215,22 @@ void MapDatabasePostgreSQL::initStatements()
 				"($1::int4, $2::int4, $3::int4, $4::bytea) "
 				"ON CONFLICT ON CONSTRAINT blocks_pkey DO "
 				"UPDATE SET data = $4::bytea");
+
+		prepareStatement("write_blocks",
+			"INSERT INTO blocks (posX, posY, posZ, data) "
+				"SELECT * FROM unnest($1::int4[], $2::int4[], $3::int4[], "
+				"$4::bytea[]) "
+				"ON CONFLICT ON CONSTRAINT blocks_pkey DO "
+				"UPDATE SET data = excluded.data");
+	}
+
+	// unnest() of several arrays WITH ORDINALITY needs PostgreSQL 9.4
+	if (getPGVersion() >= 90400) {
+		prepareStatement("read_blocks",
+			"SELECT b.i::int4, blocks.data FROM "
+				"unnest($1::int4[], $2::int4[], $3::int4[]) "
+				"WITH ORDINALITY AS b(x, y, z, i) "
+				"JOIN blocks ON posX = b.x AND posY = b.y AND posZ = b.z");
 	}
 
 	prepareStatement("delete_block", "DELETE FROM blocks WHERE "
@@ -279,6 +296,127 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+// Element type OIDs, from pg_type.h
+static constexpr u32 BYTEAOID = 17;
+static constexpr u32 INT4OID = 23;
+
+static void pg_write_u32(std::string &dst, u32 value)
+{
+	value = htonl(value);
+	dst.append((const char *) &value, sizeof(value));
+}
+
+// Starts a one-dimensional array in binary format
+static void pg_begin_array(std::string &dst, u32 elemtype, size_t count)
+{
+	pg_write_u32(dst, 1); // dimensions
+	pg_write_u32(dst, 0); // no NULL elements
+	pg_write_u32(dst, elemtype);
+	pg_write_u32(dst, count);
+	pg_write_u32(dst, 1); // lower bound
+}
+
+static void pg_write_int4_element(std::string &dst, s32 value)
+{
+	pg_write_u32(dst, sizeof(value));
+	pg_write_u32(dst, value);
+}
+
+bool MapDatabasePostgreSQL::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	// Upserting all rows in one statement needs ON CONFLICT
+	if (getPGVersion() < 90500)
+		return MapDatabase::saveBlocks(blocks);
+
+	size_t data_size = 0;
+	for (const auto &it : blocks) {
+		if (it.second.size() > INT_MAX) {
+			errorstream << "Database_PostgreSQL::saveBlocks: Data truncation! "
+				<< "data.size() over 0xFFFFFFFF (== " << it.second.size()
+				<< ")" << std::endl;
+			return false;
+		}
+		data_size += 4 + it.second.size();
+	}
+	if (blocks.empty())
+		return true;
+
+	verifyDatabase();
+
+	std::string xs, ys, zs, datas;
+	pg_begin_array(xs, INT4OID, blocks.size());
+	pg_begin_array(ys, INT4OID, blocks.size());
+	pg_begin_array(zs, INT4OID, blocks.size());
+	datas.reserve(20 + data_size);
+	pg_begin_array(datas, BYTEAOID, blocks.size());
+	for (const auto &it : blocks) {
+		pg_write_int4_element(xs, it.first.X);
+		pg_write_int4_element(ys, it.first.Y);
+		pg_write_int4_element(zs, it.first.Z);
+		pg_write_u32(datas, it.second.size());
+		datas.append(it.second);
+	}
+	if (datas.size() > INT_MAX) {
+		// Too large for one statement
+		return MapDatabase::saveBlocks(blocks);
+	}
+
+	const void *args[] = { xs.c_str(), ys.c_str(), zs.c_str(), datas.c_str() };
+	const int argLen[] = {
+		(int)xs.size(), (int)ys.size(), (int)zs.size(), (int)datas.size()
+	};
+	const int argFmt[] = { 1, 1, 1, 1 };
+
+	execPrepared("write_blocks", ARRLEN(args), args, argLen, argFmt);
+	return true;
+}
+
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	// The statement reading all blocks at once needs PostgreSQL 9.4
+	if (getPGVersion() < 90400) {
+		MapDatabase::loadBlocks(positions, blocks);
+		return;
+	}
+
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	verifyDatabase();
+
+	std::string xs, ys, zs;
+	pg_begin_array(xs, INT4OID, positions.size());
+	pg_begin_array(ys, INT4OID, positions.size());
+	pg_begin_array(zs, INT4OID, positions.size());
+	for (const v3s16 &pos : positions) {
+		pg_write_int4_element(xs, pos.X);
+		pg_write_int4_element(ys, pos.Y);
+		pg_write_int4_element(zs, pos.Z);
+	}
+
+	const void *args[] = { xs.c_str(), ys.c_str(), zs.c_str() };
+	const int argLen[] = { (int)xs.size(), (int)ys.size(), (int)zs.size() };
+	const int argFmt[] = { 1, 1, 1 };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+		argLen, argFmt, false);
+
+	// Only the blocks found are returned, with their 1-based index
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		u32 i;
+		memcpy(&i, PQgetvalue(results, row, 0), sizeof(i));
+		i = ntohl(i);
+		if (i >= 1 && i <= positions.size())
+			(*blocks)[i - 1] = pg_to_string(results, row, 1);
+	}
+
+	PQclear(results);
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
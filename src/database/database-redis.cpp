@@ -175,6 +175,89 @@ bool Database_Redis::deleteBlock(const v3s16 &pos)
 	return true;
 }
 
+bool Database_Redis::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	// Pipeline the commands instead of waiting for each reply
+	for (const auto &it : blocks) {
+		std::string tmp = i64tos(getBlockAsInteger(it.first));
+		if (redisAppendCommand(ctx, "HSET %s %s %b", hash.c_str(), tmp.c_str(),
+				it.second.c_str(), it.second.size()) != REDIS_OK) {
+			throw DatabaseException(std::string(
+				"Redis command 'HSET' failed: ") + ctx->errstr);
+		}
+	}
+
+	bool ok = true;
+	for (const auto &it : blocks) {
+		redisReply *reply;
+		if (redisGetReply(ctx, (void **) &reply) != REDIS_OK || !reply) {
+			throw DatabaseException(std::string(
+				"Redis command 'HSET' failed: ") + ctx->errstr);
+		}
+		if (reply->type == REDIS_REPLY_ERROR) {
+			warningstream << "saveBlocks: saving block " << it.first
+				<< " failed: " << std::string(reply->str, reply->len) << std::endl;
+			ok = false;
+		}
+		freeReplyObject(reply);
+	}
+	return ok;
+}
+
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	std::vector<std::string> keys;
+	keys.reserve(positions.size());
+	for (const v3s16 &pos : positions)
+		keys.push_back(i64tos(getBlockAsInteger(pos)));
+
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	argv.reserve(keys.size() + 2);
+	argvlen.reserve(keys.size() + 2);
+	argv.push_back("HMGET");
+	argvlen.push_back(5);
+	argv.push_back(hash.c_str());
+	argvlen.push_back(hash.size());
+	for (const std::string &key : keys) {
+		argv.push_back(key.c_str());
+		argvlen.push_back(key.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), argv.data(), argvlen.data()));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		std::string errstr(reply->str, reply->len);
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' errored: ") + errstr);
+	}
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != positions.size()) {
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' gave invalid reply."));
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		const redisReply *element = reply->element[i];
+		// Missing blocks are nil
+		if (element->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(element->str, element->len);
+	}
+	freeReplyObject(reply);
+}
+
 void Database_Redis::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	redisReply *reply = static_cast<redisReply *>(redisCommand(ctx, "HKEYS %s", hash.c_str()));
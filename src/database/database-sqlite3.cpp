@@ -296,12 +296,79 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+bool MapDatabaseSQLite3::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	verifyDatabase();
+
+	// One transaction for all of them, unless the caller already started one
+	bool own_transaction = sqlite3_get_autocommit(m_database) != 0;
+	if (own_transaction)
+		beginSave();
+
+	try {
+		for (const auto &it : blocks) {
+			bindPos(m_stmt_write, it.first);
+			SQLOK(sqlite3_bind_blob(m_stmt_write, 2, it.second.data(), it.second.size(), NULL),
+				"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+
+			SQLRES(sqlite3_step(m_stmt_write), SQLITE_DONE, "Failed to save block")
+			sqlite3_reset(m_stmt_write);
+		}
+	} catch (DatabaseException &) {
+		sqlite3_reset(m_stmt_write);
+		// Keep what was written so far and leave no transaction open
+		if (own_transaction)
+			endSave();
+		throw;
+	}
+
+	if (own_transaction)
+		endSave();
+	return true;
+}
+
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// Reading in one transaction takes the database lock only once
+	bool own_transaction = sqlite3_get_autocommit(m_database) != 0;
+	if (own_transaction)
+		beginSave();
+
+	for (size_t i = 0; i < positions.size(); i++) {
+		bindPos(m_stmt_read, positions[i]);
+
+		if (sqlite3_step(m_stmt_read) == SQLITE_ROW) {
+			const char *data = (const char *) sqlite3_column_blob(m_stmt_read, 0);
+			size_t len = sqlite3_column_bytes(m_stmt_read, 0);
+			if (data)
+				(*blocks)[i].assign(data, len);
+		}
+		sqlite3_reset(m_stmt_read);
+	}
+
+	if (own_transaction)
+		endSave();
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	forEachLoadableBlock([&] (v3s16 pos) {
+		dst.push_back(pos);
+	});
+}
+
+void MapDatabaseSQLite3::forEachLoadableBlock(const std::function<void(v3s16)> &callback)
 {
 	verifyDatabase();
 
 	while (sqlite3_step(m_stmt_list) == SQLITE_ROW)
-		dst.push_back(getIntegerAsBlock(sqlite3_column_int64(m_stmt_list, 0)));
+		callback(getIntegerAsBlock(sqlite3_column_int64(m_stmt_list, 0)));
 
 	sqlite3_reset(m_stmt_list);
 }
@@ -67,3 +67,29 @@ v3s16 MapDatabase::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+bool MapDatabase::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	bool ok = true;
+	for (const auto &it : blocks)
+		ok &= saveBlock(it.first, it.second);
+	return ok;
+}
+
+
+void MapDatabase::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		loadBlock(positions[i], &(*blocks)[i]);
+}
+
+
+void MapDatabase::forEachLoadableBlock(const std::function<void(v3s16)> &callback)
+{
+	std::vector<v3s16> positions;
+	listAllLoadableBlocks(positions);
+	for (v3s16 pos : positions)
+		callback(pos);
+}
@@ -19,8 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <functional>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 #include "irr_v3d.h"
 #include "irrlichttypes.h"
@@ -44,10 +46,21 @@ class MapDatabase : public Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	// Saves several blocks at once, the positions must be distinct.
+	// Returns false if any of them failed.
+	virtual bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	// Loads the blocks at positions into blocks, in the same order.
+	// Blocks missing from the database are returned empty.
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
 	virtual void listAllLoadableBlocks(std::vector<v3s16> &dst) = 0;
+	// Calls callback for every block in the database, without keeping
+	// the whole list in memory where the backend allows it
+	virtual void forEachLoadableBlock(const std::function<void(v3s16)> &callback);
 };
 
 class PlayerSAO;
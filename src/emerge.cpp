@@ -21,11 +21,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
-#include <queue>
 
 #include "util/container.h"
 #include "util/thread.h"
+#include "util/worker_pool.h"
 #include "threading/event.h"
 
 #include "config.h"
@@ -46,6 +48,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 #include "voxel.h"
 
+// Blocks an emerge thread reads from the database and decodes at once
+static constexpr size_t EMERGE_LOAD_BATCH_SIZE = 16;
+
 class EmergeThread : public Thread {
 public:
 	bool enable_mapgen_debug_info;
@@ -75,12 +80,22 @@ class EmergeThread : public Thread {
 	Mapgen *m_mapgen;
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	std::deque<v3s16> m_block_queue;
+
+	// Blocks at the front of the queue, read and decoded ahead
+	std::unordered_map<v3s16, ServerMap::DecodedBlock> m_decoded;
+	// Decodes the blocks read ahead. Every emerge thread has its own,
+	// so that they do not wait for each other.
+	std::unique_ptr<WorkerPool> m_load_pool;
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
 
-	EmergeAction getBlockOrStartGen(
-		const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
+	// Reads the block at pos and the next queued ones from the database and
+	// decodes them in parallel, without holding the environment lock
+	void loadAhead(const v3s16 &pos);
+
+	EmergeAction getBlockOrStartGen(const v3s16 &pos, bool allow_gen,
+		ServerMap::DecodedBlock *decoded, MapBlock **block, BlockMakeData *data);
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
 		std::map<v3s16, MapBlock *> *modified_blocks);
 
@@ -364,6 +379,9 @@ bool EmergeManager::enqueueBlockEmergeEx(
 		thread->pushBlock(blockpos);
 	}
 
+	if (map)
+		map->prefetchBlock(blockpos);
+
 	thread->signal();
 
 	return true;
@@ -523,6 +541,8 @@ EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	m_mapgen(NULL)
 {
 	m_name = "Emerge-" + itos(ethreadid);
+	m_load_pool = std::make_unique<WorkerPool>(m_name + "-Load",
+			g_settings->getU16("num_emerge_load_threads"));
 }
 
 
@@ -534,7 +554,7 @@ void EmergeThread::signal()
 
 bool EmergeThread::pushBlock(const v3s16 &pos)
 {
-	m_block_queue.push(pos);
+	m_block_queue.push_back(pos);
 	return true;
 }
 
@@ -548,12 +568,14 @@ void EmergeThread::cancelPendingItems()
 		v3s16 pos;
 
 		pos = m_block_queue.front();
-		m_block_queue.pop();
+		m_block_queue.pop_front();
 
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
 		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
 	}
+
+	m_decoded.clear();
 }
 
 
@@ -582,7 +604,7 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 		return false;
 
 	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	m_block_queue.pop_front();
 
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
@@ -590,8 +612,57 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 }
 
 
-EmergeAction EmergeThread::getBlockOrStartGen(
-	const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
+void EmergeThread::loadAhead(const v3s16 &pos)
+{
+	std::vector<v3s16> positions;
+	positions.push_back(pos);
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+		for (const v3s16 &p : m_block_queue) {
+			if (positions.size() >= EMERGE_LOAD_BATCH_SIZE)
+				break;
+			if (!blockpos_over_max_limit(p) && m_decoded.find(p) == m_decoded.end())
+				positions.push_back(p);
+		}
+	}
+
+	// The database is read without the environment lock where possible
+	const bool read_unlocked = m_map->canReadBlocksUnlocked();
+	std::vector<ServerMap::DecodedBlock> decoded;
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+
+		// Blocks in memory are not loaded again
+		positions.erase(std::remove_if(positions.begin(), positions.end(),
+			[this] (const v3s16 &p) {
+				return m_map->getBlockNoCreateNoEx(p) != nullptr;
+			}), positions.end());
+		if (positions.empty())
+			return;
+
+		m_map->beginReadBlocks(positions, &decoded);
+		if (!read_unlocked)
+			m_map->readBlocks(&decoded);
+	}
+
+	// Blocks saved meanwhile are noticed by attachBlock()
+	if (read_unlocked)
+		m_map->readBlocks(&decoded);
+
+	{
+		ScopeProfiler sp(g_profiler, "EmergeThread: decode blocks", SPT_AVG);
+		m_load_pool->run(decoded.size(), [&] (size_t i) {
+			m_map->decodeBlock(&decoded[i]);
+		});
+	}
+
+	for (ServerMap::DecodedBlock &d : decoded)
+		m_decoded.emplace(d.pos, std::move(d));
+}
+
+
+EmergeAction EmergeThread::getBlockOrStartGen(const v3s16 &pos, bool allow_gen,
+	ServerMap::DecodedBlock *decoded, MapBlock **block, BlockMakeData *bmdata)
 {
 	MutexAutoLock envlock(m_server->m_env_mutex);
 
@@ -602,7 +673,10 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 			return EMERGE_FROM_MEMORY;
 	} else {
 		// 2). Attempt to load block from disk if it was not in the memory
-		*block = m_map->loadBlock(pos);
+		if (decoded)
+			*block = m_map->attachBlock(decoded);
+		else
+			*block = m_map->loadBlock(pos);
 		if (*block && (*block)->isGenerated())
 			return EMERGE_FROM_DISK;
 	}
@@ -704,7 +778,19 @@ void *EmergeThread::run()
 		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
 		EMERGE_DBG_OUT("pos=" << pos << " allow_gen=" << allow_gen);
 
-		action = getBlockOrStartGen(pos, allow_gen, &block, &bmdata);
+		if (m_decoded.find(pos) == m_decoded.end())
+			loadAhead(pos);
+		ServerMap::DecodedBlock decoded;
+		bool have_decoded = false;
+		auto decoded_it = m_decoded.find(pos);
+		if (decoded_it != m_decoded.end()) {
+			decoded = std::move(decoded_it->second);
+			m_decoded.erase(decoded_it);
+			have_decoded = true;
+		}
+
+		action = getBlockOrStartGen(pos, allow_gen,
+			have_decoded ? &decoded : nullptr, &block, &bmdata);
 		if (action == EMERGE_GENERATED) {
 			{
 				ScopeProfiler sp(g_profiler,
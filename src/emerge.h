@@ -45,6 +45,7 @@ class OreManager;
 class DecorationManager;
 class SchematicManager;
 class Server;
+class ServerMap;
 class ModApiMapgen;
 
 // Structure containing inputs/outputs for chunk generation
@@ -146,6 +147,10 @@ class EmergeManager {
 	// Environment is not created until after script initialization.
 	MapSettingsManager *map_settings_mgr;
 
+	// Set by ServerMap, to read the queued blocks from the database ahead
+	// of the emerge threads
+	ServerMap *map = nullptr;
+
 	// Methods
 	EmergeManager(Server *server, MetricsBackend *mb);
 	~EmergeManager();
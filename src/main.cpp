@@ -1197,17 +1197,29 @@ static bool migrate_map_database(const GameParams &game_params, const Settings &
 	std::vector<v3s16> blocks;
 	old_db->listAllLoadableBlocks(blocks);
 	new_db->beginSave();
-	for (std::vector<v3s16>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+	// Blocks are copied in batches, which the backends can do at once
+	std::vector<v3s16> batch;
+	std::vector<std::string> batch_data;
+	std::vector<std::pair<v3s16, std::string>> batch_save;
+	for (size_t start = 0; start < blocks.size(); start += 0x100) {
 		if (kill) return false;
 
-		std::string data;
-		old_db->loadBlock(*it, &data);
-		if (!data.empty()) {
-			new_db->saveBlock(*it, data);
-		} else {
-			errorstream << "Failed to load block " << *it << ", skipping it." << std::endl;
+		size_t end = MYMIN(start + 0x100, blocks.size());
+		batch.assign(blocks.begin() + start, blocks.begin() + end);
+		old_db->loadBlocks(batch, &batch_data);
+
+		batch_save.clear();
+		for (size_t i = 0; i < batch.size(); i++) {
+			if (!batch_data[i].empty()) {
+				batch_save.emplace_back(batch[i], std::move(batch_data[i]));
+			} else {
+				errorstream << "Failed to load block " << batch[i] << ", skipping it." << std::endl;
+			}
 		}
-		if (++count % 0xFF == 0 && time(NULL) - last_update_time >= 1) {
+		new_db->saveBlocks(batch_save);
+
+		count += batch.size();
+		if (time(NULL) - last_update_time >= 1) {
 			std::cerr << " Migrated " << count << " blocks, "
 				<< (100.0 * count / blocks.size()) << "% completed.\r";
 			new_db->endSave();
@@ -41,6 +41,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "config.h"
 #include "server.h"
 #include "database/database.h"
+#include "database/database-async.h"
 #include "database/database-dummy.h"
 #include "database/database-sqlite3.h"
 #include "script/scripting_server.h"
@@ -131,6 +132,14 @@ MapBlock *Map::getBlockNoCreateNoEx(v3s16 p3d)
 	return block;
 }
 
+MapBlock *Map::getBlockNoCreateNoExNoCache(v3s16 p3d) const
+{
+	auto it = m_sectors.find(v2s16(p3d.X, p3d.Z));
+	if (it == m_sectors.end())
+		return nullptr;
+	return it->second->getBlockNoCache(p3d.Y);
+}
+
 MapBlock *Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -1225,6 +1234,10 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	}
 	std::string backend = conf.get("backend");
 	dbase = createDatabase(backend, savedir, conf);
+	if (g_settings->getBool("map_database_async")) {
+		dbase_async = new MapDatabaseAsync(dbase);
+		dbase = dbase_async;
+	}
 	if (conf.exists("readonly_backend")) {
 		std::string readonly_dir = savedir + DIR_DELIM + "readonly";
 		dbase_ro = createDatabase(conf.get("readonly_backend"), readonly_dir, conf);
@@ -1244,6 +1257,8 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
 
+	emerge->map = this;
+
 	try {
 		// If directory exists, check contents and load if possible
 		if (fs::PathExists(m_savedir)) {
@@ -1304,6 +1319,9 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	if (m_emerge->map == this)
+		m_emerge->map = nullptr;
+
 	/*
 		Close database if it was opened
 	*/
@@ -1623,6 +1641,9 @@ void ServerMap::reportMetrics(u64 save_time_us, u32 saved_blocks, u32 all_blocks
 	m_save_count_counter->increment(saved_blocks);
 }
 
+// Number of blocks ServerMap::save() passes to the database at once
+static constexpr size_t SAVE_BATCH_SIZE = 64;
+
 void ServerMap::save(ModifiedState save_level)
 {
 	if (!m_map_saving_enabled) {
@@ -1650,6 +1671,21 @@ void ServerMap::save(ModifiedState save_level)
 	// Don't do anything with sqlite unless something is really saved
 	bool save_started = false;
 
+	// Blocks are handed to the database in batches
+	MapBlockVect batch;
+	std::vector<std::pair<v3s16, std::string>> batch_data;
+	auto save_batch = [&] () {
+		for (const auto &it : batch_data)
+			markDbChanged(it.first);
+		if (dbase->saveBlocks(batch_data)) {
+			// We just wrote them to the disk so clear modified flag
+			for (MapBlock *block : batch)
+				block->resetModified();
+		}
+		batch.clear();
+		batch_data.clear();
+	};
+
 	for (auto &sector_it : m_sectors) {
 		MapSector *sector = sector_it.second;
 
@@ -1668,15 +1704,26 @@ void ServerMap::save(ModifiedState save_level)
 
 				modprofiler.add(block->getModifiedReasonString(), 1);
 
-				saveBlock(block);
+				batch.push_back(block);
+				batch_data.emplace_back(block->getPos(),
+					serializeBlock(block, m_map_compression_level));
+				if (batch.size() >= SAVE_BATCH_SIZE)
+					save_batch();
 				block_count++;
 			}
 		}
 	}
 
+	if (!batch.empty())
+		save_batch();
+
 	if(save_started)
 		endSave();
 
+	// Everything is to be on disk after a full save
+	if (save_level == MOD_STATE_CLEAN && dbase_async)
+		dbase_async->flush();
+
 	/*
 		Only print if something happened or saved whole map
 	*/
@@ -1702,6 +1749,13 @@ void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 		dbase_ro->listAllLoadableBlocks(dst);
 }
 
+void ServerMap::forEachLoadableBlock(const std::function<void(v3s16)> &callback)
+{
+	dbase->forEachLoadableBlock(callback);
+	if (dbase_ro)
+		dbase_ro->forEachLoadableBlock(callback);
+}
+
 void ServerMap::listAllLoadedBlocks(std::vector<v3s16> &dst)
 {
 	for (auto &sector_it : m_sectors) {
@@ -1757,13 +1811,12 @@ void ServerMap::endSave()
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
+	markDbChanged(block->getPos());
 	return saveBlock(block, dbase, m_map_compression_level);
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+std::string ServerMap::serializeBlock(MapBlock *block, int compression_level)
 {
-	v3s16 p3d = block->getPos();
-
 	// Format used for writing
 	u8 version = SER_FMT_VER_HIGHEST_WRITE;
 
@@ -1774,8 +1827,12 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	std::ostringstream o(std::ios_base::binary);
 	o.write((char*) &version, 1);
 	block->serialize(o, version, true, compression_level);
+	return o.str();
+}
 
-	bool ret = db->saveBlock(p3d, o.str());
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+{
+	bool ret = db->saveBlock(block->getPos(), serializeBlock(block, compression_level));
 	if (ret) {
 		// We just wrote it to the disk so clear modified flag
 		block->resetModified();
@@ -1867,23 +1924,159 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
-	if (created_new && (block != NULL)) {
-		std::map<v3s16, MapBlock*> modified_blocks;
-		// Fix lighting if necessary
-		voxalgo::update_block_border_lighting(this, block, modified_blocks);
-		if (!modified_blocks.empty()) {
-			//Modified lighting, send event
-			MapEditEvent event;
-			event.type = MEET_OTHER;
-			event.setModifiedBlocks(modified_blocks);
-			dispatchEvent(event);
+	if (created_new && (block != NULL))
+		updateLoadedBlockLighting(block);
+	return block;
+}
+
+void ServerMap::updateLoadedBlockLighting(MapBlock *block)
+{
+	std::map<v3s16, MapBlock*> modified_blocks;
+	// Fix lighting if necessary
+	voxalgo::update_block_border_lighting(this, block, modified_blocks);
+	if (!modified_blocks.empty()) {
+		//Modified lighting, send event
+		MapEditEvent event;
+		event.type = MEET_OTHER;
+		event.setModifiedBlocks(modified_blocks);
+		dispatchEvent(event);
+	}
+}
+
+void ServerMap::beginReadBlocks(const std::vector<v3s16> &positions,
+		std::vector<DecodedBlock> *decoded)
+{
+	decoded->clear();
+	decoded->resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		DecodedBlock &d = (*decoded)[i];
+		d.pos = positions[i];
+		d.db_changes = m_db_changes;
+	}
+}
+
+void ServerMap::readBlocks(std::vector<DecodedBlock> *decoded)
+{
+	std::vector<v3s16> positions;
+	positions.reserve(decoded->size());
+	for (const DecodedBlock &d : *decoded)
+		positions.push_back(d.pos);
+
+	std::vector<std::string> blobs;
+	dbase->loadBlocks(positions, &blobs);
+
+	if (dbase_ro) {
+		std::vector<v3s16> missing;
+		std::vector<size_t> missing_index;
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (blobs[i].empty()) {
+				missing.push_back(positions[i]);
+				missing_index.push_back(i);
+			}
+		}
+		if (!missing.empty()) {
+			std::vector<std::string> blobs_ro;
+			dbase_ro->loadBlocks(missing, &blobs_ro);
+			for (size_t i = 0; i < missing.size(); i++)
+				blobs[missing_index[i]] = std::move(blobs_ro[i]);
 		}
 	}
+
+	for (size_t i = 0; i < positions.size(); i++)
+		(*decoded)[i].blob = std::move(blobs[i]);
+}
+
+void ServerMap::decodeBlock(DecodedBlock *decoded)
+{
+	if (decoded->blob.empty())
+		return;
+
+	u8 version = decoded->blob[0];
+	// The oldest formats need the node definitions while being read
+	if (!ser_ver_supported(version) || version <= 21)
+		return;
+
+	try {
+		std::istringstream is(decoded->blob, std::ios_base::binary);
+		is.ignore(1);
+
+		auto block = std::make_unique<MapBlock>(this, decoded->pos, m_gamedef);
+		{
+		ScopeProfiler sp(g_profiler, "ServerMap: deSer block", SPT_AVG);
+		block->deSerialize(is, version, true, &decoded->nimap);
+		}
+		decoded->block = std::move(block);
+		decoded->blob.clear();
+	} catch (SerializationError &e) {
+		// attachBlock() reports it like loadBlock()
+	}
+}
+
+MapBlock *ServerMap::attachBlock(DecodedBlock *decoded)
+{
+	const v3s16 blockpos = decoded->pos;
+
+	// The data may be outdated if blocks were saved or deleted meanwhile,
+	// and the block must not be loaded on top of one in memory
+	if (isDbChangedSince(blockpos, decoded->db_changes) || getBlockNoCreateNoEx(blockpos))
+		return loadBlock(blockpos);
+
+	ScopeProfiler sp(g_profiler, "ServerMap: load block", SPT_AVG);
+	v2s16 p2d(blockpos.X, blockpos.Z);
+
+	if (decoded->block) {
+		MapBlock *block = decoded->block.get();
+		block->correctNodeIds(decoded->nimap);
+		createSector(p2d)->insertBlock(std::move(decoded->block));
+
+		ReflowScan scanner(this, m_emerge->ndef);
+		scanner.scan(block, &m_transforming_liquid);
+
+		// We just loaded it from, so it's up-to-date.
+		block->resetModified();
+	} else if (!decoded->blob.empty()) {
+		loadBlock(&decoded->blob, blockpos, createSector(p2d), false);
+	} else {
+		return NULL;
+	}
+
+	MapBlock *block = getBlockNoCreateNoEx(blockpos);
+	if (block)
+		updateLoadedBlockLighting(block);
 	return block;
 }
 
+// Saved or deleted positions ServerMap remembers to validate blocks read ahead
+static constexpr size_t MAX_DB_CHANGED_BLOCKS = 16384;
+
+void ServerMap::markDbChanged(v3s16 blockpos)
+{
+	// Forget the older changes once there are many, blocks read before
+	// are then treated as outdated
+	if (m_db_changed.size() >= MAX_DB_CHANGED_BLOCKS) {
+		m_db_changed.clear();
+		m_db_changes_since = m_db_changes;
+	}
+	m_db_changed[blockpos] = ++m_db_changes;
+}
+
+bool ServerMap::isDbChangedSince(v3s16 blockpos, u64 db_changes) const
+{
+	if (db_changes < m_db_changes_since)
+		return true;
+	auto it = m_db_changed.find(blockpos);
+	return it != m_db_changed.end() && it->second > db_changes;
+}
+
+void ServerMap::prefetchBlock(v3s16 blockpos)
+{
+	if (dbase_async)
+		dbase_async->prefetchBlock(blockpos);
+}
+
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
+	markDbChanged(blockpos);
 	if (!dbase->deleteBlock(blockpos))
 		return false;
 
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <functional>
 
 #include "irrlichttypes_bloated.h"
 #include "mapblock.h"
@@ -35,11 +36,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/metricsbackend.h"
 #include "util/numeric.h"
 #include "nodetimer.h"
+#include "nameidmapping.h"
 #include "map_settings_manager.h"
 #include "debug.h"
 
 class Settings;
 class MapDatabase;
+class MapDatabaseAsync;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
@@ -162,6 +165,9 @@ class Map /*: public NodeContainer*/
 	MapBlock * getBlockNoCreate(v3s16 p);
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
+	// Same as the above, but bypasses the lookup caches. May be called
+	// from several threads at once as long as nothing modifies the map.
+	MapBlock * getBlockNoCreateNoExNoCache(v3s16 p) const;
 
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
@@ -402,16 +408,49 @@ class ServerMap : public Map
 
 	void save(ModifiedState save_level) override;
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+	void forEachLoadableBlock(const std::function<void(v3s16)> &callback);
 	void listAllLoadedBlocks(std::vector<v3s16> &dst);
 
 	MapgenParams *getMapgenParams();
 
 	bool saveBlock(MapBlock *block) override;
 	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1);
+	// Serializes the block in the format stored in the database
+	static std::string serializeBlock(MapBlock *block, int compression_level = -1);
 	MapBlock* loadBlock(v3s16 p);
+	// Starts reading the block from the database in the background if
+	// supported, so that loadBlock() will not wait for it. Thread-safe.
+	void prefetchBlock(v3s16 p);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
+	/*
+		Loading blocks with the expensive part off the environment lock:
+		the reads are set up with beginReadBlocks(), the data is read with
+		readBlocks(), decoded with decodeBlock() on any thread and then
+		added to the map with attachBlock().
+	*/
+	struct DecodedBlock
+	{
+		v3s16 pos;
+		// Data as read, kept if it was not decoded
+		std::string blob;
+		std::unique_ptr<MapBlock> block;
+		NameIdMapping nimap;
+		// Value of m_db_changes when the data was read
+		u64 db_changes = 0;
+	};
+	void beginReadBlocks(const std::vector<v3s16> &positions,
+			std::vector<DecodedBlock> *decoded);
+	// Requires the environment lock unless canReadBlocksUnlocked()
+	void readBlocks(std::vector<DecodedBlock> *decoded);
+	// Whether the database is safe to read from any thread
+	bool canReadBlocksUnlocked() const { return dbase_async && !dbase_ro; }
+	// Thread-safe. Data it cannot decode without the map is left as is.
+	void decodeBlock(DecodedBlock *decoded);
+	// Same as loadBlock(), using the result of decodeBlock()
+	MapBlock *attachBlock(DecodedBlock *decoded);
+
 	// Blocks are removed from the map but not deleted from memory until
 	// deleteDetachedBlocks() is called, since pointers to them may still exist
 	// when deleteBlock() is called.
@@ -454,6 +493,9 @@ class ServerMap : public Map
 private:
 	friend class ModApiMapgen; // for m_transforming_liquid
 
+	// Fixes the light at the borders of a block which was just loaded
+	void updateLoadedBlockLighting(MapBlock *block);
+
 	// Emerge manager
 	EmergeManager *m_emerge;
 
@@ -481,6 +523,17 @@ class ServerMap : public Map
 	bool m_map_metadata_changed = true;
 	MapDatabase *dbase = nullptr;
 	MapDatabase *dbase_ro = nullptr;
+	// Same as dbase if the database is accessed asynchronously
+	MapDatabaseAsync *dbase_async = nullptr;
+	// Incremented whenever a block is saved or deleted, to detect blocks
+	// read by readBlocks() which are outdated by the time they are attached.
+	// m_db_changed has the value of the last change of every position
+	// changed since m_db_changes_since.
+	u64 m_db_changes = 0;
+	u64 m_db_changes_since = 0;
+	std::unordered_map<v3s16, u64> m_db_changed;
+	void markDbChanged(v3s16 blockpos);
+	bool isDbChangedSince(v3s16 blockpos, u64 db_changes) const;
 
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <atomic>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -202,6 +203,76 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	// Cheaper to rebuild than to compare every node
+	m_content_index.reset();
+}
+
+const MapBlockContentIndex &MapBlock::getContentIndex(
+		const std::shared_ptr<const MapBlockContentIndex::Filter> &filter,
+		bool *built)
+{
+	bool rebuild = !m_content_index || m_content_index->getFilter() != filter;
+	if (rebuild)
+		m_content_index = std::make_unique<MapBlockContentIndex>(filter, data, nodecount);
+	if (built)
+		*built = rebuild;
+	return *m_content_index;
+}
+
+/*
+	MapBlockContentIndex
+*/
+
+MapBlockContentIndex::MapBlockContentIndex(const std::shared_ptr<const Filter> &filter,
+		const MapNode *nodes, u32 nodecount) :
+	m_filter(filter),
+	m_nodecount(nodecount)
+{
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = nodes[i].getContent();
+		if (isIndexed(c))
+			m_nodes[c].push_back(i);
+	}
+}
+
+void MapBlockContentIndex::update(u16 i, content_t old_c, content_t new_c)
+{
+	if (old_c == new_c)
+		return;
+
+	if (isIndexed(old_c)) {
+		auto it = m_nodes.find(old_c);
+		if (it != m_nodes.end()) {
+			// Most blocks are never changed while indexed, so the slots
+			// are only set up for the first removal
+			if (m_slots.empty()) {
+				m_slots.resize(m_nodecount);
+				for (const auto &nodes : m_nodes) {
+					for (size_t slot = 0; slot < nodes.second.size(); slot++)
+						m_slots[nodes.second[slot]] = slot;
+				}
+			}
+
+			// Move the last node of the list into the freed slot
+			std::vector<u16> &list = it->second;
+			u16 slot = m_slots[i];
+			if (slot < list.size() && list[slot] == i) {
+				list[slot] = list.back();
+				m_slots[list[slot]] = slot;
+				list.pop_back();
+			}
+			if (list.empty())
+				m_nodes.erase(it);
+		}
+	}
+
+	if (isIndexed(new_c)) {
+		std::vector<u16> &list = m_nodes[new_c];
+		if (!m_slots.empty())
+			m_slots[i] = list.size();
+		list.push_back(i);
+	}
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -373,16 +444,36 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
-void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int compression_level)
+void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk,
+		int compression_level, const ZstdDictionary *dict)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialization version error");
 
-	std::ostringstream os_raw(std::ios_base::binary);
-	std::ostream &os = version >= 29 ? os_raw : os_compressed;
+	if (version >= 29) {
+		std::ostringstream os_raw(std::ios_base::binary);
+		serializeContents(os_raw, version, disk, compression_level);
+		// now compress the whole thing
+		compress(os_raw.str(), os_compressed, version, compression_level, dict);
+	} else {
+		serializeContents(os_compressed, version, disk, compression_level);
+	}
+}
+
+void MapBlock::serializeUncompressed(std::ostream &os, u8 version, bool disk)
+{
+	if(!ser_ver_supported(version))
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	FATAL_ERROR_IF(version < 29, "Serialization version error");
+
+	serializeContents(os, version, disk, 0);
+}
 
+void MapBlock::serializeContents(std::ostream &os, u8 version, bool disk, int compression_level)
+{
 	// First byte
 	u8 flags = 0;
 	if(is_underground)
@@ -441,10 +532,10 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 	if (version >= 29) {
 		m_node_metadata.serialize(os, version, disk);
 	} else {
-		// use os_raw from above to avoid allocating another stream object
-		m_node_metadata.serialize(os_raw, version, disk);
+		std::ostringstream os_meta(std::ios_base::binary);
+		m_node_metadata.serialize(os_meta, version, disk);
 		// prior to 29 node data was compressed individually
-		compress(os_raw.str(), os, version, compression_level);
+		compress(os_meta.str(), os, version, compression_level);
 	}
 
 	/*
@@ -472,11 +563,12 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 			m_node_timers.serialize(os, version);
 		}
 	}
+}
 
-	if (version >= 29) {
-		// now compress the whole thing
-		compress(os_raw.str(), os_compressed, version, compression_level);
-	}
+u64 MapBlock::nextModificationCounter()
+{
+	static std::atomic<u64> counter(0);
+	return ++counter;
 }
 
 void MapBlock::serializeNetworkSpecific(std::ostream &os)
@@ -484,14 +576,19 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
-void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
+void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk,
+		NameIdMapping *nimap_out, const ZstdDictionary *dict)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
+	if (nimap_out && version <= 21)
+		throw SerializationError("MapBlock::deSerialize(): cannot defer id"
+				" correction of this format");
 
 	TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()<<std::endl);
 
 	m_day_night_differs_expired = false;
+	m_content_index.reset();
 
 	if(version <= 21)
 	{
@@ -502,7 +599,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	// Decompress the whole block (version >= 29)
 	std::stringstream in_raw(std::ios_base::binary | std::ios_base::in | std::ios_base::out);
 	if (version >= 29)
-		decompress(in_compressed, in_raw, version);
+		decompress(in_compressed, in_raw, version, dict);
 	std::istream &is = version >= 29 ? in_raw : in_compressed;
 
 	u8 flags = readU8(is);
@@ -610,7 +707,10 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		}
 
 		// Dynamically re-set ids based on node names
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		if (nimap_out)
+			*nimap_out = std::move(nimap);
+		else
+			correctBlockNodeIds(&nimap, data, m_gamedef);
 
 		if(version >= 25){
 			TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()
@@ -623,6 +723,11 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 			<<": Done."<<std::endl);
 }
 
+void MapBlock::correctNodeIds(const NameIdMapping &nimap)
+{
+	correctBlockNodeIds(&nimap, data, m_gamedef);
+}
+
 void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 {
 	try {
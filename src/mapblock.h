@@ -19,7 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <memory>
 #include <set>
+#include <unordered_map>
+#include <vector>
 #include "irr_v3d.h"
 #include "mapnode.h"
 #include "exceptions.h"
@@ -35,7 +38,9 @@ class Map;
 class NodeMetadataList;
 class IGameDef;
 class MapBlockMesh;
+class NameIdMapping;
 class VoxelManipulator;
+class ZstdDictionary;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
@@ -65,6 +70,48 @@ class VoxelManipulator;
 #define MOD_REASON_VMANIP                    (1 << 19)
 #define MOD_REASON_UNKNOWN                   (1 << 20)
 
+////
+//// Content index
+////
+
+/*
+	Positions of the nodes of selected content ids within one MapBlock,
+	so that nodes with a given content can be found without a full scan.
+	Used by ABMs, which index their trigger contents.
+*/
+class MapBlockContentIndex
+{
+public:
+	// filter[c] tells whether content c is indexed
+	typedef std::vector<bool> Filter;
+	// Node indices as in MapBlock data: z * zstride + y * ystride + x
+	typedef std::unordered_map<content_t, std::vector<u16>> NodeLists;
+
+	MapBlockContentIndex(const std::shared_ptr<const Filter> &filter,
+			const MapNode *nodes, u32 nodecount);
+
+	const std::shared_ptr<const Filter> &getFilter() const { return m_filter; }
+
+	// Only indexed contents with at least one node are present
+	const NodeLists &getNodeLists() const { return m_nodes; }
+
+	// Must be called for every content change of a node
+	void update(u16 i, content_t old_c, content_t new_c);
+
+private:
+	bool isIndexed(content_t c) const
+	{
+		return c < m_filter->size() && (*m_filter)[c];
+	}
+
+	std::shared_ptr<const Filter> m_filter;
+	NodeLists m_nodes;
+	u32 m_nodecount;
+	// Position of each indexed node in its list, to remove it in O(1).
+	// Empty until a node is removed.
+	std::vector<u16> m_slots;
+};
+
 ////
 //// MapBlock itself
 ////
@@ -102,6 +149,7 @@ class MapBlock
 	{
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
+		m_content_index.reset();
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
@@ -115,6 +163,7 @@ class MapBlock
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		m_modification_counter = nextModificationCounter();
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -123,8 +172,6 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents_cached = false;
 	}
 
 	inline u32 getModified()
@@ -139,6 +186,13 @@ class MapBlock
 
 	std::string getModifiedReasonString();
 
+	// Changes whenever the block is modified. Unique across all blocks,
+	// so (position, counter) also tells apart reloaded or replaced blocks.
+	inline u64 getModificationCounter() const
+	{
+		return m_modification_counter;
+	}
+
 	inline void resetModified()
 	{
 		m_modified = MOD_STATE_CLEAN;
@@ -276,7 +330,9 @@ class MapBlock
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		u32 i = z * zstride + y * ystride + x;
+		updateContentIndex(i, n.getContent());
+		data[i] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -301,7 +357,9 @@ class MapBlock
 
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode n)
 	{
-		data[z * zstride + y * ystride + x] = n;
+		u32 i = z * zstride + y * ystride + x;
+		updateContentIndex(i, n.getContent());
+		data[i] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -438,14 +496,45 @@ class MapBlock
 	// These don't write or read version by itself
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
-	void serialize(std::ostream &result, u8 version, bool disk, int compression_level);
+	// dict is the compression dictionary for version >= 29, if any.
+	void serialize(std::ostream &result, u8 version, bool disk, int compression_level,
+			const ZstdDictionary *dict = nullptr);
+	// Same as serialize() without the final compression step, which can then
+	// be done with compress() without access to the block.
+	// Precondition: version >= 29
+	void serializeUncompressed(std::ostream &os, u8 version, bool disk);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
-	void deSerialize(std::istream &is, u8 version, bool disk);
-
-	void serializeNetworkSpecific(std::ostream &os);
+	// If nimap_out is set, the node ids are left as stored and the mapping is
+	// returned instead, to be applied with correctNodeIds(). Since the node
+	// definitions are not touched then, this can run on any thread.
+	// Precondition: version >= 22 if nimap_out is set
+	// dict must be the dictionary the block was compressed with, if any.
+	void deSerialize(std::istream &is, u8 version, bool disk,
+			NameIdMapping *nimap_out = nullptr,
+			const ZstdDictionary *dict = nullptr);
+	// Converts node ids read by deSerialize() to the ids of this game
+	void correctNodeIds(const NameIdMapping &nimap);
+
+	static void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
 
+	////
+	//// Content index (see MapBlockContentIndex)
+	////
+
+	// Returns the index for filter, building it first if there is none yet
+	// or it was built with another filter. *built is set accordingly.
+	const MapBlockContentIndex &getContentIndex(
+			const std::shared_ptr<const MapBlockContentIndex::Filter> &filter,
+			bool *built = nullptr);
+
+	// Frees the index, it is rebuilt when needed again
+	inline void clearContentIndex()
+	{
+		m_content_index.reset();
+	}
+
 	bool storeActiveObject(u16 id);
 	// clearObject and return removed objects count
 	u32 clearObjects();
@@ -457,6 +546,17 @@ class MapBlock
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
+	// Writes everything serialize() writes, uncompressed for version >= 29
+	void serializeContents(std::ostream &os, u8 version, bool disk, int compression_level);
+
+	static u64 nextModificationCounter();
+
+	inline void updateContentIndex(u32 i, content_t new_c)
+	{
+		if (m_content_index)
+			m_content_index->update(i, data[i].getContent(), new_c);
+	}
+
 public:
 	/*
 		Public member variables
@@ -474,13 +574,6 @@ class MapBlock
 
 	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
-	//// ABM optimizations ////
-	// Cache of content types
-	std::unordered_set<content_t> contents;
-	// True if content types are cached
-	bool contents_cached = false;
-	// True if we never want to cache content types for this block
-	bool do_not_cache_contents = false;
 	// marks the sides which are opaque: 00+Z-Z+Y-Y+X-X
 	u8 solid_sides {0};
 
@@ -511,6 +604,11 @@ class MapBlock
 	*/
 	u32 m_modified = MOD_STATE_WRITE_NEEDED;
 	u32 m_modified_reason = MOD_REASON_INITIAL;
+	// See getModificationCounter()
+	u64 m_modification_counter = nextModificationCounter();
+
+	// Built on demand, see getContentIndex()
+	std::unique_ptr<MapBlockContentIndex> m_content_index;
 
 	/*
 		When propagating sunlight and the above block doesn't exist,
@@ -124,6 +124,8 @@ const ToClientCommandHandler toClientCommandTable[TOCLIENT_NUM_MSG_TYPES] =
 	{ "TOCLIENT_FORMSPEC_PREPEND",         TOCLIENT_STATE_CONNECTED, &Client::handleCommand_FormspecPrepend }, // 0x61,
 	{ "TOCLIENT_MINIMAP_MODES",            TOCLIENT_STATE_CONNECTED, &Client::handleCommand_MinimapModes }, // 0x62,
 	{ "TOCLIENT_SET_LIGHTING",        TOCLIENT_STATE_CONNECTED, &Client::handleCommand_SetLighting }, // 0x63,
+	{ "TOCLIENT_BLOCK_DICTIONARY",         TOCLIENT_STATE_CONNECTED, &Client::handleCommand_BlockDictionary }, // 0x64,
+	{ "TOCLIENT_NODES_CHANGED",            TOCLIENT_STATE_CONNECTED, &Client::handleCommand_NodesChanged }, // 0x65,
 };
 
 const static ServerCommandFactory null_command_factory = { "TOSERVER_NULL", 0, false };
@@ -267,6 +267,35 @@ void Client::handleCommand_AddNode(NetworkPacket* pkt)
 	addNode(p, n, remove_metadata);
 }
 
+void Client::handleCommand_NodesChanged(NetworkPacket *pkt)
+{
+	v3s16 blockpos;
+	u16 count;
+	*pkt >> blockpos >> count;
+
+	const v3s16 base = blockpos * MAP_BLOCKSIZE;
+	std::map<v3s16, MapBlock*> modified_blocks;
+	for (u16 i = 0; i < count; i++) {
+		u16 index;
+		MapNode n;
+		u8 keep_metadata;
+		*pkt >> index >> n.param0 >> n.param1 >> n.param2 >> keep_metadata;
+
+		v3s16 p = base + v3s16(index % MAP_BLOCKSIZE,
+				index / MAP_BLOCKSIZE % MAP_BLOCKSIZE,
+				index / (MAP_BLOCKSIZE * MAP_BLOCKSIZE) % MAP_BLOCKSIZE);
+		try {
+			m_env.getMap().addNodeAndUpdate(p, n, modified_blocks, !keep_metadata);
+		} catch (InvalidPositionException &e) {
+		}
+	}
+
+	// Each block is only updated once for all of the changes
+	for (const auto &modified_block : modified_blocks) {
+		addUpdateMeshTaskWithEdge(modified_block.first, false, true);
+	}
+}
+
 void Client::handleCommand_NodemetaChanged(NetworkPacket *pkt)
 {
 	if (pkt->getSize() < 1)
@@ -318,7 +347,8 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)
 		/*
 			Update an existing block
 		*/
-		block->deSerialize(istr, m_server_ser_ver, false);
+		block->deSerialize(istr, m_server_ser_ver, false, nullptr,
+				m_block_dictionary.get());
 		block->deSerializeNetworkSpecific(istr);
 	}
 	else {
@@ -326,7 +356,8 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)
 			Create a new block
 		*/
 		block = sector->createBlankBlock(p.Y);
-		block->deSerialize(istr, m_server_ser_ver, false);
+		block->deSerialize(istr, m_server_ser_ver, false, nullptr,
+				m_block_dictionary.get());
 		block->deSerializeNetworkSpecific(istr);
 	}
 
@@ -340,6 +371,23 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)
 	addUpdateMeshTaskWithEdge(p, true);
 }
 
+void Client::handleCommand_BlockDictionary(NetworkPacket *pkt)
+{
+	std::string data = pkt->readLongString();
+
+	try {
+		m_block_dictionary = std::make_unique<ZstdDictionary>(data);
+	} catch (SerializationError &e) {
+		// Blocks compressed with it will fail to load
+		errorstream << "Client: Invalid block dictionary: " << e.what()
+				<< std::endl;
+		return;
+	}
+
+	infostream << "Client: Got block dictionary " << m_block_dictionary->getId()
+			<< " of " << data.size() << " bytes" << std::endl;
+}
+
 void Client::handleCommand_Inventory(NetworkPacket* pkt)
 {
 	if (pkt->getSize() < 1)
@@ -0,0 +1,121 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "congestioncontrol.h"
+#include <algorithm>
+#include <cmath>
+
+namespace con
+{
+
+std::unique_ptr<CongestionControl> CongestionControl::create(const std::string &name,
+		u32 initial_window, u32 min_window, u32 max_window)
+{
+	if (name == "cubic") {
+		return std::make_unique<CubicCongestionControl>(initial_window,
+			min_window, max_window);
+	}
+	return nullptr;
+}
+
+/*
+	CubicCongestionControl
+*/
+
+CubicCongestionControl::CubicCongestionControl(u32 initial_window,
+		u32 min_window, u32 max_window) :
+	m_min_window(min_window),
+	m_max_window(max_window),
+	m_cwnd(initial_window),
+	m_ssthresh(max_window)
+{
+}
+
+void CubicCongestionControl::onAck(u64 now_ms, float rtt)
+{
+	if (rtt > 0.0f) {
+		m_srtt = m_srtt < 0.0f ? rtt : m_srtt * 0.875f + rtt * 0.125f;
+		m_min_rtt = m_min_rtt < 0.0f ? rtt : std::min(m_min_rtt, rtt);
+	}
+
+	if (m_cwnd < m_ssthresh) {
+		// Slow start
+		m_cwnd = std::min(m_cwnd + 1.0f, m_max_window);
+		return;
+	}
+
+	if (m_epoch_start_ms == 0) {
+		m_epoch_start_ms = now_ms;
+		if (m_cwnd < m_w_max) {
+			m_k = std::cbrt((m_w_max - m_cwnd) / C);
+		} else {
+			m_k = 0.0f;
+			m_w_max = m_cwnd;
+		}
+		m_w_est = m_cwnd;
+	}
+
+	float t = (now_ms - m_epoch_start_ms) / 1000.0f + std::max(m_min_rtt, 0.0f);
+	float target = C * (t - m_k) * (t - m_k) * (t - m_k) + m_w_max;
+
+	m_w_est += 3.0f * (1.0f - BETA) / (1.0f + BETA) / m_cwnd;
+	target = std::max(target, m_w_est);
+
+	// Grow by at most half the window per round trip
+	if (target > m_cwnd)
+		m_cwnd += std::min(target - m_cwnd, m_cwnd * 0.5f) / m_cwnd;
+
+	m_cwnd = std::min(m_cwnd, m_max_window);
+}
+
+void CubicCongestionControl::onLoss(u64 now_ms, u32 count)
+{
+	if (count == 0)
+		return;
+
+	// Packets sent before the last reduction time out one by one,
+	// don't react to them again
+	float rtt = m_srtt > 0.0f ? m_srtt : 0.1f;
+	if (m_last_reduction_ms != 0 && now_ms < m_last_reduction_ms + rtt * 1000.0f)
+		return;
+	m_last_reduction_ms = now_ms;
+
+	// Fast convergence: give way to newer flows when still shrinking
+	if (m_cwnd < m_w_max)
+		m_w_max = m_cwnd * (1.0f + BETA) / 2.0f;
+	else
+		m_w_max = m_cwnd;
+
+	m_cwnd = std::max(m_cwnd * BETA, m_min_window);
+	m_ssthresh = m_cwnd;
+	m_epoch_start_ms = 0;
+}
+
+float CubicCongestionControl::getPacingRate() const
+{
+	if (m_srtt <= 0.0f)
+		return 0.0f;
+
+	// Send faster than the window alone allows, so it can still grow
+	float gain = m_cwnd < m_ssthresh ? 2.0f : 1.25f;
+	return gain * m_cwnd / m_srtt;
+}
+
+}
@@ -0,0 +1,95 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include <memory>
+#include <string>
+
+namespace con
+{
+
+/*
+	Decides how many reliable packets a channel may have unacknowledged and
+	how fast new ones may be sent. Not thread-safe, Channel locks around it.
+*/
+class CongestionControl
+{
+public:
+	virtual ~CongestionControl() = default;
+
+	// A packet was acknowledged, rtt in seconds is < 0 if not known
+	virtual void onAck(u64 now_ms, float rtt) = 0;
+	// count packets timed out and are being resent
+	virtual void onLoss(u64 now_ms, u32 count) = 0;
+
+	// Packets allowed to be unacknowledged at once
+	virtual u32 getWindow() const = 0;
+	// Packets per second to send new packets at, 0 for no limit
+	virtual float getPacingRate() const = 0;
+
+	// Creates the controller for a congestion_control setting value,
+	// nullptr for "legacy" (and unknown values)
+	static std::unique_ptr<CongestionControl> create(const std::string &name,
+			u32 initial_window, u32 min_window, u32 max_window);
+};
+
+/*
+	CUBIC (RFC 8312) with the window counted in packets. Loss is only seen
+	through resend timeouts, so the window is reduced at most once per
+	round trip.
+*/
+class CubicCongestionControl : public CongestionControl
+{
+public:
+	CubicCongestionControl(u32 initial_window, u32 min_window, u32 max_window);
+
+	void onAck(u64 now_ms, float rtt) override;
+	void onLoss(u64 now_ms, u32 count) override;
+
+	u32 getWindow() const override { return m_cwnd; }
+	float getPacingRate() const override;
+
+	float getSmoothedRTT() const { return m_srtt; }
+
+private:
+	static constexpr float C = 0.4f;
+	static constexpr float BETA = 0.7f;
+
+	const float m_min_window;
+	const float m_max_window;
+
+	float m_cwnd;
+	float m_ssthresh;
+	float m_w_max = 0.0f;
+	// Window a Reno-style sender would have, the CUBIC window never
+	// grows slower than that
+	float m_w_est = 0.0f;
+	float m_k = 0.0f;
+	// Start of the current growth period, 0 if none
+	u64 m_epoch_start_ms = 0;
+	u64 m_last_reduction_ms = 0;
+
+	float m_srtt = -1.0f;
+	float m_min_rtt = -1.0f;
+};
+
+}
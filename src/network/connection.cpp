@@ -76,72 +76,68 @@ BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
 	return p;
 }
 
-SharedBuffer<u8> makeOriginalPacket(const SharedBuffer<u8> &data)
-{
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
-
-	writeU8(&(b[0]), PACKET_TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
-	return b;
-}
-
-// Split data in chunks and add TYPE_SPLIT headers to them
-void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum,
-		std::list<SharedBuffer<u8>> *chunks)
+BufferedPacketPtr makePacket(Address &address, const u8 *headers, u32 headers_size,
+		std::shared_ptr<const u8> payload, u32 payload_size,
+		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	// Chunk packets, containing the TYPE_SPLIT header
-	u32 chunk_header_size = 7;
-	u32 maximum_data_size = chunksize_max - chunk_header_size;
-	u32 start = 0;
-	u32 end = 0;
-	u32 chunk_num = 0;
-	u16 chunk_count = 0;
-	do {
-		end = start + maximum_data_size - 1;
-		if (end > data.getSize() - 1)
-			end = data.getSize() - 1;
+	auto p = std::make_shared<BufferedPacket>(BASE_HEADER_SIZE + headers_size,
+		std::move(payload), payload_size);
+	p->address = address;
 
-		u32 payload_size = end - start + 1;
-		u32 packet_size = chunk_header_size + payload_size;
+	writeU32(&p->data[0], protocol_id);
+	writeU16(&p->data[4], sender_peer_id);
+	writeU8(&p->data[6], channel);
 
-		SharedBuffer<u8> chunk(packet_size);
+	memcpy(&p->data[BASE_HEADER_SIZE], headers, headers_size);
 
-		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
-		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+	return p;
+}
 
-		chunks->push_back(chunk);
-		chunk_count++;
+void makeAutoSplitSlices(u32 data_size, u32 chunksize_max,
+		u16 &split_seqnum, std::vector<PacketSlice> *slices)
+{
+	PacketSlice slice;
 
-		start = end + 1;
-		chunk_num++;
+	if (data_size + ORIGINAL_HEADER_SIZE <= chunksize_max) {
+		writeU8(&slice.header[0], PACKET_TYPE_ORIGINAL);
+		slice.header_size = ORIGINAL_HEADER_SIZE;
+		slice.offset = 0;
+		slice.size = data_size;
+		slices->push_back(slice);
+		return;
 	}
-	while (end != data.getSize() - 1);
 
-	for (SharedBuffer<u8> &chunk : *chunks) {
-		// Write chunk_count
-		writeU16(&(chunk[3]), chunk_count);
+	// Split data in chunks with TYPE_SPLIT headers
+	u32 maximum_data_size = chunksize_max - SPLIT_HEADER_SIZE;
+	u16 chunk_count = (data_size + maximum_data_size - 1) / maximum_data_size;
+	u16 chunk_num = 0;
+	for (u32 start = 0; start < data_size; start += maximum_data_size) {
+		writeU8(&slice.header[0], PACKET_TYPE_SPLIT);
+		writeU16(&slice.header[1], split_seqnum);
+		writeU16(&slice.header[3], chunk_count);
+		writeU16(&slice.header[5], chunk_num);
+		slice.header_size = SPLIT_HEADER_SIZE;
+		slice.offset = start;
+		slice.size = std::min(maximum_data_size, data_size - start);
+		slices->push_back(slice);
+		chunk_num++;
 	}
+	split_seqnum++;
 }
 
 void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list)
 {
-	u32 original_header_size = 1;
+	std::vector<PacketSlice> slices;
+	makeAutoSplitSlices(data.getSize(), chunksize_max, split_seqnum, &slices);
 
-	if (data.getSize() + original_header_size > chunksize_max) {
-		makeSplitPacket(data, chunksize_max, split_seqnum, list);
-		split_seqnum++;
-		return;
+	for (const PacketSlice &slice : slices) {
+		SharedBuffer<u8> b(slice.header_size + slice.size);
+		memcpy(&b[0], slice.header, slice.header_size);
+		if (slice.size > 0)
+			memcpy(&b[slice.header_size], &data[slice.offset], slice.size);
+		list->push_back(b);
 	}
-
-	list->push_back(makeOriginalPacket(data));
 }
 
 SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
@@ -167,7 +163,10 @@ void ReliablePacketBuffer::print()
 	MutexAutoLock listlock(m_list_mutex);
 	LOG(dout_con<<"Dump of ReliablePacketBuffer:" << std::endl);
 	unsigned int index = 0;
-	for (BufferedPacketPtr &packet : m_list) {
+	for (u32 i = 0; i < m_span; i++) {
+		const BufferedPacketPtr &packet = slotNoLock(m_first_seqnum + i);
+		if (!packet)
+			continue;
 		LOG(dout_con<<index<< ":" << packet->getSeqnum() << std::endl);
 		index++;
 	}
@@ -176,68 +175,81 @@ void ReliablePacketBuffer::print()
 bool ReliablePacketBuffer::empty()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.empty();
+	return m_count == 0;
 }
 
 u32 ReliablePacketBuffer::size()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.size();
+	return m_count;
 }
 
-RPBSearchResult ReliablePacketBuffer::findPacketNoLock(u16 seqnum)
+void ReliablePacketBuffer::reserveNoLock(u32 span)
 {
-	for (auto it = m_list.begin(); it != m_list.end(); ++it) {
-		if ((*it)->getSeqnum() == seqnum)
-			return it;
+	if (span <= m_slots.size())
+		return;
+
+	u32 capacity = m_slots.empty() ? 64 : m_slots.size();
+	while (capacity < span)
+		capacity *= 2;
+
+	std::vector<BufferedPacketPtr> slots(capacity);
+	for (u32 i = 0; i < m_span; i++) {
+		u16 seqnum = m_first_seqnum + i;
+		slots[seqnum & (capacity - 1)] = std::move(slotNoLock(seqnum));
 	}
-	return m_list.end();
+	m_slots = std::move(slots);
+}
+
+void ReliablePacketBuffer::trimNoLock()
+{
+	if (m_count == 0) {
+		m_first_seqnum = 0;
+		m_span = 0;
+		return;
+	}
+	while (!slotNoLock(m_first_seqnum)) {
+		m_first_seqnum++;
+		m_span--;
+	}
+	while (!slotNoLock(m_first_seqnum + m_span - 1))
+		m_span--;
 }
 
 bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_count == 0)
 		return false;
-	result = m_list.front()->getSeqnum();
+	result = m_first_seqnum;
 	return true;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popFirst()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_count == 0)
 		throw NotFoundException("Buffer is empty");
 
-	BufferedPacketPtr p(m_list.front());
-	m_list.pop_front();
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
+	BufferedPacketPtr p = std::move(slotNoLock(m_first_seqnum));
+	m_count--;
+	trimNoLock();
 	return p;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	RPBSearchResult r = findPacketNoLock(seqnum);
-	if (r == m_list.end()) {
+	u16 offset = seqnum - m_first_seqnum;
+	if (offset >= m_span || !slotNoLock(seqnum)) {
 		LOG(dout_con<<"Sequence number: " << seqnum
 				<< " not found in reliable buffer"<<std::endl);
 		throw NotFoundException("seqnum not found in buffer");
 	}
 
-	BufferedPacketPtr p(*r);
-	m_list.erase(r);
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
+	BufferedPacketPtr p = std::move(slotNoLock(seqnum));
+	m_count--;
+	trimNoLock();
 	return p;
 }
 
@@ -270,79 +282,66 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 		return;
 	}
 
-	sanity_check(m_list.size() <= SEQNUM_MAX); // FIXME: Handle the error?
-
-	// Find the right place for the packet and insert it there
-	// If list is empty, just add it
-	if (m_list.empty()) {
-		m_list.push_back(p_ptr);
-		m_oldest_non_answered_ack = seqnum;
+	// If the buffer is empty, just add it
+	if (m_count == 0) {
+		reserveNoLock(1);
+		slotNoLock(seqnum) = p_ptr;
+		m_first_seqnum = seqnum;
+		m_span = 1;
+		m_count = 1;
 		// Done.
 		return;
 	}
 
-	// Otherwise find the right place
-	auto it = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	u16 s = (*it)->getSeqnum();
-
-	/* case seqnum is smaller then next_expected seqnum */
-	/* this is true e.g. on wrap around */
-	if (seqnum < next_expected) {
-		while(((s < seqnum) || (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-	/* non wrap around case (at least for incoming and next_expected */
-	else
-	{
-		while(((s < seqnum) && (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-
-	if (s == seqnum) {
-		/* nothing to do this seems to be a resent packet */
-		/* for paranoia reason data should be compared */
-		auto &i = *it;
-		if (
-			(i->getSeqnum() != seqnum) ||
-			(i->size() != p.size()) ||
-			(i->address != p.address)
-			)
-		{
-			/* if this happens your maximum transfer window may be to big */
-			fprintf(stderr,
-					"Duplicated seqnum %d non matching packet detected:\n",
-					seqnum);
-			fprintf(stderr, "Old: seqnum: %05d size: %04zu, address: %s\n",
-					i->getSeqnum(), i->size(),
-					i->address.serializeString().c_str());
-			fprintf(stderr, "New: seqnum: %05d size: %04zu, address: %s\n",
-					p.getSeqnum(), p.size(),
-					p.address.serializeString().c_str());
-			throw IncomingDataCorruption("duplicated packet isn't same as original one");
-		}
-	}
-	/* insert or push back */
-	else if (it != m_list.end()) {
-		m_list.insert(it, p_ptr);
+	/* packets are ordered by their distance from next_expected, */
+	/* this handles the wrap around */
+	if ((u16)(seqnum - next_expected) < (u16)(m_first_seqnum - next_expected)) {
+		// New first packet
+		u32 span = m_span + (u16)(m_first_seqnum - seqnum);
+		reserveNoLock(span);
+		m_first_seqnum = seqnum;
+		m_span = span;
 	} else {
-		m_list.push_back(p_ptr);
+		u32 offset = (u16)(seqnum - m_first_seqnum);
+		if (offset < m_span && slotNoLock(seqnum)) {
+			/* nothing to do this seems to be a resent packet */
+			/* for paranoia reason data should be compared */
+			auto &i = slotNoLock(seqnum);
+			if (
+				(i->getSeqnum() != seqnum) ||
+				(i->size() != p.size()) ||
+				(i->address != p.address)
+				)
+			{
+				/* if this happens your maximum transfer window may be to big */
+				fprintf(stderr,
+						"Duplicated seqnum %d non matching packet detected:\n",
+						seqnum);
+				fprintf(stderr, "Old: seqnum: %05d size: %04zu, address: %s\n",
+						i->getSeqnum(), i->size(),
+						i->address.serializeString().c_str());
+				fprintf(stderr, "New: seqnum: %05d size: %04zu, address: %s\n",
+						p.getSeqnum(), p.size(),
+						p.address.serializeString().c_str());
+				throw IncomingDataCorruption("duplicated packet isn't same as original one");
+			}
+			return;
+		}
+		reserveNoLock(offset + 1);
+		m_span = std::max(m_span, offset + 1);
 	}
 
-	/* update last packet number */
-	m_oldest_non_answered_ack = m_list.front()->getSeqnum();
+	slotNoLock(seqnum) = p_ptr;
+	m_count++;
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list) {
+	for (u32 i = 0; i < m_span; i++) {
+		BufferedPacketPtr &packet = slotNoLock(m_first_seqnum + i);
+		if (!packet)
+			continue;
 		packet->time += dtime;
 		packet->totaltime += dtime;
 	}
@@ -353,8 +352,9 @@ std::list<ConstSharedPtr<BufferedPacket>>
 {
 	MutexAutoLock listlock(m_list_mutex);
 	std::list<ConstSharedPtr<BufferedPacket>> timed_outs;
-	for (auto &packet : m_list) {
-		if (packet->time < timeout)
+	for (u32 i = 0; i < m_span; i++) {
+		BufferedPacketPtr &packet = slotNoLock(m_first_seqnum + i);
+		if (!packet || packet->time < timeout)
 			continue;
 
 		// caller will resend packet so reset time and increase counter
@@ -373,41 +373,70 @@ std::list<ConstSharedPtr<BufferedPacket>>
 	IncomingSplitPacket
 */
 
-bool IncomingSplitPacket::insert(u32 chunk_num, SharedBuffer<u8> &chunkdata)
+bool IncomingSplitPacket::insert(u32 chunk_num, const u8 *chunkdata, u32 size)
 {
 	sanity_check(chunk_num < chunk_count);
 
 	// If chunk already exists, ignore it.
 	// Sometimes two identical packets may arrive when there is network
 	// lag and the server re-sends stuff.
-	if (chunks.find(chunk_num) != chunks.end())
+	if (received[chunk_num])
 		return false;
 
-	// Set chunk data in buffer
-	chunks[chunk_num] = chunkdata;
+	// Only the last chunk may differ in size
+	const bool last = chunk_num == chunk_count - 1;
+	const bool bad_size = last ?
+		chunk_size != 0 && size > chunk_size :
+		size == 0 || early_last_chunk.getSize() > size ||
+			(chunk_size != 0 && size != chunk_size);
+	if (bad_size) {
+		errorstream << "IncomingSplitPacket::insert(): chunk " << chunk_num
+				<< " of " << chunk_count << " has unexpected size " << size
+				<< std::endl;
+		return false;
+	}
 
+	if (last) {
+		last_chunk_size = size;
+		if (chunk_count == 1) {
+			data = SharedBuffer<u8>(chunkdata, size);
+		} else if (chunk_size == 0) {
+			// Wait for another chunk to tell where this one goes
+			early_last_chunk = SharedBuffer<u8>(chunkdata, size);
+		} else {
+			place(chunk_num, chunkdata, size);
+		}
+	} else {
+		if (chunk_size == 0) {
+			chunk_size = size;
+			data = SharedBuffer<u8>(chunk_count * chunk_size);
+			if (received[chunk_count - 1]) {
+				place(chunk_count - 1, *early_last_chunk,
+						early_last_chunk.getSize());
+				early_last_chunk = SharedBuffer<u8>();
+			}
+		}
+		place(chunk_num, chunkdata, size);
+	}
+
+	received[chunk_num] = true;
+	chunks_received++;
 	return true;
 }
 
+void IncomingSplitPacket::place(u32 chunk_num, const u8 *chunkdata, u32 size)
+{
+	if (size != 0)
+		memcpy(&data[chunk_num * chunk_size], chunkdata, size);
+}
+
 SharedBuffer<u8> IncomingSplitPacket::reassemble()
 {
 	sanity_check(allReceived());
 
-	// Calculate total size
-	u32 totalsize = 0;
-	for (const auto &chunk : chunks)
-		totalsize += chunk.second.getSize();
-
-	SharedBuffer<u8> fulldata(totalsize);
-
-	// Copy chunks to data buffer
-	u32 start = 0;
-	for (u32 chunk_i = 0; chunk_i < chunk_count; chunk_i++) {
-		const SharedBuffer<u8> &buf = chunks[chunk_i];
-		memcpy(&fulldata[start], *buf, buf.getSize());
-		start += buf.getSize();
-	}
-
+	// The last chunk may be shorter than the space left for it
+	SharedBuffer<u8> fulldata = data;
+	fulldata.shrink((chunk_count - 1) * chunk_size + last_chunk_size);
 	return fulldata;
 }
 
@@ -418,9 +447,16 @@ SharedBuffer<u8> IncomingSplitPacket::reassemble()
 IncomingSplitBuffer::~IncomingSplitBuffer()
 {
 	MutexAutoLock listlock(m_map_mutex);
-	for (auto &i : m_buf) {
-		delete i.second;
-	}
+	m_buf.clear();
+}
+
+void IncomingSplitBuffer::removeNoLock(u16 seqnum)
+{
+	auto it = m_buf.find(seqnum);
+	if (it == m_buf.end())
+		return;
+	m_reserved -= it->second->reservedSize();
+	m_buf.erase(it);
 }
 
 SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reliable)
@@ -450,13 +486,11 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 	}
 
 	// Add if doesn't exist
-	IncomingSplitPacket *sp;
-	if (m_buf.find(seqnum) == m_buf.end()) {
-		sp = new IncomingSplitPacket(chunk_count, reliable);
-		m_buf[seqnum] = sp;
-	} else {
-		sp = m_buf[seqnum];
-	}
+	std::unique_ptr<IncomingSplitPacket> &sp_ptr = m_buf[seqnum];
+	const bool added = !sp_ptr;
+	if (added)
+		sp_ptr.reset(new IncomingSplitPacket(chunk_count, reliable));
+	IncomingSplitPacket *sp = sp_ptr.get();
 
 	if (chunk_count != sp->chunk_count) {
 		errorstream << "IncomingSplitBuffer::insert(): chunk_count="
@@ -469,13 +503,21 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 				<<" != sp->reliable="<<sp->reliable
 				<<std::endl);
 
-	// Cut chunk data out of packet
+	// Chunk data is copied from the packet straight into place
 	u32 chunkdatasize = p.size() - headersize;
-	SharedBuffer<u8> chunkdata(chunkdatasize);
-	memcpy(*chunkdata, &(p.data[headersize]), chunkdatasize);
+	u32 reservation = sp->reservationFor(chunk_num, chunkdatasize);
+	if ((u64)m_reserved + reservation > SPLIT_RESERVED_MAX) {
+		errorstream << "IncomingSplitBuffer::insert(): dropping chunk of "
+				<< reservation << " byte split packet, too many pending"
+				<< std::endl;
+		if (added)
+			m_buf.erase(seqnum);
+		return SharedBuffer<u8>();
+	}
 
-	if (!sp->insert(chunk_num, chunkdata))
+	if (!sp->insert(chunk_num, &p.data[headersize], chunkdatasize))
 		return SharedBuffer<u8>();
+	m_reserved += reservation;
 
 	// If not all chunks are received, return empty buffer
 	if (!sp->allReceived())
@@ -484,8 +526,7 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 	SharedBuffer<u8> fulldata = sp->reassemble();
 
 	// Remove sp from buffer
-	m_buf.erase(seqnum);
-	delete sp;
+	removeNoLock(seqnum);
 
 	return fulldata;
 }
@@ -496,7 +537,7 @@ void IncomingSplitBuffer::removeUnreliableTimedOuts(float dtime, float timeout)
 	{
 		MutexAutoLock listlock(m_map_mutex);
 		for (const auto &i : m_buf) {
-			IncomingSplitPacket *p = i.second;
+			IncomingSplitPacket *p = i.second.get();
 			// Reliable ones are not removed by timeout
 			if (p->reliable)
 				continue;
@@ -508,8 +549,7 @@ void IncomingSplitBuffer::removeUnreliableTimedOuts(float dtime, float timeout)
 	for (u16 j : remove_queue) {
 		MutexAutoLock listlock(m_map_mutex);
 		LOG(dout_con<<"NOTE: Removing timed out unreliable split packet"<<std::endl);
-		delete m_buf[j];
-		m_buf.erase(j);
+		removeNoLock(j);
 	}
 }
 
@@ -687,6 +727,70 @@ void Channel::UpdatePacketLossCounter(unsigned int count)
 {
 	MutexAutoLock internal(m_internal_mutex);
 	current_packet_loss += count;
+
+	if (m_congestion_control && count > 0) {
+		m_congestion_control->onLoss(porting::getTimeMs(), count);
+		setWindowSize(m_congestion_control->getWindow());
+	}
+}
+
+void Channel::UpdatePacketAcked(float rtt)
+{
+	if (!m_congestion_control)
+		return;
+
+	MutexAutoLock internal(m_internal_mutex);
+	m_congestion_control->onAck(porting::getTimeMs(), rtt);
+	setWindowSize(m_congestion_control->getWindow());
+}
+
+void Channel::setCongestionControl(const std::string &name)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	m_congestion_control = CongestionControl::create(name, m_window_size,
+		MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+}
+
+void Channel::refillPacingTokens(u64 now_ms)
+{
+	float rate = m_congestion_control->getPacingRate();
+	if (m_pacing_last_ms != 0 && now_ms > m_pacing_last_ms)
+		m_pacing_tokens += rate * (now_ms - m_pacing_last_ms) / 1000.0f;
+	m_pacing_last_ms = now_ms;
+
+	// Allow short bursts, the send thread doesn't wake up every packet
+	float burst = std::max(4.0f, rate * 0.005f);
+	m_pacing_tokens = std::min(m_pacing_tokens, burst);
+}
+
+bool Channel::takePacingToken(u64 now_ms)
+{
+	if (!m_congestion_control)
+		return true;
+
+	MutexAutoLock internal(m_internal_mutex);
+	if (m_congestion_control->getPacingRate() <= 0.0f)
+		return true;
+
+	refillPacingTokens(now_ms);
+	if (m_pacing_tokens < 1.0f)
+		return false;
+	m_pacing_tokens -= 1.0f;
+	return true;
+}
+
+float Channel::getPacingWait(u64 now_ms)
+{
+	if (!m_congestion_control)
+		return 0.0f;
+
+	MutexAutoLock internal(m_internal_mutex);
+	float rate = m_congestion_control->getPacingRate();
+	if (rate <= 0.0f)
+		return 0.0f;
+
+	refillPacingTokens(now_ms);
+	return std::max(0.0f, (1.0f - m_pacing_tokens) / rate);
 }
 
 void Channel::UpdatePacketTooLateCounter()
@@ -708,9 +812,12 @@ void Channel::UpdateTimers(float dtime)
 		//unsigned int packet_too_late = 0;
 
 		bool reasonable_amount_of_data_transmitted = false;
+		bool controlled = false;
 
 		{
 			MutexAutoLock internal(m_internal_mutex);
+			// A controller adjusts the window on every ack and loss instead
+			controlled = !!m_congestion_control;
 			packet_loss = current_packet_loss;
 			//packet_too_late = current_packet_too_late;
 			packets_successful = current_packet_successful;
@@ -725,11 +832,11 @@ void Channel::UpdateTimers(float dtime)
 
 		/* dynamic window size */
 		float successful_to_lost_ratio = 0.0f;
-		bool done = false;
+		bool done = controlled;
 
 		if (packets_successful > 0) {
 			successful_to_lost_ratio = packet_loss/packets_successful;
-		} else if (packet_loss > 0) {
+		} else if (packet_loss > 0 && !done) {
 			setWindowSize(m_window_size - 10);
 			done = true;
 		}
@@ -949,8 +1056,10 @@ void Peer::Drop()
 UDPPeer::UDPPeer(u16 a_id, Address a_address, Connection* connection) :
 	Peer(a_address,a_id,connection)
 {
-	for (Channel &channel : channels)
+	for (Channel &channel : channels) {
 		channel.setWindowSize(START_RELIABLE_WINDOW_SIZE);
+		channel.setCongestionControl(connection->getCongestionControl());
+	}
 }
 
 bool UDPPeer::getAddress(MTProtocols type,Address& toset)
@@ -1042,13 +1151,18 @@ bool UDPPeer::processReliableSendCommand(
 
 	sanity_check(c.data.getSize() < MAX_RELIABLE_WINDOW_SIZE*512);
 
-	std::list<SharedBuffer<u8>> originals;
+	std::vector<PacketSlice> slices;
 	u16 split_sequence_number = chan.readNextSplitSeqNum();
 
 	if (c.raw) {
-		originals.emplace_back(c.data);
+		PacketSlice slice;
+		slice.header_size = 0;
+		slice.offset = 0;
+		slice.size = c.data.getSize();
+		slices.push_back(slice);
 	} else {
-		makeAutoSplitPacket(c.data, chunksize_max,split_sequence_number, &originals);
+		makeAutoSplitSlices(c.data.getSize(), chunksize_max,
+			split_sequence_number, &slices);
 		chan.setNextSplitSeqNum(split_sequence_number);
 	}
 
@@ -1057,7 +1171,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacketPtr> toadd;
 	volatile u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (const PacketSlice &slice : slices) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1070,10 +1184,18 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
+		u8 headers[RELIABLE_HEADER_SIZE + SPLIT_HEADER_SIZE];
+		writeU8(&headers[0], PACKET_TYPE_RELIABLE);
+		writeU16(&headers[1], seqnum);
+		memcpy(&headers[RELIABLE_HEADER_SIZE], slice.header, slice.header_size);
+
+		// The packets share the command's data, which is not copied
+		std::shared_ptr<const u8> payload(c_ptr, *c.data + slice.offset);
 
 		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(address, reliable,
+		BufferedPacketPtr p = con::makePacket(address,
+				headers, RELIABLE_HEADER_SIZE + slice.header_size,
+				std::move(payload), slice.size,
 				m_connection->GetProtocolID(), m_connection->GetPeerID(),
 				c.channelnum);
 
@@ -1246,24 +1368,65 @@ ConnectionEventPtr ConnectionEvent::bindFailed()
 	Connection
 */
 
+ConnectionShard::ConnectionShard(u16 index_, bool ipv6) :
+	index(index_),
+	socket(ipv6),
+	next_remote_peer_id(2)
+{
+}
+
+ConnectionShard::~ConnectionShard() = default;
+
+// Lowest remote peer id (2 or higher) belonging to a shard
+static session_t first_remote_peer_id(u16 shard_index, u16 num_shards)
+{
+	session_t peer_id = 2;
+	while (peer_id % num_shards != shard_index)
+		peer_id++;
+	return peer_id;
+}
+
 Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
-		bool ipv6, PeerHandler *peerhandler) :
-	m_udpSocket(ipv6),
+		bool ipv6, PeerHandler *peerhandler, u16 num_shards) :
 	m_protocol_id(protocol_id),
-	m_sendThread(new ConnectionSendThread(max_packet_size, timeout)),
-	m_receiveThread(new ConnectionReceiveThread(max_packet_size)),
+	m_congestion_control(g_settings->get("congestion_control")),
 	m_bc_peerhandler(peerhandler)
 
 {
-	/* Amount of time Receive() will wait for data, this is entirely different
-	 * from the connection timeout */
-	m_udpSocket.setTimeoutMs(500);
+	// Peer ids 0 and 1 are reserved, every shard needs some of the others
+	num_shards = rangelim(num_shards, 1, 64);
+	if (num_shards > 1 && !UDPSocket::canSharePort()) {
+		warningstream << "Connection: sockets cannot share a port on this "
+				"platform, using a single network thread" << std::endl;
+		num_shards = 1;
+	}
+
+	for (u16 i = 0; i < num_shards; i++) {
+		auto shard = std::make_unique<ConnectionShard>(i, ipv6);
+		// Every shard binds the same port, the kernel picks one per sender
+		if (num_shards > 1 && !shard->socket.setReusePort()) {
+			errorstream << "Connection: failed to share the port of shard "
+					<< i << std::endl;
+		}
 
-	m_sendThread->setParent(this);
-	m_receiveThread->setParent(this);
+		/* Amount of time Receive() will wait for data, this is entirely different
+		 * from the connection timeout */
+		shard->socket.setTimeoutMs(500);
 
-	m_sendThread->start();
-	m_receiveThread->start();
+		shard->next_remote_peer_id = first_remote_peer_id(i, num_shards);
+
+		shard->send_thread.reset(new ConnectionSendThread(max_packet_size, timeout));
+		shard->receive_thread.reset(new ConnectionReceiveThread(max_packet_size));
+		m_shards.push_back(std::move(shard));
+	}
+
+	for (auto &shard : m_shards) {
+		shard->send_thread->setParent(this, shard.get());
+		shard->receive_thread->setParent(this, shard.get());
+
+		shard->send_thread->start();
+		shard->receive_thread->start();
+	}
 }
 
 
@@ -1271,21 +1434,27 @@ Connection::~Connection()
 {
 	m_shutting_down = true;
 	// request threads to stop
-	m_sendThread->stop();
-	m_receiveThread->stop();
-
-	//TODO for some unkonwn reason send/receive threads do not exit as they're
-	// supposed to be but wait on peer timeout. To speed up shutdown we reduce
-	// timeout to half a second.
-	m_sendThread->setPeerTimeout(0.5);
+	for (auto &shard : m_shards) {
+		shard->send_thread->stop();
+		shard->receive_thread->stop();
+
+		//TODO for some unkonwn reason send/receive threads do not exit as they're
+		// supposed to be but wait on peer timeout. To speed up shutdown we reduce
+		// timeout to half a second.
+		shard->send_thread->setPeerTimeout(0.5);
+	}
 
 	// wait for threads to finish
-	m_sendThread->wait();
-	m_receiveThread->wait();
+	for (auto &shard : m_shards) {
+		shard->send_thread->wait();
+		shard->receive_thread->wait();
+	}
 
 	// Delete peers
-	for (auto &peer : m_peers) {
-		delete peer.second;
+	for (auto &shard : m_shards) {
+		for (auto &peer : shard->peers) {
+			delete peer.second;
+		}
 	}
 }
 
@@ -1297,17 +1466,18 @@ void Connection::putEvent(ConnectionEventPtr e)
 	m_event_queue.push_back(e);
 }
 
-void Connection::TriggerSend()
+void Connection::TriggerSend(session_t peer_id)
 {
-	m_sendThread->Trigger();
+	getShard(peer_id).send_thread->Trigger();
 }
 
 PeerHelper Connection::getPeerNoEx(session_t peer_id)
 {
-	MutexAutoLock peerlock(m_peers_mutex);
-	std::map<session_t, Peer *>::iterator node = m_peers.find(peer_id);
+	ConnectionShard &shard = getShard(peer_id);
+	MutexAutoLock peerlock(shard.peers_mutex);
+	std::map<session_t, Peer *>::iterator node = shard.peers.find(peer_id);
 
-	if (node == m_peers.end()) {
+	if (node == shard.peers.end()) {
 		return PeerHelper(NULL);
 	}
 
@@ -1318,12 +1488,12 @@ PeerHelper Connection::getPeerNoEx(session_t peer_id)
 }
 
 /* find peer_id for address */
-u16 Connection::lookupPeer(Address& sender)
+u16 Connection::lookupPeer(ConnectionShard &shard, Address& sender)
 {
-	MutexAutoLock peerlock(m_peers_mutex);
+	MutexAutoLock peerlock(shard.peers_mutex);
 	std::map<u16, Peer*>::iterator j;
-	j = m_peers.begin();
-	for(; j != m_peers.end(); ++j)
+	j = shard.peers.begin();
+	for(; j != shard.peers.end(); ++j)
 	{
 		Peer *peer = j->second;
 		if (peer->isPendingDeletion())
@@ -1347,13 +1517,14 @@ bool Connection::deletePeer(session_t peer_id, bool timeout)
 
 	/* lock list as short as possible */
 	{
-		MutexAutoLock peerlock(m_peers_mutex);
-		if (m_peers.find(peer_id) == m_peers.end())
+		ConnectionShard &shard = getShard(peer_id);
+		MutexAutoLock peerlock(shard.peers_mutex);
+		if (shard.peers.find(peer_id) == shard.peers.end())
 			return false;
-		peer = m_peers[peer_id];
-		m_peers.erase(peer_id);
-		auto it = std::find(m_peer_ids.begin(), m_peer_ids.end(), peer_id);
-		m_peer_ids.erase(it);
+		peer = shard.peers[peer_id];
+		shard.peers.erase(peer_id);
+		auto it = std::find(shard.peer_ids.begin(), shard.peer_ids.end(), peer_id);
+		shard.peer_ids.erase(it);
 	}
 
 	Address peer_address;
@@ -1380,12 +1551,37 @@ ConnectionEventPtr Connection::waitEvent(u32 timeout_ms)
 
 void Connection::putCommand(ConnectionCommandPtr c)
 {
-	if (!m_shutting_down) {
-		m_command_queue.push_back(c);
-		m_sendThread->Trigger();
+	if (m_shutting_down)
+		return;
+
+	switch (c->type) {
+	case CONNCMD_DISCONNECT:
+	case CONNCMD_SEND_TO_ALL:
+		for (auto &shard : m_shards)
+			putCommand(*shard, c);
+		return;
+	case CONNCMD_DISCONNECT_PEER:
+	case CONNCMD_SEND:
+	case CONCMD_ACK:
+	case CONCMD_CREATE_PEER:
+		putCommand(getShard(c->peer_id), c);
+		return;
+	case CONNCMD_CONNECT:
+		putCommand(getShard(PEER_ID_SERVER), c);
+		return;
+	default:
+		// Serving binds the sockets of all shards at once
+		putCommand(*m_shards[0], c);
+		return;
 	}
 }
 
+void Connection::putCommand(ConnectionShard &shard, ConnectionCommandPtr c)
+{
+	shard.command_queue.push_back(c);
+	shard.send_thread->Trigger();
+}
+
 void Connection::Serve(Address bind_addr)
 {
 	putCommand(ConnectionCommand::serve(bind_addr));
@@ -1398,13 +1594,14 @@ void Connection::Connect(Address address)
 
 bool Connection::Connected()
 {
-	MutexAutoLock peerlock(m_peers_mutex);
+	ConnectionShard &shard = getShard(PEER_ID_SERVER);
+	MutexAutoLock peerlock(shard.peers_mutex);
 
-	if (m_peers.size() != 1)
+	if (shard.peers.size() != 1)
 		return false;
 
-	std::map<session_t, Peer *>::iterator node = m_peers.find(PEER_ID_SERVER);
-	if (node == m_peers.end())
+	std::map<session_t, Peer *>::iterator node = shard.peers.find(PEER_ID_SERVER);
+	if (node == shard.peers.end())
 		return false;
 
 	if (m_peer_id == PEER_ID_INEXISTENT)
@@ -1503,11 +1700,11 @@ float Connection::getPeerStat(session_t peer_id, rtt_stat_type type)
 	return peer->getStat(type);
 }
 
-float Connection::getLocalStat(rate_stat_type type)
+float Connection::getPeerRateStat(session_t peer_id, rate_stat_type type)
 {
-	PeerHelper peer = getPeerNoEx(PEER_ID_SERVER);
-
-	FATAL_ERROR_IF(!peer, "Connection::getLocalStat we couldn't get our own peer? are you serious???");
+	PeerHelper peer = getPeerNoEx(peer_id);
+	if (!peer)
+		return -1;
 
 	float retval = 0.0;
 
@@ -1532,36 +1729,47 @@ float Connection::getLocalStat(rate_stat_type type)
 				retval += channel.getCurrentLossRateKB();
 				break;
 		default:
-			FATAL_ERROR("Connection::getLocalStat Invalid stat type");
+			FATAL_ERROR("Connection::getPeerRateStat Invalid stat type");
 		}
 	}
 	return retval;
 }
 
-u16 Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
+float Connection::getLocalStat(rate_stat_type type)
+{
+	float retval = getPeerRateStat(PEER_ID_SERVER, type);
+
+	FATAL_ERROR_IF(retval < 0, "Connection::getLocalStat we couldn't get our own peer? are you serious???");
+
+	return retval;
+}
+
+u16 Connection::createPeer(ConnectionShard &shard, Address& sender,
+		MTProtocols protocol, int fd)
 {
 	// Somebody wants to make a new connection
 
-	// Get a unique peer id (2 or higher)
-	session_t peer_id_new = m_next_remote_peer_id;
-	u16 overflow =  MAX_UDP_PEERS;
+	// Get a unique peer id (2 or higher) belonging to the shard
+	const u16 step = m_shards.size();
+	session_t peer_id_new = shard.next_remote_peer_id;
+	u16 overflow =  MAX_UDP_PEERS - step;
 
 	/*
 		Find an unused peer id
 	*/
-	MutexAutoLock lock(m_peers_mutex);
+	MutexAutoLock lock(shard.peers_mutex);
 	bool out_of_ids = false;
 	for(;;) {
 		// Check if exists
-		if (m_peers.find(peer_id_new) == m_peers.end())
+		if (shard.peers.find(peer_id_new) == shard.peers.end())
 
 			break;
 		// Check for overflow
-		if (peer_id_new == overflow) {
+		if (peer_id_new >= overflow) {
 			out_of_ids = true;
 			break;
 		}
-		peer_id_new++;
+		peer_id_new += step;
 	}
 
 	if (out_of_ids) {
@@ -1573,10 +1781,13 @@ u16 Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
 	Peer *peer = 0;
 	peer = new UDPPeer(peer_id_new, sender, this);
 
-	m_peers[peer->id] = peer;
-	m_peer_ids.push_back(peer->id);
+	shard.peers[peer->id] = peer;
+	shard.peer_ids.push_back(peer->id);
 
-	m_next_remote_peer_id = (peer_id_new +1 ) % MAX_UDP_PEERS;
+	if (peer_id_new >= overflow)
+		shard.next_remote_peer_id = first_remote_peer_id(shard.index, step);
+	else
+		shard.next_remote_peer_id = peer_id_new + step;
 
 	LOG(dout_con << getDesc()
 			<< "createPeer(): giving peer_id=" << peer_id_new << std::endl);
@@ -1600,7 +1811,7 @@ const std::string Connection::getDesc()
 {
 	MutexAutoLock _(m_info_mutex);
 	return std::string("con(")+
-			itos(m_udpSocket.GetHandle())+"/"+itos(m_peer_id)+")";
+			itos(m_shards[0]->socket.GetHandle())+"/"+itos(m_peer_id)+")";
 }
 
 void Connection::DisconnectPeer(session_t peer_id)
@@ -1623,7 +1834,6 @@ void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum)
 	writeU16(&ack[2], seqnum);
 
 	putCommand(ConnectionCommand::ack(peer_id, channelnum, ack));
-	m_sendThread->Trigger();
 }
 
 UDPPeer* Connection::createServerPeer(Address& address)
@@ -1636,9 +1846,10 @@ UDPPeer* Connection::createServerPeer(Address& address)
 	UDPPeer *peer = new UDPPeer(PEER_ID_SERVER, address, this);
 
 	{
-		MutexAutoLock lock(m_peers_mutex);
-		m_peers[peer->id] = peer;
-		m_peer_ids.push_back(peer->id);
+		ConnectionShard &shard = getShard(peer->id);
+		MutexAutoLock lock(shard.peers_mutex);
+		shard.peers[peer->id] = peer;
+		shard.peer_ids.push_back(peer->id);
 	}
 
 	return peer;
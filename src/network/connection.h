@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include "congestioncontrol.h"
 #include "peerhandler.h"
 #include "socket.h"
 #include "constants.h"
@@ -31,9 +32,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <iostream>
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
 
 #define MAX_UDP_PEERS 65535
 
+// Bytes a channel may allocate for split packets that are still incomplete.
+// Allocations are sized from the chunk count of the first chunk, so this
+// keeps forged counts from costing more than a few large packets would.
+#define SPLIT_RESERVED_MAX (64 * 1024 * 1024)
+
 /*
 === NOTES ===
 
@@ -104,6 +112,7 @@ data.
 	[5] u16 chunk_num
 */
 //#define TYPE_SPLIT 2
+#define SPLIT_HEADER_SIZE 7
 
 /*
 RELIABLE: Delivery of all RELIABLE packets shall be forced by ACKs,
@@ -190,13 +199,27 @@ struct BufferedPacket {
 		data = &m_data[0];
 	}
 
+	// Packet of header_size bytes of headers followed by payload, which
+	// is referenced instead of copied
+	BufferedPacket(u32 header_size, std::shared_ptr<const u8> payload,
+			u32 payload_size) :
+		m_payload(std::move(payload)),
+		m_payload_size(payload_size)
+	{
+		m_data.resize(header_size);
+		data = &m_data[0];
+	}
+
 	DISABLE_CLASS_COPY(BufferedPacket)
 
 	u16 getSeqnum() const;
 
-	inline size_t size() const { return m_data.size(); }
+	inline size_t size() const { return m_data.size() + m_payload_size; }
+	inline size_t headerSize() const { return m_data.size(); }
+	const u8 *payload() const { return m_payload.get(); }
+	u32 payloadSize() const { return m_payload_size; }
 
-	u8 *data; // Direct memory access
+	u8 *data; // Direct memory access, only the headers if there is a payload
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
 	float totaltime = 0.0f; // Seconds from buffering the packet
 	u64 absolute_send_time = -1;
@@ -205,6 +228,8 @@ struct BufferedPacket {
 
 private:
 	std::vector<u8> m_data; // Data of the packet, including headers
+	std::shared_ptr<const u8> m_payload;
+	u32 m_payload_size = 0;
 };
 
 typedef std::shared_ptr<BufferedPacket> BufferedPacketPtr;
@@ -214,18 +239,42 @@ typedef std::shared_ptr<BufferedPacket> BufferedPacketPtr;
 BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel);
 
+// Like above, but the packet refers to payload instead of copying it.
+// headers are put between the base headers and the payload.
+BufferedPacketPtr makePacket(Address &address, const u8 *headers, u32 headers_size,
+		std::shared_ptr<const u8> payload, u32 payload_size,
+		u32 protocol_id, session_t sender_peer_id, u8 channel);
+
+// A part of some data and the TYPE_ORIGINAL or TYPE_SPLIT header to send
+// in front of it
+struct PacketSlice
+{
+	u8 header[SPLIT_HEADER_SIZE];
+	u32 header_size;
+	u32 offset;
+	u32 size;
+};
+
 // Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
 // Increments split_seqnum if a split packet is made
 void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list);
+// Same as makeAutoSplitPacket, but only describes the packets
+void makeAutoSplitSlices(u32 data_size, u32 chunksize_max,
+		u16 &split_seqnum, std::vector<PacketSlice> *slices);
 
 // Add the TYPE_RELIABLE header to the data
 SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
 
+/*
+	A split packet being reassembled. Every chunk but the last one has the
+	same size, so chunks are written straight to their place in a single
+	buffer allocated for the whole packet once that size is known.
+*/
 struct IncomingSplitPacket
 {
 	IncomingSplitPacket(u32 cc, bool r):
-		chunk_count(cc), reliable(r) {}
+		chunk_count(cc), reliable(r), received(cc, false) {}
 
 	IncomingSplitPacket() = delete;
 
@@ -235,22 +284,45 @@ struct IncomingSplitPacket
 
 	bool allReceived() const
 	{
-		return (chunks.size() == chunk_count);
+		return (chunks_received == chunk_count);
+	}
+	// Bytes allocated for the reassembled packet
+	u32 reservedSize() const { return data.getSize(); }
+	// Bytes insert() would newly allocate for the chunk
+	u32 reservationFor(u32 chunk_num, u32 size) const
+	{
+		if (data.getSize() != 0 || received[chunk_num])
+			return 0;
+		if (chunk_count == 1)
+			return size;
+		return chunk_num == chunk_count - 1 ? 0 : chunk_count * size;
 	}
-	bool insert(u32 chunk_num, SharedBuffer<u8> &chunkdata);
+	// Returns false for duplicate or malformed chunks
+	bool insert(u32 chunk_num, const u8 *chunkdata, u32 size);
 	SharedBuffer<u8> reassemble();
 
 private:
-	// Key is chunk number, value is data without headers
-	std::map<u16, SharedBuffer<u8>> chunks;
+	void place(u32 chunk_num, const u8 *chunkdata, u32 size);
+
+	std::vector<bool> received;
+	u32 chunks_received = 0;
+	// Size of all chunks but the last, 0 until one of them arrives
+	u32 chunk_size = 0;
+	u32 last_chunk_size = 0;
+	// chunk_count * chunk_size bytes, chunk i starts at i * chunk_size
+	SharedBuffer<u8> data;
+	// Last chunk, when it arrives before chunk_size is known
+	SharedBuffer<u8> early_last_chunk;
 };
 
 /*
 	A buffer which stores reliable packets and sorts them internally
 	for fast access to the smallest one.
-*/
 
-typedef std::list<BufferedPacketPtr>::iterator RPBSearchResult;
+	Packets are kept in a ring indexed by sequence number, so lookups by
+	seqnum are O(1). The ring grows to a power of two that covers the
+	sequence numbers from the first to the last stored packet.
+*/
 
 class ReliablePacketBuffer
 {
@@ -272,11 +344,20 @@ class ReliablePacketBuffer
 
 
 private:
-	RPBSearchResult findPacketNoLock(u16 seqnum);
-
-	std::list<BufferedPacketPtr> m_list;
+	BufferedPacketPtr &slotNoLock(u16 seqnum)
+	{
+		return m_slots[seqnum & (m_slots.size() - 1)];
+	}
+	// Makes the ring large enough to hold span consecutive seqnums
+	void reserveNoLock(u32 span);
+	// Moves m_first_seqnum forward (or the end backward) past empty slots
+	void trimNoLock();
 
-	u16 m_oldest_non_answered_ack;
+	std::vector<BufferedPacketPtr> m_slots;
+	u16 m_first_seqnum = 0;
+	// Seqnums from m_first_seqnum on that may hold a packet
+	u32 m_span = 0;
+	u32 m_count = 0;
 
 	std::mutex m_list_mutex;
 };
@@ -298,8 +379,12 @@ class IncomingSplitBuffer
 	void removeUnreliableTimedOuts(float dtime, float timeout);
 
 private:
+	void removeNoLock(u16 seqnum);
+
 	// Key is seqnum
-	std::map<u16, IncomingSplitPacket*> m_buf;
+	std::unordered_map<u16, std::unique_ptr<IncomingSplitPacket>> m_buf;
+	// Sum of reservedSize() of m_buf
+	u32 m_reserved = 0;
 
 	std::mutex m_map_mutex;
 };
@@ -391,6 +476,8 @@ class Channel
 
 	void UpdatePacketLossCounter(unsigned int count);
 	void UpdatePacketTooLateCounter();
+	// rtt in seconds, < 0 if not known
+	void UpdatePacketAcked(float rtt);
 	void UpdateBytesSent(unsigned int bytes,unsigned int packages=1);
 	void UpdateBytesLost(unsigned int bytes);
 	void UpdateBytesReceived(unsigned int bytes);
@@ -426,10 +513,26 @@ class Channel
 		m_window_size = (u16)rangelim(size, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
 	}
 
+	// Lets the named controller (see CongestionControl::create) set the
+	// window size and pacing instead of the packet loss heuristic
+	void setCongestionControl(const std::string &name);
+
+	// Whether a new reliable packet may be sent now, uses up the
+	// allowance for one if so
+	bool takePacingToken(u64 now_ms);
+	// Seconds until takePacingToken() will succeed again
+	float getPacingWait(u64 now_ms);
+
 private:
+	void refillPacingTokens(u64 now_ms);
+
 	std::mutex m_internal_mutex;
 	u16 m_window_size = MIN_RELIABLE_WINDOW_SIZE;
 
+	std::unique_ptr<CongestionControl> m_congestion_control;
+	float m_pacing_tokens = 0.0f;
+	u64 m_pacing_last_ms = 0;
+
 	u16 next_incoming_seqnum = SEQNUM_INITIAL;
 
 	u16 next_outgoing_seqnum = SEQNUM_INITIAL;
@@ -694,14 +797,49 @@ struct ConnectionEvent
 
 class PeerHandler;
 
+/*
+	One of the thread pairs of a Connection, with the socket and the peers
+	it serves. Peer ids are handed out such that
+	peer_id % number of shards == index.
+*/
+struct ConnectionShard
+{
+	ConnectionShard(u16 index_, bool ipv6);
+	~ConnectionShard();
+
+	std::vector<session_t> getPeerIDs()
+	{
+		MutexAutoLock peerlock(peers_mutex);
+		return peer_ids;
+	}
+
+	const u16 index;
+	UDPSocket socket;
+	// Command queue: user -> SendThread
+	MutexedQueue<ConnectionCommandPtr> command_queue;
+
+	std::map<session_t, Peer *> peers;
+	std::vector<session_t> peer_ids;
+	std::mutex peers_mutex;
+	session_t next_remote_peer_id;
+
+	std::unique_ptr<ConnectionSendThread> send_thread;
+	std::unique_ptr<ConnectionReceiveThread> receive_thread;
+};
+
 class Connection
 {
 public:
 	friend class ConnectionSendThread;
 	friend class ConnectionReceiveThread;
 
+	/*
+		num_shards > 1 spreads the peers over that many socket and thread
+		pairs sharing one port (SO_REUSEPORT). Falls back to a single one
+		where the kernel does not balance datagrams between such sockets.
+	*/
 	Connection(u32 protocol_id, u32 max_packet_size, float timeout, bool ipv6,
-			PeerHandler *peerhandler);
+			PeerHandler *peerhandler, u16 num_shards = 1);
 	~Connection();
 
 	/* Interface */
@@ -720,16 +858,27 @@ class Connection
 	session_t GetPeerID() const { return m_peer_id; }
 	Address GetPeerAddress(session_t peer_id);
 	float getPeerStat(session_t peer_id, rtt_stat_type type);
+	// Summed over the channels of the peer, -1 if there is no such peer
+	float getPeerRateStat(session_t peer_id, rate_stat_type type);
 	float getLocalStat(rate_stat_type type);
 	u32 GetProtocolID() const { return m_protocol_id; };
 	const std::string getDesc();
 	void DisconnectPeer(session_t peer_id);
+	u16 getShardCount() const { return m_shards.size(); }
+	// Congestion control algorithm of the reliable channels of new peers
+	const std::string &getCongestionControl() const { return m_congestion_control; }
 
 protected:
+	ConnectionShard &getShard(session_t peer_id)
+	{
+		return *m_shards[peer_id % m_shards.size()];
+	}
+
 	PeerHelper getPeerNoEx(session_t peer_id);
-	u16   lookupPeer(Address& sender);
+	u16   lookupPeer(ConnectionShard &shard, Address& sender);
 
-	u16 createPeer(Address& sender, MTProtocols protocol, int fd);
+	u16 createPeer(ConnectionShard &shard, Address& sender,
+			MTProtocols protocol, int fd);
 	UDPPeer*  createServerPeer(Address& sender);
 	bool deletePeer(session_t peer_id, bool timeout);
 
@@ -737,39 +886,28 @@ class Connection
 
 	void sendAck(session_t peer_id, u8 channelnum, u16 seqnum);
 
-	std::vector<session_t> getPeerIDs()
-	{
-		MutexAutoLock peerlock(m_peers_mutex);
-		return m_peer_ids;
-	}
-
-	UDPSocket m_udpSocket;
-	// Command queue: user -> SendThread
-	MutexedQueue<ConnectionCommandPtr> m_command_queue;
-
 	bool Receive(NetworkPacket *pkt, u32 timeout);
 
 	void putEvent(ConnectionEventPtr e);
 
-	void TriggerSend();
+	// Wakes up the send thread serving peer_id
+	void TriggerSend(session_t peer_id);
 
 	bool ConnectedToServer()
 	{
 		return getPeerNoEx(PEER_ID_SERVER) != nullptr;
 	}
 private:
-	// Event queue: ReceiveThread -> user
+	void putCommand(ConnectionShard &shard, ConnectionCommandPtr c);
+
+	// Event queue: ReceiveThreads -> user
 	MutexedQueue<ConnectionEventPtr> m_event_queue;
 
 	session_t m_peer_id = 0;
 	u32 m_protocol_id;
+	std::string m_congestion_control;
 
-	std::map<session_t, Peer *> m_peers;
-	std::vector<session_t> m_peer_ids;
-	std::mutex m_peers_mutex;
-
-	std::unique_ptr<ConnectionSendThread> m_sendThread;
-	std::unique_ptr<ConnectionReceiveThread> m_receiveThread;
+	std::vector<std::unique_ptr<ConnectionShard>> m_shards;
 
 	mutable std::mutex m_info_mutex;
 
@@ -778,8 +916,6 @@ class Connection
 	u32 m_bc_receive_timeout = 0;
 
 	bool m_shutting_down = false;
-
-	session_t m_next_remote_peer_id = 2;
 };
 
 } // namespace
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <cmath>
 #include "connectionthreads.h"
 #include "log.h"
 #include "profiler.h"
@@ -46,6 +47,10 @@ namespace con
 
 #define WINDOW_SIZE 5
 
+// Most datagrams passed to the socket in one system call
+#define SEND_BATCH_SIZE 64
+#define RECEIVE_BATCH_SIZE 32
+
 static session_t readPeerId(const u8 *packetdata)
 {
 	return readU16(&packetdata[4]);
@@ -90,8 +95,11 @@ void *ConnectionSendThread::run()
 
 		m_iteration_packets_avaialble = m_max_data_packets_per_iteration;
 
-		/* wait for trigger or timeout */
-		m_send_sleep_semaphore.wait(50);
+		/* wait for trigger or timeout, or until paced packets may be sent */
+		int wait_ms = 50;
+		if (m_pacing_wait >= 0.0f)
+			wait_ms = rangelim((int)std::ceil(m_pacing_wait * 1000.0f), 1, 50);
+		m_send_sleep_semaphore.wait(wait_ms);
 
 		/* remove all triggers */
 		while (m_send_sleep_semaphore.wait(0)) {
@@ -110,19 +118,21 @@ void *ConnectionSendThread::run()
 		}
 
 		/* translate commands to packets */
-		auto c = m_connection->m_command_queue.pop_frontNoEx(0);
+		auto c = m_shard->command_queue.pop_frontNoEx(0);
 		while (c && c->type != CONNCMD_NONE) {
 			if (c->reliable)
 				processReliableCommand(c);
 			else
 				processNonReliableCommand(c);
 
-			c = m_connection->m_command_queue.pop_frontNoEx(0);
+			c = m_shard->command_queue.pop_frontNoEx(0);
 		}
 
 		/* send queued packets */
 		sendPackets(dtime);
 
+		flushSends();
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -137,7 +147,7 @@ void ConnectionSendThread::Trigger()
 
 bool ConnectionSendThread::packetsQueued()
 {
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = m_shard->getPeerIDs();
 
 	if (!m_outgoing_queue.empty() && !peerIds.empty())
 		return true;
@@ -165,9 +175,9 @@ bool ConnectionSendThread::packetsQueued()
 void ConnectionSendThread::runTimeouts(float dtime)
 {
 	std::vector<session_t> timeouted_peers;
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = m_shard->getPeerIDs();
 
-	const u32 numpeers = m_connection->m_peers.size();
+	const u32 numpeers = peerIds.size();
 
 	if (numpeers == 0)
 		return;
@@ -237,7 +247,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 					<< ", seqnum=" << seqnum
 					<< std::endl);
 
-				rawSend(k.get());
+				rawSend(k);
 
 				// do not handle rtt here as we can't decide if this packet was
 				// lost or really takes more time to transmit
@@ -270,18 +280,36 @@ void ConnectionSendThread::runTimeouts(float dtime)
 	}
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
 {
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
-		LOG(dout_con << m_connection->getDesc()
-			<< " rawSend: " << p->size()
-			<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
+	m_send_batch.push_back(p);
+	if (m_send_batch.size() >= SEND_BATCH_SIZE)
+		flushSends();
+}
+
+void ConnectionSendThread::flushSends()
+{
+	if (m_send_batch.empty())
+		return;
+
+	std::vector<UDPSocket::OutgoingDatagram> datagrams;
+	datagrams.reserve(m_send_batch.size());
+	for (const auto &p : m_send_batch)
+		datagrams.push_back({&p->address, p->data, (int)p->headerSize(),
+			p->payload(), (int)p->payloadSize()});
+
+	int sent = m_shard->socket.SendMany(datagrams.data(),
+		datagrams.size());
+	if (sent != (int)datagrams.size()) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "Connection::rawSend(): SendFailedException: "
-			<< p->address.serializeString() << std::endl);
+			<< "Connection::flushSends(): failed to send "
+			<< (datagrams.size() - sent) << " of "
+			<< datagrams.size() << " packets" << std::endl);
 	}
+	LOG(dout_con << m_connection->getDesc()
+		<< " flushSends: " << sent << " packets sent" << std::endl);
+
+	m_send_batch.clear();
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
@@ -300,7 +328,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
@@ -357,7 +385,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			channelnum);
 
 		// Send the packet
-		rawSend(p.get());
+		rawSend(p);
 		return true;
 	}
 
@@ -469,7 +497,16 @@ void ConnectionSendThread::serve(Address bind_address)
 	LOG(dout_con << m_connection->getDesc()
 		<< "UDP serving at port " << bind_address.serializeString() << std::endl);
 	try {
-		m_connection->m_udpSocket.Bind(bind_address);
+		// A port shared by the shards could also be shared with another
+		// process doing the same, so check that nobody holds it yet
+		if (m_connection->m_shards.size() > 1) {
+			UDPSocket probe(bind_address.isIPv6());
+			probe.Bind(bind_address);
+		}
+
+		// Bind every shard before any peer is assigned to one
+		for (auto &shard : m_connection->m_shards)
+			shard->socket.Bind(bind_address);
 		m_connection->SetPeerID(PEER_ID_SERVER);
 	}
 	catch (SocketException &e) {
@@ -496,7 +533,7 @@ void ConnectionSendThread::connect(Address address)
 	else
 		bind_addr.setAddress(0, 0, 0, 0);
 
-	m_connection->m_udpSocket.Bind(bind_addr);
+	m_shard->socket.Bind(bind_addr);
 
 	// Send a dummy packet to server with peer_id = PEER_ID_INEXISTENT
 	m_connection->SetPeerID(PEER_ID_INEXISTENT);
@@ -515,7 +552,7 @@ void ConnectionSendThread::disconnect()
 
 
 	// Send to all
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = m_shard->getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		sendAsPacket(peerid, 0, data, false);
@@ -587,7 +624,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 
 void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
 {
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = m_shard->getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		send(peerid, channelnum, data);
@@ -596,7 +633,7 @@ void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data
 
 void ConnectionSendThread::sendToAllReliable(ConnectionCommandPtr &c)
 {
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = m_shard->getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerid);
@@ -610,13 +647,16 @@ void ConnectionSendThread::sendToAllReliable(ConnectionCommandPtr &c)
 
 void ConnectionSendThread::sendPackets(float dtime)
 {
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = m_shard->getPeerIDs();
 	std::vector<session_t> pendingDisconnect;
 	std::map<session_t, bool> pending_unreliable;
 
 	const unsigned int peer_packet_quota = m_iteration_packets_avaialble
 		/ MYMAX(peerIds.size(), 1);
 
+	const u64 now = porting::getTimeMs();
+	m_pacing_wait = -1.0f;
+
 	for (session_t peerId : peerIds) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerId);
 		//peer may have been removed
@@ -688,6 +728,14 @@ void ConnectionSendThread::sendPackets(float dtime)
 					channel.outgoing_reliables_sent.size()
 					< channel.getWindowSize() &&
 					peer->m_increment_packets_remaining > 0) {
+				if (!channel.takePacingToken(now)) {
+					// Come back when the next one may be sent
+					float wait = channel.getPacingWait(now);
+					if (m_pacing_wait < 0.0f || wait < m_pacing_wait)
+						m_pacing_wait = wait;
+					break;
+				}
+
 				BufferedPacketPtr p = channel.queued_reliables.front();
 				channel.queued_reliables.pop();
 
@@ -787,7 +835,7 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	SharedBuffer<u8> packetdata(packet_maxsize * RECEIVE_BATCH_SIZE);
 
 	bool packet_queued = true;
 
@@ -816,7 +864,7 @@ void *ConnectionReceiveThread::run()
 		if (debug_print_timer > 20.0) {
 			debug_print_timer -= 20.0;
 
-			std::vector<session_t> peerids = m_connection->getPeerIDs();
+			std::vector<session_t> peerids = m_shard->getPeerIDs();
 
 			for (auto id : peerids)
 			{
@@ -872,143 +920,171 @@ void *ConnectionReceiveThread::run()
 void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 		bool &packet_queued)
 {
+	const u32 packet_maxsize = packetdata.getSize() / RECEIVE_BATCH_SIZE;
+	Address senders[RECEIVE_BATCH_SIZE];
+	int sizes[RECEIVE_BATCH_SIZE];
+	int received = 0;
+
 	try {
-		// First, see if there any buffered packets we can process now
-		if (packet_queued) {
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (true) {
-				try {
-					if (!getFromBuffers(peer_id, resultdata))
-						break;
-
-					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
+		for (int i = 0; i <= received; i++) {
+			// First, see if there any buffered packets we can process now
+			if (packet_queued) {
+				session_t peer_id;
+				SharedBuffer<u8> resultdata;
+				while (true) {
+					try {
+						if (!getFromBuffers(peer_id, resultdata))
+							break;
+
+						m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+					}
+					catch (ProcessedSilentlyException &e) {
+						/* try reading again */
+					}
 				}
+				packet_queued = false;
 			}
-			packet_queued = false;
-		}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
+			if (i == 0) {
+				// Call ReceiveMany() to wait for incoming data
+				received = m_shard->socket.ReceiveMany(senders, sizes,
+					*packetdata, packet_maxsize, RECEIVE_BATCH_SIZE);
+			}
+			if (i == received)
+				break;
 
-		if ((received_size < BASE_HEADER_SIZE) ||
-				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid incoming packet, "
-				<< "size: " << received_size
-				<< ", protocol: "
-				<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
-				<< std::endl);
-			return;
+			try {
+				handleDatagram(senders[i], &packetdata[i * packet_maxsize],
+					sizes[i], packet_queued);
+			}
+			catch (InvalidIncomingDataException &e) {
+			}
 		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+void ConnectionReceiveThread::handleDatagram(Address &sender,
+		const u8 *data, s32 received_size, bool &packet_queued)
+{
+	if ((received_size < BASE_HEADER_SIZE) ||
+			(readU32(&data[0]) != m_connection->GetProtocolID())) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid incoming packet, "
+			<< "size: " << received_size
+			<< ", protocol: "
+			<< ((received_size >= 4) ? readU32(&data[0]) : -1)
+			<< std::endl);
+		return;
+	}
 
-		if (channelnum > CHANNEL_COUNT - 1) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid channel " << (u32)channelnum << std::endl);
-			return;
-		}
+	session_t peer_id = readPeerId(data);
+	u8 channelnum = readChannel(data);
 
-		/* Try to identify peer by sender address (may happen on join) */
-		if (peer_id == PEER_ID_INEXISTENT) {
-			peer_id = m_connection->lookupPeer(sender);
-			// We do not have to remind the peer of its
-			// peer id as the CONTROLTYPE_SET_PEER_ID
-			// command was sent reliably.
-		}
+	if (channelnum > CHANNEL_COUNT - 1) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid channel " << (u32)channelnum << std::endl);
+		return;
+	}
 
-		if (peer_id == PEER_ID_INEXISTENT) {
-			/* Ignore it if we are a client */
-			if (m_connection->ConnectedToServer())
-				return;
-			/* The peer was not found in our lists. Add it. */
-			peer_id = m_connection->createPeer(sender, MTP_MINETEST_RELIABLE_UDP, 0);
-		}
+	/* Try to identify peer by sender address (may happen on join) */
+	if (peer_id == PEER_ID_INEXISTENT) {
+		peer_id = m_connection->lookupPeer(*m_shard, sender);
+		// We do not have to remind the peer of its
+		// peer id as the CONTROLTYPE_SET_PEER_ID
+		// command was sent reliably.
+	}
 
-		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
-		if (!peer) {
-			LOG(dout_con << m_connection->getDesc()
-				<< " got packet from unknown peer_id: "
-				<< peer_id << " Ignoring." << std::endl);
+	if (peer_id == PEER_ID_INEXISTENT) {
+		/* Ignore it if we are a client */
+		if (m_connection->ConnectedToServer())
 			return;
-		}
+		/* The peer was not found in our lists. Add it. */
+		peer_id = m_connection->createPeer(*m_shard, sender,
+				MTP_MINETEST_RELIABLE_UDP, 0);
+	}
 
-		// Validate peer address
+	// The thread pair of another shard is talking to this peer
+	if (&m_connection->getShard(peer_id) != m_shard) {
+		LOG(derr_con << m_connection->getDesc()
+			<< " got packet for peer_id " << peer_id
+			<< " of another shard. Ignoring." << std::endl);
+		return;
+	}
 
-		Address peer_address;
-		if (peer->getAddress(MTP_UDP, peer_address)) {
-			if (peer_address != sender) {
-				LOG(derr_con << m_connection->getDesc()
-					<< " Peer " << peer_id << " sending from different address."
-					" Ignoring." << std::endl);
-				return;
-			}
-		} else {
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " doesn't have an address?!"
-				" Ignoring." << std::endl);
-			return;
-		}
+	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
+	if (!peer) {
+		LOG(dout_con << m_connection->getDesc()
+			<< " got packet from unknown peer_id: "
+			<< peer_id << " Ignoring." << std::endl);
+		return;
+	}
 
-		peer->ResetTimeout();
+	// Validate peer address
 
-		Channel *channel = nullptr;
-		if (dynamic_cast<UDPPeer *>(&peer)) {
-			channel = &dynamic_cast<UDPPeer *>(&peer)->channels[channelnum];
-		} else {
+	Address peer_address;
+	if (peer->getAddress(MTP_UDP, peer_address)) {
+		if (peer_address != sender) {
 			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+				<< " Peer " << peer_id << " sending from different address."
 				" Ignoring." << std::endl);
 			return;
 		}
+	} else {
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " doesn't have an address?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		channel->UpdateBytesReceived(received_size);
+	peer->ResetTimeout();
 
-		// Throw the received packet to channel->processPacket()
+	Channel *channel = nullptr;
+	if (dynamic_cast<UDPPeer *>(&peer)) {
+		channel = &dynamic_cast<UDPPeer *>(&peer)->channels[channelnum];
+	} else {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		// Make a new SharedBuffer from the data without the base headers
-		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
-			strippeddata.getSize());
+	channel->UpdateBytesReceived(received_size);
 
-		try {
-			// Process it (the result is some data with no headers made by us)
-			SharedBuffer<u8> resultdata = processPacket
-				(channel, strippeddata, peer_id, channelnum, false);
+	// Throw the received packet to channel->processPacket()
 
-			LOG(dout_con << m_connection->getDesc()
-				<< " ProcessPacket from peer_id: " << peer_id
-				<< ", channel: " << (u32)channelnum << ", returned "
-				<< resultdata.getSize() << " bytes" << std::endl);
+	// Make a new SharedBuffer from the data without the base headers
+	SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
+	memcpy(*strippeddata, &data[BASE_HEADER_SIZE],
+		strippeddata.getSize());
 
-			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-		}
-		catch (ProcessedSilentlyException &e) {
-		}
-		catch (ProcessedQueued &e) {
-			// we set it to true anyway (see below)
-		}
+	try {
+		// Process it (the result is some data with no headers made by us)
+		SharedBuffer<u8> resultdata = processPacket
+			(channel, strippeddata, peer_id, channelnum, false);
+
+		LOG(dout_con << m_connection->getDesc()
+			<< " ProcessPacket from peer_id: " << peer_id
+			<< ", channel: " << (u32)channelnum << ", returned "
+			<< resultdata.getSize() << " bytes" << std::endl);
 
-		/* Every time we receive a packet it can happen that a previously
-		 * buffered packet is now ready to process. */
-		packet_queued = true;
+		m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
 	}
-	catch (InvalidIncomingDataException &e) {
+	catch (ProcessedSilentlyException &e) {
+	}
+	catch (ProcessedQueued &e) {
+		// we set it to true anyway (see below)
 	}
+
+	/* Every time we receive a packet it can happen that a previously
+	 * buffered packet is now ready to process. */
+	packet_queued = true;
 }
 
 bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8> &dst)
 {
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = m_shard->getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerid);
@@ -1126,6 +1202,7 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 			BufferedPacketPtr p = channel->outgoing_reliables_sent.popSeqnum(seqnum);
 
 			// the rtt calculation will be a bit off for re-sent packets but that's okay
+			float rtt = -1.0f;
 			{
 				// Get round trip time
 				u64 current_time = porting::getTimeMs();
@@ -1133,13 +1210,13 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 				// an overflow is quite unlikely but as it'd result in major
 				// rtt miscalculation we handle it here
 				if (current_time > p->absolute_send_time) {
-					float rtt = (current_time - p->absolute_send_time) / 1000.0;
+					rtt = (current_time - p->absolute_send_time) / 1000.0;
 
 					// Let peer calculate stuff according to it
 					// (avg_rtt and resend_timeout)
 					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
 				} else if (p->totaltime > 0) {
-					float rtt = p->totaltime;
+					rtt = p->totaltime;
 
 					// Let peer calculate stuff according to it
 					// (avg_rtt and resend_timeout)
@@ -1147,10 +1224,13 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 				}
 			}
 
+			// Resent packets give no rtt sample, the ack may be for any copy
+			channel->UpdatePacketAcked(p->resend_count == 0 ? rtt : -1.0f);
+
 			// put bytes for max bandwidth calculation
 			channel->UpdateBytesSent(p->size(), 1);
 			if (channel->outgoing_reliables_sent.size() == 0)
-				m_connection->TriggerSend();
+				m_connection->TriggerSend(peer->id);
 		} catch (NotFoundException &e) {
 			LOG(derr_con << m_connection->getDesc()
 				<< "WARNING: ACKed packet not in outgoing queue"
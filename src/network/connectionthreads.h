@@ -60,17 +60,22 @@ class ConnectionSendThread : public Thread
 
 	void Trigger();
 
-	void setParent(Connection *parent)
+	void setParent(Connection *parent, ConnectionShard *shard)
 	{
 		assert(parent != NULL); // Pre-condition
+		assert(shard != NULL); // Pre-condition
 		m_connection = parent;
+		m_shard = shard;
 	}
 
 	void setPeerTimeout(float peer_timeout) { m_timeout = peer_timeout; }
 
 private:
 	void runTimeouts(float dtime);
-	void rawSend(const BufferedPacket *p);
+	// Queues the packet for the next flushSends()
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	// Hands all queued packets to the socket at once
+	void flushSends();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
 			const SharedBuffer<u8> &data, bool reliable);
 
@@ -95,15 +100,20 @@ class ConnectionSendThread : public Thread
 	bool packetsQueued();
 
 	Connection *m_connection = nullptr;
+	// Peers, socket and command queue served by this thread
+	ConnectionShard *m_shard = nullptr;
 	unsigned int m_max_packet_size;
 	float m_timeout;
 	std::queue<OutgoingPacket> m_outgoing_queue;
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
 	Semaphore m_send_sleep_semaphore;
 
 	unsigned int m_iteration_packets_avaialble;
 	unsigned int m_max_commands_per_iteration = 1;
 	unsigned int m_max_data_packets_per_iteration;
 	unsigned int m_max_packets_requeued = 256;
+	// Seconds until a channel held back by pacing may send, < 0 if none
+	float m_pacing_wait = -1.0f;
 };
 
 class ConnectionReceiveThread : public Thread
@@ -113,14 +123,18 @@ class ConnectionReceiveThread : public Thread
 
 	void *run();
 
-	void setParent(Connection *parent)
+	void setParent(Connection *parent, ConnectionShard *shard)
 	{
 		assert(parent); // Pre-condition
+		assert(shard); // Pre-condition
 		m_connection = parent;
+		m_shard = shard;
 	}
 
 private:
 	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void handleDatagram(Address &sender, const u8 *data, s32 size,
+			bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -165,5 +179,7 @@ class ConnectionReceiveThread : public Thread
 	static const PacketTypeHandler packetTypeRouter[PACKET_TYPE_MAX];
 
 	Connection *m_connection = nullptr;
+	// Peers, socket and command queue served by this thread
+	ConnectionShard *m_shard = nullptr;
 };
 }
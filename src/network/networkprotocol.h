@@ -219,9 +219,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		"start_time" added to TOCLIENT_PLAY_SOUND
 		place_param2 type change u8 -> optional<u8>
 		[scheduled bump for 5.8.0]
+	PROTOCOL VERSION 44:
+		AO_CMD_UPDATE_POSITION_COMPACT replaces AO_CMD_UPDATE_POSITION
+		Add TOCLIENT_BLOCK_DICTIONARY
+		Add TOCLIENT_NODES_CHANGED
 */
 
-#define LATEST_PROTOCOL_VERSION 43
+#define LATEST_PROTOCOL_VERSION 44
 #define LATEST_PROTOCOL_VERSION_STRING TOSTRING(LATEST_PROTOCOL_VERSION)
 
 // Server's supported network protocol range
@@ -869,7 +873,28 @@ enum ToClientCommand
 			f32 center_weight_power
 	*/
 
-	TOCLIENT_NUM_MSG_TYPES = 0x64,
+	TOCLIENT_BLOCK_DICTIONARY = 0x64,
+	/*
+		u32 len
+		u8[len] zstd dictionary the data of TOCLIENT_BLOCKDATA may be
+		        compressed with from now on
+	*/
+
+	TOCLIENT_NODES_CHANGED = 0x65,
+	/*
+		Changes of several nodes of a block, replacing TOCLIENT_ADDNODE and
+		TOCLIENT_REMOVENODE (sent as air)
+		v3s16 blockpos
+		u16 count
+		for each change:
+			u16 index // z * 256 + y * 16 + x within the block
+			u16 param0
+			u8 param1
+			u8 param2
+			u8 keep_metadata
+	*/
+
+	TOCLIENT_NUM_MSG_TYPES = 0x66,
 };
 
 enum ToServerCommand
@@ -320,6 +320,11 @@ void Server::handleCommand_Init2(NetworkPacket* pkt)
 
 	m_clients.event(peer_id, CSE_SetDefinitionsSent);
 
+	// Send the dictionary mapblocks will be compressed with, which arrives
+	// before them since they share the channel
+	if (getBlockDictionary(protocol_version))
+		SendBlockDictionary(peer_id);
+
 	// Send media announcement
 	sendMediaAnnouncement(peer_id, lang);
 
@@ -29,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "constants.h"
 #include "debug.h"
 #include "log.h"
+#include "config.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -75,6 +76,59 @@ void sockets_cleanup()
 #endif
 }
 
+// Writes addr in the form used by the socket API, returns its length
+static socklen_t make_sockaddr(const Address &addr, struct sockaddr_storage *storage)
+{
+	memset(storage, 0, sizeof(*storage));
+	if (addr.getFamily() == AF_INET6) {
+		auto *address = reinterpret_cast<struct sockaddr_in6 *>(storage);
+		address->sin6_family = AF_INET6;
+		address->sin6_addr = addr.getAddress6();
+		address->sin6_port = htons(addr.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+
+	auto *address = reinterpret_cast<struct sockaddr_in *>(storage);
+	address->sin_family = AF_INET;
+	address->sin_addr = addr.getAddress();
+	address->sin_port = htons(addr.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address read_sockaddr(const struct sockaddr_storage &storage)
+{
+	if (storage.ss_family == AF_INET6) {
+		const auto *address = reinterpret_cast<const struct sockaddr_in6 *>(&storage);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes *>
+			(address->sin6_addr.s6_addr);
+		return Address(bytes, ntohs(address->sin6_port));
+	}
+
+	const auto *address = reinterpret_cast<const struct sockaddr_in *>(&storage);
+	return Address(ntohl(address->sin_addr.s_addr), ntohs(address->sin_port));
+}
+
+// Prints the address, size and start of a packet for socket_enable_debug_output
+static void trace_packet(int handle, const char *direction, const Address &addr,
+		const void *data, int size)
+{
+	tracestream << handle << direction;
+	addr.print(tracestream);
+	tracestream << ", size=" << size;
+
+	tracestream << ", data=";
+	for (int i = 0; i < size && i < 20; i++) {
+		if (i % 2 == 0)
+			tracestream << " ";
+		unsigned int a = ((const unsigned char *)data)[i];
+		tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+	}
+	if (size > 20)
+		tracestream << "...";
+
+	tracestream << std::endl;
+}
+
 /*
 	UDPSocket
 */
@@ -124,6 +178,27 @@ bool UDPSocket::init(bool ipv6, bool noExceptions)
 	return true;
 }
 
+bool UDPSocket::canSharePort()
+{
+	// Elsewhere SO_REUSEPORT exists but hands all datagrams to one socket
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool UDPSocket::setReusePort()
+{
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	int value = 1;
+	return setsockopt(m_handle, SOL_SOCKET, SO_REUSEPORT,
+			reinterpret_cast<char *>(&value), sizeof(value)) == 0;
+#else
+	return false;
+#endif
+}
+
 UDPSocket::~UDPSocket()
 {
 	if (socket_enable_debug_output) {
@@ -191,29 +266,8 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 	if (INTERNET_SIMULATOR)
 		dumping_packet = myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0;
 
-	if (socket_enable_debug_output) {
-		// Print packet destination and size
-		tracestream << (int)m_handle << " -> ";
-		destination.print(tracestream);
-		tracestream << ", size=" << size;
-
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < size && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
-		}
-
-		if (size > 20)
-			tracestream << "...";
-
-		if (dumping_packet)
-			tracestream << " (DUMPED BY INTERNET_SIMULATOR)";
-
-		tracestream << std::endl;
-	}
+	if (socket_enable_debug_output)
+		trace_packet(m_handle, " -> ", destination, data, size);
 
 	if (dumping_packet) {
 		// Lol let's forget it
@@ -288,27 +342,128 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 		sender = Address(address_ip, address_port);
 	}
 
-	if (socket_enable_debug_output) {
-		// Print packet sender and size
-		tracestream << (int)m_handle << " <- ";
-		sender.print(tracestream);
-		tracestream << ", size=" << received;
-
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < received && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+	if (socket_enable_debug_output)
+		trace_packet(m_handle, " <- ", sender, data, received);
+
+	return received;
+}
+
+int UDPSocket::SendMany(const OutgoingDatagram *datagrams, int count)
+{
+#if HAVE_SENDMMSG
+	// The simulator and the debug output work per packet
+	if (!INTERNET_SIMULATOR && !socket_enable_debug_output) {
+		constexpr int batch_size = 64;
+		struct mmsghdr msgs[batch_size];
+		struct iovec iovs[batch_size][2];
+		struct sockaddr_storage addrs[batch_size];
+
+		int sent_total = 0;
+		int i = 0;
+		while (i < count) {
+			// Datagrams in the batch, some may be skipped
+			int indices[batch_size];
+			int n = 0;
+			for (; i < count && n < batch_size; i++) {
+				const OutgoingDatagram &d = datagrams[i];
+				if (d.destination->getFamily() != m_addr_family)
+					continue;
+				iovs[n][0].iov_base = const_cast<void *>(d.data);
+				iovs[n][0].iov_len = d.size;
+				iovs[n][1].iov_base = const_cast<void *>(d.payload);
+				iovs[n][1].iov_len = d.payload_size;
+				memset(&msgs[n], 0, sizeof(msgs[n]));
+				msgs[n].msg_hdr.msg_name = &addrs[n];
+				msgs[n].msg_hdr.msg_namelen = make_sockaddr(*d.destination, &addrs[n]);
+				msgs[n].msg_hdr.msg_iov = iovs[n];
+				msgs[n].msg_hdr.msg_iovlen = d.payload_size > 0 ? 2 : 1;
+				indices[n] = i;
+				n++;
+			}
+
+			int done = 0;
+			while (done < n) {
+				int sent = sendmmsg(m_handle, &msgs[done], n - done, 0);
+				if (sent <= 0) {
+					// Skip the datagram that failed
+					tracestream << (int)m_handle << ": sendmmsg failed: "
+						<< SOCKET_ERR_STR(LAST_SOCKET_ERR()) << std::endl;
+					done++;
+					continue;
+				}
+				for (int j = done; j < done + sent; j++) {
+					const OutgoingDatagram &d = datagrams[indices[j]];
+					if ((int)msgs[j].msg_len == d.size + d.payload_size)
+						sent_total++;
+				}
+				done += sent;
+			}
+		}
+		return sent_total;
+	}
+#endif
+
+	int sent = 0;
+	std::string joined;
+	for (int i = 0; i < count; i++) {
+		const OutgoingDatagram &d = datagrams[i];
+		try {
+			if (d.payload_size > 0) {
+				joined.assign((const char *)d.data, d.size);
+				joined.append((const char *)d.payload, d.payload_size);
+				Send(*d.destination, joined.data(), joined.size());
+			} else {
+				Send(*d.destination, d.data, d.size);
+			}
+			sent++;
+		} catch (SendFailedException &e) {
 		}
-		if (received > 20)
-			tracestream << "...";
+	}
+	return sent;
+}
 
-		tracestream << std::endl;
+int UDPSocket::ReceiveMany(Address *senders, int *sizes, void *data, int size, int count)
+{
+#if HAVE_RECVMMSG
+	if (count > 1) {
+		// Return on timeout
+		if (!WaitData(m_timeout_ms))
+			return 0;
+
+		constexpr int batch_size = 64;
+		count = MYMIN(count, batch_size);
+		struct mmsghdr msgs[batch_size];
+		struct iovec iovs[batch_size];
+		struct sockaddr_storage addrs[batch_size];
+		for (int i = 0; i < count; i++) {
+			iovs[i].iov_base = (char *)data + i * size;
+			iovs[i].iov_len = size;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// Only take what is already there, WaitData() did the waiting
+		int received = recvmmsg(m_handle, msgs, count, MSG_DONTWAIT, nullptr);
+		if (received < 0)
+			return 0;
+
+		for (int i = 0; i < received; i++) {
+			senders[i] = read_sockaddr(addrs[i]);
+			sizes[i] = msgs[i].msg_len;
+			if (socket_enable_debug_output)
+				trace_packet(m_handle, " <- ", senders[i], iovs[i].iov_base, sizes[i]);
+		}
+		return received;
 	}
+#endif
 
-	return received;
+	if (count < 1)
+		return 0;
+	sizes[0] = Receive(senders[0], data, size);
+	return sizes[0] < 0 ? 0 : 1;
 }
 
 int UDPSocket::GetHandle()
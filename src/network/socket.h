@@ -41,9 +41,35 @@ class UDPSocket
 
 	bool init(bool ipv6, bool noExceptions = false);
 
+	// Whether several sockets may bind the same port, with the kernel
+	// spreading incoming datagrams between them by sender
+	static bool canSharePort();
+	// Lets this socket share its port, must be called before Bind()
+	bool setReusePort();
+
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+
+	struct OutgoingDatagram
+	{
+		const Address *destination;
+		const void *data;
+		int size;
+		// Sent right after data, as part of the same datagram
+		const void *payload = nullptr;
+		int payload_size = 0;
+	};
+	// Sends the datagrams with as few system calls as possible
+	// (sendmmsg() where available, which also avoids joining data and
+	// payload). Datagrams which cannot be sent are skipped, returns the
+	// number sent.
+	int SendMany(const OutgoingDatagram *datagrams, int count);
+	// Receives up to count datagrams of at most size bytes each, the i-th
+	// into data + i * size (recvmmsg() where available, else only one).
+	// Waits for the first one like Receive(). Returns the number received
+	// and sets their senders and sizes.
+	int ReceiveMany(Address *senders, int *sizes, void *data, int size, int count);
 	int GetHandle(); // For debugging purposes only
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
@@ -147,12 +147,18 @@ void ScriptApiEnv::initializeEnvironment(ServerEnvironment *env)
 		s16 max_y = INT16_MAX;
 		getintfield(L, current_abm, "max_y", max_y);
 
-		lua_getfield(L, current_abm, "action");
+		// bulk_action replaces action if present
+		lua_getfield(L, current_abm, "bulk_action");
+		bool bulk_action = !lua_isnil(L, -1);
+		lua_pop(L, 1);
+
+		lua_getfield(L, current_abm, bulk_action ? "bulk_action" : "action");
 		luaL_checktype(L, current_abm + 1, LUA_TFUNCTION);
 		lua_pop(L, 1);
 
 		LuaABM *abm = new LuaABM(L, id, trigger_contents, required_neighbors,
-			trigger_interval, trigger_chance, simple_catch_up, min_y, max_y);
+			trigger_interval, trigger_chance, simple_catch_up, min_y, max_y,
+			bulk_action);
 
 		env->addActiveBlockModifier(abm);
 
@@ -109,6 +109,56 @@ void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 	lua_pop(L, 1); // Pop error handler
 }
 
+void LuaABM::triggerBulk(ServerEnvironment *env,
+		const std::vector<v3s16> &positions, const std::vector<MapNode> &nodes)
+{
+	ServerScripting *scriptIface = env->getScriptIface();
+	scriptIface->realityCheck();
+
+	lua_State *L = scriptIface->getStack();
+	sanity_check(lua_checkstack(L, 20));
+	StackUnroller stack_unroller(L);
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	// Get registered_abms
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "registered_abms");
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_remove(L, -2); // Remove core
+
+	// Get registered_abms[m_id]
+	lua_pushinteger(L, m_id);
+	lua_gettable(L, -2);
+	FATAL_ERROR_IF(lua_isnil(L, -1), "Entry with given id not found in registered_abms table");
+	lua_remove(L, -2); // Remove registered_abms
+
+	scriptIface->setOriginFromTable(-1);
+
+	// Call bulk_action
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_getfield(L, -1, "bulk_action");
+	luaL_checktype(L, -1, LUA_TFUNCTION);
+	lua_remove(L, -2); // Remove registered_abms[m_id]
+
+	lua_createtable(L, positions.size(), 0);
+	for (size_t i = 0; i < positions.size(); i++) {
+		push_v3s16(L, positions[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_createtable(L, nodes.size(), 0);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		pushnode(L, nodes[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	int result = lua_pcall(L, 2, 0, error_handler);
+	if (result)
+		scriptIface->scriptError(result, "LuaABM::triggerBulk");
+
+	lua_pop(L, 1); // Pop error handler
+}
+
 void LuaLBM::trigger(ServerEnvironment *env, v3s16 p,
 	const MapNode n, const float dtime_s)
 {
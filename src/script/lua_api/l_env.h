@@ -248,11 +248,13 @@ class LuaABM : public ActiveBlockModifier {
 	bool m_simple_catch_up;
 	s16 m_min_y;
 	s16 m_max_y;
+	bool m_bulk_action;
 public:
 	LuaABM(lua_State *L, int id,
 			const std::vector<std::string> &trigger_contents,
 			const std::vector<std::string> &required_neighbors,
-			float trigger_interval, u32 trigger_chance, bool simple_catch_up, s16 min_y, s16 max_y):
+			float trigger_interval, u32 trigger_chance, bool simple_catch_up, s16 min_y, s16 max_y,
+			bool bulk_action):
 		m_id(id),
 		m_trigger_contents(trigger_contents),
 		m_required_neighbors(required_neighbors),
@@ -260,7 +262,8 @@ class LuaABM : public ActiveBlockModifier {
 		m_trigger_chance(trigger_chance),
 		m_simple_catch_up(simple_catch_up),
 		m_min_y(min_y),
-		m_max_y(max_y)
+		m_max_y(max_y),
+		m_bulk_action(bulk_action)
 	{
 	}
 	virtual const std::vector<std::string> &getTriggerContents() const
@@ -291,8 +294,14 @@ class LuaABM : public ActiveBlockModifier {
 	{
 		return m_max_y;
 	}
+	virtual bool getBulkAction()
+	{
+		return m_bulk_action;
+	}
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider);
+	virtual void triggerBulk(ServerEnvironment *env,
+			const std::vector<v3s16> &positions, const std::vector<MapNode> &nodes);
 };
 
 class LuaLBM : public LoadingBlockModifierDef
@@ -21,8 +21,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "util/serialize.h"
 
+#include <algorithm>
 #include <zlib.h>
 #include <zstd.h>
+// For the COVER trainer
+#define ZDICT_STATIC_LINKING_ONLY
+#include <zdict.h>
 
 /* report a zlib or i/o error */
 static void zerr(int ret)
@@ -205,14 +209,72 @@ struct ZSTD_Deleter {
 	}
 };
 
-void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
+ZstdDictionary::ZstdDictionary(const std::string &data, int compression_level) :
+	m_data(data)
+{
+	m_id = ZSTD_getDictID_fromDict(m_data.data(), m_data.size());
+	if (m_id == 0)
+		throw SerializationError("ZstdDictionary: not a zstd dictionary");
+
+	m_cdict = ZSTD_createCDict(m_data.data(), m_data.size(), compression_level);
+	m_ddict = ZSTD_createDDict(m_data.data(), m_data.size());
+	if (!m_cdict || !m_ddict) {
+		ZSTD_freeCDict(m_cdict);
+		ZSTD_freeDDict(m_ddict);
+		throw SerializationError("ZstdDictionary: invalid dictionary");
+	}
+}
+
+ZstdDictionary::~ZstdDictionary()
+{
+	ZSTD_freeCDict(m_cdict);
+	ZSTD_freeDDict(m_ddict);
+}
+
+std::string ZstdDictionary::train(const std::vector<std::string> &samples,
+		size_t max_size)
+{
+	// The trainer wants all samples in one buffer
+	std::string buffer;
+	std::vector<size_t> sizes;
+	sizes.reserve(samples.size());
+	for (const std::string &sample : samples) {
+		buffer.append(sample);
+		sizes.push_back(sample.size());
+	}
+
+	// Dictionaries made by ZDICT_trainFromBuffer() from short segments made
+	// mapblocks compress worse than without any, so COVER is used with
+	// longer ones
+	ZDICT_cover_params_t params {};
+	params.k = std::min<size_t>(1024, max_size);
+	params.d = 8;
+
+	std::string dict(max_size, '\0');
+	size_t ret = ZDICT_trainFromBuffer_cover(&dict[0], dict.size(),
+			buffer.data(), sizes.data(), sizes.size(), params);
+	if (ZDICT_isError(ret)) {
+		throw SerializationError(std::string("ZstdDictionary::train: ") +
+				ZDICT_getErrorName(ret));
+	}
+	dict.resize(ret);
+	return dict;
+}
+
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level,
+		const ZstdDictionary *dict)
 {
 	// reusing the context is recommended for performance
 	// it will be destroyed when the thread ends
 	thread_local std::unique_ptr<ZSTD_CStream, ZSTD_Deleter> stream(ZSTD_createCStream());
 
-
-	ZSTD_initCStream(stream.get(), level);
+	if (dict) {
+		ZSTD_CCtx_reset(stream.get(), ZSTD_reset_session_only);
+		ZSTD_CCtx_refCDict(stream.get(), dict->getCDict());
+	} else {
+		// This also drops a dictionary used before
+		ZSTD_initCStream(stream.get(), level);
+	}
 
 	const size_t bufsize = 16384;
 	char output_buffer[bufsize];
@@ -247,18 +309,25 @@ void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
 
 }
 
-void compressZstd(const std::string &data, std::ostream &os, int level)
+void compressZstd(const std::string &data, std::ostream &os, int level,
+		const ZstdDictionary *dict)
 {
-	compressZstd((u8*)data.c_str(), data.size(), os, level);
+	compressZstd((u8*)data.c_str(), data.size(), os, level, dict);
 }
 
-void decompressZstd(std::istream &is, std::ostream &os)
+void decompressZstd(std::istream &is, std::ostream &os, const ZstdDictionary *dict)
 {
 	// reusing the context is recommended for performance
 	// it will be destroyed when the thread ends
 	thread_local std::unique_ptr<ZSTD_DStream, ZSTD_Deleter> stream(ZSTD_createDStream());
 
-	ZSTD_initDStream(stream.get());
+	if (dict) {
+		ZSTD_DCtx_reset(stream.get(), ZSTD_reset_session_only);
+		ZSTD_DCtx_refDDict(stream.get(), dict->getDDict());
+	} else {
+		// This also drops a dictionary used before
+		ZSTD_initDStream(stream.get());
+	}
 
 	const size_t bufsize = 16384;
 	char output_buffer[bufsize];
@@ -295,12 +364,13 @@ void decompressZstd(std::istream &is, std::ostream &os)
 	}
 }
 
-void compress(u8 *data, u32 size, std::ostream &os, u8 version, int level)
+void compress(u8 *data, u32 size, std::ostream &os, u8 version, int level,
+		const ZstdDictionary *dict)
 {
 	if(version >= 29)
 	{
 		// map the zlib levels [0,9] to [1,10]. -1 becomes 0 which indicates the default (currently 3)
-		compressZstd(data, size, os, level + 1);
+		compressZstd(data, size, os, level + 1, dict);
 		return;
 	}
 
@@ -345,21 +415,24 @@ void compress(u8 *data, u32 size, std::ostream &os, u8 version, int level)
 	os.write((char*)&current_byte, 1);
 }
 
-void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version, int level)
+void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version, int level,
+		const ZstdDictionary *dict)
 {
-	compress(*data, data.getSize(), os, version, level);
+	compress(*data, data.getSize(), os, version, level, dict);
 }
 
-void compress(const std::string &data, std::ostream &os, u8 version, int level)
+void compress(const std::string &data, std::ostream &os, u8 version, int level,
+		const ZstdDictionary *dict)
 {
-	compress((u8*)data.c_str(), data.size(), os, version, level);
+	compress((u8*)data.c_str(), data.size(), os, version, level, dict);
 }
 
-void decompress(std::istream &is, std::ostream &os, u8 version)
+void decompress(std::istream &is, std::ostream &os, u8 version,
+		const ZstdDictionary *dict)
 {
 	if(version >= 29)
 	{
-		decompressZstd(is, os);
+		decompressZstd(is, os, dict);
 		return;
 	}
 
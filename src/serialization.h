@@ -23,6 +23,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "exceptions.h"
 #include <iostream>
 #include "util/pointer.h"
+#include "util/basic_macros.h"
+#include <string>
+#include <vector>
+
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+typedef struct ZSTD_DDict_s ZSTD_DDict;
 
 /*
 	Map format serialization version
@@ -90,12 +96,57 @@ void compressZlib(const u8 *data, size_t data_size, std::ostream &os, int level
 void compressZlib(const std::string &data, std::ostream &os, int level = -1);
 void decompressZlib(std::istream &is, std::ostream &os, size_t limit = 0);
 
-void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level = 0);
-void compressZstd(const std::string &data, std::ostream &os, int level = 0);
-void decompressZstd(std::istream &is, std::ostream &os);
+/*
+	A zstd dictionary. Small inputs resembling the samples it was trained on
+	compress much better with it, but can then only be decompressed with the
+	same dictionary. It can be used by several threads at once.
+*/
+class ZstdDictionary
+{
+public:
+	// Everything compressed with the dictionary uses compression_level,
+	// which has the same meaning as the level of compressZstd().
+	// Throws SerializationError if data is not a trained zstd dictionary.
+	ZstdDictionary(const std::string &data, int compression_level = 0);
+	~ZstdDictionary();
+
+	DISABLE_CLASS_COPY(ZstdDictionary)
+
+	// Trains a dictionary of at most max_size bytes from the samples.
+	// Throws SerializationError if this fails, e.g. with too few samples.
+	static std::string train(const std::vector<std::string> &samples,
+			size_t max_size);
+
+	const std::string &getData() const { return m_data; }
+	// Recorded in every frame compressed with the dictionary, never 0
+	u32 getId() const { return m_id; }
+
+	ZSTD_CDict *getCDict() const { return m_cdict; }
+	ZSTD_DDict *getDDict() const { return m_ddict; }
+
+private:
+	std::string m_data;
+	u32 m_id;
+	ZSTD_CDict *m_cdict = nullptr;
+	ZSTD_DDict *m_ddict = nullptr;
+};
+
+// If a dictionary is given, its compression level is used instead of level.
+// Data compressed without a dictionary can be decompressed with one too.
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level = 0,
+		const ZstdDictionary *dict = nullptr);
+void compressZstd(const std::string &data, std::ostream &os, int level = 0,
+		const ZstdDictionary *dict = nullptr);
+void decompressZstd(std::istream &is, std::ostream &os,
+		const ZstdDictionary *dict = nullptr);
 
-// These choose between zlib and a self-made one according to version
-void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version, int level = -1);
-void compress(const std::string &data, std::ostream &os, u8 version, int level = -1);
-void compress(u8 *data, u32 size, std::ostream &os, u8 version, int level = -1);
-void decompress(std::istream &is, std::ostream &os, u8 version);
+// These choose between zlib and a self-made one according to version.
+// The dictionary is only used by version >= 29.
+void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version, int level = -1,
+		const ZstdDictionary *dict = nullptr);
+void compress(const std::string &data, std::ostream &os, u8 version, int level = -1,
+		const ZstdDictionary *dict = nullptr);
+void compress(u8 *data, u32 size, std::ostream &os, u8 version, int level = -1,
+		const ZstdDictionary *dict = nullptr);
+void decompress(std::istream &is, std::ostream &os, u8 version,
+		const ZstdDictionary *dict = nullptr);
@@ -54,6 +54,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "rollback.h"
 #include "util/serialize.h"
 #include "util/thread.h"
+#include "util/timetaker.h"
+#include "util/worker_pool.h"
 #include "defaultsettings.h"
 #include "server/mods.h"
 #include "util/base64.h"
@@ -65,6 +67,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "remoteplayer.h"
 #include "server/player_sao.h"
 #include "server/serverinventorymgr.h"
+#include "server/serialized_block_cache.h"
+#include "serialization.h"
 #include "translation.h"
 #include "database/database-sqlite3.h"
 #if USE_POSTGRESQL
@@ -248,7 +252,8 @@ Server::Server(
 			512,
 			CONNECTION_TIMEOUT,
 			m_bind_addr.isIPv6(),
-			this)),
+			this,
+			g_settings->getU16("network_threads"))),
 	m_itemdef(createItemDefManager()),
 	m_nodedef(createNodeDefManager()),
 	m_craftdef(createCraftDefManager()),
@@ -417,6 +422,12 @@ void Server::init()
 	// Create emerge manager
 	m_emerge = new EmergeManager(this, m_metrics_backend.get());
 
+	// Create mapblock sending helpers
+	m_block_send_pool = std::make_unique<WorkerPool>("BlockSend",
+			g_settings->getU16("num_block_send_threads"));
+	m_block_send_cache = std::make_unique<SerializedBlockCache>(
+			(size_t)g_settings->getU32("block_send_cache_size") * 1024 * 1024);
+
 	// Create ban manager
 	std::string ban_path = m_path_world + DIR_DELIM "ipban.txt";
 	m_banmanager = new BanManager(ban_path);
@@ -514,6 +525,8 @@ void Server::init()
 
 	m_env->loadMeta();
 
+	initBlockDictionary();
+
 	// Those settings can be overwritten in world.mt, they are
 	// intended to be cached after environment loading.
 	m_liquid_transform_every = g_settings->getFloat("liquid_update");
@@ -522,6 +535,101 @@ void Server::init()
 	m_csm_restriction_noderange = g_settings->getU32("csm_restriction_noderange");
 }
 
+// Size limit of the mapblock compression dictionary
+#define BLOCK_DICTIONARY_SIZE (32 * 1024)
+// Number of blocks of the world the dictionary is trained with
+#define BLOCK_DICTIONARY_SAMPLES 1000
+#define BLOCK_DICTIONARY_MIN_SAMPLES 100
+
+void Server::initBlockDictionary()
+{
+	if (!g_settings->getBool("map_compression_dictionary"))
+		return;
+
+	// The dictionary is trained once per world and kept, so that it does not
+	// slow down every start and clients can cache it
+	const std::string path = m_path_world + DIR_DELIM "block_dictionary.zst";
+	std::string data;
+	if (!fs::ReadFile(path, data)) {
+		data = trainBlockDictionary();
+		if (data.empty())
+			return;
+		if (!fs::safeWriteToFile(path, data))
+			warningstream << "Server: Failed to save " << path << std::endl;
+	}
+
+	// Same mapping of the compression level as compress()
+	const int level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9) + 1;
+	try {
+		m_block_dictionary = std::make_unique<ZstdDictionary>(data, level);
+	} catch (SerializationError &e) {
+		errorstream << "Server: Invalid block dictionary " << path << ": "
+				<< e.what() << std::endl;
+		return;
+	}
+
+	infostream << "Server: Compressing mapblocks with dictionary "
+			<< m_block_dictionary->getId() << " of "
+			<< data.size() << " bytes" << std::endl;
+}
+
+std::string Server::trainBlockDictionary()
+{
+	ServerMap &map = m_env->getServerMap();
+
+	// Pick the samples randomly from the whole world, without listing it
+	// (reservoir sampling): the n-th block replaces a random sample with
+	// a probability of BLOCK_DICTIONARY_SAMPLES / n
+	std::vector<v3s16> positions;
+	positions.reserve(BLOCK_DICTIONARY_SAMPLES);
+	u64 seen = 0;
+	map.forEachLoadableBlock([&] (v3s16 pos) {
+		seen++;
+		if (positions.size() < BLOCK_DICTIONARY_SAMPLES) {
+			positions.push_back(pos);
+			return;
+		}
+		u64 i = ((u64)myrand() << 32 | myrand()) % seen;
+		if (i < positions.size())
+			positions[i] = pos;
+	});
+	if (positions.size() < BLOCK_DICTIONARY_MIN_SAMPLES) {
+		infostream << "Server: Too few blocks to train a block dictionary, "
+				"trying again on the next start" << std::endl;
+		return "";
+	}
+	const size_t count = positions.size();
+
+	actionstream << "Server: Training block dictionary from " << count
+			<< " blocks" << std::endl;
+	TimeTaker timer("Server: Train block dictionary");
+
+	std::vector<ServerMap::DecodedBlock> decoded;
+	map.beginReadBlocks(positions, &decoded);
+	map.readBlocks(&decoded);
+
+	// The dictionary is only used for blocks sent over the network
+	std::vector<std::string> samples;
+	samples.reserve(count);
+	for (ServerMap::DecodedBlock &d : decoded) {
+		map.decodeBlock(&d);
+		if (!d.block)
+			continue;
+		d.block->correctNodeIds(d.nimap);
+		std::ostringstream os(std::ios_base::binary);
+		d.block->serializeUncompressed(os, SER_FMT_VER_HIGHEST_WRITE, false);
+		samples.push_back(os.str());
+	}
+
+	try {
+		return ZstdDictionary::train(samples, BLOCK_DICTIONARY_SIZE);
+	} catch (SerializationError &e) {
+		warningstream << "Server: Failed to train block dictionary: "
+				<< e.what() << std::endl;
+		return "";
+	}
+}
+
 void Server::start()
 {
 	init();
@@ -829,60 +937,89 @@ void Server::AsyncRunStep(bool initial_step)
 
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
-			const RemoteClientMap &clients = m_clients.getClientList();
-			// Route data to every client
-			std::string reliable_data, unreliable_data;
-			for (const auto &client_it : clients) {
-				reliable_data.clear();
-				unreliable_data.clear();
-				RemoteClient *client = client_it.second;
-				PlayerSAO *player = getPlayerSAO(client->peer_id);
-				// Go through all objects in message buffer
-				for (const auto &buffered_message : buffered_messages) {
-					// If object does not exist or is not known by client, skip it
-					u16 id = buffered_message.first;
-					ServerActiveObject *sao = m_env->getActiveObject(id);
-					if (!sao || client->m_known_objects.find(id) == client->m_known_objects.end())
-						continue;
-
-					// Get message list of object
-					std::vector<ActiveObjectMessage>* list = buffered_message.second;
-					// Go through every message
-					for (const ActiveObjectMessage &aom : *list) {
-						// Send position updates to players who do not see the attachment
-						if (aom.datastring[0] == AO_CMD_UPDATE_POSITION) {
-							if (sao->getId() == player->getId())
-								continue;
+			// Route data only to the clients which know the object
+			// Key = peer id, Value = (reliable data, unreliable data)
+			std::unordered_map<session_t, std::pair<std::string, std::string>> peer_data;
+			// Looked up once per peer, for messages depending on it
+			std::unordered_map<session_t, u16> peer_protocol_versions;
+			auto get_protocol_version = [&] (session_t peer_id) -> u16 {
+				auto it = peer_protocol_versions.find(peer_id);
+				if (it != peer_protocol_versions.end())
+					return it->second;
+				RemoteClient *client = m_clients.lockedGetClientNoEx(peer_id, CS_Created);
+				u16 version = client ? client->net_proto_version : 0;
+				peer_protocol_versions[peer_id] = version;
+				return version;
+			};
+			std::string encoded;
+			for (const auto &buffered_message : buffered_messages) {
+				// If object does not exist or is not known by any client, skip it
+				u16 id = buffered_message.first;
+				ServerActiveObject *sao = m_env->getActiveObject(id);
+				const auto *subscribers = m_clients.lockedGetObjectSubscribers(id);
+				if (!sao || !subscribers)
+					continue;
 
-							// Do not send position updates for attached players
-							// as long the parent is known to the client
-							ServerActiveObject *parent = sao->getParent();
-							if (parent && client->m_known_objects.find(parent->getId()) !=
-									client->m_known_objects.end())
+				// Position updates are not sent to the player owning the object,
+				// nor to clients that know the parent of an attached object
+				session_t owner_peer_id = PEER_ID_INEXISTENT;
+				if (sao->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+					owner_peer_id = static_cast<PlayerSAO *>(sao)->getPeerID();
+				ServerActiveObject *parent = sao->getParent();
+				const auto *parent_subscribers = parent ?
+						m_clients.lockedGetObjectSubscribers(parent->getId()) : nullptr;
+
+				// Get message list of object
+				std::vector<ActiveObjectMessage>* list = buffered_message.second;
+				// Go through every message
+				for (const ActiveObjectMessage &aom : *list) {
+					// Serialize once, the result is shared by all subscribers
+					encoded.clear();
+					char idbuf[2];
+					writeU16((u8*) idbuf, aom.id);
+					// u16 id
+					// std::string data
+					encoded.append(idbuf, sizeof(idbuf));
+					encoded.append(serializeString16(aom.datastring));
+
+					bool is_position = aom.datastring[0] == AO_CMD_UPDATE_POSITION ||
+							aom.datastring[0] == AO_CMD_UPDATE_POSITION_COMPACT;
+					// Keyframes (the reliable compact updates) still go to the
+					// parent's subscribers, later updates are relative to them
+					bool is_keyframe = aom.datastring[0] == AO_CMD_UPDATE_POSITION_COMPACT &&
+							aom.reliable;
+					bool for_all_versions = aom.min_protocol_version == 0 &&
+							aom.max_protocol_version == U16_MAX;
+					for (session_t peer_id : *subscribers) {
+						if (is_position && peer_id == owner_peer_id)
+							continue;
+						if (is_position && !is_keyframe && parent_subscribers &&
+								parent_subscribers->count(peer_id) > 0)
+							continue;
+						if (!for_all_versions) {
+							u16 version = get_protocol_version(peer_id);
+							if (version < aom.min_protocol_version ||
+									version > aom.max_protocol_version)
 								continue;
 						}
 
 						// Add full new data to appropriate buffer
-						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
-						char idbuf[2];
-						writeU16((u8*) idbuf, aom.id);
-						// u16 id
-						// std::string data
-						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
+						auto &buffers = peer_data[peer_id];
+						(aom.reliable ? buffers.first : buffers.second).append(encoded);
 					}
 				}
-				/*
-					reliable_data and unreliable_data are now ready.
-					Send them.
-				*/
-				if (!reliable_data.empty()) {
-					SendActiveObjectMessages(client->peer_id, reliable_data);
-				}
+			}
 
-				if (!unreliable_data.empty()) {
-					SendActiveObjectMessages(client->peer_id, unreliable_data, false);
-				}
+			/*
+				Reliable and unreliable data are now ready.
+				Send them.
+			*/
+			for (const auto &it : peer_data) {
+				if (!it.second.first.empty())
+					SendActiveObjectMessages(it.first, it.second.first);
+
+				if (!it.second.second.empty())
+					SendActiveObjectMessages(it.first, it.second.second, false);
 			}
 		}
 
@@ -899,11 +1036,6 @@ void Server::AsyncRunStep(bool initial_step)
 		// We will be accessing the environment
 		MutexAutoLock lock(m_env_mutex);
 
-		// Single change sending is disabled if queue size is big
-		bool disable_single_change_sending = false;
-		if(m_unsent_map_edit_queue.size() >= 4)
-			disable_single_change_sending = true;
-
 		const auto event_count = m_unsent_map_edit_queue.size();
 		m_map_edit_event_counter->increment(event_count);
 
@@ -911,28 +1043,21 @@ void Server::AsyncRunStep(bool initial_step)
 		Profiler prof;
 
 		std::unordered_set<v3s16> node_meta_updates;
+		std::unordered_map<v3s16, BlockNodeChanges> node_changes;
 
 		while (!m_unsent_map_edit_queue.empty()) {
 			MapEditEvent* event = m_unsent_map_edit_queue.front();
 			m_unsent_map_edit_queue.pop();
 
-			// Players far away from the change are stored here.
-			// Instead of sending the changes, MapBlocks are set not sent
-			// for them.
-			std::unordered_set<u16> far_players;
-
 			switch (event->type) {
 			case MEET_ADDNODE:
 			case MEET_SWAPNODE:
 				prof.add("MEET_ADDNODE", 1);
-				sendAddNode(event->p, event->n, &far_players,
-						disable_single_change_sending ? 5 : 30,
-						event->type == MEET_ADDNODE);
+				addNodeChange(node_changes, event, event->type == MEET_ADDNODE);
 				break;
 			case MEET_REMOVENODE:
 				prof.add("MEET_REMOVENODE", 1);
-				sendRemoveNode(event->p, &far_players,
-						disable_single_change_sending ? 5 : 30);
+				addNodeChange(node_changes, event, true);
 				break;
 			case MEET_BLOCK_NODE_METADATA_CHANGED: {
 				prof.add("MEET_BLOCK_NODE_METADATA_CHANGED", 1);
@@ -960,27 +1085,12 @@ void Server::AsyncRunStep(bool initial_step)
 				break;
 			}
 
-			/*
-				Set blocks not sent to far players
-			*/
-			if (!far_players.empty()) {
-				// Convert list format to that wanted by SetBlocksNotSent
-				std::map<v3s16, MapBlock*> modified_blocks2;
-				for (const v3s16 &modified_block : event->modified_blocks) {
-					modified_blocks2[modified_block] =
-							m_env->getMap().getBlockNoCreateNoEx(modified_block);
-				}
-
-				// Set blocks not sent
-				for (const u16 far_player : far_players) {
-					if (RemoteClient *client = getClient(far_player))
-						client->SetBlocksNotSent(modified_blocks2);
-				}
-			}
-
 			delete event;
 		}
 
+		// Before the metadata, which may belong to the new nodes
+		sendNodeChanges(node_changes);
+
 		if (event_count >= 5) {
 			infostream << "Server: MapEditEvents:" << std::endl;
 			prof.print(infostream);
@@ -2082,7 +2192,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		data.append(buf, 2);
 
 		// Remove from known objects
-		client->m_known_objects.erase(id);
+		m_clients.markObjectUnknown(client, id);
 
 		if (obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
@@ -2118,7 +2228,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 			obj->getClientInitializationData(client->net_proto_version)));
 
 		// Add to known objects
-		client->m_known_objects.insert(id);
+		m_clients.markObjectKnown(client, id);
 
 		obj->m_known_by_count++;
 	}
@@ -2285,57 +2395,101 @@ void Server::fadeSound(s32 handle, float step, float gain)
 		m_playing_sounds.erase(it);
 }
 
-void Server::sendRemoveNode(v3s16 p, std::unordered_set<u16> *far_players,
-		float far_d_nodes)
+// Beyond this many changes in a step, a block is sent again as a whole
+#define NODE_CHANGES_MAX_PER_BLOCK 128
+
+void Server::addNodeChange(std::unordered_map<v3s16, BlockNodeChanges> &changes,
+		const MapEditEvent *event, bool remove_metadata)
 {
-	v3f p_f = intToFloat(p, BS);
-	v3s16 block_pos = getNodeBlockPos(p);
+	v3s16 block_pos, rel_pos;
+	getNodeBlockPosWithOffset(event->p, block_pos, rel_pos);
+	BlockNodeChanges &block_changes = changes[block_pos];
 
-	NetworkPacket pkt(TOCLIENT_REMOVENODE, 6);
-	pkt << p;
+	if (block_changes.changes.size() <= NODE_CHANGES_MAX_PER_BLOCK) {
+		const bool removed = event->type == MEET_REMOVENODE;
+		block_changes.changes.push_back({
+			(u16)(rel_pos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+				rel_pos.Y * MAP_BLOCKSIZE + rel_pos.X),
+			removed ? MapNode(CONTENT_AIR) : event->n,
+			removed,
+			remove_metadata
+		});
+	}
 
-	sendNodeChangePkt(pkt, block_pos, p_f, far_d_nodes, far_players);
+	block_changes.modified_blocks.insert(event->modified_blocks.begin(),
+			event->modified_blocks.end());
 }
 
-void Server::sendAddNode(v3s16 p, MapNode n, std::unordered_set<u16> *far_players,
-		float far_d_nodes, bool remove_metadata)
+void Server::sendNodeChanges(const std::unordered_map<v3s16, BlockNodeChanges> &changes)
 {
-	v3f p_f = intToFloat(p, BS);
-	v3s16 block_pos = getNodeBlockPos(p);
-
-	NetworkPacket pkt(TOCLIENT_ADDNODE, 6 + 2 + 1 + 1 + 1);
-	pkt << p << n.param0 << n.param1 << n.param2
-			<< (u8) (remove_metadata ? 0 : 1);
-	sendNodeChangePkt(pkt, block_pos, p_f, far_d_nodes, far_players);
-}
+	if (changes.empty())
+		return;
 
-void Server::sendNodeChangePkt(NetworkPacket &pkt, v3s16 block_pos,
-		v3f p, float far_d_nodes, std::unordered_set<u16> *far_players)
-{
-	float maxd = far_d_nodes * BS;
 	std::vector<session_t> clients = m_clients.getClientIDs();
 	ClientInterface::AutoLock clientlock(m_clients);
 
-	for (session_t client_id : clients) {
-		RemoteClient *client = m_clients.lockedGetClientNoEx(client_id);
-		if (!client)
-			continue;
-
-		RemotePlayer *player = m_env->getPlayer(client_id);
-		PlayerSAO *sao = player ? player->getPlayerSAO() : nullptr;
+	for (const auto &it : changes) {
+		const v3s16 block_pos = it.first;
+		const BlockNodeChanges &block_changes = it.second;
 
-		// If player is far away, only set modified blocks not sent
-		if (!client->isBlockSent(block_pos) || (sao &&
-				sao->getBasePosition().getDistanceFrom(p) > maxd)) {
-			if (far_players)
-				far_players->emplace(client_id);
-			else
-				client->SetBlockNotSent(block_pos);
+		if (block_changes.changes.size() > NODE_CHANGES_MAX_PER_BLOCK) {
+			for (const v3s16 &modified_block : block_changes.modified_blocks)
+				m_clients.markBlockposAsNotSent(modified_block);
 			continue;
 		}
 
-		// Send as reliable
-		m_clients.send(client_id, 0, &pkt, true);
+		// Made when the first client needing them is found
+		std::unique_ptr<NetworkPacket> pkt;
+		std::vector<NetworkPacket> legacy_pkts;
+
+		for (session_t client_id : clients) {
+			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id);
+			if (!client)
+				continue;
+
+			// The block may be on its way, so it has to be sent again
+			if (!client->isBlockSent(block_pos)) {
+				for (const v3s16 &modified_block : block_changes.modified_blocks)
+					client->SetBlockNotSent(modified_block);
+				continue;
+			}
+
+			if (client->net_proto_version >= 44) {
+				if (!pkt) {
+					pkt = std::make_unique<NetworkPacket>(TOCLIENT_NODES_CHANGED,
+							6 + 2 + block_changes.changes.size() * 7);
+					*pkt << block_pos << (u16)block_changes.changes.size();
+					for (const NodeChange &change : block_changes.changes) {
+						*pkt << change.index << change.n.param0 << change.n.param1
+								<< change.n.param2 << (u8)(change.remove_metadata ? 0 : 1);
+					}
+				}
+				// Send as reliable
+				m_clients.send(client_id, 0, pkt.get(), true);
+				continue;
+			}
+
+			if (legacy_pkts.empty()) {
+				legacy_pkts.reserve(block_changes.changes.size());
+				const v3s16 base = block_pos * MAP_BLOCKSIZE;
+				for (const NodeChange &change : block_changes.changes) {
+					v3s16 p = base + v3s16(change.index % MAP_BLOCKSIZE,
+							change.index / MAP_BLOCKSIZE % MAP_BLOCKSIZE,
+							change.index / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+					if (change.removed) {
+						legacy_pkts.emplace_back(TOCLIENT_REMOVENODE, 6);
+						legacy_pkts.back() << p;
+					} else {
+						legacy_pkts.emplace_back(TOCLIENT_ADDNODE, 6 + 2 + 1 + 1 + 1);
+						legacy_pkts.back() << p << change.n.param0 << change.n.param1
+								<< change.n.param2 << (u8)(change.remove_metadata ? 0 : 1);
+					}
+				}
+			}
+			// Send as reliable
+			for (NetworkPacket &legacy_pkt : legacy_pkts)
+				m_clients.send(client_id, 0, &legacy_pkt, true);
+		}
 	}
 }
 
@@ -2392,104 +2546,208 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 }
 
 void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+		u16 net_proto_version)
 {
 	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
 
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
-	}
+	const v3s16 pos = block->getPos();
+	const u64 modification_counter = block->getModificationCounter();
+	const ZstdDictionary *dict = getBlockDictionary(net_proto_version);
+	const u32 dict_id = dict ? dict->getId() : 0;
+	auto data = m_block_send_cache->get(pos, ver, dict_id, modification_counter);
 
 	// Serialize the block in the right format
-	if (!sptr) {
+	if (!data) {
 		std::ostringstream os(std::ios_base::binary);
-		block->serialize(os, ver, false, net_compression_level);
+		block->serialize(os, ver, false, net_compression_level, dict);
 		block->serializeNetworkSpecific(os);
-		s = os.str();
-		sptr = &s;
+		data = std::make_shared<std::string>(os.str());
+		m_block_send_cache->put(pos, ver, dict_id, modification_counter, data);
 	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
+	SendBlockData(peer_id, pos, *data);
+}
+
+void Server::SendBlockData(session_t peer_id, v3s16 blockpos, const std::string &data)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data.size(), peer_id);
+	pkt << blockpos;
+	pkt.putRawString(data);
+	Send(&pkt);
+}
+
+void Server::SendBlockDictionary(session_t peer_id)
+{
+	const std::string &data = m_block_dictionary->getData();
+	NetworkPacket pkt(TOCLIENT_BLOCK_DICTIONARY, 4 + data.size(), peer_id);
+	pkt.putLongString(data);
 	Send(&pkt);
+}
 
-	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+const ZstdDictionary *Server::getBlockDictionary(u16 net_proto_version) const
+{
+	// Older clients are not sent the dictionary
+	if (net_proto_version < 44)
+		return nullptr;
+	return m_block_dictionary.get();
 }
 
 void Server::SendBlocks(float dtime)
 {
-	MutexAutoLock envlock(m_env_mutex);
-	//TODO check if one big lock could be faster then multiple small ones
+	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
 
-	std::vector<PrioritySortedBlockTransfer> queue;
+	// A block serialized in one format, shared by all clients receiving it
+	struct SerializeJob {
+		v3s16 pos;
+		u8 version;
+		const ZstdDictionary *dict;
+		u64 modification_counter;
+		// Snapshot of the block, still to be compressed
+		std::string raw;
+		std::shared_ptr<const std::string> data;
+	};
+
+	struct BlockSend {
+		session_t peer_id;
+		v3s16 pos;
+		size_t job;
+	};
 
-	u32 total_sending = 0, unique_clients = 0;
+	std::vector<SerializeJob> jobs;
+	std::vector<BlockSend> sends;
 
 	{
-		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+		MutexAutoLock envlock(m_env_mutex);
+		//TODO check if one big lock could be faster then multiple small ones
 
-		std::vector<session_t> clients = m_clients.getClientIDs();
+		std::vector<PrioritySortedBlockTransfer> queue;
 
-		ClientInterface::AutoLock clientlock(m_clients);
-		for (const session_t client_id : clients) {
-			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+		u32 total_sending = 0;
 
-			if (!client)
-				continue;
+		{
+			ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+
+			std::vector<session_t> clients = m_clients.getClientIDs();
 
-			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
-			client->GetNextBlocks(m_env,m_emerge, dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
+			ClientInterface::AutoLock clientlock(m_clients);
+			for (const session_t client_id : clients) {
+				RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+
+				if (!client)
+					continue;
+
+				BlockSendBudget::Stats net_stats;
+				net_stats.min_rtt = m_con->getPeerStat(client_id, con::MIN_RTT);
+				net_stats.avg_rtt = m_con->getPeerStat(client_id, con::AVG_RTT);
+				net_stats.sent_kbps = m_con->getPeerRateStat(client_id, con::CUR_DL_RATE);
+				net_stats.lost_kbps = m_con->getPeerRateStat(client_id, con::CUR_LOSS_RATE);
+
+				total_sending += client->getSendingCount();
+				client->GetNextBlocks(m_env, m_emerge, dtime, net_stats, queue);
+			}
 		}
-	}
 
-	// Sort.
-	// Lowest priority number comes first.
-	// Lowest is most important.
-	std::sort(queue.begin(), queue.end());
+		// Sort.
+		// Lowest priority number comes first.
+		// Lowest is most important.
+		std::sort(queue.begin(), queue.end());
 
-	ClientInterface::AutoLock clientlock(m_clients);
+		ClientInterface::AutoLock clientlock(m_clients);
 
-	// Maximal total count calculation
-	// The per-client block sends is halved with the maximal online users
-	u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
-		g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
+		// Maximal total count calculation
+		// The per-client block sends is halved with the maximal online users
+		u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
+			g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
 
-	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
-	Map &map = m_env->getMap();
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Serialize");
+		Map &map = m_env->getMap();
+
+		// Key = (position, serialization version, dictionary id), Value = index in jobs
+		std::map<std::tuple<v3s16, u8, u32>, size_t> job_index;
+
+		for (const PrioritySortedBlockTransfer &block_to_send : queue) {
+			if (total_sending >= max_blocks_to_send)
+				break;
+
+			MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
+			if (!block)
+				continue;
+
+			RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
+					CS_Active);
+			if (!client)
+				continue;
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
+			const u8 ver = client->serialization_version;
+			const ZstdDictionary *dict = getBlockDictionary(client->net_proto_version);
+			const u32 dict_id = dict ? dict->getId() : 0;
+			auto it = job_index.find({block_to_send.pos, ver, dict_id});
+			if (it == job_index.end()) {
+				it = job_index.emplace(std::make_tuple(block_to_send.pos, ver, dict_id),
+						jobs.size()).first;
+				jobs.emplace_back();
+				SerializeJob &job = jobs.back();
+				job.pos = block_to_send.pos;
+				job.version = ver;
+				job.dict = dict;
+				job.modification_counter = block->getModificationCounter();
+				job.data = m_block_send_cache->get(job.pos, ver, dict_id,
+						job.modification_counter);
+
+				if (!job.data) {
+					std::ostringstream os(std::ios_base::binary);
+					if (ver >= 29) {
+						// Compression is left to the workers
+						block->serializeUncompressed(os, ver, false);
+						job.raw = os.str();
+					} else {
+						block->serialize(os, ver, false, net_compression_level, dict);
+						block->serializeNetworkSpecific(os);
+						job.data = std::make_shared<std::string>(os.str());
+					}
+				}
+			}
+
+			sends.push_back({block_to_send.peer_id, block_to_send.pos, it->second});
+			client->SentBlock(block_to_send.pos);
+			total_sending++;
+		}
 	}
 
-	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
-		if (total_sending >= max_blocks_to_send)
-			break;
+	/*
+		Compress the snapshots, without holding the environment lock
+	*/
+	{
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Compress");
+		const int compression_level = net_compression_level;
+		m_block_send_pool->run(jobs.size(), [&jobs, compression_level] (size_t i) {
+			SerializeJob &job = jobs[i];
+			if (job.data)
+				return;
+
+			std::ostringstream os(std::ios_base::binary);
+			compress(job.raw, os, job.version, compression_level, job.dict);
+			MapBlock::serializeNetworkSpecific(os);
+			job.data = std::make_shared<std::string>(os.str());
+		});
+	}
 
-		MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
-		if (!block)
-			continue;
+	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
 
-		RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
-				CS_Active);
-		if (!client)
+	// Store away in cache
+	for (SerializeJob &job : jobs) {
+		if (job.raw.empty())
 			continue;
+		m_block_send_cache->put(job.pos, job.version,
+				job.dict ? job.dict->getId() : 0, job.modification_counter,
+				job.data);
+	}
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
+	for (const BlockSend &send : sends)
+		SendBlockData(send.peer_id, send.pos, *jobs[send.job].data);
 
-		client->SentBlock(block_to_send.pos);
-		total_sending++;
-	}
+	g_profiler->avg("Server::SendBlocks(): cache size [MB]",
+			m_block_send_cache->getSize() / (1024.0f * 1024.0f));
 }
 
 bool Server::SendBlock(session_t peer_id, const v3s16 &blockpos)
@@ -42,6 +42,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <list>
 #include <map>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 
 class ChatEvent;
@@ -72,6 +73,9 @@ struct Lighting;
 class ServerThread;
 class ServerModManager;
 class ServerInventoryManager;
+class SerializedBlockCache;
+class WorkerPool;
+class ZstdDictionary;
 struct PackedValue;
 struct ParticleParameters;
 struct ParticleSpawnerParameters;
@@ -422,16 +426,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		std::unordered_set<session_t> waiting_players;
 	};
 
-	// The standard library does not implement std::hash for pairs so we have this:
-	struct SBCHash {
-		size_t operator() (const std::pair<v3s16, u16> &p) const {
-			return std::hash<v3s16>()(p.first) ^ p.second;
-		}
-	};
-
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
-
 	void init();
+	// Loads or trains the dictionary mapblocks are compressed with
+	void initBlockDictionary();
+	// Returns an empty string if there are too few blocks to train with
+	std::string trainBlockDictionary();
 
 	void SendMovement(session_t peer_id);
 	void SendHP(session_t peer_id, u16 hp, bool effect);
@@ -472,27 +471,41 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void broadcastModChannelMessage(const std::string &channel,
 			const std::string &message, session_t from_peer);
 
+	// Node additions and removals of one block, collected from the map edit
+	// events of a server step to be sent together
+	struct NodeChange {
+		u16 index; // of the node in the block
+		MapNode n; // air if removed
+		bool removed;
+		bool remove_metadata;
+	};
+	struct BlockNodeChanges {
+		std::vector<NodeChange> changes;
+		// Including neighbours whose lighting changed
+		std::unordered_set<v3s16> modified_blocks;
+	};
+
+	static void addNodeChange(std::unordered_map<v3s16, BlockNodeChanges> &changes,
+			const MapEditEvent *event, bool remove_metadata);
 	/*
-		Send a node removal/addition event to all clients except ignore_id.
-		Additionally, if far_players!=NULL, players further away than
-		far_d_nodes are ignored and their peer_ids are added to far_players
+		Sends the changes of each block to the clients which have it, as one
+		packet per block (or one per change for older clients). Blocks with
+		too many changes are sent again as a whole instead.
 	*/
-	// Envlock and conlock should be locked when calling these
-	void sendRemoveNode(v3s16 p, std::unordered_set<u16> *far_players = nullptr,
-			float far_d_nodes = 100);
-	void sendAddNode(v3s16 p, MapNode n,
-			std::unordered_set<u16> *far_players = nullptr,
-			float far_d_nodes = 100, bool remove_metadata = true);
-	void sendNodeChangePkt(NetworkPacket &pkt, v3s16 block_pos,
-			v3f p, float far_d_nodes, std::unordered_set<u16> *far_players);
+	// Envlock should be locked when calling this
+	void sendNodeChanges(const std::unordered_map<v3s16, BlockNodeChanges> &changes);
 
 	void sendMetadataChanged(const std::unordered_set<v3s16> &positions,
 			float far_d_nodes = 100);
 
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
+	// The serialized block is taken from m_block_send_cache if still current
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+		u16 net_proto_version);
+	void SendBlockData(session_t peer_id, v3s16 blockpos, const std::string &data);
+	void SendBlockDictionary(session_t peer_id);
+	// Dictionary to compress blocks for a client with, or nullptr
+	const ZstdDictionary *getBlockDictionary(u16 net_proto_version) const;
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -711,6 +724,13 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Inventory manager
 	std::unique_ptr<ServerInventoryManager> m_inventory_mgr;
 
+	// Compresses mapblocks for sending without holding the environment lock
+	std::unique_ptr<WorkerPool> m_block_send_pool;
+	// Network-serialized mapblocks, reused across clients and steps
+	std::unique_ptr<SerializedBlockCache> m_block_send_cache;
+	// Mapblock compression dictionary announced to clients, if any
+	std::unique_ptr<ZstdDictionary> m_block_dictionary;
+
 	// Global server metrics backend
 	std::unique_ptr<MetricsBackend> m_metrics_backend;
 
@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
@@ -35,6 +36,7 @@ void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)>
 		if (cb(it.second, it.first)) {
 			// Remove reference from m_active_objects
 			m_active_objects.erase(it.first);
+			m_spatial_map.remove(it.first);
 		}
 	}
 }
@@ -86,6 +88,7 @@ bool ActiveObjectMgr::registerObject(ServerActiveObject *obj)
 	}
 
 	m_active_objects[obj->getId()] = obj;
+	m_spatial_map.insert(obj->getId(), obj->getBasePosition());
 
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
 			<< "Added id=" << obj->getId() << "; there are now "
@@ -105,17 +108,36 @@ void ActiveObjectMgr::removeObject(u16 id)
 	}
 
 	m_active_objects.erase(id);
+	m_spatial_map.remove(id);
 	delete obj;
 }
 
+void ActiveObjectMgr::updateObjectPos(u16 id, const v3f &pos)
+{
+	m_spatial_map.updatePosition(id, pos);
+}
+
+void ActiveObjectMgr::getCandidateIds(const aabb3f &box, std::vector<u16> &ids) const
+{
+	// Copy the ids first: the callers' callbacks may add or move objects
+	m_spatial_map.getRelevantObjectIds(box, [&ids](u16 id) {
+		ids.push_back(id);
+	});
+}
+
 // clang-format on
 void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	aabb3f box(pos - radius, pos + radius);
+	std::vector<u16> ids;
+	getCandidateIds(box, ids);
+	for (u16 id : ids) {
+		ServerActiveObject *obj = getActiveObject(id);
+		if (!obj)
+			continue;
 		const v3f &objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFromSQ(pos) > r2)
 			continue;
@@ -129,8 +151,12 @@ void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	std::vector<u16> ids;
+	getCandidateIds(box, ids);
+	for (u16 id : ids) {
+		ServerActiveObject *obj = getActiveObject(id);
+		if (!obj)
+			continue;
 		const v3f &objectpos = obj->getBasePosition();
 		if (!box.isPointInside(objectpos))
 			continue;
@@ -145,17 +171,28 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 		std::queue<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects near the player,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects) {
-		u16 id = ao_it.first;
+	// player_radius == 0 means players are sent regardless of distance
+	f32 max_radius = player_radius == 0 ? 0 : std::max(radius, player_radius);
+	std::vector<u16> ids;
+	if (max_radius == 0) {
+		ids.reserve(m_active_objects.size());
+		for (auto &ao_it : m_active_objects)
+			ids.push_back(ao_it.first);
+	} else {
+		getCandidateIds(aabb3f(player_pos - max_radius, player_pos + max_radius), ids);
+		// Keep the id order of the full scan so objects are sent deterministically
+		std::sort(ids.begin(), ids.end());
+	}
 
+	for (u16 id : ids) {
 		// Get object
-		ServerActiveObject *object = ao_it.second;
+		ServerActiveObject *object = getActiveObject(id);
 		if (!object)
 			continue;
 
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
+#include "spatial_map.h"
 
 namespace server
 {
@@ -35,6 +36,9 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	bool registerObject(ServerActiveObject *obj) override;
 	void removeObject(u16 id) override;
 
+	// Keeps the spatial index in sync, called when an object moves
+	void updateObjectPos(u16 id, const v3f &pos);
+
 	void getObjectsInsideRadius(const v3f &pos, float radius,
 			std::vector<ServerActiveObject *> &result,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
@@ -45,5 +49,11 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	void getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
 			f32 player_radius, std::set<u16> &current_objects,
 			std::queue<u16> &added_objects);
+
+private:
+	// Collects the ids of all objects possibly inside box
+	void getCandidateIds(const aabb3f &box, std::vector<u16> &ids) const;
+
+	SpatialMap m_spatial_map;
 };
 } // namespace server
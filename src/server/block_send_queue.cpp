@@ -0,0 +1,238 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "block_send_queue.h"
+#include <algorithm>
+#include <cmath>
+#include "util/numeric.h"
+
+// Squared distance limit of a sphere, matching v3s16::getDistanceFrom() <= radius
+static s32 sphere_limit(s32 radius)
+{
+	return radius * radius + 2 * radius;
+}
+
+// Largest r with r * r <= n
+static s32 isqrt(s32 n)
+{
+	s32 r = std::sqrt((float)n);
+	while (r * r > n)
+		r--;
+	while ((r + 1) * (r + 1) <= n)
+		r++;
+	return r;
+}
+
+bool BlockSendQueue::isInArea(v3s16 p) const
+{
+	if (m_radius < 0)
+		return false;
+	v3s32 d = v3s32(p.X, p.Y, p.Z) - v3s32(m_center.X, m_center.Y, m_center.Z);
+	return d.X * d.X + d.Y * d.Y + d.Z * d.Z <= sphere_limit(m_radius);
+}
+
+void BlockSendQueue::setArea(v3s16 center, s16 radius, const FilterFunc &is_wanted)
+{
+	if (center == m_center && radius == m_radius)
+		return;
+
+	const v3s16 old_center = m_center;
+	const s32 old_radius = m_radius;
+	m_center = center;
+	m_radius = radius;
+
+	// Go through the area column by column and add what was not in the
+	// old area, which is a single range of each column
+	const s32 r = radius;
+	for (s32 x = -r; x <= r; x++)
+	for (s32 y = -r; y <= r; y++) {
+		s32 h2 = sphere_limit(r) - x * x - y * y;
+		if (h2 < 0)
+			continue;
+		s32 h = isqrt(h2);
+
+		s32 old_min = 1, old_max = 0;
+		if (old_radius >= 0) {
+			s32 ox = center.X + x - old_center.X;
+			s32 oy = center.Y + y - old_center.Y;
+			s32 oh2 = sphere_limit(old_radius) - ox * ox - oy * oy;
+			if (oh2 >= 0) {
+				s32 oh = isqrt(oh2);
+				old_min = old_center.Z - oh;
+				old_max = old_center.Z + oh;
+			}
+		}
+
+		for (s32 z = center.Z - h; z <= center.Z + h; z++) {
+			if (z >= old_min && z <= old_max) {
+				z = old_max;
+				continue;
+			}
+			v3s16 p(center.X + x, center.Y + y, z);
+			if (is_wanted(p) && m_blocks.insert(p).second)
+				push(p);
+		}
+	}
+
+	if (old_radius < 0)
+		return;
+
+	// Drop the blocks that left the area
+	for (auto it = m_blocks.begin(); it != m_blocks.end();) {
+		if (isInArea(*it))
+			++it;
+		else
+			it = m_blocks.erase(it);
+	}
+}
+
+void BlockSendQueue::setPriority(const PriorityFunc &priority)
+{
+	m_priority = priority;
+
+	m_heap.clear();
+	m_heap.reserve(m_blocks.size());
+	for (v3s16 p : m_blocks)
+		m_heap.emplace_back(m_priority(p), p);
+	std::make_heap(m_heap.begin(), m_heap.end(), EntryGreater());
+}
+
+void BlockSendQueue::push(v3s16 p)
+{
+	// Get rid of the outdated entries once they make up most of the heap
+	if (m_heap.size() > 2 * m_blocks.size() + 64 && m_priority) {
+		setPriority(m_priority);
+		return;
+	}
+
+	m_heap.emplace_back(m_priority ? m_priority(p) : 0.0f, p);
+	std::push_heap(m_heap.begin(), m_heap.end(), EntryGreater());
+}
+
+void BlockSendQueue::add(v3s16 p)
+{
+	if (isInArea(p) && m_blocks.insert(p).second)
+		push(p);
+}
+
+void BlockSendQueue::remove(v3s16 p)
+{
+	m_blocks.erase(p);
+}
+
+bool BlockSendQueue::pop(v3s16 &p, float &priority)
+{
+	while (!m_heap.empty()) {
+		const Entry top = m_heap.front();
+		if (std::isinf(top.first))
+			return false;
+
+		std::pop_heap(m_heap.begin(), m_heap.end(), EntryGreater());
+		m_heap.pop_back();
+
+		// Skip outdated entries
+		if (m_blocks.erase(top.second) == 0)
+			continue;
+
+		p = top.second;
+		priority = top.first;
+		return true;
+	}
+	return false;
+}
+
+void BlockSendQueue::clear()
+{
+	m_radius = -1;
+	m_blocks.clear();
+	m_heap.clear();
+}
+
+BlockSendBudget::BlockSendBudget(u16 min_blocks, u16 max_blocks) :
+	m_min(min_blocks),
+	m_max(std::max(min_blocks, max_blocks)),
+	m_limit(m_max)
+{
+}
+
+void BlockSendBudget::update(float dtime, const Stats &stats, bool window_used)
+{
+	m_time_from_decrease += dtime;
+
+	// Nothing measured yet
+	if (stats.avg_rtt < 0.0f)
+		return;
+	const float rtt = std::max(stats.avg_rtt, 0.01f);
+
+	bool congested = false;
+
+	if (stats.sent_kbps != m_last_sent_kbps || stats.lost_kbps != m_last_lost_kbps) {
+		m_last_sent_kbps = stats.sent_kbps;
+		m_last_lost_kbps = stats.lost_kbps;
+		if (stats.lost_kbps > 0.0f &&
+				stats.lost_kbps > stats.sent_kbps * LOSS_THRESHOLD)
+			congested = true;
+	}
+
+	// The average reacts slowly too, give it a round trip to settle
+	if (stats.min_rtt >= 0.0f && m_time_from_decrease >= rtt &&
+			stats.avg_rtt - stats.min_rtt > std::max(DELAY_THRESHOLD, stats.min_rtt))
+		congested = true;
+
+	if (congested) {
+		m_limit = std::max(m_limit * DECREASE_FACTOR, m_min);
+		m_time_from_decrease = 0.0f;
+	} else if (window_used) {
+		m_limit = std::min(m_limit + dtime / rtt, m_max);
+	}
+}
+
+float getBlockViewWeight(v3f rel_pos, v3f camera_dir, float fov, float aspect_ratio)
+{
+	static constexpr float MAX_WEIGHT = 4.0f;
+
+	// Half the size of the screen at distance 1
+	float tan_x = std::max(std::tan(fov / 2.0f), 0.01f);
+	float tan_y = tan_x;
+	if (aspect_ratio >= 1.0f)
+		tan_y /= aspect_ratio;
+	else if (aspect_ratio > 0.0f)
+		tan_x *= aspect_ratio;
+
+	v3f right = camera_dir.crossProduct(v3f(0, 1, 0));
+	if (right.getLengthSQ() < 1e-6f)
+		right = v3f(1, 0, 0);
+	right.normalize();
+	v3f up = right.crossProduct(camera_dir);
+	up.normalize();
+
+	// Enlarge the screen by the radius of the block, so that partly
+	// visible blocks count as visible
+	f32 forward = rel_pos.dotProduct(camera_dir) + BLOCK_MAX_RADIUS;
+	f32 side = std::max(std::fabs(rel_pos.dotProduct(right)) - BLOCK_MAX_RADIUS, 0.0f);
+	f32 vertical = std::max(std::fabs(rel_pos.dotProduct(up)) - BLOCK_MAX_RADIUS, 0.0f);
+	if (forward <= 0.0f)
+		return MAX_WEIGHT;
+	if (side == 0.0f && vertical == 0.0f)
+		return 1.0f;
+
+	f32 excess = std::max(side / (forward * tan_x), vertical / (forward * tan_y));
+	return rangelim(excess, 1.0f, MAX_WEIGHT);
+}
@@ -0,0 +1,139 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "irr_v3d.h"
+
+/*
+	Blocks around a client that still have to be sent, most important first.
+
+	The area the blocks are taken from is a sphere around the player. When
+	it moves, only the blocks that entered it are added, instead of going
+	through the whole area again. Blocks that left it are dropped lazily.
+*/
+class BlockSendQueue
+{
+public:
+	// Lower is more important, infinity for blocks that are not to be sent for now
+	typedef std::function<float(v3s16)> PriorityFunc;
+	typedef std::function<bool(v3s16)> FilterFunc;
+
+	// Moves the area to the sphere of radius around center. Blocks entering
+	// it are added if is_wanted returns true for them.
+	void setArea(v3s16 center, s16 radius, const FilterFunc &is_wanted);
+
+	// Sets how blocks are prioritized and recomputes all priorities
+	void setPriority(const PriorityFunc &priority);
+
+	// Adds a block again, e.g. after it was modified. Ignored outside of the area.
+	void add(v3s16 p);
+	void remove(v3s16 p);
+	bool contains(v3s16 p) const { return m_blocks.count(p) != 0; }
+
+	// Most important block of finite priority, false if there is none
+	bool pop(v3s16 &p, float &priority);
+
+	void clear();
+
+	size_t size() const { return m_blocks.size(); }
+	v3s16 getCenter() const { return m_center; }
+	s16 getRadius() const { return m_radius; }
+
+	bool isInArea(v3s16 p) const;
+
+private:
+	typedef std::pair<float, v3s16> Entry;
+
+	struct EntryGreater {
+		bool operator() (const Entry &a, const Entry &b) const {
+			return a.first > b.first;
+		}
+	};
+
+	void push(v3s16 p);
+
+	v3s16 m_center;
+	s16 m_radius = -1;
+	PriorityFunc m_priority;
+
+	std::unordered_set<v3s16> m_blocks;
+	// Min-heap over m_blocks, may contain outdated entries of blocks
+	// that have been removed or added again since
+	std::vector<Entry> m_heap;
+};
+
+/*
+	How many blocks a client may have on the wire at once.
+
+	Starts at the maximum and is reduced when the connection to the client
+	shows congestion: the round trip time growing well above its minimum or
+	a noticeable part of the sent data having to be resent. While the limit
+	is used up it grows back by about one block per round trip.
+*/
+class BlockSendBudget
+{
+public:
+	// Statistics of the connection to the client, see con::Connection::getPeerStat
+	struct Stats {
+		// seconds, < 0 if not known yet
+		float min_rtt = -1.0f;
+		float avg_rtt = -1.0f;
+		// KB/s, averaged over several seconds
+		float sent_kbps = 0.0f;
+		float lost_kbps = 0.0f;
+	};
+
+	BlockSendBudget(u16 min_blocks, u16 max_blocks);
+
+	// window_used: the limit was reached since the last update
+	void update(float dtime, const Stats &stats, bool window_used);
+
+	u16 getLimit() const { return (u16)m_limit; }
+
+	// Part of the sent data that may be resent before the limit is reduced
+	static constexpr float LOSS_THRESHOLD = 0.05f;
+	// Queueing delay in seconds above which the limit is reduced, at least
+	// the minimum round trip time
+	static constexpr float DELAY_THRESHOLD = 0.1f;
+	static constexpr float DECREASE_FACTOR = 0.7f;
+
+private:
+	const float m_min;
+	const float m_max;
+	float m_limit;
+
+	float m_time_from_decrease = 0.0f;
+	// The rate statistics only change every few seconds, react once per sample
+	float m_last_sent_kbps = -1.0f;
+	float m_last_lost_kbps = -1.0f;
+};
+
+/*
+	How far a block lies outside of the screen of a client, 1 if it is
+	(partly) on screen and growing with the angle beyond the screen edges.
+	rel_pos is the block center relative to the camera, fov is the larger
+	one of the horizontal and vertical field of view in radians.
+*/
+float getBlockViewWeight(v3f rel_pos, v3f camera_dir, float fov, float aspect_ratio);
@@ -138,6 +138,12 @@ std::string PlayerSAO::getClientInitializationData(u16 protocol_version)
 		}
 	}
 
+	std::string keyframe = generatePositionKeyframeCommand();
+	if (protocol_version >= 44 && !keyframe.empty()) {
+		msg_os << serializeString32(keyframe);
+		message_count++;
+	}
+
 	writeU8(os, message_count);
 	std::string serialized = msg_os.str();
 	os.write(serialized.c_str(), serialized.size());
@@ -275,26 +281,17 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 
 	if (m_position_not_sent) {
 		m_position_not_sent = false;
-		float update_interval = m_env->getSendRecommendedInterval();
-		v3f pos;
+		AOPositionUpdate update;
 		// When attached, the position is only sent to clients where the
 		// parent isn't known
 		if (isAttached())
-			pos = m_last_good_position;
+			update.position = m_last_good_position;
 		else
-			pos = m_base_position;
-
-		std::string str = generateUpdatePositionCommand(
-			pos,
-			v3f(0.0f, 0.0f, 0.0f),
-			v3f(0.0f, 0.0f, 0.0f),
-			m_rotation,
-			true,
-			false,
-			update_interval
-		);
-		// create message and add to list
-		m_messages_out.emplace(getId(), false, str);
+			update.position = m_base_position;
+		update.rotation = m_rotation;
+		update.do_interpolate = true;
+		update.update_interval = m_env->getSendRecommendedInterval();
+		sendPositionUpdate(update);
 	}
 
 	if (!m_physics_override_sent) {
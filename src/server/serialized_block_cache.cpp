@@ -0,0 +1,71 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "serialized_block_cache.h"
+
+std::shared_ptr<const std::string> SerializedBlockCache::get(v3s16 pos,
+		u8 version, u32 dictionary_id, u64 modification_counter)
+{
+	auto it = m_entries.find(Key(pos, version, dictionary_id));
+	if (it == m_entries.end())
+		return nullptr;
+
+	EntryIterator entry = it->second;
+	if (entry->modification_counter != modification_counter) {
+		// Outdated, will not be needed again
+		erase(entry);
+		return nullptr;
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, entry);
+	return entry->data;
+}
+
+void SerializedBlockCache::put(v3s16 pos, u8 version, u32 dictionary_id,
+		u64 modification_counter, std::shared_ptr<const std::string> data)
+{
+	Key key(pos, version, dictionary_id);
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		erase(it->second);
+
+	if (!data || data->size() > m_max_size)
+		return;
+
+	m_size += data->size();
+	m_lru.push_front({key, modification_counter, std::move(data)});
+	m_entries[key] = m_lru.begin();
+
+	while (m_size > m_max_size)
+		erase(std::prev(m_lru.end()));
+}
+
+void SerializedBlockCache::clear()
+{
+	m_lru.clear();
+	m_entries.clear();
+	m_size = 0;
+}
+
+void SerializedBlockCache::erase(EntryIterator it)
+{
+	m_size -= it->data->size();
+	m_entries.erase(it->key);
+	m_lru.erase(it);
+}
@@ -0,0 +1,83 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include "irr_v3d.h"
+
+/*
+	Size-bounded LRU cache of network-serialized mapblocks, shared by all
+	clients and kept across server steps.
+
+	Each entry remembers the modification counter of the block it was made
+	from, so a block changed since then is never served from the cache.
+	Entries are kept apart by the id of the compression dictionary used,
+	0 meaning none.
+*/
+class SerializedBlockCache
+{
+public:
+	SerializedBlockCache(size_t max_size) : m_max_size(max_size) {}
+
+	// Returns nullptr if there is no up-to-date entry
+	std::shared_ptr<const std::string> get(v3s16 pos, u8 version,
+			u32 dictionary_id, u64 modification_counter);
+
+	void put(v3s16 pos, u8 version, u32 dictionary_id,
+			u64 modification_counter, std::shared_ptr<const std::string> data);
+
+	void clear();
+
+	// Total size of the cached data in bytes
+	size_t getSize() const { return m_size; }
+	size_t getEntryCount() const { return m_entries.size(); }
+
+private:
+	typedef std::tuple<v3s16, u8, u32> Key;
+
+	// The standard library does not implement std::hash for tuples so we have this:
+	struct KeyHash {
+		size_t operator() (const Key &k) const {
+			return std::hash<v3s16>()(std::get<0>(k)) ^ std::get<1>(k) ^
+					((size_t)std::get<2>(k) << 8);
+		}
+	};
+
+	struct Entry {
+		Key key;
+		u64 modification_counter;
+		std::shared_ptr<const std::string> data;
+	};
+
+	typedef std::list<Entry>::iterator EntryIterator;
+
+	void erase(EntryIterator it);
+
+	// Most recently used first
+	std::list<Entry> m_lru;
+	std::unordered_map<Key, EntryIterator, KeyHash> m_entries;
+
+	size_t m_size = 0;
+	const size_t m_max_size;
+};
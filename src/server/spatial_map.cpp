@@ -0,0 +1,142 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "spatial_map.h"
+#include <algorithm>
+#include <cmath>
+#include "util/numeric.h"
+
+namespace server
+{
+
+static s16 toCellCoord(f32 v)
+{
+	if (std::isnan(v))
+		return 0;
+	f32 c = std::floor(v / SpatialMap::CELL_SIZE);
+	return (s16)rangelim(c, -32768.0f, 32767.0f);
+}
+
+v3s16 SpatialMap::getCell(const v3f &pos)
+{
+	return v3s16(toCellCoord(pos.X), toCellCoord(pos.Y), toCellCoord(pos.Z));
+}
+
+void SpatialMap::insert(u16 id, const v3f &pos)
+{
+	v3s16 cell = getCell(pos);
+	auto it = m_object_cells.find(id);
+	if (it != m_object_cells.end()) {
+		if (it->second == cell)
+			return;
+		removeFromCell(id, it->second);
+		it->second = cell;
+	} else {
+		m_object_cells.emplace(id, cell);
+	}
+	m_cells[cell].push_back(id);
+}
+
+void SpatialMap::remove(u16 id)
+{
+	auto it = m_object_cells.find(id);
+	if (it == m_object_cells.end())
+		return;
+	removeFromCell(id, it->second);
+	m_object_cells.erase(it);
+}
+
+void SpatialMap::updatePosition(u16 id, const v3f &pos)
+{
+	auto it = m_object_cells.find(id);
+	if (it == m_object_cells.end())
+		return;
+
+	v3s16 cell = getCell(pos);
+	if (it->second == cell)
+		return;
+
+	removeFromCell(id, it->second);
+	it->second = cell;
+	m_cells[cell].push_back(id);
+}
+
+void SpatialMap::removeAll()
+{
+	m_cells.clear();
+	m_object_cells.clear();
+}
+
+void SpatialMap::removeFromCell(u16 id, const v3s16 &cell)
+{
+	auto it = m_cells.find(cell);
+	if (it == m_cells.end())
+		return;
+
+	std::vector<u16> &ids = it->second;
+	auto found = std::find(ids.begin(), ids.end(), id);
+	if (found != ids.end()) {
+		*found = ids.back();
+		ids.pop_back();
+	}
+	if (ids.empty())
+		m_cells.erase(it);
+}
+
+void SpatialMap::getRelevantObjectIds(const aabb3f &box,
+		const std::function<void(u16 id)> &callback) const
+{
+	if (m_object_cells.empty())
+		return;
+
+	v3s16 min_cell = getCell(box.MinEdge);
+	v3s16 max_cell = getCell(box.MaxEdge);
+
+	u64 cell_count = (u64)(max_cell.X - min_cell.X + 1) *
+			(u64)(max_cell.Y - min_cell.Y + 1) *
+			(u64)(max_cell.Z - min_cell.Z + 1);
+
+	// Walking the grid is only worth it while the box covers fewer cells
+	// than there are occupied cells
+	if (cell_count > m_cells.size()) {
+		for (const auto &it : m_cells) {
+			const v3s16 &c = it.first;
+			if (c.X < min_cell.X || c.X > max_cell.X ||
+					c.Y < min_cell.Y || c.Y > max_cell.Y ||
+					c.Z < min_cell.Z || c.Z > max_cell.Z)
+				continue;
+			for (u16 id : it.second)
+				callback(id);
+		}
+		return;
+	}
+
+	// int counters, as the cell range may end at S16_MAX
+	for (s32 x = min_cell.X; x <= max_cell.X; x++)
+	for (s32 y = min_cell.Y; y <= max_cell.Y; y++)
+	for (s32 z = min_cell.Z; z <= max_cell.Z; z++) {
+		auto it = m_cells.find(v3s16(x, y, z));
+		if (it == m_cells.end())
+			continue;
+		for (u16 id : it->second)
+			callback(id);
+	}
+}
+
+} // namespace server
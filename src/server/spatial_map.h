@@ -0,0 +1,64 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "constants.h"
+
+namespace server
+{
+
+/*
+	Uniform grid of active object ids, bucketed by mapblock-sized cells.
+
+	Lookups return every object whose cell intersects the queried box,
+	so callers must still check the exact position of each candidate.
+*/
+class SpatialMap
+{
+public:
+	// Side length of a cell, in world units (one mapblock)
+	static constexpr f32 CELL_SIZE = MAP_BLOCKSIZE * BS;
+
+	void insert(u16 id, const v3f &pos);
+	void remove(u16 id);
+	// Moves an already inserted object; unknown ids are ignored
+	void updatePosition(u16 id, const v3f &pos);
+	void removeAll();
+
+	size_t size() const { return m_object_cells.size(); }
+
+	// Calls callback for every id stored in a cell touched by box
+	void getRelevantObjectIds(const aabb3f &box,
+			const std::function<void(u16 id)> &callback) const;
+
+	static v3s16 getCell(const v3f &pos);
+
+private:
+	void removeFromCell(u16 id, const v3s16 &cell);
+
+	std::unordered_map<v3s16, std::vector<u16>> m_cells;
+	std::unordered_map<u16, v3s16> m_object_cells;
+};
+
+} // namespace server
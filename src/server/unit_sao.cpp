@@ -350,6 +350,43 @@ std::string UnitSAO::generateUpdatePositionCommand(const v3f &position,
 	return os.str();
 }
 
+std::string UnitSAO::generatePositionKeyframeCommand() const
+{
+	if (!m_position_keyframe.valid)
+		return "";
+
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, AO_CMD_UPDATE_POSITION_COMPACT);
+	AOPositionUpdate::serializeKeyframeOnly(os, m_position_keyframe);
+	return os.str();
+}
+
+void UnitSAO::sendPositionUpdate(const AOPositionUpdate &update)
+{
+	// Older clients get every field at full precision
+	m_messages_out.emplace(getId(), false, generateUpdatePositionCommand(
+			update.position, update.velocity, update.acceleration,
+			update.rotation, update.do_interpolate, update.is_movement_end,
+			update.update_interval));
+	m_messages_out.back().max_protocol_version = 43;
+
+	// Start a new keyframe once the position is too far from the last one
+	bool is_keyframe = !AOPositionUpdate::fitsKeyframe(update.position,
+			m_position_keyframe);
+	if (is_keyframe) {
+		m_position_keyframe.valid = true;
+		m_position_keyframe.id++;
+		m_position_keyframe.position = update.position;
+	}
+
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, AO_CMD_UPDATE_POSITION_COMPACT);
+	update.serializeCompact(os, m_position_keyframe, is_keyframe);
+	// Clients must not miss keyframes, the other updates may get lost
+	m_messages_out.emplace(getId(), is_keyframe, os.str());
+	m_messages_out.back().min_protocol_version = 44;
+}
+
 std::string UnitSAO::generateSetPropertiesCommand(const ObjectProperties &prop) const
 {
 	std::ostringstream os(std::ios::binary);
@@ -102,7 +102,12 @@ class UnitSAO : public ServerActiveObject
 	std::string generateSetPropertiesCommand(const ObjectProperties &prop) const;
 	static std::string generateUpdateBonePositionCommand(const std::string &bone,
 			const v3f &position, const v3f &rotation);
+	// Tells a client since protocol 44 which keyframe position updates are
+	// relative to. Empty if no position was sent yet.
+	std::string generatePositionKeyframeCommand() const;
 	void sendPunchCommand();
+	// Queues update for every client, in compact form where supported
+	void sendPositionUpdate(const AOPositionUpdate &update);
 
 protected:
 	u16 m_hp = 1;
@@ -127,6 +132,9 @@ class UnitSAO : public ServerActiveObject
 
 	std::string generatePunchCommand(u16 result_hp) const;
 
+	// Position of the last keyframe sent to clients
+	AOPositionKeyframe m_position_keyframe;
+
 	// Armor groups
 	bool m_armor_groups_sent = false;
 
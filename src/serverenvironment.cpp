@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodemetadata.h"
 #include "gamedef.h"
 #include "map.h"
+#include "noise.h"
 #include "porting.h"
 #include "profiler.h"
 #include "raycast.h"
@@ -36,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
+#include "util/worker_pool.h"
 #include "threading/mutex_auto_lock.h"
 #include "filesys.h"
 #include "gameparams.h"
@@ -298,27 +300,13 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 	ActiveBlockList
 */
 
-void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
-{
-	v3s16 p;
-	for(p.X=p0.X-r; p.X<=p0.X+r; p.X++)
-		for(p.Y=p0.Y-r; p.Y<=p0.Y+r; p.Y++)
-			for(p.Z=p0.Z-r; p.Z<=p0.Z+r; p.Z++)
-			{
-				// limit to a sphere
-				if (p.getDistanceFrom(p0) <= r) {
-					// Set in list
-					list.insert(p);
-				}
-			}
-}
-
+// Appends the blocks in sight in ascending order
 void fillViewConeBlock(v3s16 p0,
 	const s16 r,
 	const v3f camera_pos,
 	const v3f camera_dir,
 	const float camera_fov,
-	std::set<v3s16> &list)
+	std::vector<v3s16> &list)
 {
 	v3s16 p;
 	const s16 r_nodes = r * BS * MAP_BLOCKSIZE;
@@ -326,7 +314,7 @@ void fillViewConeBlock(v3s16 p0,
 	for (p.Y = p0.Y - r; p.Y <= p0.Y+r; p.Y++)
 	for (p.Z = p0.Z - r; p.Z <= p0.Z+r; p.Z++) {
 		if (isBlockInSight(p, camera_pos, camera_dir, camera_fov, r_nodes)) {
-			list.insert(p);
+			list.push_back(p);
 		}
 	}
 }
@@ -334,18 +322,15 @@ void fillViewConeBlock(v3s16 p0,
 void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 	s16 active_block_range,
 	s16 active_object_range,
-	std::set<v3s16> &blocks_removed,
-	std::set<v3s16> &blocks_added)
+	std::vector<v3s16> &blocks_removed,
+	std::vector<v3s16> &blocks_added)
 {
-	/*
-		Create the new list
-	*/
-	std::set<v3s16> newlist = m_forceloaded_list;
-	m_abm_list = m_forceloaded_list;
+	std::vector<PlayerView> players;
+	players.reserve(active_players.size());
 	for (const PlayerSAO *playersao : active_players) {
-		v3s16 pos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
-		fillRadiusBlock(pos, active_block_range, m_abm_list);
-		fillRadiusBlock(pos, active_block_range, newlist);
+		PlayerView view;
+		view.id = playersao->getId();
+		view.blockpos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
 
 		s16 player_ao_range = std::min(active_object_range, playersao->getWantedRange());
 		// only do this if this would add blocks
@@ -355,39 +340,267 @@ void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 			camera_dir.rotateXZBy(playersao->getRotation().Y);
 			if (playersao->getCameraInverted())
 				camera_dir = -camera_dir;
-			fillViewConeBlock(pos,
-				player_ao_range,
-				playersao->getEyePosition(),
-				camera_dir,
-				playersao->getFov(),
-				newlist);
+			view.cone_range = player_ao_range;
+			view.camera_pos = playersao->getEyePosition();
+			view.camera_dir = camera_dir;
+			view.fov = playersao->getFov();
 		}
+		players.push_back(view);
+	}
+
+	update(players, active_block_range, blocks_removed, blocks_added);
+}
+
+void ActiveBlockList::update(const std::vector<PlayerView> &players,
+	s16 active_block_range,
+	std::vector<v3s16> &blocks_removed,
+	std::vector<v3s16> &blocks_added)
+{
+	// Try again to activate the blocks which could not be activated
+	for (v3s16 p : m_retry) {
+		auto it = m_refs.find(p);
+		if (it == m_refs.end())
+			continue;
+		markChanged(p, it->second);
+	}
+	m_retry.clear();
+
+	if (active_block_range != m_range) {
+		for (auto &it : m_players)
+			releasePlayer(it.second);
+		m_players.clear();
+		setRange(active_block_range);
 	}
 
 	/*
-		Find out which blocks on the old list are not on the new list
+		Count forceloaded blocks
 	*/
-	// Go through old list
-	for (v3s16 p : m_list) {
-		// If not on new list, it's been removed
-		if (newlist.find(p) == newlist.end())
-			blocks_removed.insert(p);
+	if (m_forceloaded_refs != m_forceloaded_list) {
+		for (v3s16 p : m_forceloaded_list) {
+			if (m_forceloaded_refs.find(p) == m_forceloaded_refs.end())
+				addRef(p, true);
+		}
+		for (v3s16 p : m_forceloaded_refs) {
+			if (m_forceloaded_list.find(p) == m_forceloaded_list.end())
+				removeRef(p, true);
+		}
+		m_forceloaded_refs = m_forceloaded_list;
 	}
 
 	/*
-		Find out which blocks on the new list are not on the old list
+		Count the blocks around players
 	*/
-	// Go through new list
-	for (v3s16 p : newlist) {
-		// If not on old list, it's been added
-		if (m_list.find(p) == m_list.end())
-			blocks_added.insert(p);
+	std::unordered_set<u16> seen;
+	for (const PlayerView &view : players) {
+		seen.insert(view.id);
+		auto res = m_players.emplace(view.id, PlayerState());
+		PlayerState &state = res.first->second;
+		if (res.second)
+			addSphere(view.blockpos);
+		else if (state.blockpos != view.blockpos)
+			moveSphere(state.blockpos, view.blockpos);
+		state.blockpos = view.blockpos;
+
+		updateCone(state, view);
+	}
+
+	// Players which are gone
+	for (auto it = m_players.begin(); it != m_players.end(); ) {
+		if (seen.find(it->first) == seen.end()) {
+			releasePlayer(it->second);
+			it = m_players.erase(it);
+		} else {
+			++it;
+		}
 	}
 
 	/*
-		Update m_list
+		Apply the changes to the lists
 	*/
-	m_list = std::move(newlist);
+	for (v3s16 p : m_changed) {
+		auto it = m_refs.find(p);
+		BlockRefs &refs = it->second;
+		bool active = refs.all > 0;
+		bool abm = refs.abm > 0;
+
+		if (active != refs.was_active) {
+			if (active) {
+				m_list.insert(p);
+				blocks_added.push_back(p);
+			} else {
+				m_list.erase(p);
+				blocks_removed.push_back(p);
+			}
+		}
+		if (abm != refs.was_abm) {
+			if (abm)
+				m_abm_list.insert(p);
+			else
+				m_abm_list.erase(p);
+		}
+
+		if (active)
+			refs.changed = false;
+		else
+			m_refs.erase(it);
+	}
+	m_changed.clear();
+}
+
+void ActiveBlockList::clear()
+{
+	m_list.clear();
+	m_abm_list.clear();
+	m_players.clear();
+	m_refs.clear();
+	m_forceloaded_refs.clear();
+	m_retry.clear();
+}
+
+void ActiveBlockList::setRange(s16 range)
+{
+	m_range = range;
+	m_shells.clear();
+	m_sphere.clear();
+
+	v3s16 p0(0, 0, 0);
+	v3s16 p;
+	for(p.X=-range; p.X<=range; p.X++)
+		for(p.Y=-range; p.Y<=range; p.Y++)
+			for(p.Z=-range; p.Z<=range; p.Z++)
+			{
+				// limit to a sphere
+				if (p.getDistanceFrom(p0) <= range)
+					m_sphere.push_back(p);
+			}
+}
+
+const ActiveBlockList::Shell &ActiveBlockList::getShell(v3s16 dir)
+{
+	auto it = m_shells.find(dir);
+	if (it != m_shells.end())
+		return it->second;
+
+	v3s16 p0(0, 0, 0);
+	Shell &shell = m_shells[dir];
+	for (v3s16 p : m_sphere) {
+		// Relative to the new center, outside of the old sphere
+		if ((p + dir).getDistanceFrom(p0) > m_range)
+			shell.entering.push_back(p);
+		// Relative to the old center, outside of the new sphere
+		if ((p - dir).getDistanceFrom(p0) > m_range)
+			shell.leaving.push_back(p);
+	}
+	return shell;
+}
+
+void ActiveBlockList::addSphere(v3s16 center)
+{
+	for (v3s16 p : m_sphere)
+		addRef(center + p, true);
+}
+
+void ActiveBlockList::removeSphere(v3s16 center)
+{
+	for (v3s16 p : m_sphere)
+		removeRef(center + p, true);
+}
+
+void ActiveBlockList::moveSphere(v3s16 from, v3s16 to)
+{
+	v3s16 dir = to - from;
+	if (std::abs(dir.X) > 1 || std::abs(dir.Y) > 1 || std::abs(dir.Z) > 1) {
+		// Teleported, not worth caching the shell
+		addSphere(to);
+		removeSphere(from);
+		return;
+	}
+
+	const Shell &shell = getShell(dir);
+	for (v3s16 p : shell.entering)
+		addRef(to + p, true);
+	for (v3s16 p : shell.leaving)
+		removeRef(from + p, true);
+}
+
+void ActiveBlockList::updateCone(PlayerState &state, const PlayerView &view)
+{
+	bool has_cone = view.cone_range > m_range;
+	if (!has_cone && state.cone.empty())
+		return;
+	const PlayerView &old = state.cone_view;
+	if (has_cone && old.cone_range == view.cone_range &&
+			old.blockpos == view.blockpos &&
+			old.camera_pos == view.camera_pos &&
+			old.camera_dir == view.camera_dir &&
+			old.fov == view.fov)
+		return;
+
+	std::vector<v3s16> cone;
+	if (has_cone) {
+		fillViewConeBlock(view.blockpos, view.cone_range, view.camera_pos,
+				view.camera_dir, view.fov, cone);
+	}
+
+	// Both lists are sorted, count only the difference
+	auto a = cone.begin();
+	auto b = state.cone.begin();
+	while (a != cone.end() || b != state.cone.end()) {
+		if (b == state.cone.end() || (a != cone.end() && *a < *b)) {
+			addRef(*a++, false);
+		} else if (a == cone.end() || *b < *a) {
+			removeRef(*b++, false);
+		} else {
+			++a;
+			++b;
+		}
+	}
+
+	state.cone = std::move(cone);
+	state.cone_view = view;
+	if (!has_cone)
+		state.cone_view.cone_range = 0;
+}
+
+void ActiveBlockList::releasePlayer(PlayerState &state)
+{
+	removeSphere(state.blockpos);
+	for (v3s16 p : state.cone)
+		removeRef(p, false);
+	state.cone.clear();
+}
+
+void ActiveBlockList::addRef(v3s16 p, bool abm)
+{
+	BlockRefs &refs = m_refs[p];
+	if (refs.all == 0 || (abm && refs.abm == 0))
+		markChanged(p, refs);
+	refs.all++;
+	if (abm)
+		refs.abm++;
+}
+
+void ActiveBlockList::removeRef(v3s16 p, bool abm)
+{
+	auto it = m_refs.find(p);
+	assert(it != m_refs.end());
+	BlockRefs &refs = it->second;
+	assert(refs.all > 0 && (!abm || refs.abm > 0));
+	refs.all--;
+	if (abm)
+		refs.abm--;
+	if (refs.all == 0 || (abm && refs.abm == 0))
+		markChanged(p, refs);
+}
+
+void ActiveBlockList::markChanged(v3s16 p, BlockRefs &refs)
+{
+	if (refs.changed)
+		return;
+	refs.changed = true;
+	refs.was_active = m_list.find(p) != m_list.end();
+	refs.was_abm = m_abm_list.find(p) != m_abm_list.end();
+	m_changed.push_back(p);
 }
 
 /*
@@ -427,6 +640,9 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 
 	m_active_object_gauge = mb->addGauge(
 		"minetest_env_active_objects", "Number of active objects");
+
+	m_abm_pool = std::make_unique<WorkerPool>("ABM",
+			g_settings->getU16("num_abm_threads"));
 }
 
 void ServerEnvironment::init()
@@ -779,18 +995,52 @@ struct ActiveABM
 	bool check_required_neighbors; // false if required_neighbors is known to be empty
 	s16 min_y;
 	s16 max_y;
+	// Index into ABMHandler::m_bulk, or NO_BULK if triggers are run one by one
+	size_t bulk_index;
+	static constexpr size_t NO_BULK = SIZE_MAX;
+};
+
+// An ABM which passed all checks for a node and is to be run
+struct ABMTrigger
+{
+	const ActiveABM *aabm;
+	u16 i; // node index within the block
+	content_t c; // content of the node when it was checked
+};
+
+struct ABMBlockTriggers
+{
+	MapBlock *block = nullptr;
+	std::vector<ABMTrigger> triggers;
+	// whether the block has trigger nodes at all
+	bool scanned = false;
+	// whether the content index of the block could be reused
+	bool cached = false;
 };
 
 class ABMHandler
 {
 private:
+	// A node passed to a bulk action at the end of the step
+	struct BulkTrigger
+	{
+		MapBlock *block;
+		u16 i;
+		content_t c;
+	};
+
 	ServerEnvironment *m_env;
 	std::vector<std::vector<ActiveABM> *> m_aabms;
+	std::shared_ptr<const MapBlockContentIndex::Filter> m_trigger_filter;
+	// Collected nodes of the ABMs with a bulk action, in ABM order
+	std::vector<std::pair<ActiveBlockModifier *, std::vector<BulkTrigger>>> m_bulk;
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
-		bool use_timers):
-		m_env(env)
+		bool use_timers,
+		const std::shared_ptr<const MapBlockContentIndex::Filter> &trigger_filter):
+		m_env(env),
+		m_trigger_filter(trigger_filter)
 	{
 		if(dtime_s < 0.001)
 			return;
@@ -813,6 +1063,11 @@ class ABMHandler
 				chance = 1;
 			ActiveABM aabm;
 			aabm.abm = abm;
+			aabm.bulk_index = ActiveABM::NO_BULK;
+			if (abm->getBulkAction()) {
+				aabm.bulk_index = m_bulk.size();
+				m_bulk.emplace_back(abm, std::vector<BulkTrigger>());
+			}
 			if (abm->getSimpleCatchUp()) {
 				float intervals = actual_interval / trigger_interval;
 				if (intervals == 0)
@@ -883,115 +1138,171 @@ class ABMHandler
 		wider += wider_unknown_count * wider / wider_known_count;
 		return active_object_count;
 	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	// Checks the trigger nodes of a block against the y limits, chances and
+	// neighbor requirements of the ABMs, without running any of them.
+	// Only reads the map, so blocks can be collected on several threads at once.
+	void collect(MapBlock *block, PcgRandom &pr, ABMBlockTriggers &out) const
 	{
+		out.block = block;
+		out.triggers.clear();
+		out.scanned = false;
 		if (m_aabms.empty())
 			return;
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (block->contents_cached) {
-			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
+		// The content index tells which trigger nodes the block contains
+		// without looking at all of its nodes
+		bool index_built;
+		const MapBlockContentIndex &index = block->getContentIndex(
+				m_trigger_filter, &index_built);
+		out.cached = !index_built;
+
+		const ServerMap *map = &m_env->getServerMap();
+
+		for (const auto &it : index.getNodeLists()) {
+			content_t c = it.first;
+			if (c >= m_aabms.size() || !m_aabms[c])
+				continue;
+			out.scanned = true;
+
+			for (u16 i : it.second) {
+				v3s16 p0 = indexToPos(i);
+				v3s16 p = p0 + block->getPosRelative();
+				for (const ActiveABM &aabm : *m_aabms[c]) {
+					if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
+						continue;
+
+					if (pr.next() % aabm.chance != 0)
+						continue;
+
+					// Check neighbors
+					if (aabm.check_required_neighbors) {
+						v3s16 p1;
+						for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+						for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+						for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+						{
+							if(p1 == p0)
+								continue;
+							content_t c;
+							if (block->isValidPosition(p1)) {
+								// if the neighbor is found on the same map block
+								// get it straight from there
+								const MapNode &n = block->getNodeNoCheck(p1);
+								c = n.getContent();
+							} else {
+								// otherwise consult the map, bypassing its caches
+								c = getContentNoCache(map, p1 + block->getPosRelative());
+							}
+							if (CONTAINS(aabm.required_neighbors, c))
+								goto neighbor_found;
+						}
+						// No required neighbor found
+						continue;
+					}
+					neighbor_found:
+
+					out.triggers.push_back({&aabm, i, c});
 				}
 			}
-			if (!run_abms)
-				return;
-		} else {
-			// Clear any caching
-			block->contents.clear();
 		}
-		blocks_scanned++;
+	}
+
+	// Runs the triggers collected for a block, in order
+	void apply(ABMBlockTriggers &bt, int &abms_run)
+	{
+		if (bt.triggers.empty())
+			return;
 
+		MapBlock *block = bt.block;
 		ServerMap *map = &m_env->getServerMap();
 
-		u32 active_object_count_wider;
-		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
-		m_env->m_added_objects = 0;
+		// Counted when the first ABM that is not bulk-only runs, since
+		// bulk actions do not receive the counts
+		bool counted = false;
+		u32 active_object_count = 0;
+		u32 active_object_count_wider = 0;
 
-		v3s16 p0;
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		{
+		for (const ABMTrigger &trigger : bt.triggers) {
+			v3s16 p0 = indexToPos(trigger.i);
 			MapNode n = block->getNodeNoCheck(p0);
-			content_t c = n.getContent();
-			// Cache content types as we go
-			if (!block->contents_cached && !block->do_not_cache_contents) {
-				block->contents.insert(c);
-				if (block->contents.size() > 64) {
-					// Too many different nodes... don't try to cache
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-				}
-			}
-
-			if (c >= m_aabms.size() || !m_aabms[c])
+			// Changed by an ABM run before
+			if (n.getContent() != trigger.c)
 				continue;
 
-			v3s16 p = p0 + block->getPosRelative();
-			for (ActiveABM &aabm : *m_aabms[c]) {
-				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
-					continue;
+			// Bulk actions are run once for all blocks, see applyBulk()
+			if (trigger.aabm->bulk_index != ActiveABM::NO_BULK) {
+				m_bulk[trigger.aabm->bulk_index].second.push_back(
+						{block, trigger.i, trigger.c});
+				continue;
+			}
 
-				if (myrand() % aabm.chance != 0)
-					continue;
+			if (!counted) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+				counted = true;
+			}
 
-				// Check neighbors
-				if (aabm.check_required_neighbors) {
-					v3s16 p1;
-					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-					{
-						if(p1 == p0)
-							continue;
-						content_t c;
-						if (block->isValidPosition(p1)) {
-							// if the neighbor is found on the same map block
-							// get it straight from there
-							const MapNode &n = block->getNodeNoCheck(p1);
-							c = n.getContent();
-						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
-						}
-						if (CONTAINS(aabm.required_neighbors, c))
-							goto neighbor_found;
-					}
-					// No required neighbor found
-					continue;
-				}
-				neighbor_found:
+			v3s16 p = p0 + block->getPosRelative();
+			ActiveBlockModifier *abm = trigger.aabm->abm;
 
-				abms_run++;
-				// Call all the trigger variations
-				aabm.abm->trigger(m_env, p, n);
-				aabm.abm->trigger(m_env, p, n,
-					active_object_count, active_object_count_wider);
+			abms_run++;
+			// Call all the trigger variations
+			abm->trigger(m_env, p, n);
+			abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
 
-				if (block->isOrphan())
-					return;
+			if (block->isOrphan())
+				return;
 
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
-					active_object_count = countObjects(block, map, active_object_count_wider);
-					m_env->m_added_objects = 0;
-				}
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+			}
+		}
+	}
 
-				// Update and check node after possible modification
-				n = block->getNodeNoCheck(p0);
-				if (n.getContent() != c)
-					break;
+	// Runs the bulk actions with the nodes collected by apply()
+	void applyBulk(int &abms_run)
+	{
+		std::vector<v3s16> positions;
+		std::vector<MapNode> nodes;
+		for (auto &it : m_bulk) {
+			positions.clear();
+			nodes.clear();
+			for (const BulkTrigger &trigger : it.second) {
+				if (trigger.block->isOrphan())
+					continue;
+				v3s16 p0 = indexToPos(trigger.i);
+				MapNode n = trigger.block->getNodeNoCheck(p0);
+				// Changed by an ABM run before
+				if (n.getContent() != trigger.c)
+					continue;
+				positions.push_back(p0 + trigger.block->getPosRelative());
+				nodes.push_back(n);
 			}
+			it.second.clear();
+			if (positions.empty())
+				continue;
+
+			abms_run += positions.size();
+			it.first->triggerBulk(m_env, positions, nodes);
 		}
-		block->contents_cached = !block->do_not_cache_contents;
+	}
+
+private:
+	static v3s16 indexToPos(u16 i)
+	{
+		return v3s16(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+	}
+
+	static content_t getContentNoCache(const ServerMap *map, v3s16 p)
+	{
+		MapBlock *block = map->getBlockNoCreateNoExNoCache(getNodeBlockPos(p));
+		if (!block)
+			return CONTENT_IGNORE;
+		return block->getNodeNoCheck(p - block->getPosRelative()).getContent();
 	}
 };
 
@@ -1046,6 +1357,31 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 void ServerEnvironment::addActiveBlockModifier(ActiveBlockModifier *abm)
 {
 	m_abms.emplace_back(abm);
+	m_abm_trigger_filter.reset();
+}
+
+const std::shared_ptr<const MapBlockContentIndex::Filter> &
+		ServerEnvironment::getABMTriggerFilter()
+{
+	if (m_abm_trigger_filter)
+		return m_abm_trigger_filter;
+
+	const NodeDefManager *ndef = m_server->ndef();
+	auto filter = std::make_shared<MapBlockContentIndex::Filter>();
+	std::vector<content_t> ids;
+	for (const ABMWithState &abmws : m_abms) {
+		for (const std::string &content_s : abmws.abm->getTriggerContents()) {
+			ids.clear();
+			ndef->getIds(content_s, ids);
+			for (content_t c : ids) {
+				if (c >= filter->size())
+					filter->resize(c + 1, false);
+				(*filter)[c] = true;
+			}
+		}
+	}
+	m_abm_trigger_filter = std::move(filter);
+	return m_abm_trigger_filter;
 }
 
 void ServerEnvironment::addLoadingBlockModifierDef(LoadingBlockModifierDef *lbm)
@@ -1398,8 +1734,8 @@ void ServerEnvironment::step(float dtime)
 				g_settings->getS16("active_object_send_range_blocks");
 		static thread_local const s16 active_block_range =
 				g_settings->getS16("active_block_range");
-		std::set<v3s16> blocks_removed;
-		std::set<v3s16> blocks_added;
+		std::vector<v3s16> blocks_removed;
+		std::vector<v3s16> blocks_added;
 		m_active_blocks.update(players, active_block_range, active_object_range,
 			blocks_removed, blocks_added);
 
@@ -1417,6 +1753,8 @@ void ServerEnvironment::step(float dtime)
 
 			// Set current time as timestamp (and let it set ChangedFlag)
 			block->setTimestamp(m_game_time);
+			// Only active blocks run ABMs
+			block->clearContentIndex();
 		}
 
 		/*
@@ -1483,44 +1821,80 @@ void ServerEnvironment::step(float dtime)
 		std::shuffle(m_abms.begin(), m_abms.end(), m_rgen);
 
 		// Initialize handling of ActiveBlockModifiers
-		ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true);
+		ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true,
+				getABMTriggerFilter());
 
 		int blocks_scanned = 0;
 		int abms_run = 0;
 		int blocks_cached = 0;
 
-		std::vector<v3s16> output(m_active_blocks.m_abm_list.size());
+		std::vector<MapBlock *> blocks;
+		blocks.reserve(m_active_blocks.m_abm_list.size());
+		for (const v3s16 &p : m_active_blocks.m_abm_list) {
+			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+			if (block)
+				blocks.push_back(block);
+		}
 
 		// Shuffle the active blocks so that each block gets an equal chance
 		// of having its ABMs run.
-		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
-		std::shuffle(output.begin(), output.end(), m_rgen);
+		std::shuffle(blocks.begin(), blocks.end(), m_rgen);
+
+		/*
+			Select the nodes to run ABMs on. This does not involve Lua and
+			only reads the map, so it is spread over the worker threads.
+			Each chunk of blocks gets its own random generator.
+		*/
+		std::vector<ABMBlockTriggers> triggers(blocks.size());
+		{
+			ScopeProfiler sp2(g_profiler, "SEnv: ABM selection avg per interval", SPT_AVG);
+			const size_t chunk_size = 16;
+			const size_t chunk_count = (blocks.size() + chunk_size - 1) / chunk_size;
+			std::vector<u64> seeds(chunk_count);
+			for (u64 &chunk_seed : seeds)
+				chunk_seed = ((u64)m_rgen() << 32) | m_rgen();
+
+			m_abm_pool->run(chunk_count, [&] (size_t chunk) {
+				PcgRandom pr(seeds[chunk]);
+				size_t end = std::min(blocks.size(), (chunk + 1) * chunk_size);
+				for (size_t i = chunk * chunk_size; i < end; i++)
+					abmhandler.collect(blocks[i], pr, triggers[i]);
+			});
+		}
 
-		int i = 0;
+		/*
+			Run the selected ABMs
+		*/
+		size_t i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
-				continue;
-
+		for (ABMBlockTriggers &bt : triggers) {
 			i++;
 
 			// Set current time as timestamp
-			block->setTimestampNoChangedFlag(m_game_time);
+			bt.block->setTimestampNoChangedFlag(m_game_time);
+
+			if (bt.scanned)
+				blocks_scanned++;
+			if (bt.cached)
+				blocks_cached++;
 
 			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			if (!bt.block->isOrphan())
+				abmhandler.apply(bt, abms_run);
 
 			u32 time_ms = timer.getTimerTime();
 
 			if (time_ms > max_time_ms) {
 				warningstream << "active block modifiers took "
 					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
+					  << triggers.size() << " active blocks)" << std::endl;
 				break;
 			}
 		}
+
+		abmhandler.applyBulk(abms_run);
+
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
 		g_profiler->avg("ServerEnv: active blocks cached", blocks_cached);
 		g_profiler->avg("ServerEnv: active blocks scanned for ABMs", blocks_scanned);
@@ -22,12 +22,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "activeobject.h"
 #include "environment.h"
 #include "map.h"
+#include "mapblock.h"
 #include "settings.h"
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
 #include "util/metricsbackend.h"
 #include <set>
 #include <random>
+#include <unordered_map>
+#include <unordered_set>
 
 class IGameDef;
 struct GameParams;
@@ -41,6 +44,7 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class WorkerPool;
 enum AccessDeniedCode : u8;
 typedef u16 session_t;
 
@@ -76,6 +80,11 @@ class ActiveBlockModifier
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n){};
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 		u32 active_object_count, u32 active_object_count_wider){};
+	// Whether to collect the nodes of a whole step and pass them to
+	// triggerBulk() instead of calling trigger() for each of them
+	virtual bool getBulkAction() { return false; }
+	virtual void triggerBulk(ServerEnvironment *env,
+		const std::vector<v3s16> &positions, const std::vector<MapNode> &nodes){};
 };
 
 struct ABMWithState
@@ -159,16 +168,39 @@ class LBMManager
 
 /*
 	List of active blocks, used by ServerEnvironment
+
+	Every block keeps a count of the players (and forceloads) wanting it
+	active. When a player moves into another block only the blocks
+	entering or leaving its radius are counted up or down, so players
+	which stay within their block cost next to nothing.
 */
 
 class ActiveBlockList
 {
 public:
+	// What update() needs to know of a player
+	struct PlayerView
+	{
+		// Unique among the players passed to one update()
+		u16 id = 0;
+		v3s16 blockpos;
+		// Range of the view cone, only used if larger than active_block_range
+		s16 cone_range = 0;
+		v3f camera_pos;
+		v3f camera_dir;
+		f32 fov = 0.0f;
+	};
+
 	void update(std::vector<PlayerSAO*> &active_players,
 		s16 active_block_range,
 		s16 active_object_range,
-		std::set<v3s16> &blocks_removed,
-		std::set<v3s16> &blocks_added);
+		std::vector<v3s16> &blocks_removed,
+		std::vector<v3s16> &blocks_added);
+
+	void update(const std::vector<PlayerView> &players,
+		s16 active_block_range,
+		std::vector<v3s16> &blocks_removed,
+		std::vector<v3s16> &blocks_added);
 
 	bool contains(v3s16 p) const {
 		return (m_list.find(p) != m_list.end());
@@ -178,19 +210,74 @@ class ActiveBlockList
 		return m_list.size();
 	}
 
-	void clear() {
-		m_list.clear();
-	}
+	void clear();
 
+	// The block is added again by the next update() if it is still wanted
 	void remove(v3s16 p) {
 		m_list.erase(p);
 		m_abm_list.erase(p);
+		m_retry.insert(p);
 	}
 
-	std::set<v3s16> m_list;
-	std::set<v3s16> m_abm_list;
+	std::unordered_set<v3s16> m_list;
+	std::unordered_set<v3s16> m_abm_list;
 	// list of blocks that are always active, not modified by this class
 	std::set<v3s16> m_forceloaded_list;
+
+private:
+	struct PlayerState
+	{
+		v3s16 blockpos;
+		// View cone blocks in ascending order, and what they were made from
+		std::vector<v3s16> cone;
+		PlayerView cone_view;
+	};
+
+	struct BlockRefs
+	{
+		u32 all = 0;
+		// References which also make the block run ABMs
+		u32 abm = 0;
+		// Whether the block is in m_changed, and its state before
+		bool changed = false;
+		bool was_active;
+		bool was_abm;
+	};
+
+	// Block offsets entering and leaving the radius when moving by one block
+	struct Shell
+	{
+		std::vector<v3s16> entering;
+		std::vector<v3s16> leaving;
+	};
+
+	void setRange(s16 range);
+	const Shell &getShell(v3s16 dir);
+
+	void addSphere(v3s16 center);
+	void removeSphere(v3s16 center);
+	void moveSphere(v3s16 from, v3s16 to);
+	void updateCone(PlayerState &state, const PlayerView &view);
+	void releasePlayer(PlayerState &state);
+
+	// abm: whether the reference also makes the block run ABMs
+	void addRef(v3s16 p, bool abm);
+	void removeRef(v3s16 p, bool abm);
+	void markChanged(v3s16 p, BlockRefs &refs);
+
+	s16 m_range = -1;
+	// Blocks within the radius around (0,0,0)
+	std::vector<v3s16> m_sphere;
+	std::unordered_map<v3s16, Shell> m_shells;
+
+	std::unordered_map<u16, PlayerState> m_players;
+	std::unordered_map<v3s16, BlockRefs> m_refs;
+	// Forceloaded blocks counted in the references
+	std::set<v3s16> m_forceloaded_refs;
+	// Blocks dropped by remove()
+	std::unordered_set<v3s16> m_retry;
+	// Blocks whose references dropped to or rose from zero during update()
+	std::vector<v3s16> m_changed;
 };
 
 /*
@@ -358,6 +445,12 @@ class ServerEnvironment final : public Environment
 		return m_ao_manager.getObjectsInArea(box, objects, include_obj_cb);
 	}
 
+	// Called by objects when their base position changes
+	void updateObjectPos(u16 id, const v3f &pos)
+	{
+		m_ao_manager.updateObjectPos(id, pos);
+	}
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -453,6 +546,9 @@ class ServerEnvironment final : public Environment
 	bool saveStaticToBlock(v3s16 blockpos, u16 store_id,
 			ServerActiveObject *obj, const StaticObject &s_obj, u32 mod_reason);
 
+	// Returns m_abm_trigger_filter, building it if needed
+	const std::shared_ptr<const MapBlockContentIndex::Filter> &getABMTriggerFilter();
+
 	/*
 		Member variables
 	*/
@@ -492,6 +588,11 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Trigger contents of all ABMs, indexed by the active blocks.
+	// Built on first use, as node ids are not known when ABMs are added.
+	std::shared_ptr<const MapBlockContentIndex::Filter> m_abm_trigger_filter;
+	// Threads selecting the nodes ABMs are run on
+	std::unique_ptr<WorkerPool> m_abm_pool;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
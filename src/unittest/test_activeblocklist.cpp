@@ -0,0 +1,161 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include "serverenvironment.h"
+
+class TestActiveBlockList : public TestBase
+{
+public:
+	TestActiveBlockList() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveBlockList"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testMove();
+	void testForceloaded();
+	void testRemove();
+};
+
+static TestActiveBlockList g_test_instance;
+
+void TestActiveBlockList::runTests(IGameDef *gamedef)
+{
+	TEST(testMove);
+	TEST(testForceloaded);
+	TEST(testRemove);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::unordered_set<v3s16> sphere(v3s16 p0, s16 r)
+{
+	std::unordered_set<v3s16> result;
+	v3s16 p;
+	for (p.X = p0.X - r; p.X <= p0.X + r; p.X++)
+	for (p.Y = p0.Y - r; p.Y <= p0.Y + r; p.Y++)
+	for (p.Z = p0.Z - r; p.Z <= p0.Z + r; p.Z++) {
+		if (p.getDistanceFrom(p0) <= r)
+			result.insert(p);
+	}
+	return result;
+}
+
+static bool contains(const std::vector<v3s16> &list, v3s16 p)
+{
+	return std::find(list.begin(), list.end(), p) != list.end();
+}
+
+void TestActiveBlockList::testMove()
+{
+	ActiveBlockList list;
+	std::vector<ActiveBlockList::PlayerView> players(2);
+	players[0].id = 1;
+	players[1].id = 2;
+	players[1].blockpos = v3s16(3, 0, 0);
+
+	std::vector<v3s16> removed, added;
+	list.update(players, 2, removed, added);
+	std::unordered_set<v3s16> expected = sphere(players[0].blockpos, 2);
+	for (v3s16 p : sphere(players[1].blockpos, 2))
+		expected.insert(p);
+	UASSERT(removed.empty());
+	UASSERTEQ(size_t, added.size(), expected.size());
+	UASSERT(list.m_list == expected);
+	UASSERT(list.m_abm_list == expected);
+
+	// Step by one block, then teleport
+	for (v3s16 pos : {v3s16(0, 1, 0), v3s16(20, -5, 7)}) {
+		std::unordered_set<v3s16> old = list.m_list;
+		players[0].blockpos = pos;
+		removed.clear();
+		added.clear();
+		list.update(players, 2, removed, added);
+
+		expected = sphere(players[0].blockpos, 2);
+		for (v3s16 p : sphere(players[1].blockpos, 2))
+			expected.insert(p);
+		UASSERT(list.m_list == expected);
+		UASSERT(list.m_abm_list == expected);
+		for (v3s16 p : removed)
+			UASSERT(old.count(p) && !expected.count(p));
+		for (v3s16 p : added)
+			UASSERT(!old.count(p) && expected.count(p));
+		UASSERTEQ(size_t, old.size() - removed.size() + added.size(), expected.size());
+	}
+
+	// Player leaves
+	removed.clear();
+	added.clear();
+	players.pop_back();
+	list.update(players, 2, removed, added);
+	UASSERT(list.m_list == sphere(players[0].blockpos, 2));
+	UASSERT(added.empty());
+	UASSERT(contains(removed, v3s16(3, 0, 0)));
+}
+
+void TestActiveBlockList::testForceloaded()
+{
+	ActiveBlockList list;
+	std::vector<ActiveBlockList::PlayerView> players;
+	std::vector<v3s16> removed, added;
+
+	list.m_forceloaded_list.insert(v3s16(100, 0, 0));
+	list.update(players, 2, removed, added);
+	UASSERTEQ(size_t, added.size(), 1);
+	UASSERT(list.contains(v3s16(100, 0, 0)));
+	UASSERT(list.m_abm_list.count(v3s16(100, 0, 0)));
+
+	list.m_forceloaded_list.clear();
+	removed.clear();
+	added.clear();
+	list.update(players, 2, removed, added);
+	UASSERTEQ(size_t, removed.size(), 1);
+	UASSERT(list.m_list.empty());
+	UASSERT(list.m_abm_list.empty());
+}
+
+void TestActiveBlockList::testRemove()
+{
+	ActiveBlockList list;
+	std::vector<ActiveBlockList::PlayerView> players(1);
+	std::vector<v3s16> removed, added;
+	list.update(players, 1, removed, added);
+
+	// Removed blocks are added again while they are wanted
+	list.remove(v3s16(1, 0, 0));
+	UASSERT(!list.contains(v3s16(1, 0, 0)));
+	added.clear();
+	list.update(players, 1, removed, added);
+	UASSERTEQ(size_t, added.size(), 1);
+	UASSERT(added[0] == v3s16(1, 0, 0));
+	UASSERT(list.contains(v3s16(1, 0, 0)));
+
+	// but not once nobody wants them anymore
+	list.remove(v3s16(1, 0, 0));
+	players[0].blockpos = v3s16(-10, 0, 0);
+	removed.clear();
+	added.clear();
+	list.update(players, 1, removed, added);
+	UASSERT(!list.contains(v3s16(1, 0, 0)));
+	UASSERT(!contains(removed, v3s16(1, 0, 0)));
+	UASSERT(!contains(added, v3s16(1, 0, 0)));
+}
@@ -19,6 +19,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <cmath>
+#include <sstream>
 #include "mock_activeobject.h"
 
 class TestActiveObject : public TestBase
@@ -30,6 +32,7 @@ class TestActiveObject : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testAOAttributes();
+	void testCompactPositionUpdate();
 };
 
 static TestActiveObject g_test_instance;
@@ -37,6 +40,7 @@ static TestActiveObject g_test_instance;
 void TestActiveObject::runTests(IGameDef *gamedef)
 {
 	TEST(testAOAttributes);
+	TEST(testCompactPositionUpdate);
 }
 
 void TestActiveObject::testAOAttributes()
@@ -47,3 +51,83 @@ void TestActiveObject::testAOAttributes()
 	ao.setId(558);
 	UASSERT(ao.getId() == 558);
 }
+
+static bool roundtrip(const AOPositionUpdate &update, const AOPositionKeyframe &sent,
+		bool is_keyframe, AOPositionKeyframe &received, AOPositionUpdate &result,
+		size_t *size = nullptr)
+{
+	std::ostringstream os(std::ios::binary);
+	update.serializeCompact(os, sent, is_keyframe);
+	if (size)
+		*size = os.str().size();
+	std::istringstream is(os.str(), std::ios::binary);
+	return result.deSerializeCompact(is, received);
+}
+
+void TestActiveObject::testCompactPositionUpdate()
+{
+	AOPositionUpdate update;
+	update.position = v3f(12345.5f, -20.25f, 300.0f);
+	update.velocity = v3f(10.0f, 0.0f, -5.5f);
+	update.acceleration = v3f(0.0f, -98.0f, 0.0f);
+	update.rotation = v3f(0.0f, 90.0f, 0.0f);
+	update.do_interpolate = true;
+	update.update_interval = 0.2f;
+
+	// Nothing to be relative to yet
+	AOPositionKeyframe sent, received;
+	UASSERT(!AOPositionUpdate::fitsKeyframe(update.position, sent));
+	sent.valid = true;
+	sent.id = 1;
+	sent.position = update.position;
+
+	AOPositionUpdate result;
+	UASSERT(roundtrip(update, sent, true, received, result));
+	UASSERT(received.valid && received.id == 1);
+	UASSERT(result.position == update.position);
+	UASSERT(result.velocity == update.velocity);
+	UASSERT(result.acceleration == update.acceleration);
+	UASSERT(result.rotation == update.rotation);
+	UASSERT(result.do_interpolate && !result.is_movement_end);
+	UASSERT(std::fabs(result.update_interval - 0.2f) < 0.001f);
+
+	// Updates relative to the keyframe, with only yaw and no acceleration
+	update.position += v3f(0.5f, 1.0f / 16.0f, -300.0f);
+	update.acceleration = v3f();
+	update.rotation = v3f(0.0f, 359.0f, 0.0f);
+	UASSERT(AOPositionUpdate::fitsKeyframe(update.position, sent));
+	size_t size;
+	UASSERT(roundtrip(update, sent, false, received, result, &size));
+	UASSERT(result.position.getDistanceFrom(update.position) < 1.0f / 32.0f);
+	UASSERT(result.acceleration == v3f());
+	UASSERT(std::fabs(result.rotation.Y - 359.0f) < 0.01f);
+	// flags, id, position, velocity, yaw, interval
+	UASSERTEQ(size_t, size, 1 + 1 + 6 + 6 + 2 + 2);
+
+	// Too far from the keyframe
+	UASSERT(!AOPositionUpdate::fitsKeyframe(
+			sent.position + v3f(0.0f, 3000.0f, 0.0f), sent));
+
+	// Fast objects keep their full velocity
+	update.velocity = v3f(5000.25f, 0.0f, 0.0f);
+	update.rotation = v3f(10.0f, 20.0f, 30.0f);
+	UASSERT(roundtrip(update, sent, false, received, result));
+	UASSERT(result.velocity == update.velocity);
+	UASSERT(result.rotation.getDistanceFrom(update.rotation) < 0.01f);
+
+	// Updates for another keyframe are dropped
+	AOPositionKeyframe other = sent;
+	other.id = 2;
+	UASSERT(!roundtrip(update, other, false, received, result));
+	AOPositionKeyframe unknown;
+	UASSERT(!roundtrip(update, sent, false, unknown, result));
+
+	// A keyframe alone only sets what later updates are relative to
+	std::ostringstream os(std::ios::binary);
+	AOPositionUpdate::serializeKeyframeOnly(os, other);
+	std::istringstream is(os.str(), std::ios::binary);
+	UASSERT(!result.deSerializeCompact(is, unknown));
+	UASSERT(unknown.valid && unknown.id == 2);
+	UASSERT(unknown.position == other.position);
+	UASSERT(roundtrip(update, other, false, unknown, result));
+}
@@ -0,0 +1,218 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include <cmath>
+#include <unordered_set>
+#include "server/block_send_queue.h"
+#include "util/numeric.h"
+
+class TestBlockSendQueue : public TestBase
+{
+public:
+	TestBlockSendQueue() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestBlockSendQueue"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testArea();
+	void testPriority();
+	void testBudget();
+	void testViewWeight();
+};
+
+static TestBlockSendQueue g_test_instance;
+
+void TestBlockSendQueue::runTests(IGameDef *gamedef)
+{
+	TEST(testArea);
+	TEST(testPriority);
+	TEST(testBudget);
+	TEST(testViewWeight);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::unordered_set<v3s16> sphere(v3s16 p0, s16 r)
+{
+	std::unordered_set<v3s16> result;
+	v3s16 p;
+	for (p.X = p0.X - r; p.X <= p0.X + r; p.X++)
+	for (p.Y = p0.Y - r; p.Y <= p0.Y + r; p.Y++)
+	for (p.Z = p0.Z - r; p.Z <= p0.Z + r; p.Z++) {
+		if (p.getDistanceFrom(p0) <= r)
+			result.insert(p);
+	}
+	return result;
+}
+
+static std::unordered_set<v3s16> pop_all(BlockSendQueue &queue)
+{
+	std::unordered_set<v3s16> result;
+	v3s16 p;
+	float priority;
+	while (queue.pop(p, priority))
+		result.insert(p);
+	return result;
+}
+
+void TestBlockSendQueue::testArea()
+{
+	auto all = [] (v3s16) { return true; };
+
+	BlockSendQueue queue;
+	queue.setPriority([] (v3s16) { return 0.0f; });
+	queue.setArea(v3s16(0, 0, 0), 4, all);
+
+	auto area = sphere(v3s16(0, 0, 0), 4);
+	UASSERTEQ(size_t, queue.size(), area.size());
+	for (v3s16 p : area)
+		UASSERT(queue.contains(p));
+
+	// Moving adds what entered the area and drops what left it
+	queue.setArea(v3s16(1, -2, 0), 4, all);
+	area = sphere(v3s16(1, -2, 0), 4);
+	UASSERT(pop_all(queue) == area);
+	UASSERTEQ(size_t, queue.size(), 0);
+
+	// Only the new blocks are added after the old ones were taken
+	queue.setArea(v3s16(2, -2, 0), 5, all);
+	auto entered = pop_all(queue);
+	for (v3s16 p : sphere(v3s16(2, -2, 0), 5))
+		UASSERT(entered.count(p) == (area.count(p) ? 0 : 1));
+
+	// The filter decides what is added
+	queue.clear();
+	queue.setArea(v3s16(0, 0, 0), 3, [] (v3s16 p) { return p.Y >= 0; });
+	for (v3s16 p : pop_all(queue))
+		UASSERT(p.Y >= 0);
+
+	// Adding only works within the area
+	queue.add(v3s16(0, -1, 0));
+	queue.add(v3s16(0, 10, 0));
+	UASSERT(queue.contains(v3s16(0, -1, 0)));
+	UASSERT(!queue.contains(v3s16(0, 10, 0)));
+	queue.remove(v3s16(0, -1, 0));
+	UASSERTEQ(size_t, queue.size(), 0);
+}
+
+void TestBlockSendQueue::testPriority()
+{
+	BlockSendQueue queue;
+	// Blocks below are never sent, the others nearest first
+	queue.setPriority([] (v3s16 p) {
+		return p.Y < 0 ? INFINITY : (float)p.getDistanceFromSQ(v3s16(0, 0, 0));
+	});
+	queue.setArea(v3s16(0, 0, 0), 3, [] (v3s16) { return true; });
+
+	v3s16 p;
+	float priority, last = -1.0f;
+	size_t count = 0;
+	while (queue.pop(p, priority)) {
+		UASSERT(p.Y >= 0);
+		UASSERT(priority >= last);
+		last = priority;
+		count++;
+	}
+	UASSERT(count > 0);
+	UASSERT(queue.size() > 0);
+
+	// Now nearest to (0, -3, 0) first
+	queue.setPriority([] (v3s16 p) {
+		return (float)p.getDistanceFromSQ(v3s16(0, -3, 0));
+	});
+	UASSERT(queue.pop(p, priority));
+	UASSERT(p == v3s16(0, -3, 0));
+
+	// Re-added blocks are found again, removed ones not
+	queue.add(v3s16(0, -3, 0));
+	queue.remove(v3s16(0, -2, 0));
+	UASSERT(queue.pop(p, priority));
+	UASSERT(p == v3s16(0, -3, 0));
+	UASSERT(queue.pop(p, priority));
+	UASSERT(p != v3s16(0, -2, 0));
+}
+
+void TestBlockSendQueue::testBudget()
+{
+	BlockSendBudget budget(1, 40);
+	UASSERTEQ(u16, budget.getLimit(), 40);
+
+	BlockSendBudget::Stats stats;
+	// Nothing known yet
+	budget.update(0.1f, stats, true);
+	UASSERTEQ(u16, budget.getLimit(), 40);
+
+	// Round trip time far above its minimum
+	stats.min_rtt = 0.05f;
+	stats.avg_rtt = 0.5f;
+	for (int i = 0; i < 100; i++)
+		budget.update(0.1f, stats, false);
+	UASSERTEQ(u16, budget.getLimit(), 1);
+
+	// Grows back by about one block per round trip while used up
+	stats.avg_rtt = 0.06f;
+	budget.update(0.6f, stats, true);
+	UASSERTEQ(u16, budget.getLimit(), 11);
+	// but not if the limit is not reached
+	budget.update(0.6f, stats, false);
+	UASSERTEQ(u16, budget.getLimit(), 11);
+	for (int i = 0; i < 100; i++)
+		budget.update(0.1f, stats, true);
+	UASSERTEQ(u16, budget.getLimit(), 40);
+
+	// Loss reduces the limit once per sample of the rate statistics
+	stats.sent_kbps = 100.0f;
+	stats.lost_kbps = 20.0f;
+	budget.update(0.1f, stats, false);
+	budget.update(0.1f, stats, false);
+	UASSERTEQ(u16, budget.getLimit(), 28);
+	stats.lost_kbps = 1.0f;
+	budget.update(0.1f, stats, false);
+	UASSERTEQ(u16, budget.getLimit(), 28);
+}
+
+void TestBlockSendQueue::testViewWeight()
+{
+	const float fov = 72.0f * core::DEGTORAD * 1.4f;
+	const v3f dir(0, 0, 1);
+	const float d = 20 * MAP_BLOCKSIZE * BS;
+
+	// Ahead
+	UASSERTEQ(float, getBlockViewWeight(v3f(0, 0, d), dir, fov, 16.0f / 9.0f), 1.0f);
+
+	// Just outside of the screen vertically, but not horizontally
+	const float offset = d * std::tan(fov / 2) * 0.8f;
+	UASSERT(getBlockViewWeight(v3f(offset, 0, d), dir, fov, 16.0f / 9.0f) == 1.0f);
+	UASSERT(getBlockViewWeight(v3f(0, offset, d), dir, fov, 16.0f / 9.0f) > 1.0f);
+	// Unless the screen is square
+	UASSERT(getBlockViewWeight(v3f(0, offset, d), dir, fov, 1.0f) == 1.0f);
+
+	// Further outside weighs more, up to a limit
+	float w1 = getBlockViewWeight(v3f(2 * d, 0, d), dir, fov, 1.0f);
+	float w2 = getBlockViewWeight(v3f(4 * d, 0, d), dir, fov, 1.0f);
+	UASSERT(w1 > 1.0f && w2 > w1);
+	UASSERT(getBlockViewWeight(v3f(0, 0, -d), dir, fov, 1.0f) >=
+			getBlockViewWeight(v3f(10 * d, 0, d), dir, fov, 1.0f));
+
+	// Works when looking straight up
+	UASSERTEQ(float, getBlockViewWeight(v3f(0, d, 0), v3f(0, 1, 0), fov, 1.0f), 1.0f);
+}
@@ -38,6 +38,7 @@ class TestCompression : public TestBase {
 	void testZlibCompression();
 	void testZlibLargeData();
 	void testZstdLargeData();
+	void testZstdDictionary();
 	void testZlibLimit();
 	void _testZlibLimit(u32 size, u32 limit);
 };
@@ -50,6 +51,7 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
 	TEST(testZstdLargeData);
+	TEST(testZstdDictionary);
 	TEST(testZlibLimit);
 }
 
@@ -212,6 +214,61 @@ void TestCompression::testZstdLargeData()
 	}
 }
 
+void TestCompression::testZstdDictionary()
+{
+	// Records sharing most of their structure, like serialized mapblocks
+	PseudoRandom pseudorandom(1337);
+	std::vector<std::string> samples;
+	for (u32 i = 0; i < 300; i++) {
+		std::string sample;
+		for (u32 j = 0; j < 256; j++) {
+			sample += "node:" + std::to_string(pseudorandom.range(0, 7));
+			sample += j % 16 ? ';' : '\n';
+		}
+		samples.push_back(sample);
+	}
+
+	EXCEPTION_CHECK(SerializationError, ZstdDictionary("not a dictionary"));
+
+	ZstdDictionary dict(ZstdDictionary::train(samples, 4096));
+	UASSERT(dict.getId() != 0);
+	UASSERT(dict.getData().size() <= 4096);
+
+	const std::string &data_in = samples[0];
+	std::ostringstream os_plain(std::ios::binary);
+	compressZstd(data_in, os_plain, 0);
+	std::ostringstream os_dict(std::ios::binary);
+	compressZstd(data_in, os_dict, 0, &dict);
+	UASSERT(os_dict.str().size() < os_plain.str().size());
+
+	// Round trip with the dictionary
+	{
+		std::istringstream is(os_dict.str(), std::ios::binary);
+		std::ostringstream os(std::ios::binary);
+		decompressZstd(is, os, &dict);
+		UASSERT(os.str() == data_in);
+	}
+
+	// It cannot be decompressed without the dictionary
+	{
+		std::istringstream is(os_dict.str(), std::ios::binary);
+		std::ostringstream os(std::ios::binary);
+		EXCEPTION_CHECK(SerializationError, decompressZstd(is, os));
+	}
+
+	// Data compressed without it can still be decompressed with it
+	{
+		std::istringstream is(os_plain.str(), std::ios::binary);
+		std::ostringstream os(std::ios::binary);
+		decompressZstd(is, os, &dict);
+		UASSERT(os.str() == data_in);
+	}
+
+	// Training needs more than a handful of samples
+	std::vector<std::string> few_samples(samples.begin(), samples.begin() + 2);
+	EXCEPTION_CHECK(SerializationError, ZstdDictionary::train(few_samples, 4096));
+}
+
 void TestCompression::testZlibLimit()
 {
 	// edge cases
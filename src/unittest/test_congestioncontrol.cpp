@@ -0,0 +1,224 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include <deque>
+#include <map>
+#include "noise.h"
+#include "network/congestioncontrol.h"
+#include "network/connection.h"
+
+class TestCongestionControl : public TestBase
+{
+public:
+	TestCongestionControl() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestCongestionControl"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testCubicWindow();
+	void testSimulatedLink();
+	void testSimulatedLossyLink();
+};
+
+static TestCongestionControl g_test_instance;
+
+void TestCongestionControl::runTests(IGameDef *gamedef)
+{
+	TEST(testCubicWindow);
+	TEST(testSimulatedLink);
+	TEST(testSimulatedLossyLink);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+/*
+	A sender driven by a controller, connected through a link with a
+	bottleneck queue, fixed latency and random loss. Time advances in
+	steps of 1 ms.
+*/
+class LinkSimulation
+{
+public:
+	u32 capacity_per_ms = 2;
+	u32 queue_size = 200;
+	u32 one_way_delay_ms = 25;
+	// Chance in 1/1000 that a packet is lost on the way
+	u32 loss_permille = 0;
+
+	u32 delivered = 0;
+	u32 dropped = 0;
+	u32 sent = 0;
+
+	LinkSimulation(con::CongestionControl *cc) : m_cc(cc) {}
+
+	void run(u32 duration_ms)
+	{
+		for (u32 i = 0; i < duration_ms; i++)
+			step();
+	}
+
+private:
+	struct Packet {
+		u32 id;
+		u64 send_time;
+		bool resent;
+	};
+
+	void step()
+	{
+		m_now++;
+
+		// Resend what timed out, the window shrinks before sending
+		const u64 timeout = std::max<u64>(200, 3 * m_rtt_ms);
+		u32 timed_out = 0;
+		for (auto &it : m_in_flight) {
+			if (m_now - it.second.send_time >= timeout) {
+				it.second.send_time = m_now;
+				it.second.resent = true;
+				m_to_resend.push_back(it.second);
+				timed_out++;
+			}
+		}
+		m_cc->onLoss(m_now, timed_out);
+		for (const Packet &p : m_to_resend)
+			transmit(p);
+		m_to_resend.clear();
+
+		// New packets, held back by the window and the pacing
+		float rate = m_cc->getPacingRate();
+		if (rate > 0.0f)
+			m_tokens = std::min(m_tokens + rate / 1000.0f, std::max(4.0f, rate * 0.005f));
+		while (m_in_flight.size() < m_cc->getWindow() &&
+				(rate <= 0.0f || m_tokens >= 1.0f)) {
+			Packet p{m_next_id++, m_now, false};
+			m_in_flight[p.id] = p;
+			transmit(p);
+			m_tokens -= 1.0f;
+		}
+
+		// The bottleneck forwards a fixed number of packets
+		for (u32 i = 0; i < capacity_per_ms && !m_queue.empty(); i++) {
+			m_acks.emplace_back(m_now + 2 * one_way_delay_ms, m_queue.front());
+			m_queue.pop_front();
+		}
+
+		while (!m_acks.empty() && m_acks.front().first <= m_now) {
+			const Packet &p = m_acks.front().second;
+			auto it = m_in_flight.find(p.id);
+			// Only the first copy to arrive counts
+			if (it != m_in_flight.end() && it->second.send_time == p.send_time) {
+				float rtt = (m_now - p.send_time) / 1000.0f;
+				m_cc->onAck(m_now, p.resent ? -1.0f : rtt);
+				m_rtt_ms = m_now - p.send_time;
+				m_in_flight.erase(it);
+				delivered++;
+			}
+			m_acks.pop_front();
+		}
+	}
+
+	void transmit(const Packet &p)
+	{
+		sent++;
+		if (m_queue.size() >= queue_size || m_random.range(0, 999) < (s32)loss_permille) {
+			dropped++;
+			return;
+		}
+		m_queue.push_back(p);
+	}
+
+	con::CongestionControl *m_cc;
+	PcgRandom m_random;
+	u64 m_now = 1000;
+	u64 m_rtt_ms = 50;
+	u32 m_next_id = 0;
+	float m_tokens = 0.0f;
+	std::map<u32, Packet> m_in_flight;
+	std::vector<Packet> m_to_resend;
+	std::deque<Packet> m_queue;
+	std::deque<std::pair<u64, Packet>> m_acks;
+};
+
+}
+
+void TestCongestionControl::testCubicWindow()
+{
+	UASSERT(!con::CongestionControl::create("legacy", 100, 10, 1000));
+	auto cc = con::CongestionControl::create("cubic", 100, 10, 1000);
+	UASSERT(cc);
+	UASSERTEQ(u32, cc->getWindow(), 100);
+	UASSERTEQ(float, cc->getPacingRate(), 0.0f);
+
+	// Slow start grows by one packet per ack
+	for (int i = 0; i < 50; i++)
+		cc->onAck(1000, 0.1f);
+	UASSERTEQ(u32, cc->getWindow(), 150);
+	UASSERT(cc->getPacingRate() > 150 / 0.1f);
+
+	// Loss shrinks it once per round trip
+	cc->onLoss(1000, 3);
+	UASSERTEQ(u32, cc->getWindow(), 105);
+	cc->onLoss(1050, 1);
+	UASSERTEQ(u32, cc->getWindow(), 105);
+	cc->onLoss(1200, 1);
+	UASSERTEQ(u32, cc->getWindow(), 73);
+
+	// Afterwards it grows back towards the old size
+	u64 now = 1200;
+	for (int i = 0; i < 10000; i++)
+		cc->onAck(now += 1, 0.1f);
+	UASSERT(cc->getWindow() > 105);
+	UASSERT(cc->getWindow() <= 1000);
+
+	// It never leaves the limits
+	for (int i = 0; i < 20; i++)
+		cc->onLoss(now += 1000, 1);
+	UASSERTEQ(u32, cc->getWindow(), 10);
+}
+
+void TestCongestionControl::testSimulatedLink()
+{
+	// 2000 packets/s with 50 ms latency: 100 packets in flight fill the link
+	con::CubicCongestionControl cc(MIN_RELIABLE_WINDOW_SIZE,
+		MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+	LinkSimulation link(&cc);
+	link.run(20000);
+
+	// Most of the capacity is used without constantly overflowing the queue
+	UASSERT(link.delivered > 20000 * 2 * 0.8f);
+	UASSERT(link.dropped < link.sent * 0.05f);
+	UASSERT(cc.getWindow() < MAX_RELIABLE_WINDOW_SIZE);
+}
+
+void TestCongestionControl::testSimulatedLossyLink()
+{
+	con::CubicCongestionControl cc(MIN_RELIABLE_WINDOW_SIZE,
+		MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+	LinkSimulation link(&cc);
+	link.loss_permille = 10;
+	link.run(20000);
+
+	// Random loss doesn't stop the window from filling the link
+	UASSERT(link.delivered > 20000 * 2 * 0.5f);
+}
@@ -19,6 +19,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <memory>
+#include <set>
+
 #include "log.h"
 #include "porting.h"
 #include "settings.h"
@@ -41,7 +44,11 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testReliablePacketBuffer();
+	void testSplitSlices();
+	void testIncomingSplitBuffer();
 	void testConnectSendReceive();
+	void testShardedServer();
 };
 
 static TestConnection g_test_instance;
@@ -50,7 +57,11 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testReliablePacketBuffer);
+	TEST(testSplitSlices);
+	TEST(testIncomingSplitBuffer);
 	TEST(testConnectSendReceive);
+	TEST(testShardedServer);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -156,6 +167,170 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p2[3]) == data1[0]);
 }
 
+static con::BufferedPacketPtr makeReliable(u16 seqnum)
+{
+	Address a(127, 0, 0, 1, 10);
+	SharedBuffer<u8> data(1);
+	data[0] = seqnum & 0xff;
+	return con::makePacket(a, con::makeReliablePacket(data, seqnum),
+			0x12345678, 123, 0);
+}
+
+void TestConnection::testReliablePacketBuffer()
+{
+	con::ReliablePacketBuffer buf;
+	u16 first;
+	UASSERT(buf.empty());
+	UASSERT(!buf.getFirstSeqnum(first));
+
+	// Out of order inserts across the wrap around are sorted
+	const u16 next_expected = 65530;
+	const u16 seqnums[] = { 3, 65533, 200, 65531, 0 };
+	for (u16 seqnum : seqnums) {
+		auto p = makeReliable(seqnum);
+		buf.insert(p, next_expected);
+	}
+	UASSERTEQ(u32, buf.size(), 5);
+	UASSERT(buf.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, 65531);
+
+	// Resent packets are ignored, the next expected one is rejected
+	auto dup = makeReliable(200);
+	buf.insert(dup, next_expected);
+	auto expected = makeReliable(next_expected);
+	buf.insert(expected, next_expected);
+	UASSERTEQ(u32, buf.size(), 5);
+
+	// Removing from the middle and the end keeps the order
+	UASSERTEQ(u16, buf.popSeqnum(3)->getSeqnum(), 3);
+	UASSERTEQ(u16, buf.popSeqnum(200)->getSeqnum(), 200);
+	EXCEPTION_CHECK(con::NotFoundException, buf.popSeqnum(3));
+
+	const u16 order[] = { 65531, 65533, 0 };
+	for (u16 seqnum : order)
+		UASSERTEQ(u16, buf.popFirst()->getSeqnum(), seqnum);
+	UASSERT(buf.empty());
+	EXCEPTION_CHECK(con::NotFoundException, buf.popFirst());
+
+	// The ring grows beyond its initial size
+	for (u16 seqnum = 1000; seqnum > 1; seqnum -= 3) {
+		auto p = makeReliable(seqnum);
+		buf.insert(p, 1);
+	}
+	UASSERTEQ(u32, buf.size(), 333);
+	u16 last = 0;
+	while (!buf.empty()) {
+		u16 seqnum = buf.popFirst()->getSeqnum();
+		UASSERT(seqnum > last);
+		last = seqnum;
+	}
+	UASSERTEQ(u16, last, 1000);
+}
+
+void TestConnection::testSplitSlices()
+{
+	SharedBuffer<u8> data(1000);
+	for (u32 i = 0; i < data.getSize(); i++)
+		data[i] = i * 7;
+
+	// Small data is sent as one TYPE_ORIGINAL packet
+	std::vector<con::PacketSlice> slices;
+	u16 split_seqnum = 5;
+	con::makeAutoSplitSlices(100, 300, split_seqnum, &slices);
+	UASSERTEQ(size_t, slices.size(), 1);
+	UASSERTEQ(u32, slices[0].header_size, ORIGINAL_HEADER_SIZE);
+	UASSERTEQ(u32, slices[0].size, 100);
+	UASSERTEQ(u16, split_seqnum, 5);
+
+	// The slices describe exactly the packets makeAutoSplitPacket() copies
+	slices.clear();
+	con::makeAutoSplitSlices(data.getSize(), 300, split_seqnum, &slices);
+	std::list<SharedBuffer<u8>> packets;
+	u16 split_seqnum2 = 5;
+	con::makeAutoSplitPacket(data, 300, split_seqnum2, &packets);
+	UASSERTEQ(u16, split_seqnum, 6);
+	UASSERTEQ(u16, split_seqnum2, 6);
+	UASSERTEQ(size_t, slices.size(), 4);
+	UASSERTEQ(size_t, packets.size(), 4);
+
+	u32 offset = 0;
+	auto packet = packets.begin();
+	for (const con::PacketSlice &slice : slices) {
+		UASSERTEQ(u32, slice.header_size, SPLIT_HEADER_SIZE);
+		UASSERTEQ(u32, slice.offset, offset);
+		UASSERTEQ(u16, readU16(&slice.header[3]), 4);
+		UASSERTEQ(u32, packet->getSize(), slice.header_size + slice.size);
+		UASSERT(!memcmp(&(*packet)[0], slice.header, slice.header_size));
+		UASSERT(!memcmp(&(*packet)[slice.header_size], &data[slice.offset],
+			slice.size));
+		offset += slice.size;
+		++packet;
+	}
+	UASSERTEQ(u32, offset, data.getSize());
+
+	// Packets made from a slice refer to the payload
+	Address a(127, 0, 0, 1, 10);
+	std::shared_ptr<u8> payload(new u8[1000], std::default_delete<u8[]>());
+	const u8 headers[] = { con::PACKET_TYPE_RELIABLE, 0x12, 0x34 };
+	con::BufferedPacketPtr p = con::makePacket(a, headers, sizeof(headers),
+		std::shared_ptr<const u8>(payload, payload.get() + 100), 200,
+		0x12345678, 123, 2);
+	UASSERTEQ(size_t, p->size(), BASE_HEADER_SIZE + sizeof(headers) + 200);
+	UASSERTEQ(size_t, p->headerSize(), BASE_HEADER_SIZE + sizeof(headers));
+	UASSERT(p->payload() == payload.get() + 100);
+	UASSERTEQ(u16, p->getSeqnum(), 0x1234);
+	UASSERTEQ(long, payload.use_count(), 2);
+}
+
+void TestConnection::testIncomingSplitBuffer()
+{
+	Address a(127, 0, 0, 1, 10);
+	SharedBuffer<u8> data(1000);
+	for (u32 i = 0; i < data.getSize(); i++)
+		data[i] = i * 7;
+
+	std::list<SharedBuffer<u8>> chunks;
+	u16 split_seqnum = 5;
+	con::makeAutoSplitPacket(data, 300, split_seqnum, &chunks);
+	std::vector<con::BufferedPacketPtr> packets;
+	for (const SharedBuffer<u8> &chunk : chunks)
+		packets.push_back(con::makePacket(a, chunk, 0x12345678, 123, 0));
+	UASSERTEQ(size_t, packets.size(), 4);
+
+	// The last chunk arrives first and waits for the chunk size
+	con::IncomingSplitBuffer buf;
+	UASSERTEQ(u32, buf.insert(packets[3], true).getSize(), 0);
+	UASSERTEQ(u32, buf.insert(packets[1], true).getSize(), 0);
+	UASSERTEQ(u32, buf.insert(packets[0], true).getSize(), 0);
+	// Duplicates are ignored
+	UASSERTEQ(u32, buf.insert(packets[1], true).getSize(), 0);
+	SharedBuffer<u8> full = buf.insert(packets[2], true);
+	UASSERTEQ(u32, full.getSize(), data.getSize());
+	UASSERT(!memcmp(*full, *data, data.getSize()));
+
+	// A packet of a single chunk is complete right away
+	SharedBuffer<u8> single(SPLIT_HEADER_SIZE + data.getSize());
+	single[0] = con::PACKET_TYPE_SPLIT;
+	writeU16(&single[1], 9);
+	writeU16(&single[3], 1);
+	writeU16(&single[5], 0);
+	memcpy(&single[SPLIT_HEADER_SIZE], *data, data.getSize());
+	auto p = con::makePacket(a, single, 0x12345678, 123, 0);
+	full = buf.insert(p, false);
+	UASSERTEQ(u32, full.getSize(), data.getSize());
+	UASSERT(!memcmp(*full, *data, data.getSize()));
+
+	// All chunks but the last one must have the same size
+	UASSERTEQ(u32, buf.insert(packets[0], false).getSize(), 0);
+	const SharedBuffer<u8> &second = *++chunks.begin();
+	SharedBuffer<u8> shorter(*second, second.getSize() - 1);
+	p = con::makePacket(a, shorter, 0x12345678, 123, 0);
+	UASSERTEQ(u32, buf.insert(p, false).getSize(), 0);
+	UASSERTEQ(u32, buf.insert(packets[2], false).getSize(), 0);
+	UASSERTEQ(u32, buf.insert(packets[3], false).getSize(), 0);
+	full = buf.insert(packets[1], false);
+	UASSERTEQ(u32, full.getSize(), data.getSize());
+}
 
 void TestConnection::testConnectSendReceive()
 {
@@ -376,3 +551,89 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id == 2);
 }
+
+
+void TestConnection::testShardedServer()
+{
+	const u16 num_shards = 2;
+	const int num_clients = 4;
+	u32 proto_id = 0x12345678;
+
+	Handler hand_server("server");
+	con::Connection server(proto_id, 512, 5.0, false, &hand_server, num_shards);
+	UASSERT(server.getShardCount() ==
+			(UDPSocket::canSharePort() ? num_shards : 1));
+	server.Serve(Address(0, 0, 0, 0, 30002));
+
+	sleep_ms(50);
+
+	std::vector<std::unique_ptr<con::Connection>> clients;
+	for (int i = 0; i < num_clients; i++) {
+		clients.emplace_back(new con::Connection(proto_id, 512, 5.0, false,
+				nullptr));
+		clients.back()->Connect(Address(127, 0, 0, 1, 30002));
+	}
+
+	// Every client says hello, whichever shard the kernel picked for it
+	std::set<session_t> peer_ids;
+	u64 timems0 = porting::getTimeMs();
+	while ((int)peer_ids.size() < num_clients &&
+			porting::getTimeMs() - timems0 < 5000) {
+		for (auto &client : clients) {
+			NetworkPacket pkt;
+			client->TryReceive(&pkt);
+			if (client->Connected() && !peer_ids.count(client->GetPeerID())) {
+				NetworkPacket pkt(0x42, 0);
+				client->Send(PEER_ID_SERVER, 0, &pkt, true);
+			}
+		}
+
+		NetworkPacket pkt;
+		if (server.TryReceive(&pkt) && pkt.getCommand() == 0x42)
+			peer_ids.insert(pkt.getPeerId());
+		sleep_ms(10);
+	}
+	UASSERTEQ(int, peer_ids.size(), num_clients);
+	UASSERTEQ(int, hand_server.count, num_clients);
+
+	// Each reply must leave through the socket its client talks to
+	for (session_t peer_id : peer_ids) {
+		NetworkPacket pkt(0x43, 2);
+		pkt << peer_id;
+		server.Send(peer_id, 0, &pkt, true);
+	}
+
+	int replies = 0;
+	timems0 = porting::getTimeMs();
+	while (replies < num_clients && porting::getTimeMs() - timems0 < 5000) {
+		for (auto &client : clients) {
+			NetworkPacket pkt;
+			if (!client->TryReceive(&pkt) || pkt.getCommand() != 0x43)
+				continue;
+			session_t peer_id;
+			pkt >> peer_id;
+			UASSERTEQ(session_t, peer_id, client->GetPeerID());
+			replies++;
+		}
+		sleep_ms(10);
+	}
+	UASSERTEQ(int, replies, num_clients);
+
+	// Another server must not share the port
+	if (UDPSocket::canSharePort()) {
+		con::Connection other(proto_id, 512, 5.0, false, nullptr, num_shards);
+		other.Serve(Address(0, 0, 0, 0, 30002));
+		bool bind_failed = false;
+		timems0 = porting::getTimeMs();
+		while (!bind_failed && porting::getTimeMs() - timems0 < 5000) {
+			try {
+				NetworkPacket pkt;
+				other.TryReceive(&pkt);
+			} catch (con::ConnectionBindFailed &e) {
+				bind_failed = true;
+			}
+			sleep_ms(10);
+		}
+		UASSERT(bind_failed);
+	}
+}
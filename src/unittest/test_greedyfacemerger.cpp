@@ -0,0 +1,179 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include <map>
+#include "client/meshgen/greedy.h"
+#include "noise.h"
+
+class TestGreedyFaceMerger : public TestBase
+{
+public:
+	TestGreedyFaceMerger() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestGreedyFaceMerger"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testPlane();
+	void testDifferentLook();
+	void testSeparatePlanes();
+	void testRandomFaces();
+};
+
+static TestGreedyFaceMerger g_test_instance;
+
+void TestGreedyFaceMerger::runTests(IGameDef *gamedef)
+{
+	TEST(testPlane);
+	TEST(testDifferentLook);
+	TEST(testSeparatePlanes);
+	TEST(testRandomFaces);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const video::SColor gray(255, 128, 128, 128);
+const video::SColor white(255, 255, 255, 255);
+
+u32 getArea(const GreedyFaceMerger::Quad &quad)
+{
+	v3s16 size = quad.max - quad.min + 1;
+	return size.X * size.Y * size.Z;
+}
+
+}
+
+void TestGreedyFaceMerger::testPlane()
+{
+	GreedyFaceMerger merger;
+	// top faces of a 16x16 floor at y = 3
+	for (s16 z = 0; z < 16; z++)
+	for (s16 x = 0; x < 16; x++)
+		merger.add(v3s16(x, 3, z), 0, 1, gray);
+
+	std::vector<GreedyFaceMerger::Quad> quads;
+	merger.merge(16, quads);
+	UASSERT(merger.empty());
+	UASSERTEQ(size_t, quads.size(), 1);
+	UASSERT(quads[0].min == v3s16(0, 3, 0));
+	UASSERT(quads[0].max == v3s16(15, 3, 15));
+	UASSERTEQ(int, quads[0].face, 0);
+	UASSERTEQ(int, quads[0].tile, 1);
+	UASSERT(quads[0].color == gray);
+}
+
+void TestGreedyFaceMerger::testDifferentLook()
+{
+	GreedyFaceMerger merger;
+	// a 4x4 wall facing +X with a lighter column and another tile in a corner
+	for (s16 z = 0; z < 4; z++)
+	for (s16 y = 0; y < 4; y++) {
+		video::SColor color = z == 2 ? white : gray;
+		u16 tile = (y == 3 && z == 3) ? 2 : 1;
+		merger.add(v3s16(5, y, z), 2, tile, color);
+	}
+
+	std::vector<GreedyFaceMerger::Quad> quads;
+	merger.merge(16, quads);
+
+	u32 area = 0;
+	for (const auto &quad : quads) {
+		UASSERTEQ(s16, quad.min.X, 5);
+		UASSERTEQ(s16, quad.max.X, 5);
+		// no quad mixes looks
+		if (quad.tile == 2)
+			UASSERT(quad.min == v3s16(5, 3, 3) && quad.max == quad.min);
+		else if (quad.color == white)
+			UASSERT(quad.min.Z == 2 && quad.max.Z == 2);
+		else
+			UASSERT(quad.max.Z < 2 || quad.min.Z > 2);
+		area += getArea(quad);
+	}
+	UASSERTEQ(u32, area, 16);
+	// rows z=0..1, the column z=2, and z=3 below the corner plus the corner
+	UASSERTEQ(size_t, quads.size(), 4);
+}
+
+void TestGreedyFaceMerger::testSeparatePlanes()
+{
+	GreedyFaceMerger merger;
+	// a node sticking out of the floor, and the bottom of the floor
+	merger.add(v3s16(0, 0, 0), 0, 1, gray);
+	merger.add(v3s16(1, 1, 0), 0, 1, gray);
+	merger.add(v3s16(2, 0, 0), 0, 1, gray);
+	merger.add(v3s16(0, 0, 0), 1, 1, gray);
+	merger.add(v3s16(1, 0, 0), 1, 1, gray);
+	merger.add(v3s16(2, 0, 0), 1, 1, gray);
+
+	std::vector<GreedyFaceMerger::Quad> quads;
+	merger.merge(16, quads);
+	// tops at y=0 are not adjacent, the bottoms merge into one
+	UASSERTEQ(size_t, quads.size(), 4);
+	u32 bottoms = 0;
+	for (const auto &quad : quads) {
+		if (quad.face == 1) {
+			bottoms++;
+			UASSERT(quad.min == v3s16(0, 0, 0) && quad.max == v3s16(2, 0, 0));
+		} else {
+			UASSERTEQ(u32, getArea(quad), 1);
+		}
+	}
+	UASSERTEQ(u32, bottoms, 1);
+}
+
+void TestGreedyFaceMerger::testRandomFaces()
+{
+	PcgRandom pr(1234);
+	std::map<std::pair<v3s16, u8>, std::pair<u16, video::SColor>> faces;
+	for (int i = 0; i < 3000; i++) {
+		v3s16 p(pr.range(0, 15), pr.range(0, 15), pr.range(0, 15));
+		u8 face = pr.range(0, 5);
+		u16 tile = pr.range(0, 1);
+		video::SColor color = pr.range(0, 3) ? gray : white;
+		faces[{p, face}] = {tile, color};
+	}
+
+	GreedyFaceMerger merger;
+	for (const auto &it : faces)
+		merger.add(it.first.first, it.first.second, it.second.first, it.second.second);
+	std::vector<GreedyFaceMerger::Quad> quads;
+	merger.merge(16, quads);
+	UASSERT(quads.size() < faces.size());
+
+	// The quads cover every face exactly once and only faces that look the same
+	size_t covered = 0;
+	for (const auto &quad : quads) {
+		v3s16 p;
+		for (p.X = quad.min.X; p.X <= quad.max.X; p.X++)
+		for (p.Y = quad.min.Y; p.Y <= quad.max.Y; p.Y++)
+		for (p.Z = quad.min.Z; p.Z <= quad.max.Z; p.Z++) {
+			auto it = faces.find({p, quad.face});
+			UASSERT(it != faces.end());
+			UASSERT(it->second.first == quad.tile && it->second.second == quad.color);
+			faces.erase(it);
+			covered++;
+		}
+	}
+	UASSERT(faces.empty());
+	UASSERT(covered > 0);
+}
@@ -18,11 +18,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <unordered_set>
 #include <unordered_map>
 #include "mapblock.h"
 #include "dummymap.h"
+#include "nameidmapping.h"
+#include "serialization.h"
 
 class TestMap : public TestBase
 {
@@ -36,6 +39,8 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testContentIndex(IGameDef *gamedef);
+	void testDeferredNodeIds(IGameDef *gamedef);
 };
 
 static TestMap g_test_instance;
@@ -46,6 +51,8 @@ void TestMap::runTests(IGameDef *gamedef)
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testContentIndex, gamedef);
+	TEST(testDeferredNodeIds, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +176,76 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+void TestMap::testContentIndex(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	block.setNodeNoCheck(1, 2, 3, MapNode(t_CONTENT_TORCH));
+	block.setNodeNoCheck(4, 5, 6, MapNode(t_CONTENT_LAVA));
+
+	auto filter = std::make_shared<MapBlockContentIndex::Filter>();
+	filter->resize(std::max(t_CONTENT_TORCH, t_CONTENT_WATER) + 1);
+	(*filter)[t_CONTENT_TORCH] = true;
+	(*filter)[t_CONTENT_WATER] = true;
+	std::shared_ptr<const MapBlockContentIndex::Filter> cfilter = filter;
+
+	bool built = false;
+	const MapBlockContentIndex &index = block.getContentIndex(cfilter, &built);
+	UASSERT(built);
+	const auto &lists = index.getNodeLists();
+	UASSERTEQ(size_t, lists.size(), 1);
+	UASSERTEQ(size_t, lists.at(t_CONTENT_TORCH).size(), 1);
+	UASSERTEQ(u16, lists.at(t_CONTENT_TORCH)[0],
+		3 * MAP_BLOCKSIZE * MAP_BLOCKSIZE + 2 * MAP_BLOCKSIZE + 1);
+
+	// Changes through setNode are applied to the existing index
+	block.setNodeNoCheck(1, 2, 3, MapNode(t_CONTENT_WATER));
+	block.setNodeNoCheck(7, 7, 7, MapNode(t_CONTENT_WATER));
+	block.setNodeNoCheck(4, 5, 6, MapNode(CONTENT_AIR));
+	block.getContentIndex(cfilter, &built);
+	UASSERT(!built);
+	UASSERT(lists.find(t_CONTENT_TORCH) == lists.end());
+	UASSERTEQ(size_t, lists.at(t_CONTENT_WATER).size(), 2);
+
+	// Removing a node from the middle of a list keeps the others
+	block.setNodeNoCheck(8, 8, 8, MapNode(t_CONTENT_WATER));
+	block.setNodeNoCheck(7, 7, 7, MapNode(CONTENT_AIR));
+	block.setNodeNoCheck(8, 8, 8, MapNode(CONTENT_AIR));
+	block.setNodeNoCheck(7, 7, 7, MapNode(t_CONTENT_WATER));
+	std::vector<u16> water = lists.at(t_CONTENT_WATER);
+	std::sort(water.begin(), water.end());
+	UASSERTEQ(size_t, water.size(), 2);
+	UASSERTEQ(u16, water[0], 3 * MAP_BLOCKSIZE * MAP_BLOCKSIZE + 2 * MAP_BLOCKSIZE + 1);
+	UASSERTEQ(u16, water[1], 7 * MAP_BLOCKSIZE * MAP_BLOCKSIZE + 7 * MAP_BLOCKSIZE + 7);
+
+	// A cleared index is rebuilt with the current contents
+	block.clearContentIndex();
+	const auto &rebuilt = block.getContentIndex(cfilter, &built).getNodeLists();
+	UASSERT(built);
+	UASSERTEQ(size_t, rebuilt.size(), 1);
+	UASSERTEQ(size_t, rebuilt.at(t_CONTENT_WATER).size(), 2);
+}
+
+void TestMap::testDeferredNodeIds(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(1, 2, 3), gamedef);
+	block.setNodeNoCheck(1, 2, 3, MapNode(t_CONTENT_TORCH));
+	block.setNodeNoCheck(4, 5, 6, MapNode(t_CONTENT_LAVA));
+
+	const u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::ostringstream os(std::ios_base::binary);
+	block.serialize(os, version, true, -1);
+
+	// The stored ids are only converted once the mapping is applied
+	MapBlock loaded(nullptr, v3s16(1, 2, 3), gamedef);
+	NameIdMapping nimap;
+	std::istringstream is(os.str(), std::ios_base::binary);
+	loaded.deSerialize(is, version, true, &nimap);
+	UASSERT(nimap.size() > 0);
+	loaded.correctNodeIds(nimap);
+
+	UASSERTEQ(content_t, loaded.getNodeNoCheck(1, 2, 3).getContent(), t_CONTENT_TORCH);
+	UASSERTEQ(content_t, loaded.getNodeNoCheck(4, 5, 6).getContent(), t_CONTENT_LAVA);
+	UASSERTEQ(content_t, loaded.getNodeNoCheck(0, 0, 0).getContent(),
+		block.getNodeNoCheck(0, 0, 0).getContent());
+}
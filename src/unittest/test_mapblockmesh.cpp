@@ -0,0 +1,77 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include <vector>
+#include "client/mapblock_mesh.h"
+#include "noise.h"
+
+class TestMapBlockMesh : public TestBase
+{
+public:
+	TestMapBlockMesh() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlockMesh"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testFinalColorBlendBatch();
+};
+
+static TestMapBlockMesh g_test_instance;
+
+void TestMapBlockMesh::runTests(IGameDef *gamedef)
+{
+	TEST(testFinalColorBlendBatch);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapBlockMesh::testFinalColorBlendBatch()
+{
+	PcgRandom pr(1234);
+
+	// More vertices than one blend chunk, in shuffled order
+	const u16 count = 1000;
+	VertexColorChannels data;
+	std::vector<u16> indices;
+	std::vector<video::S3DVertex> vertices(count);
+	for (u16 i = 0; i < count; i++) {
+		data.push_back(video::SColor(pr.range(0, 255), pr.range(0, 255),
+			pr.range(0, 255), pr.range(0, 255)));
+		indices.push_back((i * 7) % count);
+		vertices[i].Color = video::SColor(pr.range(0, 255), 0, 0, 0);
+	}
+
+	for (u32 daynight_ratio : {0, 150, 500, 750, 1000}) {
+		video::SColorf day_light;
+		get_sunlight_color(&day_light, daynight_ratio);
+
+		std::vector<video::S3DVertex> batch = vertices;
+		final_color_blend(batch.data(), indices.data(), data, day_light);
+
+		for (u16 i = 0; i < count; i++) {
+			video::SColor expected = vertices[indices[i]].Color;
+			final_color_blend(&expected, video::SColor(data.sunlight[i],
+				data.red[i], data.green[i], data.blue[i]), day_light);
+			UASSERTEQ(u32, batch[indices[i]].Color.color, expected.color);
+		}
+	}
+}
@@ -0,0 +1,230 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <atomic>
+#include "database/database-async.h"
+#include "database/database-dummy.h"
+#include "database/database-sqlite3.h"
+#include "filesys.h"
+
+class TestMapDatabase : public TestBase
+{
+public:
+	TestMapDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testAsyncReadWrite();
+	void testAsyncPrefetch();
+	void testAsyncWriteFailure();
+	void testBatch();
+
+private:
+	void checkBatch(MapDatabase *db);
+};
+
+static TestMapDatabase g_test_instance;
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	TEST(testAsyncReadWrite);
+	TEST(testAsyncPrefetch);
+	TEST(testAsyncWriteFailure);
+	TEST(testBatch);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Fails to save blocks while told so, by returning false or throwing
+class FailingDatabase : public Database_Dummy
+{
+public:
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks) override
+	{
+		if (throw_error)
+			throw DatabaseException("test");
+		if (fail)
+			return false;
+		return Database_Dummy::saveBlocks(blocks);
+	}
+
+	void beginSave() override { transactions++; }
+	void endSave() override { transactions--; }
+
+	std::atomic<bool> fail{false};
+	std::atomic<bool> throw_error{false};
+	// Transactions begun but not ended
+	std::atomic<int> transactions{0};
+};
+
+}
+
+
+void TestMapDatabase::testAsyncReadWrite()
+{
+	MapDatabaseAsync db(new Database_Dummy());
+	const v3s16 p1(1, 2, 3), p2(-4, 5, -6);
+	std::string data;
+
+	// Pending writes are visible right away
+	db.beginSave();
+	UASSERT(db.saveBlock(p1, "one"));
+	UASSERT(db.saveBlock(p2, "two"));
+	db.saveBlock(p1, "three");
+	db.endSave();
+	db.loadBlock(p1, &data);
+	UASSERTEQ(std::string, data, "three");
+
+	db.flush();
+	db.loadBlock(p1, &data);
+	UASSERTEQ(std::string, data, "three");
+	db.loadBlock(p2, &data);
+	UASSERTEQ(std::string, data, "two");
+
+	std::vector<v3s16> blocks;
+	db.listAllLoadableBlocks(blocks);
+	UASSERTEQ(size_t, blocks.size(), 2);
+	size_t count = 0;
+	db.forEachLoadableBlock([&] (v3s16 pos) {
+		UASSERT(pos == p1 || pos == p2);
+		count++;
+	});
+	UASSERTEQ(size_t, count, 2);
+
+	db.saveBlock(p2, "four");
+	UASSERT(db.deleteBlock(p2));
+	data = "x";
+	db.loadBlock(p2, &data);
+	UASSERT(data.empty());
+}
+
+void TestMapDatabase::testAsyncPrefetch()
+{
+	MapDatabaseAsync db(new Database_Dummy());
+	std::string data;
+
+	for (s16 i = 0; i < 100; i++)
+		db.saveBlock(v3s16(i, 0, 0), std::to_string(i));
+	db.flush();
+
+	for (s16 i = 0; i < 100; i++)
+		db.prefetchBlock(v3s16(i, 0, 0));
+	// Saving again must not be hidden by the blocks read ahead
+	for (s16 i = 0; i < 100; i += 2)
+		db.saveBlock(v3s16(i, 0, 0), "new");
+
+	for (s16 i = 0; i < 100; i++) {
+		db.loadBlock(v3s16(i, 0, 0), &data);
+		UASSERTEQ(std::string, data, i % 2 ? std::to_string(i) : "new");
+	}
+
+	// Blocks not in the database are read ahead as well
+	db.prefetchBlock(v3s16(0, 100, 0));
+	data = "x";
+	db.loadBlock(v3s16(0, 100, 0), &data);
+	UASSERT(data.empty());
+}
+
+void TestMapDatabase::testAsyncWriteFailure()
+{
+	auto *failing = new FailingDatabase();
+	MapDatabaseAsync db(failing);
+	const v3s16 p1(1, 2, 3), p2(-4, 5, -6);
+	std::string data;
+
+	// The first failure is only noticed by later saves
+	failing->fail = true;
+	UASSERT(db.saveBlock(p1, "one"));
+	db.flush();
+	UASSERT(!db.saveBlock(p2, "two"));
+	db.loadBlock(p1, &data);
+	UASSERTEQ(std::string, data, "one");
+
+	// Exceptions do the same and still end the transaction
+	failing->fail = false;
+	failing->throw_error = true;
+	db.flush();
+	UASSERT(!db.saveBlocks({{p2, "three"}}));
+	UASSERTEQ(int, failing->transactions, 0);
+
+	// The blocks kept are written once the database works again
+	failing->throw_error = false;
+	db.flush();
+	UASSERT(db.saveBlock(v3s16(0, 0, 0), "four"));
+	db.flush();
+	failing->loadBlock(p1, &data);
+	UASSERTEQ(std::string, data, "one");
+	failing->loadBlock(p2, &data);
+	UASSERTEQ(std::string, data, "three");
+}
+
+void TestMapDatabase::testBatch()
+{
+	{
+		Database_Dummy db;
+		checkBatch(&db);
+	}
+
+	const std::string test_dir = getTestTempDirectory();
+	{
+		MapDatabaseSQLite3 db(test_dir);
+		checkBatch(&db);
+	}
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+
+	{
+		MapDatabaseAsync db(new MapDatabaseSQLite3(test_dir));
+		checkBatch(&db);
+	}
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+}
+
+void TestMapDatabase::checkBatch(MapDatabase *db)
+{
+	std::vector<std::pair<v3s16, std::string>> blocks;
+	for (s16 i = 0; i < 10; i++)
+		blocks.emplace_back(v3s16(i, -i, 2 * i), std::string(i + 1, 'a' + i));
+	UASSERT(db->saveBlocks(blocks));
+
+	// Overwriting within a transaction of the caller
+	db->beginSave();
+	UASSERT(db->saveBlocks({{v3s16(3, -3, 6), "new"}}));
+	db->endSave();
+
+	std::vector<v3s16> positions = {
+		v3s16(3, -3, 6), v3s16(0, 100, 0), v3s16(9, -9, 18), v3s16(0, 0, 0)
+	};
+	std::vector<std::string> data = {"x"};
+	db->loadBlocks(positions, &data);
+	UASSERTEQ(size_t, data.size(), positions.size());
+	UASSERTEQ(std::string, data[0], "new");
+	UASSERT(data[1].empty());
+	UASSERTEQ(std::string, data[2], std::string(10, 'j'));
+	UASSERTEQ(std::string, data[3], "a");
+
+	std::string single;
+	db->loadBlock(v3s16(5, -5, 10), &single);
+	UASSERTEQ(std::string, single, std::string(6, 'f'));
+}
@@ -0,0 +1,206 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include "client/mapdrawlist.h"
+#include "mapblock.h"
+
+class TestMapDrawList : public TestBase
+{
+public:
+	TestMapDrawList() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDrawList"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBitset();
+	void testUpdate(IGameDef *gamedef);
+	void testMeshArrival(IGameDef *gamedef);
+};
+
+static TestMapDrawList g_test_instance;
+
+void TestMapDrawList::runTests(IGameDef *gamedef)
+{
+	TEST(testBitset);
+	TEST(testUpdate, gamedef);
+	TEST(testMeshArrival, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+class BlockPool
+{
+public:
+	BlockPool(IGameDef *gamedef) : m_gamedef(gamedef) {}
+
+	MapBlock *get(v3s16 p)
+	{
+		auto &block = m_blocks[p];
+		if (!block)
+			block = std::make_unique<MapBlock>(nullptr, p, m_gamedef);
+		return block.get();
+	}
+
+private:
+	IGameDef *m_gamedef;
+	std::unordered_map<v3s16, std::unique_ptr<MapBlock>> m_blocks;
+};
+
+bool is_sorted_far_to_near(const MapDrawList &list, v3s16 camera_block)
+{
+	s32 last = S32_MAX;
+	for (const auto &entry : list) {
+		s32 d = entry.pos.getDistanceFromSQ(camera_block);
+		if (d > last || entry.distance_sq != d)
+			return false;
+		last = d;
+	}
+	return true;
+}
+
+}
+
+void TestMapDrawList::testBitset()
+{
+	BlockBitset bits;
+	const v3s16 positions[] = {
+		{0, 0, 0}, {0, 63, 0}, {0, 64, 0}, {0, -1, 0}, {0, -200, 0},
+		{5, 1000, -7}, {-2048, -2048, -2048}, {2047, 2047, 2047},
+	};
+
+	for (v3s16 p : positions)
+		UASSERT(!bits.set(p));
+	for (v3s16 p : positions) {
+		UASSERT(bits.get(p));
+		UASSERT(bits.set(p));
+	}
+	UASSERT(!bits.get(v3s16(0, 1, 0)));
+	UASSERT(!bits.get(v3s16(0, -65, 0)));
+	UASSERT(!bits.get(v3s16(1, 0, 0)));
+
+	bits.reset(v3s16(0, -1, 0));
+	UASSERT(!bits.get(v3s16(0, -1, 0)));
+	UASSERT(bits.get(v3s16(0, 0, 0)));
+	UASSERT(bits.get(v3s16(0, -200, 0)));
+
+	// Emptied columns are freed by shrink, unless set again before
+	UASSERTEQ(size_t, bits.getColumnCount(), 4);
+	bits.reset(v3s16(5, 1000, -7));
+	bits.reset(v3s16(2047, 2047, 2047));
+	bits.set(v3s16(2047, 0, 2047));
+	bits.shrink();
+	UASSERTEQ(size_t, bits.getColumnCount(), 3);
+	UASSERT(!bits.get(v3s16(5, 1000, -7)));
+	UASSERT(bits.get(v3s16(2047, 0, 2047)));
+	UASSERT(!bits.set(v3s16(5, 1000, -7)));
+
+	bits.clear();
+	for (v3s16 p : positions)
+		UASSERT(!bits.get(p));
+}
+
+void TestMapDrawList::testUpdate(IGameDef *gamedef)
+{
+	BlockPool pool(gamedef);
+	MapDrawList list;
+	auto get_block = [&] (v3s16 p) { return pool.get(p); };
+
+	// A cube of blocks, marked several times
+	list.beginUpdate(v3s16(0, 0, 0));
+	for (int i = 0; i < 2; i++) {
+		v3s16 p;
+		for (p.X = -2; p.X <= 2; p.X++)
+		for (p.Y = -2; p.Y <= 2; p.Y++)
+		for (p.Z = -2; p.Z <= 2; p.Z++)
+			list.markVisible(p);
+	}
+	list.endUpdate(get_block);
+	UASSERTEQ(size_t, list.size(), 125);
+	UASSERTEQ(u32, list.getAddedCount(), 125);
+	UASSERT(is_sorted_far_to_near(list, v3s16(0, 0, 0)));
+	UASSERTEQ(int, pool.get(v3s16(1, 1, 1))->refGet(), 1);
+
+	// Camera moved, half of the blocks left the view and others entered it
+	list.beginUpdate(v3s16(1, 0, 0));
+	{
+		v3s16 p;
+		for (p.X = 0; p.X <= 4; p.X++)
+		for (p.Y = -2; p.Y <= 2; p.Y++)
+		for (p.Z = -2; p.Z <= 2; p.Z++)
+			list.markVisible(p);
+	}
+	list.endUpdate(get_block);
+	UASSERTEQ(size_t, list.size(), 125);
+	UASSERTEQ(u32, list.getAddedCount(), 50);
+	UASSERTEQ(u32, list.getRemovedCount(), 50);
+	UASSERT(is_sorted_far_to_near(list, v3s16(1, 0, 0)));
+	UASSERTEQ(int, pool.get(v3s16(-1, 0, 0))->refGet(), 0);
+	UASSERTEQ(int, pool.get(v3s16(1, 0, 0))->refGet(), 1);
+	UASSERTEQ(int, pool.get(v3s16(4, 0, 0))->refGet(), 1);
+
+	// Nothing changed
+	list.beginUpdate(v3s16(1, 0, 0));
+	{
+		v3s16 p;
+		for (p.X = 0; p.X <= 4; p.X++)
+		for (p.Y = -2; p.Y <= 2; p.Y++)
+		for (p.Z = -2; p.Z <= 2; p.Z++)
+			list.markVisible(p);
+	}
+	list.endUpdate(get_block);
+	UASSERTEQ(u32, list.getAddedCount(), 0);
+	UASSERTEQ(u32, list.getRemovedCount(), 0);
+	UASSERTEQ(int, pool.get(v3s16(1, 0, 0))->refGet(), 1);
+
+	list.clear();
+	UASSERTEQ(size_t, list.size(), 0);
+	UASSERTEQ(int, pool.get(v3s16(1, 0, 0))->refGet(), 0);
+}
+
+void TestMapDrawList::testMeshArrival(IGameDef *gamedef)
+{
+	BlockPool pool(gamedef);
+	MapDrawList list;
+
+	// Only blocks with X >= 0 have a mesh yet
+	list.beginUpdate(v3s16(0, 0, 0));
+	for (s16 x = -3; x <= 3; x++)
+		list.markVisible(v3s16(x, 0, 0));
+	list.endUpdate([&] (v3s16 p) { return p.X >= 0 ? pool.get(p) : nullptr; });
+	UASSERTEQ(size_t, list.size(), 4);
+
+	// Meshes arriving for visible blocks are drawn right away
+	list.addIfVisible(v3s16(-2, 0, 0), pool.get(v3s16(-2, 0, 0)));
+	list.addIfVisible(v3s16(-2, 0, 0), pool.get(v3s16(-2, 0, 0)));
+	list.addIfVisible(v3s16(0, 5, 0), pool.get(v3s16(0, 5, 0)));
+	UASSERTEQ(size_t, list.size(), 5);
+	UASSERTEQ(int, pool.get(v3s16(-2, 0, 0))->refGet(), 1);
+	UASSERTEQ(int, pool.get(v3s16(0, 5, 0))->refGet(), 0);
+	UASSERT(is_sorted_far_to_near(list, v3s16(0, 0, 0)));
+
+	list.clear();
+}
@@ -0,0 +1,170 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "test.h"
+
+#include "client/occlusionbuffer.h"
+
+class TestOcclusionBuffer : public TestBase
+{
+public:
+	TestOcclusionBuffer() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestOcclusionBuffer"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testEmpty();
+	void testWall();
+	void testGap();
+	void testNearPlane();
+	void testBoxSide();
+};
+
+static TestOcclusionBuffer g_test_instance;
+
+void TestOcclusionBuffer::runTests(IGameDef *gamedef)
+{
+	TEST(testEmpty);
+	TEST(testWall);
+	TEST(testGap);
+	TEST(testNearPlane);
+	TEST(testBoxSide);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Quad perpendicular to the view at the given depth
+void addWall(OcclusionBuffer &buffer, f32 x_min, f32 x_max, f32 y_min, f32 y_max, f32 z)
+{
+	v3f quad[4] = {
+		v3f(x_min, y_min, z),
+		v3f(x_max, y_min, z),
+		v3f(x_max, y_max, z),
+		v3f(x_min, y_max, z),
+	};
+	buffer.addOccluder(quad, 4);
+}
+
+}
+
+void TestOcclusionBuffer::testEmpty()
+{
+	OcclusionBuffer buffer;
+	buffer.begin(v3f(0, 0, 0), v3f(0, 0, 1), M_PI / 2);
+	buffer.end();
+
+	UASSERTEQ(u32, buffer.getOccluderCount(), 0);
+	UASSERT(!buffer.isOccluded(aabb3f(-5, -5, 60, 5, 5, 70)));
+}
+
+void TestOcclusionBuffer::testWall()
+{
+	OcclusionBuffer buffer;
+	buffer.begin(v3f(0, 0, 0), v3f(0, 0, 1), M_PI / 2);
+	addWall(buffer, -40, 40, -40, 40, 50);
+	// entirely outside of the view
+	addWall(buffer, -40, 40, -40, 40, -50);
+	buffer.end();
+
+	UASSERTEQ(u32, buffer.getOccluderCount(), 1);
+	// behind the wall
+	UASSERT(buffer.isOccluded(aabb3f(-5, -5, 60, 5, 5, 70)));
+	UASSERT(buffer.isOccluded(aabb3f(20, 20, 500, 30, 30, 510)));
+	// in front of it
+	UASSERT(!buffer.isOccluded(aabb3f(-5, -5, 20, 5, 5, 30)));
+	// touching it
+	UASSERT(!buffer.isOccluded(aabb3f(-5, -5, 40, 5, 5, 50)));
+	// reaching past its edge
+	UASSERT(!buffer.isOccluded(aabb3f(30, -5, 60, 50, 5, 70)));
+	// out of the view
+	UASSERT(!buffer.isOccluded(aabb3f(-5, -5, -70, 5, 5, -60)));
+	UASSERT(!buffer.isOccluded(aabb3f(200, -5, 60, 210, 5, 70)));
+	// around the camera
+	UASSERT(!buffer.isOccluded(aabb3f(-5, -5, -5, 5, 5, 5)));
+
+	// seen from the other side
+	buffer.begin(v3f(0, 0, 100), v3f(0, 0, -1), M_PI / 2);
+	addWall(buffer, -40, 40, -40, 40, 50);
+	buffer.end();
+	UASSERT(!buffer.isOccluded(aabb3f(-5, -5, 60, 5, 5, 70)));
+}
+
+void TestOcclusionBuffer::testGap()
+{
+	OcclusionBuffer buffer;
+	buffer.begin(v3f(0, 0, 0), v3f(0, 0, 1), M_PI / 2);
+	addWall(buffer, -40, -1, -40, 40, 50);
+	addWall(buffer, 1, 40, -40, 40, 50);
+	buffer.end();
+
+	UASSERTEQ(u32, buffer.getOccluderCount(), 2);
+	// seen through the gap
+	UASSERT(!buffer.isOccluded(aabb3f(-3, -3, 100, 3, 3, 110)));
+	UASSERT(!buffer.isOccluded(aabb3f(-30, -30, 300, 30, 30, 310)));
+	// beside it
+	UASSERT(buffer.isOccluded(aabb3f(10, -3, 100, 16, 3, 110)));
+	UASSERT(buffer.isOccluded(aabb3f(-16, -3, 100, -10, 3, 110)));
+}
+
+void TestOcclusionBuffer::testNearPlane()
+{
+	OcclusionBuffer buffer;
+	buffer.begin(v3f(0, 0, 0), v3f(0, 0, 1), M_PI / 2);
+	// floor reaching behind the camera
+	v3f floor[4] = {
+		v3f(-100, -10, -100),
+		v3f(100, -10, -100),
+		v3f(100, -10, 200),
+		v3f(-100, -10, 200),
+	};
+	buffer.addOccluder(floor, 4);
+	buffer.end();
+
+	UASSERTEQ(u32, buffer.getOccluderCount(), 1);
+	UASSERT(buffer.isOccluded(aabb3f(-5, -30, 50, 5, -20, 60)));
+	UASSERT(!buffer.isOccluded(aabb3f(-5, 0, 50, 5, 10, 60)));
+	// below the floor, but beyond its end
+	UASSERT(!buffer.isOccluded(aabb3f(-5, -12, 300, 5, -11, 310)));
+}
+
+void TestOcclusionBuffer::testBoxSide()
+{
+	OcclusionBuffer buffer;
+	buffer.begin(v3f(0, 0, 0), v3f(0, 0, 1), M_PI / 2);
+
+	aabb3f box(-8, -8, 40, 8, 8, 56);
+	for (u8 side = 0; side < 6; side++)
+		UASSERT(buffer.isFrontSide(box, side) == (side == 4));
+
+	buffer.addBoxSide(box, 4);
+	buffer.end();
+	UASSERT(buffer.isOccluded(aabb3f(-2, -2, 70, 2, 2, 80)));
+	UASSERT(!buffer.isOccluded(aabb3f(-20, -2, 70, -10, 2, 80)));
+
+	// the far side only hides what is behind it
+	buffer.begin(v3f(0, 0, 0), v3f(0, 0, 1), M_PI / 2);
+	buffer.addBoxSide(box, 5);
+	buffer.end();
+	UASSERT(!buffer.isOccluded(aabb3f(-2, -2, 45, 2, 2, 50)));
+	UASSERT(buffer.isOccluded(aabb3f(-2, -2, 70, 2, 2, 80)));
+}
@@ -40,6 +40,8 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
 	void testGetAddedActiveObjectsAroundPos();
+	void testGetObjectsInArea();
+	void testSpatialIndexUpdate();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -51,6 +53,8 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testGetObjectsInArea);
+	TEST(testSpatialIndexUpdate);
 }
 
 void clearSAOMgr(server::ActiveObjectMgr *saomgr)
@@ -190,3 +194,73 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	clearSAOMgr(&saomgr);
 }
+
+void TestServerActiveObjectMgr::testGetObjectsInArea()
+{
+	server::ActiveObjectMgr saomgr;
+	static const v3f sao_pos[] = {
+			v3f(10, 40, 10),
+			v3f(740, 100, -304),
+			v3f(-200, 100, -304),
+			v3f(740, -740, -304),
+			v3f(1500, -740, -304),
+	};
+
+	for (const auto &p : sao_pos) {
+		saomgr.registerObject(new MockServerActiveObject(nullptr, p));
+	}
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInArea(aabb3f(0, 0, 0, 50, 50, 50), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(-1000, -1000, -1000, 1000, 1000, 1000),
+			result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 4);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(-1e6f, -1e6f, -1e6f, 1e6f, 1e6f, 1e6f),
+			result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 5);
+
+	clearSAOMgr(&saomgr);
+}
+
+void TestServerActiveObjectMgr::testSpatialIndexUpdate()
+{
+	server::ActiveObjectMgr saomgr;
+	auto sao = new MockServerActiveObject(nullptr, v3f(10, 10, 10));
+	UASSERT(saomgr.registerObject(sao));
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Objects without an environment do not report their movement
+	v3f new_pos(5000, 10, 10);
+	sao->setBasePosition(new_pos);
+	saomgr.updateObjectPos(sao->getId(), new_pos);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(new_pos, 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	u16 id = sao->getId();
+	saomgr.removeObject(id);
+	result.clear();
+	saomgr.getObjectsInsideRadius(new_pos, 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	// Updating a removed object must not resurrect it
+	saomgr.updateObjectPos(id, v3f());
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	clearSAOMgr(&saomgr);
+}
@@ -37,6 +37,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatch();
 
 	static const int port = 30003;
 };
@@ -46,6 +47,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatch);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -147,3 +149,39 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatch()
+{
+	UDPSocket socket(false);
+	socket.Bind(Address(127, 0, 0, 1, port));
+	socket.setTimeoutMs(50);
+
+	const Address destination(127, 0, 0, 1, port);
+	const char *payloads[] = { "first", "second!", "3" };
+	UDPSocket::OutgoingDatagram datagrams[3];
+	for (int i = 0; i < 3; i++)
+		datagrams[i] = { &destination, payloads[i], (int)strlen(payloads[i]) };
+
+	UASSERTEQ(int, socket.SendMany(datagrams, 3), 3);
+	sleep_ms(50);
+
+	const int max_size = 64;
+	char rcvbuffer[max_size * 4];
+	Address senders[4];
+	int sizes[4];
+	int received = 0;
+	while (received < 3) {
+		int count = socket.ReceiveMany(&senders[received], &sizes[received],
+			rcvbuffer + received * max_size, max_size, 4 - received);
+		if (count == 0)
+			break;
+		received += count;
+	}
+
+	UASSERTEQ(int, received, 3);
+	for (int i = 0; i < 3; i++) {
+		UASSERTEQ(int, sizes[i], (int)strlen(payloads[i]));
+		UASSERT(memcmp(rcvbuffer + i * max_size, payloads[i], sizes[i]) == 0);
+		UASSERT(senders[i] == destination);
+	}
+}
@@ -20,8 +20,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <atomic>
+#include <stdexcept>
+#include <vector>
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "util/worker_pool.h"
 
 
 class TestThreading : public TestBase {
@@ -32,6 +35,7 @@ class TestThreading : public TestBase {
 
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -40,6 +44,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 {
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -156,3 +161,34 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+void TestThreading::testWorkerPool()
+{
+	for (u32 thread_count : {0, 1, 4}) {
+		WorkerPool pool("Test", thread_count);
+		UASSERTEQ(u32, pool.getThreadCount(), thread_count);
+
+		// Batches must be reusable and every job run exactly once
+		for (size_t round = 0; round < 20; round++) {
+			std::vector<u32> values(1000, 0);
+			pool.run(values.size(), [&values] (size_t i) {
+				values[i] += i;
+			});
+			for (size_t i = 0; i < values.size(); i++)
+				UASSERTEQ(u32, values[i], i);
+		}
+
+		// Exceptions are passed on to the caller
+		bool caught = false;
+		try {
+			pool.run(50, [] (size_t i) {
+				if (i == 25)
+					throw std::runtime_error("job failed");
+			});
+		} catch (std::runtime_error &e) {
+			caught = true;
+		}
+		UASSERT(caught);
+	}
+}
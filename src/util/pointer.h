@@ -237,6 +237,12 @@ class SharedBuffer
 	{
 		return m_size;
 	}
+	// Makes this reference cover only the first size elements
+	void shrink(unsigned int size)
+	{
+		assert(size <= m_size);
+		m_size = size;
+	}
 	operator Buffer<T>() const
 	{
 		return Buffer<T>(data, m_size);
@@ -0,0 +1,140 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "worker_pool.h"
+#include "threading/thread.h"
+#include "log.h"
+
+class WorkerPool::WorkerThread : public Thread
+{
+public:
+	WorkerThread(const std::string &name, WorkerPool *pool) :
+		Thread(name), m_pool(pool)
+	{}
+
+protected:
+	void *run()
+	{
+		m_pool->workerLoop();
+		return nullptr;
+	}
+
+private:
+	WorkerPool *m_pool;
+};
+
+WorkerPool::WorkerPool(const std::string &name, u32 thread_count)
+{
+	m_threads.reserve(thread_count);
+	for (u32 i = 0; i < thread_count; i++) {
+		m_threads.emplace_back(new WorkerThread(name + "Worker", this));
+		if (!m_threads.back()->start()) {
+			errorstream << "WorkerPool: failed to start thread for "
+					<< name << std::endl;
+			m_threads.pop_back();
+			break;
+		}
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_work_cv.notify_all();
+
+	for (auto &thread : m_threads)
+		thread->wait();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &job)
+{
+	if (count == 0)
+		return;
+
+	std::lock_guard<std::mutex> run_lock(m_run_mutex);
+
+	// Not worth waking up anyone
+	if (m_threads.empty() || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			job(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &job;
+		m_count = count;
+		m_next = 0;
+		m_error = nullptr;
+		m_busy = m_threads.size();
+		m_batch++;
+	}
+	m_work_cv.notify_all();
+
+	work();
+
+	std::exception_ptr error;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done_cv.wait(lock, [this] { return m_busy == 0; });
+		m_job = nullptr;
+		error = m_error;
+		m_error = nullptr;
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void WorkerPool::work()
+{
+	size_t i;
+	while ((i = m_next++) < m_count) {
+		try {
+			(*m_job)(i);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_error)
+				m_error = std::current_exception();
+		}
+	}
+}
+
+void WorkerPool::workerLoop()
+{
+	u64 last_batch = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_cv.wait(lock, [&] { return m_stop || m_batch != last_batch; });
+			if (m_stop)
+				break;
+			last_batch = m_batch;
+		}
+
+		work();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_busy == 0)
+			m_done_cv.notify_one();
+	}
+}
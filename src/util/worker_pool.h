@@ -0,0 +1,77 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "util/basic_macros.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+	Fixed-size pool of threads for running batches of independent jobs.
+
+	The thread calling run() takes part in the work and returns once the
+	whole batch has been processed, so a pool without threads simply runs
+	everything inline.
+*/
+class WorkerPool
+{
+public:
+	WorkerPool(const std::string &name, u32 thread_count);
+	~WorkerPool();
+
+	DISABLE_CLASS_COPY(WorkerPool)
+
+	u32 getThreadCount() const { return m_threads.size(); }
+
+	// Calls job(i) for every i in [0, count), in no particular order.
+	// If a job throws, the first exception is rethrown once the batch is done.
+	// Only one batch can run at a time.
+	void run(size_t count, const std::function<void(size_t)> &job);
+
+private:
+	class WorkerThread;
+
+	void work();
+	void workerLoop();
+
+	std::mutex m_mutex;
+	std::mutex m_run_mutex;
+	std::condition_variable m_work_cv;
+	std::condition_variable m_done_cv;
+
+	// Current batch
+	const std::function<void(size_t)> *m_job = nullptr;
+	size_t m_count = 0;
+	std::atomic<size_t> m_next {0};
+	u64 m_batch = 0;
+	// Threads which have not finished the current batch yet
+	u32 m_busy = 0;
+	std::exception_ptr m_error;
+
+	bool m_stop = false;
+	std::vector<std::unique_ptr<WorkerThread>> m_threads;
+};